@@ -0,0 +1,167 @@
+/** Client side of the daemon shared memory transport. Region is requested by the 'shm' command over the daemon
+ *  socket and comes with the response as SCM_RIGHTS descriptor. After that requests are written to the request ring
+ *  and responses are read from the response ring without any syscalls, unless one of the sides sleeps */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "nsd_shm.h"
+#include "../inc/otpp.h"
+
+/** Max count of the request args including command name */
+#define NSD_SHM_MAX_ARGS 32
+
+/** How long sender sleeps on the full ring before it checks that daemon is alive */
+#define NSD_SHM_WAIT 100
+
+/** Internal function. Receive the 'shm' command response and descriptor passed with it. Return descriptor or -1 */
+static int NsdShm_receiveFd(int sockfd, char *buf, size_t size) {
+    int fd = -1;
+    size_t len = 0;
+    while (len == 0 || buf[len - 1] != '\r') {
+        char control[CMSG_SPACE(sizeof(int))];
+        struct iovec iov = {buf + len, size - len - 1};
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        ssize_t r = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC);
+        if (r <= 0 || len + r >= size - 1)
+            break;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        len += r;
+    }
+    buf[len] = 0;
+
+    return fd;
+}
+
+/** Connect to the daemon socket and open shared memory transport. Return NULL if it can't be opened */
+NsdShm* NsdShm_open(const char *socketPath) {
+    int sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+    if (sockfd < 0 || connect(sockfd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        if (sockfd >= 0)
+            close(sockfd);
+        return NULL;
+    }
+
+    const char *request = "q\t1\tshm\r";
+    char response[64];
+    int fd = -1;
+    if (write(sockfd, request, strlen(request)) == (ssize_t) strlen(request))
+        fd = NsdShm_receiveFd(sockfd, response, sizeof(response));
+    if (fd < 0 || strncmp(response, "r\t1\t", 4) != 0) {
+        if (fd >= 0)
+            close(fd);
+        close(sockfd);
+        return NULL;
+    }
+
+    uint32_t ringSize = (uint32_t) strtoul(response + 4, NULL, 10);
+    size_t mapSize = SHM_REGION_SIZE(ringSize);
+    ShmRegion *region = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED || region->magic != SHM_MAGIC || region->version != SHM_VERSION
+        || region->ringSize != ringSize) {
+        if (region != MAP_FAILED)
+            munmap(region, mapSize);
+        close(sockfd);
+        return NULL;
+    }
+
+    NsdShm *shm = malloc(sizeof(NsdShm));
+    shm->sockfd = sockfd;
+    shm->region = region;
+    shm->mapSize = mapSize;
+    shm->ringSize = ringSize;
+    shm->requests = ShmRegion_data(region, &region->request);
+    shm->responses = ShmRegion_data(region, &region->response);
+
+    return shm;
+}
+
+/** Internal function. Return false if daemon has closed the socket */
+static bool NsdShm_alive(NsdShm *shm) {
+    struct pollfd pfd = {shm->sockfd, POLLRDHUP, 0};
+    return poll(&pfd, 1, 0) == 0;
+}
+
+/** Send request with zero terminated args, the first is the command name. If the ring is full, wait for the space.
+ *  Return false if request is too big or daemon is gone */
+bool NsdShm_send(NsdShm *shm, uint32_t msgId, uint16_t argc, const char **argv) {
+    if (argc > NSD_SHM_MAX_ARGS)
+        return false;
+
+    char header[OTPP_HEADER_SIZE];
+    uint32_t lens[NSD_SHM_MAX_ARGS];
+    struct iovec iov[1 + 2 * NSD_SHM_MAX_ARGS];
+    uint32_t payload = 0;
+    for (uint16_t i = 0; i < argc; i++) {
+        lens[i] = (uint32_t) strlen(argv[i]);
+        iov[1 + 2 * i].iov_base = &lens[i];
+        iov[1 + 2 * i].iov_len = sizeof(uint32_t);
+        iov[2 + 2 * i].iov_base = (void*) argv[i];
+        iov[2 + 2 * i].iov_len = lens[i];
+        payload += sizeof(uint32_t) + lens[i];
+    }
+    if (payload > OTPP_MAX_PAYLOAD)
+        return false;
+
+    Otpp_Header h = {OTPP_MAGIC, OTPP_VERSION, 'q', 0, 0, msgId, payload};
+    memcpy(header, &h, OTPP_HEADER_SIZE);
+    iov[0].iov_base = header;
+    iov[0].iov_len = OTPP_HEADER_SIZE;
+
+    ShmRing *ring = &shm->region->request;
+    while (!ShmRing_push(ring, shm->requests, shm->ringSize, iov, 1 + 2 * argc)) {
+        if (OTPP_HEADER_SIZE + payload + sizeof(uint32_t) > shm->ringSize || !NsdShm_alive(shm))
+            return false;
+        ShmRing_waitSpace(ring, shm->ringSize, OTPP_HEADER_SIZE + payload, NSD_SHM_WAIT);
+    }
+
+    return true;
+}
+
+/** Receive response, waiting for it not longer than timeout millis. Content is copied to the buffer and truncated to
+ *  it's size. Return full content length or -1 if there is no response */
+int64_t NsdShm_receive(NsdShm *shm, char *type, uint32_t *msgId, char *buf, size_t size, uint32_t timeout) {
+    ShmRing *ring = &shm->region->response;
+    const char *record;
+    uint32_t next;
+    int64_t len = ShmRing_peek(ring, shm->responses, shm->ringSize, &record, &next);
+    if (len == 0 && ShmRing_waitData(ring, timeout))
+        len = ShmRing_peek(ring, shm->responses, shm->ringSize, &record, &next);
+    if (len < OTPP_HEADER_SIZE)
+        return -1;
+
+    Otpp_Header header;
+    memcpy(&header, record, OTPP_HEADER_SIZE);
+    uint32_t content = (uint32_t) len - OTPP_HEADER_SIZE;
+    memcpy(buf, record + OTPP_HEADER_SIZE, content < size ? content : size);
+    *type = (char) header.type;
+    *msgId = header.msgId;
+    ShmRing_pop(ring, next);
+
+    return content;
+}
+
+/** Close transport. Daemon stops it when the socket is closed */
+void NsdShm_close(NsdShm *shm) {
+    munmap(shm->region, shm->mapSize);
+    close(shm->sockfd);
+    free(shm);
+}
@@ -0,0 +1,30 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_SHM_CLIENT_H
+#define NSD_SHM_CLIENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "../inc/shm_ring.h"
+
+/** Client side of the daemon shared memory transport. Connection is opened through the daemon socket, that must stay
+ *  open while the transport is used. Requests and responses are binary OTPP packets. Handle must be used by one
+ *  thread, or sending and receiving may be split between two threads */
+typedef struct NsdShm {
+    int sockfd;
+    ShmRegion *region;
+    size_t mapSize;
+    uint32_t ringSize;
+    char *requests;
+    char *responses;
+} NsdShm;
+
+NsdShm* NsdShm_open(const char *socketPath);
+bool NsdShm_send(NsdShm *shm, uint32_t msgId, uint16_t argc, const char **argv);
+int64_t NsdShm_receive(NsdShm *shm, char *type, uint32_t *msgId, char *buf, size_t size, uint32_t timeout);
+void NsdShm_close(NsdShm *shm);
+
+#endif //NSD_SHM_CLIENT_H
@@ -0,0 +1,64 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_ACCOUNTING_H
+#define NSD_ACCOUNTING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../libs/oscl/include/twheel.h"
+
+/** Buckets of the CPU time distribution. Bucket i counts handlers that took less than 2^i micros, the last one counts
+ *  the rest */
+#define ACCOUNTING_BUCKETS 24
+
+/** Max count of the accounted command names */
+#define ACCOUNTING_MAX_COMMANDS 64
+
+/** Max count of uids accounted separately, handlers of the other uids are accounted to the uid -1 */
+#define ACCOUNTING_MAX_UIDS 256
+
+/** Default period of the summary log line in seconds */
+#define ACCOUNTING_DEFAULT_INTERVAL 60
+
+/** Max length of the counters prefix, 'cmd.<name>' or 'uid.<uid>' */
+#define ACCOUNTING_NAME_MAX 48
+
+/** Count of the commands and uids named by the summary log line */
+#define ACCOUNTING_SUMMARY_TOP 5
+
+/** Resources consumed by the handlers of one command or one uid. Times are in nanos. Context switches and page faults
+ *  are counted only with 'account.rusage' */
+typedef struct Accounting_Usage {
+    uint64_t calls;
+    uint64_t cpuNanos;
+    uint64_t maxCpuNanos;
+    uint64_t wallNanos;
+    uint64_t voluntarySwitches;
+    uint64_t involuntarySwitches;
+    uint64_t minorFaults;
+    uint64_t majorFaults;
+    uint64_t buckets[ACCOUNTING_BUCKETS];
+    /** CPU time reported by the previous summary, touched only by the summary timer */
+    uint64_t reportedCpuNanos;
+} Accounting_Usage;
+
+/** Counters of the thread taken before the handler */
+typedef struct Accounting_Mark {
+    uint64_t cpu;
+    uint64_t wall;
+    long voluntarySwitches;
+    long involuntarySwitches;
+    long minorFaults;
+    long majorFaults;
+} Accounting_Mark;
+
+bool Accounting_init(twheel_t *wheel);
+bool Accounting_enabled();
+void Accounting_begin(Accounting_Mark *mark);
+void Accounting_end(Accounting_Mark *mark, const char *command, uid_t uid);
+char* Accounting_format();
+
+#endif //NSD_ACCOUNTING_H
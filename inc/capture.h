@@ -0,0 +1,60 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_CAPTURE_H
+#define NSD_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "connection.h"
+#include "frame.h"
+
+/** Capture file format. File starts with the header, then records follow in the order they were captured, each record
+ *  is Capture_Record followed by len bytes of the packet data. Text packet is stored as received including the
+ *  trailing '\r', binary packet is stored as payload, it's header fields are in the record. All numbers are in the
+ *  host byte order, capture is replayed on the same kind of node */
+#define CAPTURE_MAGIC "NSDCAP\0"
+#define CAPTURE_MAGIC_LEN 7
+#define CAPTURE_VERSION 1
+
+/** Default capacity of the capture buffer in packets. Packets received while it is full are dropped */
+#define CAPTURE_DEFAULT_QUEUE 65536
+
+/** Size of the writer buffer, records are written to the file by blocks of this size */
+#define CAPTURE_WRITE_BUF 262144
+
+/** How long writer waits for the packet before it writes the collected records */
+#define CAPTURE_FLUSH_TIMEOUT 100
+
+/** How long exiting daemon waits for the writer to write queued packets, and how often it checks it */
+#define CAPTURE_STOP_TIMEOUT 2000
+#define CAPTURE_STOP_POLL 5
+
+typedef struct Capture_FileHeader {
+    char magic[CAPTURE_MAGIC_LEN];
+    uint8_t version;
+    /** Wall clock time of the capture start in epoch millis */
+    uint64_t started;
+} Capture_FileHeader;
+
+typedef struct Capture_Record {
+    /** Monotonic nanos from the capture start to the moment when packet was completely received */
+    uint64_t time;
+    /** Id of the connection, packets of the same connection are in the order of reception */
+    uint32_t conn;
+    uint32_t len;
+    /** Header fields of the binary packet */
+    uint32_t msgId;
+    uint16_t flags;
+    uint8_t type;
+    /** Framing of the connection, OTPP_MODE_TEXT or OTPP_MODE_BINARY */
+    uint8_t mode;
+} Capture_Record;
+
+bool Capture_init();
+bool Capture_enabled();
+void Capture_stop();
+void Capture_frame(Connection *conn, Frame *frame);
+
+#endif //NSD_CAPTURE_H
@@ -6,9 +6,34 @@
 #define NSD_CLIENT_THREAD_H
 
 #include <stdbool.h>
+#include "cmd_processor.h"
+#include "frame.h"
+#include "otpp.h"
 
-bool clientThread_alive;
+/** Size of the text packets assembly buffer. Batch packets must fit into it */
+#define CLIENT_THREAD_TEXT_BUFFER 16384
+
+/** Max size of the text packet head, where msgId of the packet that does not fit the buffer is looked for */
+#define CLIENT_THREAD_HEAD_MAX 32
+
+/** Count of messages that the seqpacket connection reads by one recvmmsg call */
+#define CLIENT_THREAD_SEQPACKET_SLOTS 8
+
+/** Max size of the seqpacket message. Bigger messages are truncated by kernel and dropped */
+#define CLIENT_THREAD_SEQPACKET_BUF CLIENT_THREAD_TEXT_BUFFER
+
+/** How long reader waits for free space in the full queue before it reports about this */
+#define CLIENT_THREAD_BACKPRESSURE_TIMEOUT 5000
+
+extern bool clientThread_alive;
 
 void ClientThread_run(void *args);
+CmdProcessor_Args* ClientThread_startProcessor(Connection *conn);
+Frame* ClientThread_textFrame(char *data, uint32_t len);
+Frame* ClientThread_binaryFrame(const Otpp_Header *header, char *payload);
+Frame* ClientThread_messageFrame(Connection *conn, const char *data, size_t len);
+Frame* ClientThread_oversizedFrame(const char *head, size_t len);
+bool ClientThread_hello(Connection *conn, const char *block);
+void ClientThread_enqueue(CmdProcessor_Args *cpa, Frame *frame, int sockfd);
 
 #endif //NSD_CLIENT_THREAD_H
@@ -0,0 +1,58 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_CLIENTS_H
+#define NSD_CLIENTS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "../libs/oscl/include/threads.h"
+
+/** Bit of the registry key that marks clients identified by uid */
+#define CLIENTS_UID_KEY (1ULL << 32)
+
+/** Command waiting for the execution slot */
+typedef struct Clients_Waiter {
+    struct Clients_Waiter *next;
+    cond_t *cond;
+    bool granted;
+} Clients_Waiter;
+
+/** Client of the daemon identified by the peer credentials. All connections of the one client share it's rate limit
+ *  and it's turn in the commands scheduling */
+typedef struct Client {
+    /** Key of the client in the registry, pid or uid with CLIENTS_UID_KEY bit */
+    uint64_t key;
+    uid_t uid;
+    pid_t pid;
+    uint32_t refs;
+
+    /** Token bucket, protected by it's own mutex. Rate is in requests per second, zero rate means unlimited client */
+    mutex_t *bucketMutex;
+    uint32_t rate;
+    uint32_t burst;
+    double tokens;
+    uint64_t refilled;
+
+    /** Deficit round robin state. Quantum is count of commands served in a row when client has the turn */
+    uint32_t quantum;
+    int32_t deficit;
+    Clients_Waiter *waitHead;
+    Clients_Waiter *waitTail;
+    struct Client *nextActive;
+    bool active;
+
+    uint64_t requests;
+    uint64_t throttled;
+} Client;
+
+bool Clients_init();
+Client* Clients_attach(uid_t uid, pid_t pid);
+void Clients_detach(Client *client);
+bool Clients_admit(Client *client);
+void Clients_enter(Client *client);
+void Clients_leave();
+
+#endif //NSD_CLIENTS_H
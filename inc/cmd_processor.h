@@ -6,16 +6,102 @@
 #define NSD_CMD_PROCESSOR_H
 
 #include <stdbool.h>
-#include "../libs/collections/include/lbq.h"
+#include <stddef.h>
+#include "../libs/collections/include/mlq.h"
+#include "../libs/oscl/include/twheel.h"
+#include "connection.h"
+#include "frame.h"
+
+/** Commands priority classes. Each class has it's own lane in the connection queue, lane of the lower number is
+ *  served first */
+#define CMD_PRIORITY_CONTROL 0
+#define CMD_PRIORITY_NORMAL 1
+#define CMD_PRIORITY_BULK 2
+#define CMD_PRIORITY_COUNT 3
+
+/** Max count of sub-commands in the batch packet */
+#define CMD_PROCESSOR_MAX_BATCH 64
+
+/** Max count of tab separated fields in the packet */
+#define CMD_PROCESSOR_MAX_FIELDS (CMD_PROCESSOR_MAX_BATCH + 8)
+
+/** Max count of the command args including command name */
+#define CMD_PROCESSOR_MAX_ARGS 32
+
+/** Daemon version reported by the 'version' command */
+#define CMD_PROCESSOR_VERSION "0.0.1"
+
+/** Size of the stack buffer for the response building. Bigger responses are built in the heap */
+#define CMD_PROCESSOR_RESPONSE_BUF 512
+
+/** Max size of the preformatted response */
+#define CMD_PROCESSOR_CACHED_MAX 64
+
+/** Initial size of the batch results buffer */
+#define CMD_PROCESSOR_BATCH_BUF 1024
+
+/** Max count of responses held while the command runs in the execution slot, the next ones are written at once */
+#define CMD_PROCESSOR_HELD_MESSAGES 4
+
+/** Command flag. Command can't be a part of the batch, because it's response is not written by the handler itself */
+#define CMD_FLAG_NO_BATCH 0x01
+
+/** Command flag. Command does not block, takes bounded time and it's response is at most IO_ENGINE_INLINE_SLACK
+ *  longer than the packet, so it is executed by the reader of the connection when no earlier packets of the connection
+ *  wait for responses, and it does not take the execution slot */
+#define CMD_FLAG_INLINE 0x02
+
+/** Max count of already queued packets executed with corked connection */
+#define CMD_PROCESSOR_CORK_FRAMES CONNECTION_CORK_MESSAGES
+
+/** How long processor waits for the packet before it checks that connection is still alive */
+#define CMD_PROCESSOR_IDLE_TIMEOUT 100
+
+/** Command handler. First of the args is the command name. Each arg is terminated by zero, but binary args may contain
+ *  zero bytes, so their lengths are given by argl */
+typedef void (*CmdProcessor_Handler)(uint32_t packetId, Connection *conn, uint16_t argc, char **argv,
+                                     uint32_t *argl);
+
+/** Registered command definition */
+typedef struct CmdProcessor_Command {
+    const char *name;
+    uint8_t priority;
+    uint8_t minArgs;
+    uint8_t flags;
+    CmdProcessor_Handler run;
+} CmdProcessor_Command;
+
+/** Preformatted constant response. Content is placed at the tail offset, msgId is formatted right before it */
+typedef struct CmdProcessor_Cached {
+    char data[CMD_PROCESSOR_CACHED_MAX];
+    uint16_t tail;
+    uint16_t len;
+    char type;
+} CmdProcessor_Cached;
 
 /** Thread args */
 typedef struct CmdProcessor_Args {
-    LinkedBlockingQueue *cmdQueue;
-    int sockfd;
+    MultiLaneQueue *cmdQueue;
+    Connection *conn;
     bool alive;
+    /** Count of packets passed to the queue by the reader and count of packets whose responses are written */
+    uint32_t queued;
+    uint32_t finished;
 } CmdProcessor_Args;
 
-char* CmdProcessor_createResponse(const char *type, uint32_t msgId, const char *content);
+bool CmdProcessor_init();
+uint8_t CmdProcessor_queueEngine();
+twheel_t* CmdProcessor_timers();
+const CmdProcessor_Command* CmdProcessor_findCommand(const char *name, size_t len);
+void CmdProcessor_classify(Frame *frame);
+size_t CmdProcessor_buildResponse(char *buf, size_t size, char type, uint32_t msgId, const char *content,
+                                  size_t len);
+void CmdProcessor_respond(Connection *conn, char type, uint32_t msgId, const char *content);
+void CmdProcessor_respondData(Connection *conn, char type, uint32_t msgId, const char *content, size_t len);
+void CmdProcessor_respondCached(Connection *conn, const CmdProcessor_Cached *cached, uint32_t msgId);
 void CmdProcessor_run(void *args);
+void CmdProcessor_stop(CmdProcessor_Args *cpa);
+bool CmdProcessor_idle(CmdProcessor_Args *cpa);
+bool CmdProcessor_tryInline(CmdProcessor_Args *cpa, Frame *frame);
 
 #endif //NSD_CMD_PROCESSOR_H
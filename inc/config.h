@@ -0,0 +1,18 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_CONFIG_H
+#define NSD_CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Default path of the daemon configuration file. May be overridden by the NSD_CONFIG environment variable */
+#define CONFIG_DEFAULT_PATH "/etc/nsd.conf"
+
+bool Config_load(const char *path);
+const char* Config_getString(const char *key, const char *def);
+int64_t Config_getInt(const char *key, int64_t def);
+
+#endif //NSD_CONFIG_H
@@ -0,0 +1,92 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_CONNECTION_H
+#define NSD_CONNECTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "../libs/oscl/include/threads.h"
+#include "clients.h"
+
+/** Size of the buffer where responses are collected while the connection is corked */
+#define CONNECTION_CORK_BUF 16384
+
+/** Max count of responses collected while the connection is corked */
+#define CONNECTION_CORK_MESSAGES 32
+
+struct ShmTransport;
+struct UringEngine;
+
+/** Client connection shared by the client thread, command processor and asynchronously completed commands. Socket is
+ *  closed when the last reference is released, so descriptor can't be reused while somebody may write to it */
+typedef struct Connection {
+    /** Unique number of the connection in this process */
+    uint32_t id;
+    int sockfd;
+    uint32_t refs;
+    volatile bool open;
+    mutex_t *writeMutex;
+    /** Peer credentials captured at accept */
+    uid_t uid;
+    pid_t pid;
+    /** Client to which connection belongs, may be NULL if credentials are unknown */
+    Client *client;
+    /** Framing negotiated by the client, OTPP_MODE_TEXT or OTPP_MODE_BINARY */
+    uint8_t mode;
+    /** Framing was already selected, connection was passed by the previous daemon process after the handshake */
+    bool framed;
+    /** Connection was passed to the new daemon process by the upgrade, it is not served by this process anymore */
+    bool passed;
+    /** Connection was accepted by the SOCK_SEQPACKET listener, so each response is a separate message */
+    bool seqpacket;
+    /** While connection is corked, responses are collected to the cork buffer and are written together by uncork */
+    bool corked;
+    char *corkBuf;
+    size_t corkLen;
+    uint32_t corkEnds[CONNECTION_CORK_MESSAGES];
+    uint16_t corkCount;
+    /** Shm transport whose response ring receives all writes, socket of such connection is -1 */
+    struct ShmTransport *shm;
+    /** Shm transport was opened by this socket connection, only one is allowed */
+    bool shmOpened;
+    /** Io_uring engine to which collected responses are submitted, NULL if socket is written directly */
+    struct UringEngine *uring;
+    /** Buffer of the send in flight and count of it's submissions that are not completed yet */
+    char *sendBuf;
+    /** Length of the stream data in the send buffer and count of it's bytes that were already sent */
+    uint32_t sendLen;
+    uint32_t sendOff;
+    uint16_t sending;
+    cond_t *sent;
+    /** Io_uring loop executes the packet inline, other writers wait until it's response is collected */
+    bool inlining;
+    /** Thread that blocks in the socket reading, it is interrupted by the upgrade */
+    thread_t reader;
+    bool hasReader;
+    /** Neighbours in the list of the accepted connections */
+    struct Connection *prevOpen;
+    struct Connection *nextOpen;
+} Connection;
+
+Connection* Connection_new(int sockfd);
+Connection* Connection_accepted(int sockfd, bool seqpacket);
+void Connection_retain(Connection *conn);
+void Connection_release(Connection *conn);
+void Connection_shutdown(Connection *conn);
+ssize_t Connection_write(Connection *conn, const char *data, size_t len);
+ssize_t Connection_writev(Connection *conn, struct iovec *iov, int count);
+ssize_t Connection_sendFd(Connection *conn, const char *data, size_t len, int fd);
+void Connection_cork(Connection *conn);
+void Connection_uncork(Connection *conn);
+void Connection_sent(Connection *conn, int32_t res);
+bool Connection_claimInline(Connection *conn);
+void Connection_releaseInline(Connection *conn);
+void Connection_setReader(Connection *conn, bool reading);
+uint32_t Connection_count();
+void Connection_interruptReaders(int sig);
+
+#endif //NSD_CONNECTION_H
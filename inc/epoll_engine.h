@@ -0,0 +1,18 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_EPOLL_ENGINE_H
+#define NSD_EPOLL_ENGINE_H
+
+#include "io_engine.h"
+
+/** Max count of events taken by one epoll_wait call */
+#define EPOLL_ENGINE_EVENTS 64
+
+/** Size of the buffer for the stream socket reading */
+#define EPOLL_ENGINE_READ_BUF 16384
+
+void EpollEngine_run(IoEngine_Listener *listeners, int count);
+
+#endif //NSD_EPOLL_ENGINE_H
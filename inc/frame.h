@@ -0,0 +1,38 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_FRAME_H
+#define NSD_FRAME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Packet received from the client, as it is passed from the client thread to the command processor */
+typedef struct Frame {
+    /** Text packet data with terminating '\r', followed by zero char, or binary packet payload followed by one spare
+     *  byte */
+    char *data;
+    uint32_t len;
+    /** Monotonic time in nanos when the packet was completely received */
+    uint64_t arrival;
+    /** Priority class of the command, that defines lane of the connection queue */
+    uint8_t priority;
+    /** Command of the packet is inline-safe, so the reader may execute it itself */
+    bool inlineSafe;
+    /** Framing of the packet, OTPP_MODE_TEXT or OTPP_MODE_BINARY */
+    uint8_t mode;
+    /** Header of the binary packet */
+    uint8_t type;
+    uint32_t msgId;
+    uint16_t flags;
+    /** Packets of the connection that were in work when this one was received */
+    uint32_t depth;
+    /** Text packet was too big for the assembly buffer and was skipped, it is answered by error with msgId */
+    bool oversized;
+} Frame;
+
+Frame* Frame_new(char *data, uint32_t len);
+void Frame_free(Frame *frame);
+
+#endif //NSD_FRAME_H
@@ -0,0 +1,107 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_IO_ENGINE_H
+#define NSD_IO_ENGINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "cmd_processor.h"
+#include "frame.h"
+#include "otpp.h"
+
+/** Engines that serve the client sockets. Threads engine reads each connection by it's own blocking thread, event
+ *  loop engines read all connections by the one loop thread and pass parsed frames to the same command processors */
+#define IO_ENGINE_THREADS 0
+#define IO_ENGINE_EPOLL 1
+#define IO_ENGINE_URING 2
+
+/** How long the loop sleeps without events before it writes the collected log entries */
+#define IO_ENGINE_FLUSH_INTERVAL 100
+
+/** How long the loop sleeps while some connection waits for the free space in it's command queue */
+#define IO_ENGINE_DRAIN_INTERVAL 10
+
+/** Responses of the inline-safe commands are at most this longer than their packets. Io_uring loop executes only
+ *  packets whose responses surely fit the cork buffer */
+#define IO_ENGINE_INLINE_SLACK 2048
+
+/** Tags of the loop events. Event data is the pointer with the tag in the low bits */
+#define IO_ENGINE_TAG_NONE 0
+#define IO_ENGINE_TAG_ACCEPT 1
+#define IO_ENGINE_TAG_RECV 2
+#define IO_ENGINE_TAG_SEND 3
+#define IO_ENGINE_TAG_LOG 4
+#define IO_ENGINE_TAG_MASK 7
+
+#define IO_ENGINE_DATA(ptr, tag) ((uint64_t) (uintptr_t) (ptr) | (tag))
+#define IO_ENGINE_PTR(data) ((void*) (uintptr_t) ((data) & ~(uint64_t) IO_ENGINE_TAG_MASK))
+#define IO_ENGINE_TAG(data) ((uint8_t) ((data) & IO_ENGINE_TAG_MASK))
+
+/** Parser states of the stream connection */
+#define IO_CONN_HANDSHAKE 0
+#define IO_CONN_HELLO 1
+#define IO_CONN_TEXT 2
+#define IO_CONN_HEADER 3
+#define IO_CONN_PAYLOAD 4
+
+/** Listening socket served by the loop */
+typedef struct IoEngine_Listener {
+    int sockfd;
+    const char *path;
+    bool seqpacket;
+} IoEngine_Listener;
+
+/** Connection served by the event loop. Received data comes in arbitrary chunks, so packets are assembled by the
+ *  incremental parser. Connection is owned by the loop thread only */
+typedef struct IoConn {
+    Connection *conn;
+    CmdProcessor_Args *cpa;
+    uint8_t state;
+    /** Collected part of the hello block or of the binary header */
+    char head[OTPP_HEADER_SIZE];
+    uint32_t headLen;
+    Otpp_Header header;
+    /** Text packet or binary payload under assembly */
+    char *packet;
+    uint32_t packetLen;
+    /** Text packet has exceeded the assembly buffer, it is skipped until it's end */
+    bool overflow;
+    /** Error frame of the skipped packet, NULL if it has no msgId */
+    Frame *oversized;
+    /** Seqpacket connection has not received any message yet */
+    bool first;
+    /** Frames that found the command queue full. Socket is not read until they are queued */
+    Frame **pending;
+    uint32_t pendingHead;
+    uint32_t pendingCount;
+    uint32_t pendingCap;
+    bool paused;
+    uint64_t pausedAt;
+    /** Receive is submitted to the kernel, connection can't be freed until it is completed */
+    bool armed;
+    /** Connection must be freed as soon as it's receive is completed */
+    bool closing;
+    /** Next paused connection of the loop, or next connection waiting for adoption */
+    struct IoConn *next;
+    /** Neighbours in the list of the connections served by the loop */
+    struct IoConn *prevOpen;
+    struct IoConn *nextOpen;
+} IoConn;
+
+uint8_t IoEngine_select();
+void IoEngine_run(uint8_t engine, IoEngine_Listener *listeners, int count);
+IoConn* IoEngine_open(Connection *conn);
+bool IoEngine_feed(IoConn *io, const char *data, size_t len);
+bool IoEngine_message(IoConn *io, const char *data, size_t len, bool truncated);
+bool IoEngine_drain(IoConn *io);
+void IoEngine_close(IoConn *io);
+IoConn* IoEngine_conns();
+int IoEngine_idleState(IoConn *io);
+void IoEngine_passed(IoConn *io);
+void IoEngine_adopt(uint8_t engine, int sockfd, bool seqpacket, uint8_t state);
+IoConn* IoEngine_takeAdopted();
+
+#endif //NSD_IO_ENGINE_H
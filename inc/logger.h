@@ -1,8 +1,22 @@
 #ifndef NSD_LOGGER_H
 #define NSD_LOGGER_H
 
+#include <stddef.h>
+
+/** Max size of the log batch. When the loop does not take the batch in time, it is written directly, unless the
+ *  previous batch is being written */
+#define LOGGER_BATCH_LIMIT 65536
+
+/** Max count of the descriptors returned by Logger_targets */
+#define LOGGER_MAX_TARGETS 2
+
 int Logger_init(const char* fp);
 void Logger_info(char *source, char *str, ...);
 void Logger_fatal(char *source, char *str, ...);
+void Logger_batch();
+char* Logger_takeBatch(size_t *len);
+void Logger_written();
+int Logger_targets(int *fds);
+void Logger_flush();
 
 #endif //NSD_LOGGER_H
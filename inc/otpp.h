@@ -0,0 +1,63 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_OTPP_H
+#define NSD_OTPP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Binary framing of the OTPP. Connection is switched to it by the hello block sent by the client as the first bytes
+ *  of the connection. Text packets never start from the zero byte, so text clients are not affected. Daemon answers
+ *  with the same hello block carrying the accepted version. All numbers are in the host byte order, because the
+ *  daemon is reached by the local socket only.
+ *
+ *  Each packet is OTPP_HEADER_SIZE bytes header followed by the payload. Request payload is a sequence of arguments,
+ *  each is u32 length and bytes of the argument, the first argument is the command name. If the header has flag
+ *  OTPP_FLAG_TIMEOUT, payload starts from u32 timeout in millis, then with OTPP_FLAG_DEADLINE from u64 deadline in
+ *  epoch millis. Response payload is the raw content.
+ *
+ *  Batch packet has type 'b'. It's payload after the options is a sequence of sub-commands, each is u32 sub-id, u32
+ *  size and the arguments list of that size. Flag OTPP_FLAG_STOP_ON_ERROR stops the batch on the first failed
+ *  sub-command. Response payload is a sequence of sub-results, each is u32 sub-id, u8 type, u32 size and content. */
+
+#define OTPP_HELLO "\0OTPPB"
+#define OTPP_HELLO_LEN 6
+/** Size of the hello block, that is hello magic followed by the version byte and the reserved byte */
+#define OTPP_HELLO_SIZE 8
+
+#define OTPP_MAGIC 0x4F54
+#define OTPP_VERSION 1
+#define OTPP_HEADER_SIZE 16
+
+/** Max payload size of the request. Client sending bigger packet is disconnected */
+#define OTPP_MAX_PAYLOAD 65536
+
+#define OTPP_FLAG_TIMEOUT 0x0001
+#define OTPP_FLAG_DEADLINE 0x0002
+#define OTPP_FLAG_STOP_ON_ERROR 0x0004
+
+/** Connection framing modes */
+#define OTPP_MODE_TEXT 0
+#define OTPP_MODE_BINARY 1
+
+typedef struct Otpp_Header {
+    uint16_t magic;
+    uint8_t version;
+    /** Packet type char, same as in the text framing */
+    uint8_t type;
+    uint16_t flags;
+    uint16_t reserved;
+    uint32_t msgId;
+    uint32_t len;
+} Otpp_Header;
+
+void Otpp_hello(char *block, uint8_t version);
+bool Otpp_checkHello(const char *block, uint8_t *version);
+void Otpp_writeHeader(char *buf, char type, uint32_t msgId, uint32_t len);
+bool Otpp_readHeader(const char *buf, Otpp_Header *header);
+uint16_t Otpp_splitArgs(char *payload, uint32_t len, char **argv, uint32_t *argl, uint16_t max);
+
+#endif //NSD_OTPP_H
@@ -0,0 +1,30 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_PROFILER_H
+#define NSD_PROFILER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Max frames stored for one sample */
+#define PROFILER_MAX_DEPTH 48
+
+/** Default count of samples that the buffer may hold before new samples will be dropped */
+#define PROFILER_DEFAULT_CAPACITY 65536
+
+/** Default sampling frequency in Hz */
+#define PROFILER_DEFAULT_HZ 99
+
+/** Directory where folded stacks dumps will be placed */
+#define PROFILER_DUMP_DIR "/var/log"
+
+bool Profiler_start(uint32_t hz);
+void Profiler_stop();
+bool Profiler_isRunning();
+uint32_t Profiler_samples();
+uint32_t Profiler_dropped();
+int32_t Profiler_dump(const char *path);
+
+#endif //NSD_PROFILER_H
@@ -0,0 +1,54 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_SHM_RING_H
+#define NSD_SHM_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+/** Layout of the shared memory region of the shm transport. It is used by the daemon and by the client helper, so it
+ *  must not depend on the daemon modules */
+
+#define SHM_MAGIC 0x4E534453
+#define SHM_VERSION 1
+
+/** Marker of the record that fills the end of the ring, the next record is placed at the ring start */
+#define SHM_RING_WRAP 0xFFFFFFFF
+
+/** Single producer single consumer ring of records. Each record is u32 length and data, aligned to 4 bytes. Head and
+ *  tail are free running byte counters, they are placed on separate cache lines, so producer and consumer do not
+ *  share lines in the fast path. Waiting flags are set by the side that sleeps on the futex, so the other side makes
+ *  wake syscall only on the transition from empty (or full) ring */
+typedef struct ShmRing {
+    volatile uint32_t head;
+    volatile uint32_t headWaiting;
+    char pad1[56];
+    volatile uint32_t tail;
+    volatile uint32_t tailWaiting;
+    char pad2[56];
+} ShmRing;
+
+/** Shared region. Request ring data follows the header, then response ring data */
+typedef struct ShmRegion {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ringSize;
+    char pad[52];
+    ShmRing request;
+    ShmRing response;
+} ShmRegion;
+
+#define SHM_REGION_SIZE(ringSize) (sizeof(ShmRegion) + 2 * (size_t) (ringSize))
+
+void ShmRegion_init(ShmRegion *region, uint32_t ringSize);
+char* ShmRegion_data(ShmRegion *region, ShmRing *ring);
+bool ShmRing_push(ShmRing *ring, char *data, uint32_t size, const struct iovec *iov, int count);
+int64_t ShmRing_peek(ShmRing *ring, char *data, uint32_t size, const char **record, uint32_t *next);
+void ShmRing_pop(ShmRing *ring, uint32_t next);
+bool ShmRing_waitData(ShmRing *ring, uint32_t timeout);
+bool ShmRing_waitSpace(ShmRing *ring, uint32_t size, uint32_t len, uint32_t timeout);
+
+#endif //NSD_SHM_RING_H
@@ -0,0 +1,41 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_SHM_TRANSPORT_H
+#define NSD_SHM_TRANSPORT_H
+
+#include <stdint.h>
+#include <sys/uio.h>
+#include "connection.h"
+#include "shm_ring.h"
+
+/** Default size of each ring of the shm transport. Zero in the config disables transport */
+#define SHM_TRANSPORT_DEFAULT_RING 262144
+
+/** How long the transport reader sleeps on the empty ring before it checks that the client is still connected */
+#define SHM_TRANSPORT_IDLE_TIMEOUT 100
+
+/** How long the response waits for space in the full response ring before the transport is closed, millis */
+#define SHM_TRANSPORT_WRITE_TIMEOUT 5000
+
+/** Result of ShmTransport_open for the connection that already has the transport */
+#define SHM_TRANSPORT_OPENED (-2)
+
+/** Shared memory transport of the client. It is created on the client request over the socket connection and lives
+ *  while this connection is open */
+typedef struct ShmTransport {
+    ShmRegion *region;
+    size_t mapSize;
+    uint32_t ringSize;
+    /** Socket connection that requested the transport */
+    Connection *origin;
+    /** Connection whose responses are written to the response ring */
+    Connection *conn;
+} ShmTransport;
+
+int ShmTransport_open(Connection *origin, uint32_t *ringSize);
+ssize_t ShmTransport_write(ShmTransport *shm, const struct iovec *iov, int count);
+void ShmTransport_free(ShmTransport *shm);
+
+#endif //NSD_SHM_TRANSPORT_H
@@ -0,0 +1,48 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_SLOWLOG_H
+#define NSD_SLOWLOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "connection.h"
+
+/** Default path of the slow requests log */
+#define SLOWLOG_DEFAULT_PATH "/var/log/nsd.slow.log"
+
+/** Default count of lines written per second, the rest are counted as suppressed */
+#define SLOWLOG_DEFAULT_RATE 10
+
+/** Max length of the command name stored in the trace */
+#define SLOWLOG_NAME_MAX 32
+
+/** Count of the argument sizes stored in the trace */
+#define SLOWLOG_MAX_ARGS 8
+
+/** Timings of one request, collected by the command processor while the slow log is enabled. Times are monotonic
+ *  nanos */
+typedef struct SlowLog_Trace {
+    uint32_t msgId;
+    /** Command name, empty if packet was dropped before the command was found */
+    char command[SLOWLOG_NAME_MAX];
+    /** Count of the arguments without the command name and sizes of the first of them */
+    uint16_t argc;
+    uint32_t argSizes[SLOWLOG_MAX_ARGS];
+    /** Packet was completely received */
+    uint64_t arrival;
+    /** Processor started to execute the packet */
+    uint64_t dequeued;
+    /** Time spent in the handlers excluding their writes, and time spent to write responses */
+    uint64_t handlerNanos;
+    uint64_t writeNanos;
+    /** Packets of the connection that were in work when this one was received */
+    uint32_t depth;
+} SlowLog_Trace;
+
+bool SlowLog_init();
+bool SlowLog_enabled();
+void SlowLog_check(const SlowLog_Trace *trace, Connection *conn, uint64_t end);
+
+#endif //NSD_SLOWLOG_H
@@ -0,0 +1,39 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_STATS_H
+#define NSD_STATS_H
+
+#include <stdint.h>
+
+/** Daemon wide monitoring counters. Names of the counters, as they are reported by the 'stats' command, are defined
+ *  in the stats.c */
+typedef enum Stats_Counter {
+    STATS_QUEUE_FULL,
+    STATS_QUEUE_FULL_TIMEOUT,
+    STATS_REQUESTS_SHED,
+    STATS_QUEUE_DEPTH_CONTROL,
+    STATS_QUEUE_DEPTH_NORMAL,
+    STATS_QUEUE_DEPTH_BULK,
+    STATS_REQUESTS_THROTTLED,
+    STATS_SCHED_WAITS,
+    STATS_BATCH_PACKETS,
+    STATS_BATCH_COMMANDS,
+    STATS_IO_SYSCALLS,
+    STATS_THREADS_POOL,
+    STATS_THREADS_BUSY,
+    STATS_THREADS_QUEUED,
+    STATS_THREADS_STACK,
+    STATS_REQUESTS_INLINE,
+    STATS_CAPTURE_FRAMES,
+    STATS_CAPTURE_DROPPED,
+    STATS_COUNTERS_COUNT
+} Stats_Counter;
+
+void Stats_inc(Stats_Counter counter);
+void Stats_add(Stats_Counter counter, int64_t value);
+uint64_t Stats_get(Stats_Counter counter);
+char* Stats_format();
+
+#endif //NSD_STATS_H
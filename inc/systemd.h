@@ -0,0 +1,21 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_SYSTEMD_H
+#define NSD_SYSTEMD_H
+
+#include <stdbool.h>
+
+/** First descriptor passed by the socket activation */
+#define SYSTEMD_LISTEN_FDS_START 3
+
+/** Max count of the activated sockets taken by the daemon */
+#define SYSTEMD_MAX_LISTENERS 8
+
+void Systemd_init();
+int Systemd_listener(const char *path, bool seqpacket);
+void Systemd_closeUntaken();
+bool Systemd_notify(const char *state);
+
+#endif //NSD_SYSTEMD_H
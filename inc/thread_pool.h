@@ -0,0 +1,48 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_THREAD_POOL_H
+#define NSD_THREAD_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../libs/oscl/include/threads.h"
+#include "../libs/oscl/include/twheel.h"
+
+/** Count of workers started at the daemon start, they are never retired */
+#define THREAD_POOL_DEFAULT_THREADS 8
+
+/** Max count of the workers. Tasks submitted when all of them are busy wait in the queue, owned tasks go above it */
+#define THREAD_POOL_DEFAULT_MAX 1024
+
+/** Stack size of the worker in kilobytes. Connection threads use only small buffers on the stack */
+#define THREAD_POOL_DEFAULT_STACK 128
+
+/** How long the worker above the prestarted count stays idle before it exits */
+#define THREAD_POOL_IDLE_TIMEOUT 10000
+
+/** How long after the last retired worker the allocator is trimmed */
+#define THREAD_POOL_TRIM_DELAY 1000
+
+/** Task waiting for the free worker */
+typedef struct ThreadPool_Task {
+    void (*run)(void*);
+    void *args;
+    struct ThreadPool_Task *next;
+} ThreadPool_Task;
+
+/** Idle worker parked on it's own condition. Parked workers form a stack, the task wakes the most recently parked one,
+ *  so workers not needed by the current load stay parked until they retire */
+typedef struct ThreadPool_Sleeper {
+    cond_t *cond;
+    /** Sleeper was taken from the stack by the task */
+    bool woken;
+    struct ThreadPool_Sleeper *next;
+} ThreadPool_Sleeper;
+
+bool ThreadPool_init(twheel_t *wheel);
+void ThreadPool_run(void (*run)(void*), void *args);
+void ThreadPool_runOwned(void (*run)(void*), void *args);
+
+#endif //NSD_THREAD_POOL_H
@@ -0,0 +1,68 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_UPGRADE_H
+#define NSD_UPGRADE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/un.h>
+#include "connection.h"
+#include "io_engine.h"
+
+/** Socket where the running daemon waits for the new process */
+#define UPGRADE_DEFAULT_SOCKET "/tmp/nsd.upgrade"
+
+/** How long the old process waits for it's connections to be closed or passed before it exits */
+#define UPGRADE_DEFAULT_DRAIN 30000
+
+/** How long the old process waits for the hello and then for the READY of the new process before it keeps serving */
+#define UPGRADE_DEFAULT_READY 30000
+
+/** How often blocked readers and accepting threads of the old process are interrupted while it is drained */
+#define UPGRADE_INTERRUPT_INTERVAL 20
+
+/** Max count of the passed listeners */
+#define UPGRADE_MAX_LISTENERS 2
+
+#define UPGRADE_MAGIC 0x4E534455
+#define UPGRADE_VERSION 1
+
+/** Flag of the hello. New process is able to serve connections passed with their framing state */
+#define UPGRADE_FLAG_ADOPT 0x01
+
+/** Record types. Listeners go first and are finished by the LISTENED record, new process answers by the READY when
+ *  they accept, then connections go until the END */
+#define UPGRADE_LISTENER 1
+#define UPGRADE_LISTENED 2
+#define UPGRADE_CONN 3
+#define UPGRADE_END 4
+#define UPGRADE_READY 5
+
+/** Hello sent by the new process right after it has connected */
+typedef struct Upgrade_Hello {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+} Upgrade_Hello;
+
+/** Record of the upgrade socket, only READY is sent by the new process. Listener and connection records carry the
+ *  descriptor. Path is set for the listener, state is the IO_CONN_* framing state of the connection */
+typedef struct Upgrade_Record {
+    uint8_t type;
+    uint8_t seqpacket;
+    uint8_t state;
+    char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+} Upgrade_Record;
+
+void Upgrade_listen(int sockfd, IoEngine_Listener *listeners, int count, bool passConnections);
+bool Upgrade_handingOff();
+bool Upgrade_passing();
+bool Upgrade_sendConn(Connection *conn, uint8_t state);
+void Upgrade_acceptStarted();
+void Upgrade_acceptStopped();
+int Upgrade_connect(IoEngine_Listener *listeners, bool adopt);
+void Upgrade_adopt(uint8_t engine);
+
+#endif //NSD_UPGRADE_H
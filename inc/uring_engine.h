@@ -0,0 +1,76 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef NSD_URING_ENGINE_H
+#define NSD_URING_ENGINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <linux/io_uring.h>
+#include "io_engine.h"
+#include "client_thread.h"
+
+/** Size of the submission queue. Completion queue is URING_ENGINE_CQ_FACTOR times bigger, because each multishot
+ *  submission produces many completions */
+#define URING_ENGINE_ENTRIES 256
+#define URING_ENGINE_CQ_FACTOR 16
+
+/** Count of the provided receive buffers, must be a power of two */
+#define URING_ENGINE_BUFFERS 64
+
+/** Size of the provided receive buffer. It is bigger than the max seqpacket message, so truncated message is
+ *  recognized by it's length */
+#define URING_ENGINE_BUFFER_SIZE (CLIENT_THREAD_SEQPACKET_BUF + 64)
+
+#define URING_ENGINE_BUFFER_GROUP 0
+
+struct UringEngine_Send;
+
+/** Io_uring instance of the loop. Submission queue is shared by the loop and by the command processors, that submit
+ *  responses, so it is filled under the mutex. Completion queue is reaped by the loop only. Processor never waits for
+ *  the space in the full submission queue, it's send is deferred and is submitted by the loop */
+typedef struct UringEngine {
+    int fd;
+    uint32_t *sqHead;
+    uint32_t *sqTail;
+    uint32_t sqMask;
+    uint32_t sqEntries;
+    uint32_t *sqArray;
+    struct io_uring_sqe *sqes;
+    /** Tail of the filled entries, it is published to the kernel when whole chain is filled */
+    uint32_t sqLocal;
+    mutex_t *sqMutex;
+    /** Sends that did not fit the full submission queue, filled under the sq mutex */
+    struct UringEngine_Send *deferred;
+    struct UringEngine_Send *deferredTail;
+    /** Thread of the loop, the only one that frees the overflowed completion queue */
+    thread_t loop;
+    uint32_t *cqHead;
+    uint32_t *cqTail;
+    uint32_t cqMask;
+    struct io_uring_cqe *cqes;
+    /** Completions moved out of the queue by the loop that waits for the submission space, they are handled first */
+    struct io_uring_cqe *backlog;
+    uint32_t backlogHead;
+    uint32_t backlogCount;
+    uint32_t backlogCap;
+    /** Ring of the provided receive buffers and the buffers memory */
+    struct io_uring_buf_ring *bufRing;
+    char *buffers;
+    uint16_t bufTail;
+    /** Kernel supports multishot accept and receive */
+    bool multishot;
+    /** Log batch is being written */
+    bool logging;
+    /** Connections waiting for the free space in their command queues */
+    IoConn *paused;
+    /** Count of the accepts in flight, they are cancelled while the daemon is upgraded */
+    uint8_t accepting;
+    bool stopping;
+} UringEngine;
+
+void UringEngine_run(IoEngine_Listener *listeners, int count);
+uint16_t UringEngine_send(UringEngine *engine, Connection *conn, char *data, const uint32_t *ends, uint16_t count);
+
+#endif //NSD_URING_ENGINE_H
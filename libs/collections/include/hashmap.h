@@ -0,0 +1,162 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef ACTORS_HASHMAP_H
+#define ACTORS_HASHMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "../../oscl/include/malloc.h"
+
+/** Capacity of the map after the first put, must be a power of two */
+#define HASHMAP_INITIAL_CAPACITY 16
+
+/** Mix bits of the integer key, so the low bits used for the slot index depend on all key bits */
+static inline uint64_t HashMap_mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+#define HASHMAP_HASH_INT(key) HashMap_mix((uint64_t) (key))
+#define HASHMAP_EQ_INT(a, b) ((a) == (b))
+
+/** Define hash map from K to V, named HashMap_K_V. Keys and values are stored inline in the open addressing table
+ *  with the linear probing, removal shifts following entries back, so there are no tombstones. Table grows twice when
+ *  it is filled by 3/4. DEFINE_HASHMAP is for the integer keys, DEFINE_HASHMAP_NAMED takes the hash and equality
+ *  expressions for other keys. Map is not thread safe, all functions are static inline. Zeroed struct is the empty
+ *  map */
+#define DEFINE_HASHMAP(K, V) DEFINE_HASHMAP_NAMED(HashMap_##K##_##V, K, V, HASHMAP_HASH_INT, HASHMAP_EQ_INT)
+
+#define DEFINE_HASHMAP_NAMED(Name, K, V, HASH, EQ)                                                                    \
+typedef struct Name {                                                                                                 \
+    K *keys;                                                                                                          \
+    V *values;                                                                                                        \
+    uint8_t *used;                                                                                                    \
+    uint32_t size;                                                                                                    \
+    uint32_t capacity;                                                                                                \
+} Name;                                                                                                               \
+                                                                                                                      \
+static inline void Name##_init(Name *m) {                                                                             \
+    memset(m, 0, sizeof(Name));                                                                                       \
+}                                                                                                                     \
+                                                                                                                      \
+static inline void Name##_free(Name *m) {                                                                             \
+    pfree(m->keys);                                                                                                   \
+    pfree(m->values);                                                                                                 \
+    pfree(m->used);                                                                                                   \
+    Name##_init(m);                                                                                                   \
+}                                                                                                                     \
+                                                                                                                      \
+/** Internal function. Return slot of the key, or -1 if map has no such key */                                        \
+static inline int64_t Name##_slot(const Name *m, K key) {                                                             \
+    if (m->capacity == 0)                                                                                             \
+        return -1;                                                                                                    \
+    uint32_t mask = m->capacity - 1;                                                                                  \
+    for (uint32_t i = (uint32_t) HASH(key) & mask; m->used[i]; i = (i + 1) & mask) {                                  \
+        if (EQ(m->keys[i], key))                                                                                      \
+            return i;                                                                                                 \
+    }                                                                                                                 \
+    return -1;                                                                                                        \
+}                                                                                                                     \
+                                                                                                                      \
+/** Internal function. Place entry that is known to be absent to the table that has a free slot */                   \
+static inline void Name##_place(Name *m, K key, V value) {                                                            \
+    uint32_t mask = m->capacity - 1;                                                                                  \
+    uint32_t i = (uint32_t) HASH(key) & mask;                                                                         \
+    while (m->used[i])                                                                                                \
+        i = (i + 1) & mask;                                                                                           \
+    m->keys[i] = key;                                                                                                 \
+    m->values[i] = value;                                                                                             \
+    m->used[i] = 1;                                                                                                   \
+    m->size++;                                                                                                        \
+}                                                                                                                     \
+                                                                                                                      \
+/** Internal function. Move entries to the table of the new capacity. Return false if memory can't be allocated */    \
+static inline bool Name##_rehash(Name *m, uint32_t capacity) {                                                        \
+    Name old = *m;                                                                                                    \
+    m->keys = (K*) pmalloc((size_t) capacity * sizeof(K));                                                            \
+    m->values = (V*) pmalloc((size_t) capacity * sizeof(V));                                                          \
+    m->used = (uint8_t*) pmalloc(capacity);                                                                           \
+    if (m->keys == NULL || m->values == NULL || m->used == NULL) {                                                    \
+        pfree(m->keys);                                                                                               \
+        pfree(m->values);                                                                                             \
+        pfree(m->used);                                                                                               \
+        *m = old;                                                                                                     \
+        return false;                                                                                                 \
+    }                                                                                                                 \
+    memset(m->used, 0, capacity);                                                                                     \
+    m->capacity = capacity;                                                                                           \
+    m->size = 0;                                                                                                      \
+    for (uint32_t i = 0; i < old.capacity; i++) {                                                                     \
+        if (old.used[i])                                                                                              \
+            Name##_place(m, old.keys[i], old.values[i]);                                                              \
+    }                                                                                                                 \
+    pfree(old.keys);                                                                                                  \
+    pfree(old.values);                                                                                                \
+    pfree(old.used);                                                                                                  \
+    return true;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+/** Return pointer to the value of the key, or NULL if map has no such key. Pointer is valid until the next put or   \
+ *  remove */                                                                                                         \
+static inline V* Name##_get(Name *m, K key) {                                                                         \
+    int64_t slot = Name##_slot(m, key);                                                                               \
+    return slot < 0 ? NULL : &m->values[slot];                                                                        \
+}                                                                                                                     \
+                                                                                                                      \
+/** Set value of the key. Return false if memory can't be allocated */                                                \
+static inline bool Name##_put(Name *m, K key, V value) {                                                              \
+    int64_t slot = Name##_slot(m, key);                                                                               \
+    if (slot >= 0) {                                                                                                  \
+        m->values[slot] = value;                                                                                      \
+        return true;                                                                                                  \
+    }                                                                                                                 \
+    if ((m->size + 1) * 4 > m->capacity * 3                                                                           \
+        && !Name##_rehash(m, m->capacity == 0 ? HASHMAP_INITIAL_CAPACITY : m->capacity * 2))                          \
+        return false;                                                                                                 \
+    Name##_place(m, key, value);                                                                                      \
+    return true;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+/** Remove the key, it's value is stored to the out if it is not NULL. Return false if map has no such key */        \
+static inline bool Name##_remove(Name *m, K key, V *out) {                                                            \
+    int64_t slot = Name##_slot(m, key);                                                                               \
+    if (slot < 0)                                                                                                     \
+        return false;                                                                                                 \
+    if (out != NULL)                                                                                                  \
+        *out = m->values[slot];                                                                                       \
+    uint32_t mask = m->capacity - 1;                                                                                  \
+    uint32_t hole = (uint32_t) slot;                                                                                  \
+    m->used[hole] = 0;                                                                                                \
+    m->size--;                                                                                                        \
+    /* Entries of the same probe chain are shifted to the hole, unless their home slot is after it */                 \
+    for (uint32_t i = (hole + 1) & mask; m->used[i]; i = (i + 1) & mask) {                                            \
+        uint32_t home = (uint32_t) HASH(m->keys[i]) & mask;                                                           \
+        if (((i - home) & mask) >= ((i - hole) & mask)) {                                                             \
+            m->keys[hole] = m->keys[i];                                                                               \
+            m->values[hole] = m->values[i];                                                                           \
+            m->used[hole] = 1;                                                                                        \
+            m->used[i] = 0;                                                                                           \
+            hole = i;                                                                                                 \
+        }                                                                                                             \
+    }                                                                                                                 \
+    return true;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+/** Iterate entries. Position must be zero before the first call. Return false when all entries were passed */       \
+static inline bool Name##_next(const Name *m, uint32_t *pos, K *key, V *value) {                                      \
+    for (; *pos < m->capacity; (*pos)++) {                                                                            \
+        if (m->used[*pos]) {                                                                                          \
+            *key = m->keys[*pos];                                                                                     \
+            *value = m->values[(*pos)++];                                                                             \
+            return true;                                                                                              \
+        }                                                                                                             \
+    }                                                                                                                 \
+    return false;                                                                                                     \
+}
+
+#endif //ACTORS_HASHMAP_H
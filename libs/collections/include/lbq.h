@@ -6,23 +6,46 @@
 #define ACTORS_LBQ_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <malloc.h>
 #include "colnode.h"
+#include "mpmc.h"
 #include "../../oscl/include/threads.h"
 
+/** Capacity value for the queue without size limit */
+#define LBQ_UNBOUNDED 0
+
+/** Engines of the queue. Mutex engine links items to the list under the queue mutex. MPMC engine stores them to the
+ *  lock free MpmcQueue array, which is rounded up to the power of two, while the count keeps the configured capacity.
+ *  Unbounded queue always uses the mutex engine */
+#define LBQ_ENGINE_MUTEX 0
+#define LBQ_ENGINE_MPMC 1
+
 typedef struct LinkedBlockingQueue {
     uint16_t capacity;
     uint16_t count;
     Node *head;
     Node *last;
     mutex_t *mutex;
+    cond_t *notFull;
+    /** Count of insertions that found the queue full */
+    uint32_t fullHits;
+    /** Count of insertions that was rejected because the queue stays full */
+    uint32_t rejects;
+    /** Array of the MPMC engine, NULL for the mutex engine */
+    MpmcQueue *mpmc;
+    /** Producers of the MPMC engine parked until consumer frees the slot */
+    parker_t slots;
 
     void (*enqueue)(void*, void*);
+    bool (*put)(void*, void*, uint64_t);
+    bool (*tryPut)(void*, void*);
     void* (*dequeue)(void*);
     uint16_t (*size)(void*);
 } LinkedBlockingQueue;
 
 void del_LQB(LinkedBlockingQueue *queue);
 LinkedBlockingQueue* new_LQB(uint16_t capacity);
+LinkedBlockingQueue* new_LQB_engine(uint16_t capacity, uint8_t engine);
 
 #endif //ACTORS_LBQ_H
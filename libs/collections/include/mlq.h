@@ -0,0 +1,53 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef ACTORS_MLQ_H
+#define ACTORS_MLQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "lbq.h"
+#include "../../oscl/include/threads.h"
+
+/** Queue with several priority lanes. Lane 0 has the highest priority. Each lane is a LinkedBlockingQueue of the given
+ *  engine. Capacity is shared by all lanes, so a flooded lane does not fill up while others are empty, and the reserve
+ *  part of it is left for the lane 0 only. Producers take the queue mutex only to wake the waiting consumer or to wait
+ *  for space */
+typedef struct MultiLaneQueue {
+    uint8_t lanes;
+    /** Max count of items in all lanes */
+    uint16_t capacity;
+    /** Places of the capacity that only lane 0 may take */
+    uint16_t reserve;
+    /** Count of items in all lanes, including the ones being linked */
+    uint16_t count;
+    /** How many times non empty lane may be passed over in favor of higher lanes before it is served out of turn */
+    uint16_t starvationLimit;
+    LinkedBlockingQueue **queues;
+    uint16_t *skips;
+    /** Count of dequeues that was made from a lane out of turn because of starvation */
+    uint32_t starvationPicks;
+    mutex_t *mutex;
+    cond_t *notEmpty;
+    cond_t *notFull;
+    /** Count of consumers that wait on the notEmpty condition */
+    uint32_t waiting;
+    /** Count of producers that wait on the notFull condition, changed under the queue mutex */
+    uint32_t fullWaiting;
+    /** Consumer must stop, so take does not wait on the empty queue */
+    bool closed;
+
+    bool (*put)(void*, uint8_t, void*, uint64_t);
+    bool (*tryPut)(void*, uint8_t, void*);
+    void* (*dequeue)(void*);
+    void* (*take)(void*, uint64_t);
+    uint16_t (*size)(void*);
+    uint16_t (*laneSize)(void*, uint8_t);
+    void (*close)(void*);
+} MultiLaneQueue;
+
+void del_MLQ(MultiLaneQueue *queue);
+MultiLaneQueue* new_MLQ(uint8_t lanes, uint16_t capacity, uint16_t reserve, uint16_t starvationLimit, uint8_t engine);
+
+#endif //ACTORS_MLQ_H
@@ -0,0 +1,51 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef ACTORS_MPMC_H
+#define ACTORS_MPMC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../../oscl/include/wait.h"
+
+/** Size of the cache line. Counters of producers and consumers are placed to the separate lines */
+#define MPMC_CACHE_LINE 64
+
+/** Timeout value of the wait without time limit */
+#define MPMC_WAIT_FOREVER UINT64_MAX
+
+typedef struct MpmcCell {
+    /** Equal to the position of the cell while it waits for the item of this position, and to the position + 1 while it
+     *  holds the item */
+    uint64_t sequence;
+    void *item;
+} MpmcCell;
+
+/** Bounded multi producer multi consumer queue on the array of sequence numbered cells (D. Vyukov). Producers and
+ *  consumers claim positions by CAS of their counter, so they don't take locks and don't allocate memory. Capacity is
+ *  rounded up to the power of two. Blocked producers and consumers retry the queue by the process wait strategy, then
+ *  park on the futex, they are woken only if some of them is parked */
+typedef struct MpmcQueue {
+    MpmcCell *cells;
+    uint64_t mask;
+    char pad0[MPMC_CACHE_LINE];
+    uint64_t enqueuePos;
+    char pad1[MPMC_CACHE_LINE - sizeof(uint64_t)];
+    uint64_t dequeuePos;
+    char pad2[MPMC_CACHE_LINE - sizeof(uint64_t)];
+    /** Parked producers and consumers */
+    parker_t notFull;
+    parker_t notEmpty;
+} MpmcQueue;
+
+bool MPMC_tryPut(MpmcQueue *queue, void *item);
+bool MPMC_put(MpmcQueue *queue, void *item, uint64_t timeout);
+void* MPMC_dequeue(MpmcQueue *queue);
+void* MPMC_take(MpmcQueue *queue, uint64_t timeout);
+uint32_t MPMC_size(MpmcQueue *queue);
+uint32_t MPMC_capacity(MpmcQueue *queue);
+void MPMC_del(MpmcQueue *queue);
+MpmcQueue* MPMC_new(uint32_t capacity);
+
+#endif //ACTORS_MPMC_H
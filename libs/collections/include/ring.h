@@ -0,0 +1,63 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef ACTORS_RING_H
+#define ACTORS_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Define fixed capacity FIFO ring of N elements of T stored inline, named Ring_T_N. N must be a power of two, so
+ *  positions are wrapped by the mask. Head and tail are free running counters, their difference is the size. Ring is
+ *  not thread safe, all functions are static inline. Zeroed struct is the empty ring */
+#define DEFINE_RING(T, N) DEFINE_RING_NAMED(Ring_##T##_##N, T, N)
+
+#define DEFINE_RING_NAMED(Name, T, N)                                                                                 \
+_Static_assert((N) > 0 && ((N) & ((N) - 1)) == 0, "Ring capacity must be a power of two");                            \
+                                                                                                                      \
+typedef struct Name {                                                                                                 \
+    T items[N];                                                                                                       \
+    uint32_t head;                                                                                                    \
+    uint32_t tail;                                                                                                    \
+} Name;                                                                                                               \
+                                                                                                                      \
+static inline void Name##_init(Name *r) {                                                                             \
+    r->head = 0;                                                                                                      \
+    r->tail = 0;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+static inline uint32_t Name##_size(const Name *r) {                                                                   \
+    return r->tail - r->head;                                                                                         \
+}                                                                                                                     \
+                                                                                                                      \
+static inline bool Name##_empty(const Name *r) {                                                                      \
+    return r->tail == r->head;                                                                                        \
+}                                                                                                                     \
+                                                                                                                      \
+static inline bool Name##_full(const Name *r) {                                                                       \
+    return r->tail - r->head == (N);                                                                                  \
+}                                                                                                                     \
+                                                                                                                      \
+/** Append element to the tail. Return false if ring is full */                                                       \
+static inline bool Name##_push(Name *r, T value) {                                                                    \
+    if (Name##_full(r))                                                                                               \
+        return false;                                                                                                 \
+    r->items[r->tail++ & ((N) - 1)] = value;                                                                          \
+    return true;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+/** Take element from the head to the out. Return false if ring is empty */                                          \
+static inline bool Name##_pop(Name *r, T *out) {                                                                      \
+    if (Name##_empty(r))                                                                                              \
+        return false;                                                                                                 \
+    *out = r->items[r->head++ & ((N) - 1)];                                                                           \
+    return true;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+/** Return pointer to the head element without taking it, or NULL if ring is empty */                                \
+static inline T* Name##_peek(Name *r) {                                                                               \
+    return Name##_empty(r) ? NULL : &r->items[r->head & ((N) - 1)];                                                   \
+}
+
+#endif //ACTORS_RING_H
@@ -0,0 +1,85 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef ACTORS_VECTOR_H
+#define ACTORS_VECTOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../../oscl/include/malloc.h"
+
+/** Capacity of the vector after the first push */
+#define VECTOR_INITIAL_CAPACITY 8
+
+/** Define growable array of T elements stored inline, named Vector_T. For the type names that are not identifiers
+ *  (pointers, 'unsigned int') DEFINE_VECTOR_NAMED gives the name explicitly. All functions are static inline, so the
+ *  element access compiles to the plain memory access. Zeroed struct is the empty vector */
+#define DEFINE_VECTOR(T) DEFINE_VECTOR_NAMED(Vector_##T, T)
+
+#define DEFINE_VECTOR_NAMED(Name, T)                                                                                  \
+typedef struct Name {                                                                                                 \
+    T *data;                                                                                                          \
+    uint32_t size;                                                                                                    \
+    uint32_t capacity;                                                                                                \
+} Name;                                                                                                               \
+                                                                                                                      \
+static inline void Name##_init(Name *v) {                                                                             \
+    v->data = NULL;                                                                                                   \
+    v->size = 0;                                                                                                      \
+    v->capacity = 0;                                                                                                  \
+}                                                                                                                     \
+                                                                                                                      \
+/** Make room for at least capacity elements. Return false if memory can't be allocated */                            \
+static inline bool Name##_reserve(Name *v, uint32_t capacity) {                                                       \
+    if (capacity <= v->capacity)                                                                                      \
+        return true;                                                                                                  \
+    T *data = (T*) prealloc(v->data, (size_t) capacity * sizeof(T));                                                  \
+    if (data == NULL)                                                                                                 \
+        return false;                                                                                                 \
+    v->data = data;                                                                                                   \
+    v->capacity = capacity;                                                                                           \
+    return true;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+/** Append element. Return false if memory can't be allocated */                                                      \
+static inline bool Name##_push(Name *v, T value) {                                                                    \
+    if (v->size == v->capacity                                                                                        \
+        && !Name##_reserve(v, v->capacity == 0 ? VECTOR_INITIAL_CAPACITY : v->capacity * 2))                          \
+        return false;                                                                                                 \
+    v->data[v->size++] = value;                                                                                       \
+    return true;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+/** Remove the last element to the out. Return false if vector is empty */                                            \
+static inline bool Name##_pop(Name *v, T *out) {                                                                      \
+    if (v->size == 0)                                                                                                 \
+        return false;                                                                                                 \
+    *out = v->data[--v->size];                                                                                        \
+    return true;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+/** Return element by index, index must be less than size */                                                         \
+static inline T Name##_get(const Name *v, uint32_t index) {                                                           \
+    return v->data[index];                                                                                            \
+}                                                                                                                     \
+                                                                                                                      \
+static inline void Name##_set(Name *v, uint32_t index, T value) {                                                     \
+    v->data[index] = value;                                                                                           \
+}                                                                                                                     \
+                                                                                                                      \
+/** Remove element by index, the last element takes it's place, so order is not kept */                             \
+static inline void Name##_swapRemove(Name *v, uint32_t index) {                                                       \
+    v->data[index] = v->data[--v->size];                                                                              \
+}                                                                                                                     \
+                                                                                                                      \
+static inline void Name##_clear(Name *v) {                                                                            \
+    v->size = 0;                                                                                                      \
+}                                                                                                                     \
+                                                                                                                      \
+static inline void Name##_free(Name *v) {                                                                             \
+    pfree(v->data);                                                                                                   \
+    Name##_init(v);                                                                                                   \
+}
+
+#endif //ACTORS_VECTOR_H
@@ -1,30 +1,98 @@
+#include <string.h>
 #include "../include/lbq.h"
 #include "../../oscl/include/malloc.h"
 #include "../../oscl/include/threads.h"
+#include "../../oscl/include/time.h"
 
+/** Internal function. Link node to the tail of the queue. Must be called under the queue mutex */
+static void linkNode(LinkedBlockingQueue *this, Node *node) {
+    if (this->last == NULL) {
+        this->last = node;
+        this->head = node;
+    } else {
+        this->last->next = node;
+        this->last = node;
+    }
+
+    this->count = (uint16_t) (this->count + 1);
+}
+
+/** Internal function. Return true if the queue can't accept new item. Must be called under the queue mutex */
+static bool isFull(LinkedBlockingQueue *this) {
+    return this->capacity != LBQ_UNBOUNDED && this->count >= this->capacity;
+}
+
+/** Insert item to the queue. If the queue is full, wait for free space for unlimited time */
 void enqueue(void *self, void *item) {
-    //TODO Блокировка очереди с проверкой работы экзекутора и акторов
     LinkedBlockingQueue *this = (LinkedBlockingQueue*) self;
     Node *node = pmalloc(sizeof(Node));
+    node->item = item;
+    node->next = NULL;
 
     MutexLock(this->mutex);
 
+    if (isFull(this)) {
+        this->fullHits++;
+        while (isFull(this))
+            CondWait(this->notFull, this->mutex);
+    }
+
+    linkNode(this, node);
+
+    MutexUnlock(this->mutex);
+}
+
+/** Insert item to the queue. If the queue is full, wait for free space not longer than timeout millis. Return false if
+ *  space was not freed in time. In this case item is not inserted and stay owned by caller */
+bool put(void *self, void *item, uint64_t timeout) {
+    LinkedBlockingQueue *this = (LinkedBlockingQueue*) self;
+
+    MutexLock(this->mutex);
+
+    if (isFull(this)) {
+        this->fullHits++;
+        while (isFull(this)) {
+            if (!CondTimedWait(this->notFull, this->mutex, timeout) && isFull(this)) {
+                this->rejects++;
+                MutexUnlock(this->mutex);
+                return false;
+            }
+        }
+    }
+
+    Node *node = pmalloc(sizeof(Node));
     node->item = item;
     node->next = NULL;
+    linkNode(this, node);
 
-    if (this->last == NULL) {
-        this->last = node;
-        this->head = node;
-    } else {
-        this->last->next = node;
-        this->last = node;
+    MutexUnlock(this->mutex);
+
+    return true;
+}
+
+/** Insert item to the queue without waiting. Return false if the queue is full. In this case item is not inserted and
+ *  stay owned by caller */
+bool tryPut(void *self, void *item) {
+    LinkedBlockingQueue *this = (LinkedBlockingQueue*) self;
+
+    MutexLock(this->mutex);
+
+    if (isFull(this)) {
+        this->fullHits++;
+        this->rejects++;
+        MutexUnlock(this->mutex);
+        return false;
     }
 
-    this->count = (uint16_t) (this->count + 1);
+    Node *node = pmalloc(sizeof(Node));
+    node->item = item;
+    node->next = NULL;
+    linkNode(this, node);
 
     MutexUnlock(this->mutex);
-}
 
+    return true;
+}
 
 void* dequeue(void *self) {
     LinkedBlockingQueue *this = (LinkedBlockingQueue*) self;
@@ -46,6 +114,7 @@ void* dequeue(void *self) {
         }
 
         this->count = (uint16_t) (this->count - 1);
+        CondSignal(this->notFull);
         MutexUnlock(this->mutex);
         return item;
     } else {
@@ -63,23 +132,156 @@ uint16_t size(void *self) {
 
 }
 
-//Внимание, до вызова функции очередь должна быть полностью очищена
+/** Internal function. Take the slot of the MPMC engine queue for the new item. Return false if the queue holds
+ *  capacity items already. Array of the engine is rounded up to the power of two, so the count keeps the configured
+ *  capacity */
+static bool mpmcReserve(LinkedBlockingQueue *this) {
+    uint16_t count = __atomic_load_n(&this->count, __ATOMIC_RELAXED);
+    while (count < this->capacity) {
+        //On failure count is updated by the actual value
+        if (__atomic_compare_exchange_n(&this->count, &count, (uint16_t) (count + 1), true, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+            return true;
+    }
+
+    return false;
+}
+
+/** Internal function. Store item to the reserved slot. Array cell may be still held by the consumer that has taken
+ *  it's item but not released it yet, in this case wait for it */
+static void mpmcStore(LinkedBlockingQueue *this, void *item) {
+    if (!MPMC_tryPut(this->mpmc, item))
+        MPMC_put(this->mpmc, item, MPMC_WAIT_FOREVER);
+}
+
+/** Internal function. Wait for the free slot until deadline. Return false if the queue stays full */
+static bool mpmcAwait(LinkedBlockingQueue *this, uint64_t deadline) {
+    uint32_t round = 0;
+    do {
+        if (mpmcReserve(this))
+            return true;
+    } while (WaitStep(WaitDefault(), &round));
+
+    while (1) {
+        uint32_t seen = ParkerPrepare(&this->slots);
+        if (mpmcReserve(this)) {
+            ParkerCancel(&this->slots);
+            return true;
+        }
+        if (!ParkerPark(&this->slots, seen, deadline))
+            return mpmcReserve(this);
+    }
+}
+
+/** Insert item to the MPMC engine queue. If the queue is full, wait for free space for unlimited time */
+static void mpmcEnqueue(void *self, void *item) {
+    LinkedBlockingQueue *this = (LinkedBlockingQueue*) self;
+    if (!mpmcReserve(this)) {
+        __atomic_add_fetch(&this->fullHits, 1, __ATOMIC_RELAXED);
+        mpmcAwait(this, WAIT_FOREVER);
+    }
+    mpmcStore(this, item);
+}
+
+/** Insert item to the MPMC engine queue. If the queue is full, wait for free space not longer than timeout millis */
+static bool mpmcPut(void *self, void *item, uint64_t timeout) {
+    LinkedBlockingQueue *this = (LinkedBlockingQueue*) self;
+    if (!mpmcReserve(this)) {
+        __atomic_add_fetch(&this->fullHits, 1, __ATOMIC_RELAXED);
+        uint64_t deadline = timeout == MPMC_WAIT_FOREVER ? WAIT_FOREVER : MonotonicNanos() + timeout * NANOS_IN_MILLI;
+        if (!mpmcAwait(this, deadline)) {
+            __atomic_add_fetch(&this->rejects, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    }
+    mpmcStore(this, item);
+
+    return true;
+}
+
+/** Insert item to the MPMC engine queue without waiting. Return false if the queue is full */
+static bool mpmcTryPut(void *self, void *item) {
+    LinkedBlockingQueue *this = (LinkedBlockingQueue*) self;
+    if (!mpmcReserve(this)) {
+        __atomic_add_fetch(&this->fullHits, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&this->rejects, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    mpmcStore(this, item);
+
+    return true;
+}
+
+/** Take item from the MPMC engine queue and free it's slot. Return NULL if the queue is empty */
+static void* mpmcDequeue(void *self) {
+    LinkedBlockingQueue *this = (LinkedBlockingQueue*) self;
+    void *item = MPMC_dequeue(this->mpmc);
+    if (item != NULL) {
+        __atomic_sub_fetch(&this->count, 1, __ATOMIC_RELEASE);
+        ParkerUnpark(&this->slots);
+    }
+
+    return item;
+}
+
+static uint16_t mpmcSize(void *self) {
+    return __atomic_load_n(&((LinkedBlockingQueue*) self)->count, __ATOMIC_RELAXED);
+}
+
+/** Delete the queue. Nodes of the items left in the queue are freed, items themselves stay owned by caller, so they
+ *  must be taken before if they hold resources */
 void del_LQB(LinkedBlockingQueue *queue) {
-    pfree(queue->mutex);
+    if (queue->mpmc != NULL) {
+        MPMC_del(queue->mpmc);
+    } else {
+        Node *node = queue->head;
+        while (node != NULL) {
+            Node *next = node->next;
+            pfree(node);
+            node = next;
+        }
+        DelCond(queue->notFull);
+        DelMutex(queue->mutex);
+    }
     pfree(queue);
 }
 
 LinkedBlockingQueue* new_LQB(uint16_t capacity) {
+    return new_LQB_engine(capacity, LBQ_ENGINE_MUTEX);
+}
+
+/** Create queue with the given engine. Both engines have the same interface and the same counters */
+LinkedBlockingQueue* new_LQB_engine(uint16_t capacity, uint8_t engine) {
     LinkedBlockingQueue* queue = (LinkedBlockingQueue*) pmalloc(sizeof(LinkedBlockingQueue));
     queue->capacity = capacity;
     queue->count = 0;
     queue->head = NULL;
     queue->last = NULL;
-    queue->mutex = NewMutex();
+    queue->fullHits = 0;
+    queue->rejects = 0;
+    memset(&queue->slots, 0, sizeof(parker_t));
 
-    queue->enqueue = enqueue;
-    queue->dequeue = dequeue;
-    queue->size = size;
+    if (engine == LBQ_ENGINE_MPMC && capacity != LBQ_UNBOUNDED) {
+        queue->mpmc = MPMC_new(capacity);
+        queue->mutex = NULL;
+        queue->notFull = NULL;
+
+        queue->enqueue = mpmcEnqueue;
+        queue->put = mpmcPut;
+        queue->tryPut = mpmcTryPut;
+        queue->dequeue = mpmcDequeue;
+        queue->size = mpmcSize;
+    } else {
+        queue->mpmc = NULL;
+        queue->mutex = NewMutex("lbq");
+        queue->notFull = NewCond();
+
+        queue->enqueue = enqueue;
+        queue->put = put;
+        queue->tryPut = tryPut;
+        queue->dequeue = dequeue;
+        queue->size = size;
+    }
 
     return queue;
-}
\ No newline at end of file
+}
@@ -0,0 +1,225 @@
+#include "../include/mlq.h"
+#include "../../oscl/include/malloc.h"
+#include "../../oscl/include/threads.h"
+#include "../../oscl/include/wait.h"
+
+/** Internal function. Wake the consumer if it waits for items. The fence orders the inserted item before the waiting
+ *  count read, the consumer increments the count before it checks lanes last time */
+static void MLQ_notify(MultiLaneQueue *this) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&this->waiting, __ATOMIC_RELAXED) == 0)
+        return;
+
+    MutexLock(this->mutex);
+    CondSignal(this->notEmpty);
+    MutexUnlock(this->mutex);
+}
+
+/** Internal function. Take place for the item in the queue. Items of the lanes below the first one may not take the
+ *  last reserve places, so the first lane is never blocked by the others. Return false if the queue is full for the
+ *  lane */
+static bool MLQ_reserve(MultiLaneQueue *this, uint8_t lane) {
+    uint16_t limit = lane == 0 ? this->capacity : (uint16_t) (this->capacity - this->reserve);
+    uint16_t count = __atomic_load_n(&this->count, __ATOMIC_RELAXED);
+    do {
+        if (count >= limit)
+            return false;
+    } while (!__atomic_compare_exchange_n(&this->count, &count, (uint16_t) (count + 1), true, __ATOMIC_SEQ_CST,
+                                          __ATOMIC_RELAXED));
+
+    return true;
+}
+
+/** Internal function. Link item to the lane, place for it is already taken. Lanes hold the whole capacity of the queue,
+ *  so this never fails */
+static void MLQ_link(MultiLaneQueue *this, uint8_t lane, void *item) {
+    LinkedBlockingQueue *queue = this->queues[lane];
+    queue->tryPut(queue, item);
+    MLQ_notify(this);
+}
+
+/** Insert item to the lane. If the queue is full for the lane, wait for free space not longer than timeout millis.
+ *  Return false if space was not freed in time */
+bool MLQ_put(void *self, uint8_t lane, void *item, uint64_t timeout) {
+    MultiLaneQueue *this = (MultiLaneQueue*) self;
+    if (lane >= this->lanes)
+        lane = (uint8_t) (this->lanes - 1);
+
+    bool reserved = MLQ_reserve(this, lane);
+    if (!reserved) {
+        MutexLock(this->mutex);
+        this->fullWaiting++;
+        while (!(reserved = MLQ_reserve(this, lane))) {
+            if (!CondTimedWait(this->notFull, this->mutex, timeout)) {
+                reserved = MLQ_reserve(this, lane);
+                break;
+            }
+        }
+        this->fullWaiting--;
+        MutexUnlock(this->mutex);
+        if (!reserved)
+            return false;
+    }
+    MLQ_link(this, lane, item);
+
+    return true;
+}
+
+/** Insert item to the lane without waiting. Return false if the queue is full for the lane */
+bool MLQ_tryPut(void *self, uint8_t lane, void *item) {
+    MultiLaneQueue *this = (MultiLaneQueue*) self;
+    if (lane >= this->lanes)
+        lane = (uint8_t) (this->lanes - 1);
+
+    if (!MLQ_reserve(this, lane))
+        return false;
+    MLQ_link(this, lane, item);
+
+    return true;
+}
+
+/** Internal function. Take item from the highest non empty lane. Lower lane that was passed over starvationLimit
+ *  times while it had items is served first. Producer waiting for space is woken. Must be called under the queue
+ *  mutex */
+static void* MLQ_select(MultiLaneQueue *this) {
+    void *item = NULL;
+
+    for (uint8_t i = this->lanes; i > 0 && item == NULL; i--) {
+        uint8_t lane = (uint8_t) (i - 1);
+        if (this->skips[lane] >= this->starvationLimit) {
+            item = this->queues[lane]->dequeue(this->queues[lane]);
+            this->skips[lane] = 0;
+            if (item != NULL)
+                this->starvationPicks++;
+        }
+    }
+
+    for (uint8_t lane = 0; lane < this->lanes && item == NULL; lane++) {
+        item = this->queues[lane]->dequeue(this->queues[lane]);
+        if (item != NULL) {
+            this->skips[lane] = 0;
+            for (uint8_t lower = (uint8_t) (lane + 1); lower < this->lanes; lower++) {
+                if (this->queues[lower]->size(this->queues[lower]) > 0)
+                    this->skips[lower]++;
+            }
+        }
+    }
+
+    if (item != NULL) {
+        __atomic_sub_fetch(&this->count, 1, __ATOMIC_SEQ_CST);
+        if (this->fullWaiting > 0)
+            CondSignal(this->notFull);
+    }
+
+    return item;
+}
+
+uint16_t MLQ_laneSize(void *self, uint8_t lane) {
+    MultiLaneQueue *this = (MultiLaneQueue*) self;
+    return this->queues[lane]->size(this->queues[lane]);
+}
+
+uint16_t MLQ_size(void *self) {
+    MultiLaneQueue *this = (MultiLaneQueue*) self;
+    uint16_t size = 0;
+    for (uint8_t lane = 0; lane < this->lanes; lane++)
+        size += this->queues[lane]->size(this->queues[lane]);
+
+    return size;
+}
+
+/** Take item from the queue. Return NULL if all lanes are empty */
+void* MLQ_dequeue(void *self) {
+    MultiLaneQueue *this = (MultiLaneQueue*) self;
+
+    MutexLock(this->mutex);
+    void *item = MLQ_select(this);
+    MutexUnlock(this->mutex);
+
+    return item;
+}
+
+/** Take item from the queue. If all lanes are empty, wait for item not longer than timeout millis. Return NULL if
+ *  nothing was inserted in time. Lanes are polled by the process wait strategy before the consumer parks on the
+ *  condition */
+void* MLQ_take(void *self, uint64_t timeout) {
+    MultiLaneQueue *this = (MultiLaneQueue*) self;
+    const wait_t *wait = WaitDefault();
+
+    MutexLock(this->mutex);
+    void *item = MLQ_select(this);
+    if (item == NULL && wait->spins + wait->yields > 0) {
+        MutexUnlock(this->mutex);
+        uint32_t round = 0;
+        while (MLQ_size(this) == 0 && !__atomic_load_n(&this->closed, __ATOMIC_RELAXED) && WaitStep(wait, &round));
+        MutexLock(this->mutex);
+        item = MLQ_select(this);
+    }
+    if (item == NULL && !this->closed) {
+        __atomic_add_fetch(&this->waiting, 1, __ATOMIC_SEQ_CST);
+        item = MLQ_select(this);
+        if (item == NULL && CondTimedWait(this->notEmpty, this->mutex, timeout))
+            item = MLQ_select(this);
+        __atomic_sub_fetch(&this->waiting, 1, __ATOMIC_RELAXED);
+    }
+    MutexUnlock(this->mutex);
+
+    return item;
+}
+
+/** Wake the consumer and let it's takes on the empty queue return at once, so it sees that it must stop without
+ *  waiting for the take timeout. Items still may be inserted and taken */
+void MLQ_close(void *self) {
+    MultiLaneQueue *this = (MultiLaneQueue*) self;
+
+    MutexLock(this->mutex);
+    __atomic_store_n(&this->closed, true, __ATOMIC_RELAXED);
+    CondBroadcast(this->notEmpty);
+    MutexUnlock(this->mutex);
+}
+
+/** Delete the queue with all it's lanes. Items left in the lanes stay owned by caller, as with del_LQB */
+void del_MLQ(MultiLaneQueue *queue) {
+    for (uint8_t lane = 0; lane < queue->lanes; lane++)
+        del_LQB(queue->queues[lane]);
+    pfree(queue->queues);
+    pfree(queue->skips);
+    DelMutex(queue->mutex);
+    DelCond(queue->notEmpty);
+    DelCond(queue->notFull);
+    pfree(queue);
+}
+
+/** Create queue of capacity items in all lanes, reserve of them may be taken only by the first lane. Lanes are
+ *  LBQ_ENGINE_MUTEX or LBQ_ENGINE_MPMC engine queues */
+MultiLaneQueue* new_MLQ(uint8_t lanes, uint16_t capacity, uint16_t reserve, uint16_t starvationLimit, uint8_t engine) {
+    MultiLaneQueue *queue = (MultiLaneQueue*) pmalloc(sizeof(MultiLaneQueue));
+    queue->lanes = lanes;
+    queue->capacity = capacity;
+    queue->reserve = reserve < capacity ? reserve : (uint16_t) (capacity - 1);
+    queue->count = 0;
+    queue->starvationLimit = starvationLimit;
+    queue->queues = pmalloc(lanes * sizeof(LinkedBlockingQueue*));
+    queue->skips = pmalloc(lanes * sizeof(uint16_t));
+    for (uint8_t lane = 0; lane < lanes; lane++) {
+        queue->queues[lane] = new_LQB_engine(capacity, engine);
+        queue->skips[lane] = 0;
+    }
+    queue->starvationPicks = 0;
+    queue->mutex = NewMutex("mlq");
+    queue->notEmpty = NewCond();
+    queue->notFull = NewCond();
+    queue->waiting = 0;
+    queue->fullWaiting = 0;
+    queue->closed = false;
+
+    queue->put = MLQ_put;
+    queue->tryPut = MLQ_tryPut;
+    queue->dequeue = MLQ_dequeue;
+    queue->take = MLQ_take;
+    queue->size = MLQ_size;
+    queue->laneSize = MLQ_laneSize;
+    queue->close = MLQ_close;
+
+    return queue;
+}
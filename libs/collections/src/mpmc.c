@@ -0,0 +1,149 @@
+#include <string.h>
+#include "../include/mpmc.h"
+#include "../../oscl/include/malloc.h"
+#include "../../oscl/include/time.h"
+
+/** Internal function. Return MonotonicNanos deadline of the timeout in millis */
+static uint64_t MPMC_deadline(uint64_t timeout) {
+    return timeout == MPMC_WAIT_FOREVER ? WAIT_FOREVER : MonotonicNanos() + timeout * NANOS_IN_MILLI;
+}
+
+/** Insert item to the queue without waiting. Return false if the queue is full */
+bool MPMC_tryPut(MpmcQueue *queue, void *item) {
+    MpmcCell *cell;
+    uint64_t pos = __atomic_load_n(&queue->enqueuePos, __ATOMIC_RELAXED);
+    while (1) {
+        cell = &queue->cells[pos & queue->mask];
+        uint64_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t) (sequence - pos);
+        if (diff == 0) {
+            //On failure pos is updated by the actual value
+            if (__atomic_compare_exchange_n(&queue->enqueuePos, &pos, pos + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            //Cell still holds the item of the previous round
+            return false;
+        } else {
+            pos = __atomic_load_n(&queue->enqueuePos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->item = item;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    ParkerUnpark(&queue->notEmpty);
+
+    return true;
+}
+
+/** Insert item to the queue. If the queue is full, wait for free space not longer than timeout millis. Return false if
+ *  space was not freed in time. In this case item is not inserted and stay owned by caller */
+bool MPMC_put(MpmcQueue *queue, void *item, uint64_t timeout) {
+    uint64_t deadline = MPMC_deadline(timeout);
+    uint32_t round = 0;
+    do {
+        if (MPMC_tryPut(queue, item))
+            return true;
+    } while (WaitStep(WaitDefault(), &round));
+
+    while (1) {
+        uint32_t seen = ParkerPrepare(&queue->notFull);
+        if (MPMC_tryPut(queue, item)) {
+            ParkerCancel(&queue->notFull);
+            return true;
+        }
+        if (!ParkerPark(&queue->notFull, seen, deadline))
+            return false;
+    }
+}
+
+/** Take item from the queue without waiting. Return NULL if the queue is empty */
+void* MPMC_dequeue(MpmcQueue *queue) {
+    MpmcCell *cell;
+    uint64_t pos = __atomic_load_n(&queue->dequeuePos, __ATOMIC_RELAXED);
+    while (1) {
+        cell = &queue->cells[pos & queue->mask];
+        uint64_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t) (sequence - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&queue->dequeuePos, &pos, pos + 1, true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            //Item of this position is not inserted yet
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&queue->dequeuePos, __ATOMIC_RELAXED);
+        }
+    }
+
+    void *item = cell->item;
+    //Cell waits for the item of the next round
+    __atomic_store_n(&cell->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+    ParkerUnpark(&queue->notFull);
+
+    return item;
+}
+
+/** Take item from the queue. If the queue is empty, wait for item not longer than timeout millis. Return NULL if
+ *  nothing was inserted in time */
+void* MPMC_take(MpmcQueue *queue, uint64_t timeout) {
+    uint64_t deadline = MPMC_deadline(timeout);
+    uint32_t round = 0;
+    void *item;
+    do {
+        if ((item = MPMC_dequeue(queue)) != NULL)
+            return item;
+    } while (WaitStep(WaitDefault(), &round));
+
+    while (1) {
+        uint32_t seen = ParkerPrepare(&queue->notEmpty);
+        if ((item = MPMC_dequeue(queue)) != NULL) {
+            ParkerCancel(&queue->notEmpty);
+            return item;
+        }
+        if (!ParkerPark(&queue->notEmpty, seen, deadline))
+            return NULL;
+    }
+}
+
+/** Return count of items in the queue. While queue is changed concurrently, it is approximate */
+uint32_t MPMC_size(MpmcQueue *queue) {
+    uint64_t dequeuePos = __atomic_load_n(&queue->dequeuePos, __ATOMIC_ACQUIRE);
+    uint64_t enqueuePos = __atomic_load_n(&queue->enqueuePos, __ATOMIC_ACQUIRE);
+    if (enqueuePos <= dequeuePos)
+        return 0;
+    uint64_t size = enqueuePos - dequeuePos;
+
+    return size > queue->mask + 1 ? (uint32_t) (queue->mask + 1) : (uint32_t) size;
+}
+
+uint32_t MPMC_capacity(MpmcQueue *queue) {
+    return (uint32_t) (queue->mask + 1);
+}
+
+//Внимание, до вызова функции очередь должна быть полностью очищена
+void MPMC_del(MpmcQueue *queue) {
+    pfree(queue->cells);
+    pfree(queue);
+}
+
+MpmcQueue* MPMC_new(uint32_t capacity) {
+    uint64_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+
+    MpmcQueue *queue = (MpmcQueue*) pmalloc(sizeof(MpmcQueue));
+    queue->cells = (MpmcCell*) pmalloc(size * sizeof(MpmcCell));
+    for (uint64_t i = 0; i < size; i++) {
+        queue->cells[i].sequence = i;
+        queue->cells[i].item = NULL;
+    }
+    queue->mask = size - 1;
+    queue->enqueuePos = 0;
+    queue->dequeuePos = 0;
+    memset(&queue->notFull, 0, sizeof(parker_t));
+    memset(&queue->notEmpty, 0, sizeof(parker_t));
+
+    return queue;
+}
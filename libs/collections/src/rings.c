@@ -55,6 +55,7 @@ RingBufferDef* RINGS_createRingBuffer(uint16_t size, uint8_t overflowPolitics, u
  */
 void RINGS_Free(RingBufferDef* rbd) {
 	pfree(rbd->buffer);
+	pfree(rbd);
 }
 
 /**
@@ -212,7 +213,9 @@ char* RINGS_readStringInRange(uint16_t start, uint16_t lenght, RingBufferDef* rb
  * @return количество байт
  */
 uint16_t RINGS_dataLenght(RingBufferDef* rbd) {
-	return rbd->writer - rbd->reader;
+	if (rbd->writer >= rbd->reader)
+		return rbd->writer - rbd->reader;
+	return rbd->size - rbd->reader + rbd->writer;
 }
 
 /**
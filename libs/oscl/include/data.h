@@ -10,7 +10,13 @@
 #include <string.h>
 #include "../include/malloc.h"
 
+/** Max count of chars in the decimal representation of uint32_t */
+#define U32_MAX_DIGITS 10
+
 char* itoa2(int num);
 char* strcpy2(char* str);
+uint8_t u32toa(uint32_t value, char *buf);
+char* u32toaEnd(uint32_t value, char *end);
+const char* atou32(const char *str, const char *end, uint32_t *value);
 
 #endif //MNVP_DRIVER_DATA_H
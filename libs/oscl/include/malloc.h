@@ -8,6 +8,7 @@
 #define ACTORS_MALLOC_H
 
 void *pmalloc (size_t __size);
+void *prealloc(void *__ptr, size_t __size);
 void pfree(void* __prt);
 
 #endif //ACTORS_MALLOC_H
@@ -7,14 +7,55 @@
 
 #include <pthread.h>
 #include <stdint.h>
+#include <stdbool.h>
+
+/** Max count of distinct mutex names, which contention is measured */
+#define MUTEX_STATS_MAX 64
+
+/** Initializer of the static mutex with the name */
+#define MUTEX_INITIALIZER(name) {PTHREAD_MUTEX_INITIALIZER, name, NULL, 0}
 
 typedef pthread_t thread_t;
-typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+
+/** Contention of the mutexes with the same name, times are in nanos. Updated only while profiling is enabled */
+typedef struct MutexStats {
+    const char *name;
+    uint64_t acquired;
+    /** Acquisitions that found mutex locked by another thread */
+    uint64_t contended;
+    uint64_t waitNanos;
+    uint64_t maxWaitNanos;
+    uint64_t holdNanos;
+    uint64_t maxHoldNanos;
+} MutexStats;
+
+/** Mutex with optional name. Acquisitions of the named mutex are measured while profiling is enabled */
+typedef struct Mutex {
+    pthread_mutex_t mutex;
+    const char *name;
+    /** Stats of the name, bound on the first measured acquisition */
+    MutexStats *stats;
+    /** Time of the measured acquisition, changed only by the owner */
+    uint64_t lockedAt;
+} mutex_t;
 
 thread_t NewThread(void (*run)(void *), void *args, uint16_t stackSize, char *name, uint64_t priority);
-mutex_t* NewMutex();
+void ThreadJoin(thread_t thread);
+void ThreadDetach(thread_t thread);
+bool ThreadPin(thread_t thread, const char *cpus);
+mutex_t* NewMutex(const char *name);
+void DelMutex(mutex_t *mutex);
 void MutexLock(mutex_t *mutex);
 int MutexTryLock(mutex_t *mutex);
 void MutexUnlock(mutex_t *mutex);
+void MutexProfile(bool enabled);
+uint32_t MutexStatsSnapshot(MutexStats *stats, uint32_t max);
+cond_t* NewCond();
+void DelCond(cond_t *cond);
+void CondWait(cond_t *cond, mutex_t *mutex);
+bool CondTimedWait(cond_t *cond, mutex_t *mutex, uint64_t millis);
+void CondSignal(cond_t *cond);
+void CondBroadcast(cond_t *cond);
 
 #endif //ACTORS_THREADS_H
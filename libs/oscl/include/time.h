@@ -1,10 +1,32 @@
 #include <time.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #ifndef ACTORS_TIME_H
 #define ACTORS_TIME_H
 
+#define NANOS_IN_MILLI 1000000ULL
+#define NANOS_IN_SECOND 1000000000ULL
+
+/** Stopwatch for the interval measurements. Lap is measured from the previous lap or from the start */
+typedef struct Stopwatch {
+    uint64_t start;
+    uint64_t lap;
+} stopwatch_t;
+
 uint64_t SystemTime();
+uint64_t MonotonicNanos();
+uint64_t MonotonicMillis();
+uint64_t FastMonotonicNanos();
+uint64_t CoarseMonotonicMillis();
+uint64_t RealTimeMillis();
+uint64_t CoarseRealTimeSeconds();
+bool CalibrateTsc();
+void NanosToTimespec(uint64_t nanos, struct timespec *ts);
+void SleepUntilNanos(uint64_t deadline);
 void DelayMillis(uint64_t millis);
+void StopwatchStart(stopwatch_t *sw);
+uint64_t StopwatchElapsedNanos(stopwatch_t *sw);
+uint64_t StopwatchLapNanos(stopwatch_t *sw);
 
 #endif //ACTORS_TIME_H
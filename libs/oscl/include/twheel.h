@@ -0,0 +1,48 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef ACTORS_TWHEEL_H
+#define ACTORS_TWHEEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "threads.h"
+
+/** Bits of the slot index on the one wheel level */
+#define TWHEEL_LEVEL_BITS 6
+#define TWHEEL_LEVEL_SLOTS (1 << TWHEEL_LEVEL_BITS)
+#define TWHEEL_LEVELS 4
+
+/** Timer that may be scheduled on the wheel. It is embedded to the object owned by caller, so wheel itself never
+ *  allocates memory */
+typedef struct WheelTimer {
+    struct WheelTimer *next;
+    struct WheelTimer *prev;
+    uint64_t expires;
+    void (*callback)(void*);
+    void *arg;
+    int8_t level;
+    uint8_t slot;
+    bool pending;
+} wtimer_t;
+
+typedef struct TimerWheel {
+    wtimer_t *slots[TWHEEL_LEVELS][TWHEEL_LEVEL_SLOTS];
+    uint64_t bitmap[TWHEEL_LEVELS];
+    uint64_t current;
+    uint64_t armed;
+    uint32_t count;
+    uint32_t tickMillis;
+    int timerfd;
+    mutex_t *mutex;
+    thread_t thread;
+} twheel_t;
+
+twheel_t* NewTimerWheel(uint32_t tickMillis);
+void WheelTimerInit(wtimer_t *timer, void (*callback)(void*), void *arg);
+void TimerSchedule(twheel_t *wheel, wtimer_t *timer, uint64_t delayMillis);
+bool TimerCancel(twheel_t *wheel, wtimer_t *timer);
+uint32_t TimerWheelCount(twheel_t *wheel);
+
+#endif //ACTORS_TWHEEL_H
@@ -0,0 +1,46 @@
+//
+// Created by serbis on 19.10.26.
+//
+
+#ifndef ACTORS_WAIT_H
+#define ACTORS_WAIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** Round counts of the predefined strategies */
+#define WAIT_HYBRID_SPINS 200
+#define WAIT_HYBRID_YIELDS 20
+#define WAIT_SPIN_SPINS 20000
+#define WAIT_SPIN_YIELDS 2000
+
+/** Deadline value of the park without time limit */
+#define WAIT_FOREVER UINT64_MAX
+
+/** Strategy of the thread that waits for some condition. It checks the condition with the CPU pause between checks
+ *  'spins' times, then it yields the CPU between checks 'yields' times, then it parks on the futex or the condition
+ *  variable. More rounds give lower wakeup latency for more CPU time burned while idle, zero rounds park at once */
+typedef struct WaitStrategy {
+    uint32_t spins;
+    uint32_t yields;
+} wait_t;
+
+/** Futex event count. Waiter registers itself before the last check of it's condition and parks while the counter
+ *  keeps the value seen before that check, so the wakeup made between the check and the park is not lost. Waker
+ *  makes syscall only if somebody is parked. Zeroed struct is ready to use */
+typedef struct Parker {
+    uint32_t seq;
+    uint32_t parked;
+} parker_t;
+
+void WaitPause();
+bool WaitStep(const wait_t *wait, uint32_t *round);
+bool WaitParse(const char *name, wait_t *wait);
+void WaitSetDefault(const wait_t *wait);
+const wait_t* WaitDefault();
+uint32_t ParkerPrepare(parker_t *parker);
+void ParkerCancel(parker_t *parker);
+bool ParkerPark(parker_t *parker, uint32_t seen, uint64_t deadline);
+void ParkerUnpark(parker_t *parker);
+
+#endif //ACTORS_WAIT_H
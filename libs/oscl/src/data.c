@@ -1,14 +1,32 @@
 #include "../include/data.h"
 
+/** Decimal representations of all two digits numbers. Conversion takes two digits per step, so it needs half of the
+ *  divisions of the digit by digit conversion */
+static const char digitPairs[201] =
+        "00010203040506070809"
+        "10111213141516171819"
+        "20212223242526272829"
+        "30313233343536373839"
+        "40414243444546474849"
+        "50515253545556575859"
+        "60616263646566676869"
+        "70717273747576777879"
+        "80818283848586878889"
+        "90919293949596979899";
+
 char* itoa2(int num) {
-    char *buf = pmalloc(50);
-    sprintf(buf, "%d", num);
-    uint8_t len = (uint8_t) (strlen(buf) + 1);
-    char *split = pmalloc(len);
-    memcpy(split, buf, len);
-    pfree(buf);
-
-    return split;
+    char digits[U32_MAX_DIGITS + 1];
+    char *end = digits + sizeof(digits);
+    char *start = u32toaEnd(num < 0 ? 0 - (uint32_t) num : (uint32_t) num, end);
+    if (num < 0)
+        *--start = '-';
+
+    size_t len = end - start;
+    char *str = pmalloc(len + 1);
+    memcpy(str, start, len);
+    str[len] = 0;
+
+    return str;
 }
 
 char* strcpy2(char* str) {
@@ -17,4 +35,55 @@ char* strcpy2(char* str) {
     memcpy(dup_str, str, strsize);
 
     return dup_str;
-}
\ No newline at end of file
+}
+
+/** Write decimal representation of the value right aligned to the end pointer. Zero char is not written. Return
+ *  pointer to the first written char */
+char* u32toaEnd(uint32_t value, char *end) {
+    char *p = end;
+    while (value >= 100) {
+        uint32_t pair = (value % 100) * 2;
+        value /= 100;
+        *--p = digitPairs[pair + 1];
+        *--p = digitPairs[pair];
+    }
+    if (value >= 10) {
+        *--p = digitPairs[value * 2 + 1];
+        *--p = digitPairs[value * 2];
+    } else {
+        *--p = (char) ('0' + value);
+    }
+
+    return p;
+}
+
+/** Write decimal representation of the value to the buffer, which must have at least U32_MAX_DIGITS chars. Zero char
+ *  is not written. Return count of written chars */
+uint8_t u32toa(uint32_t value, char *buf) {
+    char digits[U32_MAX_DIGITS];
+    char *start = u32toaEnd(value, digits + U32_MAX_DIGITS);
+    uint8_t len = (uint8_t) (digits + U32_MAX_DIGITS - start);
+    memcpy(buf, start, len);
+
+    return len;
+}
+
+/** Parse decimal number from the chars in range [str, end). Parsing stops at the first non digit char. If end is NULL,
+ *  string must be zero terminated. Return pointer to the char after the last digit, or NULL if there are no digits or
+ *  value overflows uint32_t */
+const char* atou32(const char *str, const char *end, uint32_t *value) {
+    const char *p = str;
+    uint64_t result = 0;
+    while ((end == NULL || p < end) && *p >= '0' && *p <= '9') {
+        result = result * 10 + (*p - '0');
+        if (result > UINT32_MAX)
+            return NULL;
+        p++;
+    }
+    if (p == str)
+        return NULL;
+
+    *value = (uint32_t) result;
+
+    return p;
+}
@@ -5,6 +5,10 @@ void *pmalloc (size_t __size) {
     return malloc(__size);
 }
 
+void *prealloc(void *__ptr, size_t __size) {
+    return realloc(__ptr, __size);
+}
+
 void pfree(void *__ptr) {
     free(__ptr);
 }
@@ -1,37 +1,272 @@
+#define _GNU_SOURCE
 #include <stdint.h>
+#include <stdlib.h>
 #include <malloc.h>
+#include <time.h>
+#include <sched.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
 #include "../include/threads.h"
 #include "../include/malloc.h"
+#include "../include/time.h"
 
-
+/** Create thread. Stack size is in kilobytes, zero means the default (8 MB by the rlimit), value below the
+ *  PTHREAD_STACK_MIN is raised to it. Name is set to the thread (truncated to 15 chars) and freed. Nonzero priority is
+ *  the SCHED_RR priority, if process is not permitted to use it, thread is created with the inherited scheduling.
+ *  Thread is joinable, it must be joined or detached by caller. Return 0 if thread can't be created */
 thread_t NewThread(void (*run)(void *), void *args, uint16_t stackSize, char *name, uint64_t priority) {
-    if (name != NULL)
-        pfree(name);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (stackSize > 0) {
+        size_t size = (size_t) stackSize * 1024;
+        pthread_attr_setstacksize(&attr, size < PTHREAD_STACK_MIN ? PTHREAD_STACK_MIN : size);
+    }
+    if (priority > 0) {
+        struct sched_param param;
+        int max = sched_get_priority_max(SCHED_RR);
+        param.sched_priority = priority > (uint64_t) max ? max : (int) priority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_RR);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
     pthread_t thread;
-    int createerror = pthread_create(&thread, NULL, (void*) run, args);
-    if (!createerror) {
-        //pthread_join(thread, NULL);
-        return thread;
-    } else {
-        return NULL;
+    int createerror = pthread_create(&thread, &attr, (void*) run, args);
+    if (createerror == EPERM && priority > 0) {
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        createerror = pthread_create(&thread, &attr, (void*) run, args);
+    }
+    pthread_attr_destroy(&attr);
+
+    if (name != NULL) {
+        if (!createerror) {
+            char shortName[16];
+            strncpy(shortName, name, sizeof(shortName) - 1);
+            shortName[sizeof(shortName) - 1] = 0;
+            pthread_setname_np(thread, shortName);
+        }
+        pfree(name);
     }
+
+    return createerror ? 0 : thread;
+}
+
+/** Wait for thread termination and free it's resources */
+void ThreadJoin(thread_t thread) {
+    pthread_join(thread, NULL);
 }
 
-mutex_t* NewMutex() {
-    pthread_mutex_t *mutex = malloc(sizeof(pthread_mutex_t));
-    pthread_mutex_init(mutex, NULL);
+/** Let thread resources be freed by itself when it terminates */
+void ThreadDetach(thread_t thread) {
+    pthread_detach(thread);
+}
+
+/** Bind thread to the CPUs, given as list of numbers and ranges, like '0-3,6'. Return false if list is malformed or
+ *  affinity can't be set */
+bool ThreadPin(thread_t thread, const char *cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    const char *p = cpus;
+    while (*p != 0) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0)
+            return false;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+                return false;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, &set);
+        if (*end == ',')
+            end++;
+        else if (*end != 0)
+            return false;
+        p = end;
+    }
+
+    return CPU_COUNT(&set) > 0 && pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+/** Acquisitions of the named mutexes are measured */
+static bool profiling = false;
+/** Stats of the mutex names. Entries are only appended, the last one collects the names that did not fit */
+static MutexStats mutexStats[MUTEX_STATS_MAX];
+static uint32_t mutexStatsCount = 0;
+static pthread_mutex_t mutexStatsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Internal function. Return stats of the mutex name, binding them to the mutex on the first call */
+static MutexStats* MutexBind(mutex_t *mutex) {
+    MutexStats *stats = __atomic_load_n(&mutex->stats, __ATOMIC_ACQUIRE);
+    if (stats != NULL)
+        return stats;
+
+    pthread_mutex_lock(&mutexStatsLock);
+    for (uint32_t i = 0; i < mutexStatsCount && stats == NULL; i++) {
+        if (strcmp(mutexStats[i].name, mutex->name) == 0)
+            stats = &mutexStats[i];
+    }
+    if (stats == NULL && mutexStatsCount < MUTEX_STATS_MAX) {
+        stats = &mutexStats[mutexStatsCount];
+        memset(stats, 0, sizeof(MutexStats));
+        stats->name = mutexStatsCount < MUTEX_STATS_MAX - 1 ? mutex->name : "other";
+        __atomic_store_n(&mutexStatsCount, mutexStatsCount + 1, __ATOMIC_RELEASE);
+    } else if (stats == NULL) {
+        stats = &mutexStats[MUTEX_STATS_MAX - 1];
+    }
+    pthread_mutex_unlock(&mutexStatsLock);
+    __atomic_store_n(&mutex->stats, stats, __ATOMIC_RELEASE);
+
+    return stats;
+}
+
+/** Internal function. Raise the max counter to the value */
+static void MutexStatsMax(uint64_t *max, uint64_t value) {
+    uint64_t current = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (value > current && !__atomic_compare_exchange_n(max, &current, value, true, __ATOMIC_RELAXED,
+                                                           __ATOMIC_RELAXED));
+}
+
+/** Internal function. Start the hold time of the mutex just acquired by the caller */
+static void MutexAcquired(mutex_t *mutex, MutexStats *stats, uint64_t now) {
+    __atomic_fetch_add(&stats->acquired, 1, __ATOMIC_RELAXED);
+    mutex->lockedAt = now;
+}
+
+/** Internal function. Account the hold time of the mutex that caller is going to release */
+static void MutexReleased(mutex_t *mutex) {
+    if (mutex->lockedAt == 0)
+        return;
+    uint64_t hold = FastMonotonicNanos() - mutex->lockedAt;
+    mutex->lockedAt = 0;
+    __atomic_fetch_add(&mutex->stats->holdNanos, hold, __ATOMIC_RELAXED);
+    MutexStatsMax(&mutex->stats->maxHoldNanos, hold);
+}
+
+/** Create mutex. Acquisitions of the mutex with not NULL name are measured while profiling is enabled, mutexes with the
+ *  same name share the stats. Name must live while the mutex is used */
+mutex_t* NewMutex(const char *name) {
+    mutex_t *mutex = malloc(sizeof(mutex_t));
+    pthread_mutex_init(&mutex->mutex, NULL);
+    mutex->name = name;
+    mutex->stats = NULL;
+    mutex->lockedAt = 0;
 
     return mutex;
 }
 
+void DelMutex(mutex_t *mutex) {
+    pthread_mutex_destroy(&mutex->mutex);
+    free(mutex);
+}
+
+/** Acquire mutex. Contended acquisition of the measured mutex counts the time spent to wait for it */
 void MutexLock(mutex_t *mutex) {
-    pthread_mutex_lock(mutex);
+    if (mutex->name == NULL || !__atomic_load_n(&profiling, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&mutex->mutex);
+        return;
+    }
+
+    MutexStats *stats = MutexBind(mutex);
+    if (pthread_mutex_trylock(&mutex->mutex) == 0) {
+        MutexAcquired(mutex, stats, FastMonotonicNanos());
+        return;
+    }
+    uint64_t start = FastMonotonicNanos();
+    pthread_mutex_lock(&mutex->mutex);
+    uint64_t now = FastMonotonicNanos();
+    __atomic_fetch_add(&stats->contended, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->waitNanos, now - start, __ATOMIC_RELAXED);
+    MutexStatsMax(&stats->maxWaitNanos, now - start);
+    MutexAcquired(mutex, stats, now);
 }
 
+/** Acquire mutex if it is free. Return 0 on success or the error of pthread_mutex_trylock */
 int MutexTryLock(mutex_t *mutex) {
-    pthread_mutex_trylock(mutex);
+    int r = pthread_mutex_trylock(&mutex->mutex);
+    if (r == 0 && mutex->name != NULL && __atomic_load_n(&profiling, __ATOMIC_RELAXED))
+        MutexAcquired(mutex, MutexBind(mutex), FastMonotonicNanos());
+
+    return r;
 }
 
 void MutexUnlock(mutex_t *mutex) {
-    pthread_mutex_unlock(mutex);
+    MutexReleased(mutex);
+    pthread_mutex_unlock(&mutex->mutex);
+}
+
+/** Enable or disable measurement of the named mutexes */
+void MutexProfile(bool enabled) {
+    __atomic_store_n(&profiling, enabled, __ATOMIC_RELAXED);
+}
+
+/** Copy stats of the measured mutex names to the array, not more than max. Return count of copied entries */
+uint32_t MutexStatsSnapshot(MutexStats *stats, uint32_t max) {
+    uint32_t count = __atomic_load_n(&mutexStatsCount, __ATOMIC_ACQUIRE);
+    if (count > max)
+        count = max;
+    for (uint32_t i = 0; i < count; i++) {
+        stats[i].name = mutexStats[i].name;
+        stats[i].acquired = __atomic_load_n(&mutexStats[i].acquired, __ATOMIC_RELAXED);
+        stats[i].contended = __atomic_load_n(&mutexStats[i].contended, __ATOMIC_RELAXED);
+        stats[i].waitNanos = __atomic_load_n(&mutexStats[i].waitNanos, __ATOMIC_RELAXED);
+        stats[i].maxWaitNanos = __atomic_load_n(&mutexStats[i].maxWaitNanos, __ATOMIC_RELAXED);
+        stats[i].holdNanos = __atomic_load_n(&mutexStats[i].holdNanos, __ATOMIC_RELAXED);
+        stats[i].maxHoldNanos = __atomic_load_n(&mutexStats[i].maxHoldNanos, __ATOMIC_RELAXED);
+    }
+
+    return count;
+}
+
+/** Create condition variable. It's timed waits are measured by the monotonic clock, so they are not affected by
+ *  wall clock changes */
+cond_t* NewCond() {
+    pthread_cond_t *cond = malloc(sizeof(pthread_cond_t));
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    return cond;
+}
+
+void DelCond(cond_t *cond) {
+    pthread_cond_destroy(cond);
+    free(cond);
+}
+
+/** Wait for condition. Time of the wait is not counted as the hold time of the measured mutex */
+void CondWait(cond_t *cond, mutex_t *mutex) {
+    bool measured = mutex->lockedAt != 0;
+    MutexReleased(mutex);
+    pthread_cond_wait(cond, &mutex->mutex);
+    if (measured)
+        mutex->lockedAt = FastMonotonicNanos();
+}
+
+/** Wait for condition not longer than specified count of millis. Return false if timeout was expired */
+bool CondTimedWait(cond_t *cond, mutex_t *mutex, uint64_t millis) {
+    struct timespec ts;
+    NanosToTimespec(MonotonicNanos() + millis * NANOS_IN_MILLI, &ts);
+
+    bool measured = mutex->lockedAt != 0;
+    MutexReleased(mutex);
+    bool signaled = pthread_cond_timedwait(cond, &mutex->mutex, &ts) == 0;
+    if (measured)
+        mutex->lockedAt = FastMonotonicNanos();
+
+    return signaled;
+}
+
+void CondSignal(cond_t *cond) {
+    pthread_cond_signal(cond);
+}
+
+void CondBroadcast(cond_t *cond) {
+    pthread_cond_broadcast(cond);
 }
\ No newline at end of file
@@ -1,12 +1,134 @@
-#include <unistd.h>
+#include <errno.h>
 #include "../include/time.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define TIME_HAS_TSC 1
+#endif
 
-//Return current system time in millis
+/** Time stamp counter conversion. Nanos are counted from the calibration point, with the nanos per tick as 32.32
+ *  fixed point number */
+static volatile bool tscEnabled = false;
+static uint64_t tscBase = 0;
+static uint64_t tscNanosBase = 0;
+static uint64_t tscMult = 0;
+
+/** Time of the TSC calibration */
+#define TIME_TSC_CALIBRATION_MILLIS 50
+
+//Return current wall clock time in millis since epoch
 uint64_t SystemTime() {
-    return (uint64_t) time(NULL) * 1000;
+    return RealTimeMillis();
+}
+
+//Return monotonic time in nanos. It is not affected by wall clock changes, so it must be used for intervals and it is
+//the clock of the absolute sleeps and timed waits
+uint64_t MonotonicNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NANOS_IN_SECOND + ts.tv_nsec;
+}
+
+//Return monotonic time in millis
+uint64_t MonotonicMillis() {
+    return MonotonicNanos() / NANOS_IN_MILLI;
+}
+
+//Return monotonic time in nanos read from the TSC if it was calibrated, or from the CLOCK_MONOTONIC. It may drift from
+//the CLOCK_MONOTONIC by the calibration error, so it is used only for the intervals measurement
+uint64_t FastMonotonicNanos() {
+#ifdef TIME_HAS_TSC
+    if (__atomic_load_n(&tscEnabled, __ATOMIC_ACQUIRE))
+        return tscNanosBase + (uint64_t) (((unsigned __int128) (__rdtsc() - tscBase) * tscMult) >> 32);
+#endif
+    return MonotonicNanos();
+}
+
+//Return monotonic time in millis with the resolution of the scheduler tick. It is cheaper than the precise one
+uint64_t CoarseMonotonicMillis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / NANOS_IN_MILLI;
+}
+
+//Return wall clock time in millis since epoch
+uint64_t RealTimeMillis() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / NANOS_IN_MILLI;
+}
+
+//Return wall clock time in seconds since epoch with the resolution of the scheduler tick, for the log timestamps
+uint64_t CoarseRealTimeSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (uint64_t) ts.tv_sec;
+}
+
+//Calibrate TSC against the CLOCK_MONOTONIC, so FastMonotonicNanos reads it without syscall. It blocks for the
+//calibration time. Return false if CPU has no invariant TSC, then CLOCK_MONOTONIC stays in use
+bool CalibrateTsc() {
+#ifdef TIME_HAS_TSC
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
+        return false;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    if ((edx & (1 << 8)) == 0)
+        return false;
+
+    uint64_t nanos0 = MonotonicNanos();
+    uint64_t ticks0 = __rdtsc();
+    SleepUntilNanos(nanos0 + TIME_TSC_CALIBRATION_MILLIS * NANOS_IN_MILLI);
+    uint64_t nanos1 = MonotonicNanos();
+    uint64_t ticks1 = __rdtsc();
+    if (ticks1 <= ticks0)
+        return false;
+
+    tscMult = (uint64_t) ((((unsigned __int128) (nanos1 - nanos0)) << 32) / (ticks1 - ticks0));
+    tscBase = ticks1;
+    tscNanosBase = nanos1;
+    __atomic_store_n(&tscEnabled, true, __ATOMIC_RELEASE);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+//Convert nanos of the clock to the timespec
+void NanosToTimespec(uint64_t nanos, struct timespec *ts) {
+    ts->tv_sec = (time_t) (nanos / NANOS_IN_SECOND);
+    ts->tv_nsec = (long) (nanos % NANOS_IN_SECOND);
+}
+
+//Sleep until the absolute MonotonicNanos time. Signals don't shorten the sleep and periodic sleeps don't drift
+void SleepUntilNanos(uint64_t deadline) {
+    struct timespec ts;
+    NanosToTimespec(deadline, &ts);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
 }
 
 //Delay current thread for some millis
 void DelayMillis(uint64_t millis) {
-    usleep((__useconds_t) (millis * 1000));
-}
\ No newline at end of file
+    SleepUntilNanos(MonotonicNanos() + millis * NANOS_IN_MILLI);
+}
+
+//Start the stopwatch
+void StopwatchStart(stopwatch_t *sw) {
+    sw->start = FastMonotonicNanos();
+    sw->lap = sw->start;
+}
+
+//Return nanos since the stopwatch start
+uint64_t StopwatchElapsedNanos(stopwatch_t *sw) {
+    return FastMonotonicNanos() - sw->start;
+}
+
+//Return nanos since the previous lap and start the next one
+uint64_t StopwatchLapNanos(stopwatch_t *sw) {
+    uint64_t now = FastMonotonicNanos();
+    uint64_t lap = now - sw->lap;
+    sw->lap = now;
+
+    return lap;
+}
@@ -0,0 +1,249 @@
+/** Hierarchical timer wheel. Each of TWHEEL_LEVELS levels has TWHEEL_LEVEL_SLOTS slots, slot of the level L covers
+ *  SLOTS^L ticks. Timer is placed to the lowest level that can hold it and is moved to the lower level (cascaded) when
+ *  the wheel reaches it's slot, so schedule and cancel are O(1). The wheel is driven by one thread that sleeps on the
+ *  timerfd armed to the absolute CLOCK_MONOTONIC time of the nearest slot with timers, so the idle wheel does not
+ *  tick at all. Callbacks are called by the wheel thread without the wheel lock, so they may schedule new timers, but
+ *  must not block for a long time */
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include "../include/twheel.h"
+#include "../include/malloc.h"
+#include "../include/time.h"
+
+#define TWHEEL_MASK (TWHEEL_LEVEL_SLOTS - 1)
+
+/** Internal function. Return current monotonic time in wheel ticks */
+static uint64_t nowTicks(twheel_t *wheel) {
+    return MonotonicMillis() / wheel->tickMillis;
+}
+
+/** Internal function. Place timer to the slot according to it's expiration tick relative to the base tick */
+static void insert(twheel_t *wheel, wtimer_t *timer, uint64_t base) {
+    uint64_t expires = timer->expires;
+    int level = 0;
+    uint64_t index = expires;
+
+    if (expires - base >= TWHEEL_LEVEL_SLOTS) {
+        for (level = 1; level < TWHEEL_LEVELS; level++) {
+            uint32_t shift = level * TWHEEL_LEVEL_BITS;
+            if ((expires >> shift) - (base >> shift) < TWHEEL_LEVEL_SLOTS)
+                break;
+        }
+        if (level == TWHEEL_LEVELS) {
+            //Too far timer is parked in the last slot of the top level and placed again when this slot is cascaded
+            level = TWHEEL_LEVELS - 1;
+            index = (base >> (level * TWHEEL_LEVEL_BITS)) + TWHEEL_LEVEL_SLOTS - 1;
+        } else {
+            index = expires >> (level * TWHEEL_LEVEL_BITS);
+        }
+    }
+
+    uint8_t slot = (uint8_t) (index & TWHEEL_MASK);
+    wtimer_t *head = wheel->slots[level][slot];
+    timer->level = (int8_t) level;
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = head;
+    if (head != NULL)
+        head->prev = timer;
+    wheel->slots[level][slot] = timer;
+    wheel->bitmap[level] |= 1ULL << slot;
+}
+
+/** Internal function. Remove timer from it's slot */
+static void unlinkTimer(twheel_t *wheel, wtimer_t *timer) {
+    if (timer->prev != NULL)
+        timer->prev->next = timer->next;
+    else
+        wheel->slots[timer->level][timer->slot] = timer->next;
+    if (timer->next != NULL)
+        timer->next->prev = timer->prev;
+    if (wheel->slots[timer->level][timer->slot] == NULL)
+        wheel->bitmap[timer->level] &= ~(1ULL << timer->slot);
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+/** Internal function. Move timers of the higher levels slots that starts at this tick to the lower levels */
+static void cascade(twheel_t *wheel, uint64_t tick) {
+    for (int level = TWHEEL_LEVELS - 1; level >= 1; level--) {
+        uint32_t shift = level * TWHEEL_LEVEL_BITS;
+        if ((tick & ((1ULL << shift) - 1)) != 0)
+            continue;
+
+        uint8_t slot = (uint8_t) ((tick >> shift) & TWHEEL_MASK);
+        wtimer_t *timer = wheel->slots[level][slot];
+        wheel->slots[level][slot] = NULL;
+        wheel->bitmap[level] &= ~(1ULL << slot);
+        while (timer != NULL) {
+            wtimer_t *next = timer->next;
+            insert(wheel, timer, tick);
+            timer = next;
+        }
+    }
+}
+
+/** Internal function. Move wheel to the specified tick and prepend all expired timers to the list */
+static void advance(twheel_t *wheel, uint64_t now, wtimer_t **expired) {
+    while (wheel->current < now) {
+        if (wheel->count == 0) {
+            wheel->current = now;
+            break;
+        }
+
+        uint64_t tick = wheel->current + 1;
+        uint8_t index = (uint8_t) (tick & TWHEEL_MASK);
+        if (index == 0)
+            cascade(wheel, tick);
+
+        wtimer_t *timer = wheel->slots[0][index];
+        wheel->slots[0][index] = NULL;
+        wheel->bitmap[0] &= ~(1ULL << index);
+        while (timer != NULL) {
+            wtimer_t *next = timer->next;
+            timer->pending = false;
+            timer->prev = NULL;
+            timer->next = *expired;
+            *expired = timer;
+            wheel->count--;
+            timer = next;
+        }
+        wheel->current = tick;
+
+        //Skip empty slots up to the next timer or to the end of the level 0 round, where cascade must be done
+        uint64_t rest = index == TWHEEL_MASK ? 0 : wheel->bitmap[0] >> (index + 1);
+        uint64_t skipTo = rest == 0 ? (tick | TWHEEL_MASK) : tick + __builtin_ctzll(rest);
+        wheel->current = skipTo < now ? skipTo : now;
+    }
+}
+
+/** Internal function. Arm timerfd to the nearest tick that has something to do, or disarm it if wheel is empty */
+static void arm(twheel_t *wheel) {
+    uint64_t next = 0;
+    if (wheel->count > 0) {
+        uint8_t index = (uint8_t) (wheel->current & TWHEEL_MASK);
+        uint64_t rest = index == TWHEEL_MASK ? 0 : wheel->bitmap[0] >> (index + 1);
+        next = rest == 0 ? (wheel->current | TWHEEL_MASK) + 1 : wheel->current + __builtin_ctzll(rest) + 1;
+    }
+
+    if (next == wheel->armed)
+        return;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (next != 0) {
+        uint64_t millis = next * wheel->tickMillis;
+        its.it_value.tv_sec = millis / 1000;
+        its.it_value.tv_nsec = (millis % 1000) * 1000000;
+    }
+    timerfd_settime(wheel->timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    wheel->armed = next;
+}
+
+/** Wheel thread function */
+static void TimerWheel_run(void *args) {
+    twheel_t *wheel = (twheel_t*) args;
+
+    while (1) {
+        uint64_t expirations;
+        if (read(wheel->timerfd, &expirations, sizeof(expirations)) < 0 && errno != EINTR && errno != EAGAIN)
+            break;
+
+        wtimer_t *expired = NULL;
+        MutexLock(wheel->mutex);
+        wheel->armed = 0;
+        advance(wheel, nowTicks(wheel), &expired);
+        arm(wheel);
+        MutexUnlock(wheel->mutex);
+
+        while (expired != NULL) {
+            wtimer_t *next = expired->next;
+            expired->next = NULL;
+            expired->callback(expired->arg);
+            expired = next;
+        }
+    }
+}
+
+/** Create timer wheel with specified tick duration and start it's thread. Return NULL if timerfd can't be created */
+twheel_t* NewTimerWheel(uint32_t tickMillis) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    twheel_t *wheel = pmalloc(sizeof(twheel_t));
+    memset(wheel, 0, sizeof(twheel_t));
+    wheel->tickMillis = tickMillis > 0 ? tickMillis : 1;
+    wheel->timerfd = fd;
+    wheel->current = nowTicks(wheel);
+    wheel->mutex = NewMutex("twheel");
+    wheel->thread = NewThread(TimerWheel_run, wheel, 0, NULL, 0);
+
+    return wheel;
+}
+
+/** Prepare timer for scheduling. Callback will be called with specified arg from the wheel thread */
+void WheelTimerInit(wtimer_t *timer, void (*callback)(void*), void *arg) {
+    memset(timer, 0, sizeof(wtimer_t));
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+/** Schedule timer to fire after specified count of millis. If timer is already pending, it is rescheduled */
+void TimerSchedule(twheel_t *wheel, wtimer_t *timer, uint64_t delayMillis) {
+    MutexLock(wheel->mutex);
+
+    if (timer->pending) {
+        unlinkTimer(wheel, timer);
+        wheel->count--;
+    }
+
+    uint64_t now = nowTicks(wheel);
+    if (wheel->count == 0 && now > wheel->current)
+        wheel->current = now;
+
+    uint64_t expires = now + (delayMillis + wheel->tickMillis - 1) / wheel->tickMillis;
+    if (expires <= wheel->current)
+        expires = wheel->current + 1;
+
+    timer->expires = expires;
+    insert(wheel, timer, wheel->current);
+    timer->pending = true;
+    wheel->count++;
+    arm(wheel);
+
+    MutexUnlock(wheel->mutex);
+}
+
+/** Cancel pending timer. Return false if timer is not pending, that is it's callback is already called or is being
+ *  called now */
+bool TimerCancel(twheel_t *wheel, wtimer_t *timer) {
+    MutexLock(wheel->mutex);
+
+    if (!timer->pending) {
+        MutexUnlock(wheel->mutex);
+        return false;
+    }
+
+    unlinkTimer(wheel, timer);
+    timer->pending = false;
+    wheel->count--;
+    arm(wheel);
+
+    MutexUnlock(wheel->mutex);
+
+    return true;
+}
+
+/** Return count of pending timers */
+uint32_t TimerWheelCount(twheel_t *wheel) {
+    MutexLock(wheel->mutex);
+    uint32_t count = wheel->count;
+    MutexUnlock(wheel->mutex);
+
+    return count;
+}
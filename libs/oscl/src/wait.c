@@ -0,0 +1,109 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "../include/wait.h"
+#include "../include/time.h"
+
+/** Strategy of the process waits. It is set once at start, before threads wait by it */
+static wait_t defaultWait = {0, 0};
+
+//Hint CPU that the thread spins, so it does not starve the sibling hyper thread and leaves the loop faster
+void WaitPause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#else
+    __asm__ __volatile__("" ::: "memory");
+#endif
+}
+
+//Make next round of the busy wait, the CPU pause or the yield, depending on the round number counted from zero. Return
+//false when rounds of the strategy are over and the thread must park
+bool WaitStep(const wait_t *wait, uint32_t *round) {
+    if (*round < wait->spins) {
+        WaitPause();
+    } else if (*round - wait->spins < wait->yields) {
+        sched_yield();
+    } else {
+        return false;
+    }
+    (*round)++;
+
+    return true;
+}
+
+//Fill strategy by name, 'park', 'hybrid' or 'spin'. Return false if name is unknown
+bool WaitParse(const char *name, wait_t *wait) {
+    if (strcmp(name, "park") == 0) {
+        wait->spins = 0;
+        wait->yields = 0;
+    } else if (strcmp(name, "hybrid") == 0) {
+        wait->spins = WAIT_HYBRID_SPINS;
+        wait->yields = WAIT_HYBRID_YIELDS;
+    } else if (strcmp(name, "spin") == 0) {
+        wait->spins = WAIT_SPIN_SPINS;
+        wait->yields = WAIT_SPIN_YIELDS;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+//Set strategy of the process waits
+void WaitSetDefault(const wait_t *wait) {
+    defaultWait = *wait;
+}
+
+//Return strategy of the process waits, by default threads park at once
+const wait_t* WaitDefault() {
+    return &defaultWait;
+}
+
+//Register waiter and return counter value, that must be passed to the park. Condition is checked after this call
+uint32_t ParkerPrepare(parker_t *parker) {
+    __atomic_add_fetch(&parker->parked, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    return __atomic_load_n(&parker->seq, __ATOMIC_ACQUIRE);
+}
+
+//Unregister waiter that found it's condition true after the prepare
+void ParkerCancel(parker_t *parker) {
+    __atomic_sub_fetch(&parker->parked, 1, __ATOMIC_RELAXED);
+}
+
+//Sleep while counter keeps the seen value, but not after the MonotonicNanos deadline, and unregister waiter. Return
+//false if the deadline has passed
+bool ParkerPark(parker_t *parker, uint32_t seen, uint64_t deadline) {
+    bool inTime = true;
+    if (deadline == WAIT_FOREVER) {
+        syscall(SYS_futex, &parker->seq, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+    } else {
+        uint64_t now = MonotonicNanos();
+        if (now < deadline) {
+            struct timespec ts;
+            NanosToTimespec(deadline - now, &ts);
+            syscall(SYS_futex, &parker->seq, FUTEX_WAIT_PRIVATE, seen, &ts, NULL, 0);
+        } else {
+            inTime = false;
+        }
+    }
+    __atomic_sub_fetch(&parker->parked, 1, __ATOMIC_RELAXED);
+
+    return inTime;
+}
+
+//Wake all parked waiters. Must be called after the condition was changed
+void ParkerUnpark(parker_t *parker) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&parker->parked, __ATOMIC_RELAXED) == 0)
+        return;
+
+    __atomic_add_fetch(&parker->seq, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &parker->seq, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+}
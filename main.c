@@ -14,6 +14,7 @@
  *
  *  */
 
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <stdio.h>
@@ -25,67 +26,225 @@
 #include <pthread.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <stdint.h>
+#include <poll.h>
 #include "inc/client_thread.h"
 #include "inc/logger.h"
+#include "inc/cmd_processor.h"
+#include "inc/connection.h"
+#include "inc/clients.h"
+#include "inc/config.h"
+#include "inc/io_engine.h"
+#include "inc/stats.h"
+#include "inc/upgrade.h"
+#include "inc/systemd.h"
+#include "inc/thread_pool.h"
+#include "inc/capture.h"
 #include "libs/oscl/include/data.h"
+#include "libs/oscl/include/threads.h"
+#include "libs/oscl/include/time.h"
+#include "libs/oscl/include/wait.h"
 
 // ================================ GLOBAL VARIABLES ====================================
 
 char *pid_path = "/var/run/nsd.pid";
 
-/** Start domain server. This server listen for incoming bind request. After accept a connection, it create
- *  new client thread with client socket id, and try to accept a new connections */
-void startServer() {
-    int server_sockfd, client_sockfd;
-    int server_len, client_len;
+/** Create listening domain socket of specified type. Socket activated by systemd on the same path is taken as is.
+ *  Return socket or -1 if it can't be created */
+int openListener(const char *socket_path, int type) {
     struct sockaddr_un server_address;
-    struct sockaddr_un client_address;
-    char *socket_path = "/tmp/nsd.socket";
+
+    int activated_sockfd = Systemd_listener(socket_path, type == SOCK_SEQPACKET);
+    if (activated_sockfd != -1)
+        return activated_sockfd;
 
     unlink(socket_path);
-    server_sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    int server_sockfd = socket(AF_UNIX, type, 0);
+    if (server_sockfd == -1)
+        return -1;
 
     server_address.sun_family = AF_UNIX;
-    strcpy(server_address.sun_path, socket_path);
-    server_len = sizeof(server_address);
-    bind(server_sockfd, (struct sockaddr *)&server_address, server_len);
+    strncpy(server_address.sun_path, socket_path, sizeof(server_address.sun_path) - 1);
+    server_address.sun_path[sizeof(server_address.sun_path) - 1] = 0;
+    if (bind(server_sockfd, (struct sockaddr *)&server_address, sizeof(server_address)) != 0
+        || listen(server_sockfd, 5) != 0) {
+        close(server_sockfd);
+        return -1;
+    }
 
-    listen(server_sockfd, 5);
+    return server_sockfd;
+}
 
-    Logger_info("Server", "Server listen '%s'", socket_path);
+/** Accept connections of the listener and create client thread for each one. Return when listener was passed to
+ *  the new daemon process by the upgrade */
+void acceptLoop(IoEngine_Listener *listener) {
+    int client_sockfd;
+    socklen_t client_len;
+    struct sockaddr_un client_address;
+
+    Logger_info("Server", "Server listen '%s'", listener->path);
+    Upgrade_acceptStarted();
     while(1) {
         client_len = sizeof(client_address);
-        client_sockfd = accept(server_sockfd, (struct sockaddr *) &client_address, &client_len);
-
+        client_sockfd = accept(listener->sockfd, (struct sockaddr *) &client_address, &client_len);
+        Stats_inc(STATS_IO_SYSCALLS);
+
+        //Listener is nonblocking if the other daemon process of the upgrade serves it by the epoll
+        if (client_sockfd == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd ready = {listener->sockfd, POLLIN, 0};
+            if (poll(&ready, 1, -1) >= 0)
+                continue;
+        }
         if (client_sockfd == -1) {
-            Logger_fatal("Server", "Unable to open socket '%s'", socket_path);
+            if (errno == EINTR) {
+                if (Upgrade_handingOff())
+                    break;
+                continue;
+            }
+            Logger_fatal("Server", "Unable to open socket '%s'", listener->path);
+            exit(-1);
+        }
+        Connection *conn = Connection_accepted(client_sockfd, listener->seqpacket);
+        ThreadPool_run(ClientThread_run, conn);
+    }
+    Upgrade_acceptStopped();
+}
+
+/** Thread function of the additional listener */
+void listenerThread(void *args) {
+    acceptLoop((IoEngine_Listener*) args);
+}
+
+/** Start domain server. This server listen for incoming bind request. After accept a connection, it create
+ *  new client thread with client socket id, and try to accept a new connections. If 'listen.seqpacket' is configured,
+ *  the SOCK_SEQPACKET listener is started side by side with the stream one. It receives one packet by each message,
+ *  packets are parsed and executed by the same code. With 'io.engine' set to 'epoll' or 'uring' all listeners and
+ *  connections are served by the one event loop instead of the threads. Daemon started by the upgrade serves
+ *  listeners passed by the running one instead of creating them, and takes connections that it passes then. Listeners
+ *  bound by the systemd socket activation are taken instead of creating too. Readiness is reported to systemd when
+ *  listeners are ready */
+void startServer(IoEngine_Listener *inherited, int inheritedCount) {
+    char *socket_path = "/tmp/nsd.socket";
+    //Listeners are referred by the listener threads and by the upgrade until the process exits
+    static IoEngine_Listener listeners[UPGRADE_MAX_LISTENERS];
+    int count = 0;
+
+    //Client may close socket while responses for it are written, this must not terminate the daemon
+    signal(SIGPIPE, SIG_IGN);
+
+    //Strategy must be set before any thread waits by it
+    wait_t wait;
+    const char *strategy = Config_getString("wait.strategy", "park");
+    if (!WaitParse(strategy, &wait)) {
+        Logger_info("Server", "Unknown wait strategy '%s', threads park at once", strategy);
+        WaitParse("park", &wait);
+    }
+    wait.spins = (uint32_t) Config_getInt("wait.spins", wait.spins);
+    wait.yields = (uint32_t) Config_getInt("wait.yields", wait.yields);
+    WaitSetDefault(&wait);
+
+    //Enabled before the workers start, so the queues and registries are measured from the first request
+    if (Config_getInt("mutex.profile", 0) != 0) {
+        MutexProfile(true);
+        Logger_info("Server", "Contention of the named mutexes is measured");
+    }
+
+    if (!CmdProcessor_init() || !Clients_init() || !ThreadPool_init(CmdProcessor_timers()) || !Capture_init())
+        exit(-1);
+
+    //Timestamps of the packets are taken for each request, TSC reads them without the vDSO call
+    if (Config_getInt("clock.tsc", 0) != 0) {
+        if (CalibrateTsc())
+            Logger_info("Server", "Timestamps are read from the calibrated TSC");
+        else
+            Logger_info("Server", "CPU has no invariant TSC, timestamps are read from CLOCK_MONOTONIC");
+    }
+
+    if (inherited != NULL) {
+        memcpy(listeners, inherited, inheritedCount * sizeof(IoEngine_Listener));
+        count = inheritedCount;
+    } else {
+        const char *seqpacket_path = Config_getString("listen.seqpacket", NULL);
+        if (seqpacket_path != NULL && seqpacket_path[0] != 0) {
+            int seqpacket_sockfd = openListener(seqpacket_path, SOCK_SEQPACKET);
+            if (seqpacket_sockfd == -1) {
+                Logger_fatal("Server", "Unable to listen '%s' (%s)", seqpacket_path, strerror(errno));
+                exit(-1);
+            }
+            listeners[count++] = (IoEngine_Listener) {seqpacket_sockfd, seqpacket_path, true};
+        }
+
+        int server_sockfd = openListener(socket_path, SOCK_STREAM);
+        if (server_sockfd == -1) {
+            Logger_fatal("Server", "Unable to listen '%s' (%s)", socket_path, strerror(errno));
             exit(-1);
         }
-        pthread_t thread;
-        int *sockfd = (int*) malloc(4);
-        *sockfd = client_sockfd;
-        pthread_create(&thread, NULL, (void *) ClientThread_run, sockfd);
+        listeners[count++] = (IoEngine_Listener) {server_sockfd, socket_path, false};
+    }
+
+    uint8_t engine = IoEngine_select();
+    const char *upgrade_path = Config_getString("upgrade.socket", UPGRADE_DEFAULT_SOCKET);
+    if (upgrade_path[0] != 0) {
+        //Socket gives away the listeners, so only root may connect to it
+        int upgrade_sockfd = openListener(upgrade_path, SOCK_SEQPACKET);
+        if (upgrade_sockfd == -1 || chmod(upgrade_path, 0600) != 0)
+            Logger_fatal("Server", "Unable to listen '%s' (%s), daemon can't be upgraded", upgrade_path,
+                         strerror(errno));
+        else
+            Upgrade_listen(upgrade_sockfd, listeners, count, engine != IO_ENGINE_URING);
     }
+    if (inherited != NULL)
+        Upgrade_adopt(engine);
+    Systemd_closeUntaken();
+
+    //Listeners accept from now, so dependent services may be started. Daemon started by the upgrade becomes the main
+    //process of the service before it's accepting thread sends READY, so the old process exits only after that
+    char ready[48];
+    snprintf(ready, sizeof(ready), "READY=1\nMAINPID=%d", getpid());
+    Systemd_notify(ready);
+
+    if (engine != IO_ENGINE_THREADS)
+        IoEngine_run(engine, listeners, count);
+
+    for (int i = 0; i < count - 1; i++)
+        ThreadDetach(NewThread(listenerThread, &listeners[i], 0, NULL, 0));
+    acceptLoop(&listeners[count - 1]);
+    //Listeners were passed to the new process, this one exits when connections are drained
+    pthread_exit(NULL);
 }
 
 /** Daemon signal handler. This handler handle only one signal SIGUSR1. This signal sent by daemon launcher from
  *  stop logic branch. After receive this signal daemon will terminates */
 void signalHandler(int sig) {
     if (sig == SIGUSR1) {
+        Capture_stop();
         exit(0);
     }
 }
 
-/** Start new daemon instance. It fork the program process and write it pid to the nsd.pid file. Child process
- *  run new domain socket server. */
-int start() {
-    //check pid file existing
-    if (access(pid_path, 0) == 0)  {
-        Logger_fatal("DaemonRunner/start", "Daemon already started");
+/** Write pid of the daemon process to the nsd.pid file. Return false if it can't be written */
+bool writePid(int pid) {
+    int pidf = open(pid_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
 
-        return -1;
+    if (pidf == -1) {
+        Logger_fatal("DaemonRunner/start", "Unable to create pid file");
+
+        return false;
     }
 
+    char *pstr = itoa2(pid);
+    bool written = write(pidf, pstr, strlen(pstr)) > 0;
+    if (!written)
+        Logger_fatal("DaemonRunner/start", "Unable to write pid file");
+    free(pstr);
+    close(pidf);
+
+    return written;
+}
+
+/** Fork the program process and write child pid to the nsd.pid file. Child process run new domain socket server, on
+ *  the inherited listeners if they are given */
+int spawn(IoEngine_Listener *inherited, int inheritedCount) {
     int pid = fork();
 
     if (pid == -1) { // если не удалось запустить потомка
@@ -97,30 +256,71 @@ int start() {
         setsid();
 
         signal(SIGUSR1, signalHandler);
-        startServer();
+        startServer(inherited, inheritedCount);
 
         return 0;
     } else { // если это родитель
-        int pidf = open(pid_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (!writePid(pid))
+            return -1;
 
-        if (pidf == -1) {
-            Logger_fatal("DaemonRunner/start", "Unable to create pid file");
+        Logger_info("DaemonRunner/start", "Daemon has been successfully started with pid '%d'", pid);
 
-            return -1;
-        }
+        return 0;
+    }
+}
 
-        char *pstr = itoa2(pid);
-        if (write(pidf, pstr, strlen(pstr)) <= 0) {
-            Logger_fatal("DaemonRunner/start", "Unable to write pid file");
+/** Start new daemon instance. It fork the program process and write it pid to the nsd.pid file. Child process
+ *  run new domain socket server. */
+int start() {
+    //check pid file existing
+    if (access(pid_path, 0) == 0)  {
+        Logger_fatal("DaemonRunner/start", "Daemon already started");
 
-            return -1;
-        }
-        free(pstr);
+        return -1;
+    }
 
-        Logger_info("DaemonRunner/start", "Daemon has been successfully started with pid '%d'", pid);
+    return spawn(NULL, 0);
+}
 
-        return 0;
+/** Run daemon in the foreground, as the main process of the systemd service with Type=notify. Pid file is written,
+ *  so the daemon is stopped and upgraded by the same actions */
+int run() {
+    if (access(pid_path, 0) == 0)  {
+        Logger_fatal("DaemonRunner/run", "Daemon already started");
+
+        return -1;
+    }
+    if (!writePid(getpid()))
+        return -1;
+
+    umask(0);
+    signal(SIGUSR1, signalHandler);
+    startServer(NULL, 0);
+
+    return 0;
+}
+
+/** Replace the running daemon by the new instance without closing of the sockets. Listeners are taken from the running
+ *  instance before the fork, so it keeps serving if they can't be taken. Running instance passes idle connections to
+ *  the new one, drains the rest and exits by itself */
+int upgrade() {
+    if (access(pid_path, 0) != 0)  {
+        Logger_fatal("DaemonRunner/upgrade", "Daemon does not started");
+
+        return -1;
+    }
+
+    IoEngine_Listener listeners[UPGRADE_MAX_LISTENERS];
+    bool adopt = Config_getInt("upgrade.connections", 1) != 0;
+    int count = Upgrade_connect(listeners, adopt);
+    if (count < 0) {
+        Logger_fatal("DaemonRunner/upgrade", "Unable to upgrade daemon");
+
+        return -1;
     }
+    remove(pid_path);
+
+    return spawn(listeners, count);
 }
 
 /** Stop current daemon instance. It is send SIGUSR1 to the daemon process with pid from nsd.pid file and remove thi
@@ -213,6 +413,10 @@ int daemonRun(int argc, char* argv[]) {
         return stop();
     } else if(strcmp(argv[1], "restart") == 0) {
         return restart();
+    } else if(strcmp(argv[1], "run") == 0) {
+        return run();
+    } else if(strcmp(argv[1], "upgrade") == 0) {
+        return upgrade();
     } else if(strcmp(argv[1], "status") == 0) {
         return status();
     } else {
@@ -225,7 +429,7 @@ int daemonRun(int argc, char* argv[]) {
 /** This function used to start program in the developing mode. In this mode, fork does not take place, and execution
  *  immediately begins from startServer function */
 int devRun(int argc, char* argv[]) {
-    startServer();
+    startServer(NULL, 0);
 
     return 0;
 }
@@ -237,5 +441,10 @@ int main(int argc, char* argv[]) {
         exit(1);
     }
 
+    char *config_path = getenv("NSD_CONFIG");
+    Config_load(config_path != NULL ? config_path : CONFIG_DEFAULT_PATH);
+    //Activated sockets are addressed to this process, so they are taken before any fork
+    Systemd_init();
+
     return daemonRun(argc, argv);
 }
\ No newline at end of file
@@ -0,0 +1,316 @@
+/** Per command resource accounting. While 'account.cpu' is set, command processor samples the CPU time of it's thread
+ *  (CLOCK_THREAD_CPUTIME_ID) and the wall time around each handler, with 'account.rusage' also context switches and
+ *  page faults of the thread (getrusage RUSAGE_THREAD). Usage is aggregated per command name and per client uid and is
+ *  reported by the 'account' OTPP command. Each 'account.interval' seconds commands and uids that consumed most CPU
+ *  since the previous summary are logged by one line. Latency alone does not show whether command burns CPU or waits,
+ *  CPU time against wall time does */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "../inc/accounting.h"
+#include "../inc/config.h"
+#include "../inc/logger.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/threads.h"
+#include "../libs/oscl/include/time.h"
+
+typedef struct Accounting_Command {
+    const char *name;
+    Accounting_Usage usage;
+} Accounting_Command;
+
+typedef struct Accounting_Uid {
+    uid_t uid;
+    Accounting_Usage usage;
+} Accounting_Uid;
+
+static bool enabled = false;
+static bool rusage = false;
+
+/** Commands are found by the name pointer, entries are only appended and published by the count */
+static Accounting_Command commands[ACCOUNTING_MAX_COMMANDS];
+static uint32_t commandsCount = 0;
+
+/** Uids are found by the scan too, daemon serves few of them. First entry is the uid -1, that takes uids above the
+ *  limit */
+static Accounting_Uid uids[ACCOUNTING_MAX_UIDS];
+static uint32_t uidsCount = 0;
+
+/** Serializes appending of the entries */
+static mutex_t *entriesMutex = NULL;
+
+static twheel_t *summaryWheel = NULL;
+static wtimer_t summaryTimer;
+static uint64_t summaryInterval = ACCOUNTING_DEFAULT_INTERVAL;
+
+static void Accounting_summary(void *arg);
+
+/** Read configuration and start the summary timer on the wheel. Accounting is disabled unless 'account.cpu' is set */
+bool Accounting_init(twheel_t *wheel) {
+    enabled = Config_getInt("account.cpu", 0) != 0;
+    rusage = Config_getInt("account.rusage", 0) != 0;
+    if (!enabled)
+        return true;
+
+    entriesMutex = NewMutex("accounting");
+    uids[0].uid = (uid_t) -1;
+    uidsCount = 1;
+
+    int64_t interval = Config_getInt("account.interval", ACCOUNTING_DEFAULT_INTERVAL);
+    if (interval > 0) {
+        summaryWheel = wheel;
+        summaryInterval = (uint64_t) interval;
+        WheelTimerInit(&summaryTimer, Accounting_summary, NULL);
+        TimerSchedule(summaryWheel, &summaryTimer, summaryInterval * 1000);
+    }
+    Logger_info("Accounting", "CPU time of the command handlers is accounted%s",
+                rusage ? " with context switches and page faults" : "");
+
+    return true;
+}
+
+bool Accounting_enabled() {
+    return enabled;
+}
+
+/** Internal function. Return CPU time consumed by the calling thread */
+static uint64_t Accounting_threadCpu() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return (uint64_t) ts.tv_sec * NANOS_IN_SECOND + ts.tv_nsec;
+}
+
+/** Take counters of the calling thread before the handler */
+void Accounting_begin(Accounting_Mark *mark) {
+    if (rusage) {
+        struct rusage ru;
+        getrusage(RUSAGE_THREAD, &ru);
+        mark->voluntarySwitches = ru.ru_nvcsw;
+        mark->involuntarySwitches = ru.ru_nivcsw;
+        mark->minorFaults = ru.ru_minflt;
+        mark->majorFaults = ru.ru_majflt;
+    }
+    mark->wall = FastMonotonicNanos();
+    mark->cpu = Accounting_threadCpu();
+}
+
+/** Internal function. Add one handler execution to the usage */
+static void Accounting_add(Accounting_Usage *usage, uint64_t cpu, uint64_t wall, const Accounting_Mark *delta) {
+    __atomic_fetch_add(&usage->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&usage->cpuNanos, cpu, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&usage->wallNanos, wall, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&usage->maxCpuNanos, __ATOMIC_RELAXED);
+    while (cpu > max && !__atomic_compare_exchange_n(&usage->maxCpuNanos, &max, cpu, true, __ATOMIC_RELAXED,
+                                                     __ATOMIC_RELAXED));
+
+    uint64_t micros = cpu / 1000;
+    uint32_t bucket = micros == 0 ? 0 : 64 - __builtin_clzll(micros);
+    if (bucket >= ACCOUNTING_BUCKETS)
+        bucket = ACCOUNTING_BUCKETS - 1;
+    __atomic_fetch_add(&usage->buckets[bucket], 1, __ATOMIC_RELAXED);
+
+    if (rusage) {
+        __atomic_fetch_add(&usage->voluntarySwitches, (uint64_t) delta->voluntarySwitches, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&usage->involuntarySwitches, (uint64_t) delta->involuntarySwitches, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&usage->minorFaults, (uint64_t) delta->minorFaults, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&usage->majorFaults, (uint64_t) delta->majorFaults, __ATOMIC_RELAXED);
+    }
+}
+
+/** Internal function. Return usage of the command name, appending it on the first call. Names are compared by pointer,
+ *  they are the names of the commands table */
+static Accounting_Usage* Accounting_command(const char *name) {
+    uint32_t count = __atomic_load_n(&commandsCount, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++) {
+        if (commands[i].name == name)
+            return &commands[i].usage;
+    }
+
+    Accounting_Usage *usage = NULL;
+    MutexLock(entriesMutex);
+    for (uint32_t i = 0; i < commandsCount && usage == NULL; i++) {
+        if (commands[i].name == name)
+            usage = &commands[i].usage;
+    }
+    if (usage == NULL && commandsCount < ACCOUNTING_MAX_COMMANDS) {
+        commands[commandsCount].name = name;
+        usage = &commands[commandsCount].usage;
+        __atomic_store_n(&commandsCount, commandsCount + 1, __ATOMIC_RELEASE);
+    }
+    MutexUnlock(entriesMutex);
+
+    return usage;
+}
+
+/** Internal function. Return usage of the uid, appending it on the first call. Published entries are scanned without
+ *  lock, so the mutex is taken only by the first call of the uid */
+static Accounting_Usage* Accounting_uid(uid_t uid) {
+    uint32_t count = __atomic_load_n(&uidsCount, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++) {
+        if (uids[i].uid == uid)
+            return &uids[i].usage;
+    }
+
+    uint32_t entry = 0;
+    MutexLock(entriesMutex);
+    for (uint32_t i = 1; i < uidsCount && entry == 0; i++) {
+        if (uids[i].uid == uid)
+            entry = i;
+    }
+    if (entry == 0 && uid != (uid_t) -1 && uidsCount < ACCOUNTING_MAX_UIDS) {
+        entry = uidsCount;
+        uids[entry].uid = uid;
+        __atomic_store_n(&uidsCount, uidsCount + 1, __ATOMIC_RELEASE);
+    }
+    MutexUnlock(entriesMutex);
+
+    return &uids[entry].usage;
+}
+
+/** Account handler of the command executed for the uid since the mark was taken by the same thread */
+void Accounting_end(Accounting_Mark *mark, const char *command, uid_t uid) {
+    uint64_t cpu = Accounting_threadCpu() - mark->cpu;
+    uint64_t wall = FastMonotonicNanos() - mark->wall;
+    Accounting_Mark delta = {0};
+    if (rusage) {
+        struct rusage ru;
+        getrusage(RUSAGE_THREAD, &ru);
+        delta.voluntarySwitches = ru.ru_nvcsw - mark->voluntarySwitches;
+        delta.involuntarySwitches = ru.ru_nivcsw - mark->involuntarySwitches;
+        delta.minorFaults = ru.ru_minflt - mark->minorFaults;
+        delta.majorFaults = ru.ru_majflt - mark->majorFaults;
+    }
+
+    Accounting_Usage *usage = Accounting_command(command);
+    if (usage != NULL)
+        Accounting_add(usage, cpu, wall, &delta);
+    Accounting_add(Accounting_uid(uid), cpu, wall, &delta);
+}
+
+/** Internal function. Return upper bound of the CPU time in micros below which the part of the handlers took. Bound
+ *  is the power of two, but not above the max */
+static uint64_t Accounting_percentile(const Accounting_Usage *usage, uint64_t calls, double part) {
+    uint64_t max = __atomic_load_n(&usage->maxCpuNanos, __ATOMIC_RELAXED) / 1000;
+    uint64_t need = (uint64_t) (calls * part);
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < ACCOUNTING_BUCKETS - 1; i++) {
+        seen += __atomic_load_n(&usage->buckets[i], __ATOMIC_RELAXED);
+        if (seen > need)
+            return (1ULL << i) < max ? 1ULL << i : max;
+    }
+
+    return max;
+}
+
+/** Internal function. Append usage counters with the prefix to the buffer. Return count of written chars */
+static int Accounting_formatUsage(char *buf, const char *prefix, const Accounting_Usage *usage) {
+    uint64_t calls = __atomic_load_n(&usage->calls, __ATOMIC_RELAXED);
+    int len = sprintf(buf, " %s.calls=%llu %s.cpu_us=%llu %s.cpu_p50_us=%llu %s.cpu_p99_us=%llu %s.cpu_max_us=%llu"
+                           " %s.wall_us=%llu", prefix, (unsigned long long) calls, prefix,
+                      (unsigned long long) (__atomic_load_n(&usage->cpuNanos, __ATOMIC_RELAXED) / 1000), prefix,
+                      (unsigned long long) Accounting_percentile(usage, calls, 0.5), prefix,
+                      (unsigned long long) Accounting_percentile(usage, calls, 0.99), prefix,
+                      (unsigned long long) (__atomic_load_n(&usage->maxCpuNanos, __ATOMIC_RELAXED) / 1000), prefix,
+                      (unsigned long long) (__atomic_load_n(&usage->wallNanos, __ATOMIC_RELAXED) / 1000));
+    if (rusage) {
+        len += sprintf(buf + len, " %s.nvcsw=%llu %s.nivcsw=%llu %s.minflt=%llu %s.majflt=%llu", prefix,
+                       (unsigned long long) __atomic_load_n(&usage->voluntarySwitches, __ATOMIC_RELAXED), prefix,
+                       (unsigned long long) __atomic_load_n(&usage->involuntarySwitches, __ATOMIC_RELAXED), prefix,
+                       (unsigned long long) __atomic_load_n(&usage->minorFaults, __ATOMIC_RELAXED), prefix,
+                       (unsigned long long) __atomic_load_n(&usage->majorFaults, __ATOMIC_RELAXED));
+    }
+
+    return len;
+}
+
+/** Return usage of the commands and uids that have executed handlers, as string in form 'cmd.<name>.<counter>=value
+ *  ... uid.<uid>.<counter>=value ...'. Counters are calls, cpu_us, cpu_p50_us, cpu_p99_us, cpu_max_us, wall_us and
+ *  with 'account.rusage' nvcsw, nivcsw, minflt and majflt. Percentiles are the power of two bounds. Result must be
+ *  freed by caller, it is empty if accounting is disabled */
+char* Accounting_format() {
+    uint32_t commandCount = enabled ? __atomic_load_n(&commandsCount, __ATOMIC_ACQUIRE) : 0;
+    uint32_t uidCount = enabled ? __atomic_load_n(&uidsCount, __ATOMIC_ACQUIRE) : 0;
+    //Each counter takes the prefix, it's name and the value
+    size_t entrySize = 10 * (ACCOUNTING_NAME_MAX + 40);
+    char *buf = pmalloc((commandCount + uidCount) * entrySize + 1);
+    size_t pos = 0;
+    buf[0] = 0;
+
+    char prefix[ACCOUNTING_NAME_MAX];
+    for (uint32_t i = 0; i < commandCount; i++) {
+        if (__atomic_load_n(&commands[i].usage.calls, __ATOMIC_RELAXED) == 0)
+            continue;
+        snprintf(prefix, sizeof(prefix), "cmd.%s", commands[i].name);
+        pos += Accounting_formatUsage(buf + pos, prefix, &commands[i].usage);
+    }
+    for (uint32_t i = 0; i < uidCount; i++) {
+        if (__atomic_load_n(&uids[i].usage.calls, __ATOMIC_RELAXED) == 0)
+            continue;
+        snprintf(prefix, sizeof(prefix), "uid.%d", (int) uids[i].uid);
+        pos += Accounting_formatUsage(buf + pos, prefix, &uids[i].usage);
+    }
+    //Counters are separated by spaces, so the first one drops it's separator
+    if (pos > 0)
+        memmove(buf, buf + 1, pos);
+
+    return buf;
+}
+
+/** Internal function. Return CPU time consumed by the usage since the previous summary and remember it */
+static uint64_t Accounting_report(Accounting_Usage *usage) {
+    uint64_t cpu = __atomic_load_n(&usage->cpuNanos, __ATOMIC_RELAXED);
+    uint64_t delta = cpu - usage->reportedCpuNanos;
+    usage->reportedCpuNanos = cpu;
+
+    return delta;
+}
+
+/** Internal function. Insert entry to the list of the top CPU consumers, sorted by the CPU time descending */
+static void Accounting_top(uint64_t *cpus, uint32_t *entries, uint32_t *count, uint64_t cpu, uint32_t entry) {
+    if (cpu == 0 || (*count == ACCOUNTING_SUMMARY_TOP && cpu <= cpus[*count - 1]))
+        return;
+    uint32_t i = *count < ACCOUNTING_SUMMARY_TOP ? (*count)++ : *count - 1;
+    while (i > 0 && cpus[i - 1] < cpu) {
+        cpus[i] = cpus[i - 1];
+        entries[i] = entries[i - 1];
+        i--;
+    }
+    cpus[i] = cpu;
+    entries[i] = entry;
+}
+
+/** Internal function. Log commands and uids that consumed most CPU since the previous summary. Called by the wheel
+ *  thread, that is the only one who touches the reported values */
+static void Accounting_summary(void *arg) {
+    uint64_t commandCpus[ACCOUNTING_SUMMARY_TOP];
+    uint32_t commandEntries[ACCOUNTING_SUMMARY_TOP];
+    uint32_t commandTop = 0;
+    uint32_t commandCount = __atomic_load_n(&commandsCount, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < commandCount; i++)
+        Accounting_top(commandCpus, commandEntries, &commandTop, Accounting_report(&commands[i].usage), i);
+
+    uint64_t uidCpus[ACCOUNTING_SUMMARY_TOP];
+    uint32_t uidEntries[ACCOUNTING_SUMMARY_TOP];
+    uint32_t uidTop = 0;
+    uint32_t uidCount = __atomic_load_n(&uidsCount, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < uidCount; i++)
+        Accounting_top(uidCpus, uidEntries, &uidTop, Accounting_report(&uids[i].usage), i);
+
+    if (commandTop > 0) {
+        char line[ACCOUNTING_SUMMARY_TOP * 2 * (ACCOUNTING_NAME_MAX + 24) + 32];
+        int len = sprintf(line, "commands");
+        for (uint32_t i = 0; i < commandTop; i++)
+            len += sprintf(line + len, " %.*s %.3f ms", ACCOUNTING_NAME_MAX, commands[commandEntries[i]].name,
+                           commandCpus[i] / 1e6);
+        len += sprintf(line + len, ", uids");
+        for (uint32_t i = 0; i < uidTop; i++)
+            len += sprintf(line + len, " %d %.3f ms", (int) uids[uidEntries[i]].uid, uidCpus[i] / 1e6);
+        Logger_info("Accounting", "CPU of the last %llu s: %s", (unsigned long long) summaryInterval, line);
+    }
+
+    TimerSchedule(summaryWheel, &summaryTimer, summaryInterval * 1000);
+}
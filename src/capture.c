@@ -0,0 +1,157 @@
+/** Traffic capture. When 'capture.path' is set, each packet received by the daemon is written to the capture file with
+ *  the id of it's connection and the time of it's reception, so the load may be replayed later by the nsd-replay.
+ *  Readers copy packets to the records and pass them through the lock free queue to the writer thread, that collects
+ *  them to the big blocks and writes them to the file. Readers never wait for the writer, when the queue is full the
+ *  packet is not captured and 'capture.dropped' counter is increased, as well as for the packets whose write was failed.
+ *  Daemon stops the capture before it exits, so the writer writes all queued packets */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../inc/capture.h"
+#include "../inc/config.h"
+#include "../inc/logger.h"
+#include "../inc/stats.h"
+#include "../libs/collections/include/mpmc.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/threads.h"
+#include "../libs/oscl/include/time.h"
+
+static int fd = -1;
+static MpmcQueue *records = NULL;
+/** Monotonic time of the capture start, record times are counted from it */
+static uint64_t started = 0;
+/** Capture is requested to stop, writer reports that queued records are written */
+static volatile bool stopping = false;
+static volatile bool stopped = false;
+
+/** Internal function. Write whole block to the capture file. Return false if write was failed */
+static bool Capture_write(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t r = write(fd, data, len);
+        Stats_inc(STATS_IO_SYSCALLS);
+        if (r < 0)
+            return false;
+        data += r;
+        len -= r;
+    }
+
+    return true;
+}
+
+/** Internal function. Write collected records. Records of the failed write are counted as dropped */
+static void Capture_flush(const char *buf, size_t len, uint32_t count) {
+    if (len > 0 && !Capture_write(buf, len)) {
+        Stats_add(STATS_CAPTURE_DROPPED, count);
+        Logger_info("Capture", "Unable to write %u packets to the capture file", count);
+    }
+}
+
+/** Internal function. Writer thread. It collects records to the buffer and writes it when it is full or when no
+ *  packets were received for the flush timeout, so the file lags behind the traffic for a short time only. When the
+ *  capture is stopped, it writes the rest of the queue and exits */
+static void Capture_run(void *args) {
+    char *buf = pmalloc(CAPTURE_WRITE_BUF);
+    size_t len = 0;
+    uint32_t count = 0;
+    while (1) {
+        char *record = stopping ? MPMC_dequeue(records) : MPMC_take(records, CAPTURE_FLUSH_TIMEOUT);
+        if (record == NULL) {
+            Capture_flush(buf, len, count);
+            len = 0;
+            count = 0;
+            if (stopping)
+                break;
+            continue;
+        }
+
+        size_t size = sizeof(Capture_Record) + ((Capture_Record*) record)->len;
+        if (len + size > CAPTURE_WRITE_BUF) {
+            Capture_flush(buf, len, count);
+            len = 0;
+            count = 0;
+        }
+        if (size > CAPTURE_WRITE_BUF) {
+            Capture_flush(record, size, 1);
+        } else {
+            memcpy(buf + len, record, size);
+            len += size;
+            count++;
+        }
+        pfree(record);
+    }
+    pfree(buf);
+    stopped = true;
+}
+
+/** Read configuration, open the capture file and start the writer. Capture is disabled unless 'capture.path' is set.
+ *  Return false if the file can't be opened */
+bool Capture_init() {
+    const char *path = Config_getString("capture.path", NULL);
+    if (path == NULL || *path == 0)
+        return true;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        Logger_fatal("Capture", "Unable to open capture file '%s'", path);
+        return false;
+    }
+    Capture_FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN);
+    header.version = CAPTURE_VERSION;
+    header.started = RealTimeMillis();
+    if (!Capture_write((const char*) &header, sizeof(header))) {
+        Logger_fatal("Capture", "Unable to write capture file '%s'", path);
+        close(fd);
+        fd = -1;
+        return false;
+    }
+
+    int64_t capacity = Config_getInt("capture.queue", CAPTURE_DEFAULT_QUEUE);
+    records = MPMC_new(capacity > 0 ? (uint32_t) capacity : CAPTURE_DEFAULT_QUEUE);
+    started = FastMonotonicNanos();
+    ThreadDetach(NewThread(Capture_run, NULL, 0, NULL, 0));
+    Logger_info("Capture", "Received packets are captured to '%s'", path);
+
+    return true;
+}
+
+bool Capture_enabled() {
+    return records != NULL;
+}
+
+/** Stop the capture before the daemon exits. Writer writes packets that are still queued, caller waits for it not
+ *  longer than CAPTURE_STOP_TIMEOUT. Packets captured after the stop are not written. It only waits by sleeps, so may
+ *  be called from the signal handler */
+void Capture_stop() {
+    if (records == NULL || stopping)
+        return;
+
+    stopping = true;
+    uint64_t deadline = MonotonicNanos() + CAPTURE_STOP_TIMEOUT * NANOS_IN_MILLI;
+    while (!stopped && MonotonicNanos() < deadline)
+        SleepUntilNanos(MonotonicNanos() + CAPTURE_STOP_POLL * NANOS_IN_MILLI);
+}
+
+/** Capture packet of the frame received by the connection. Must be called by the reader before the packet is executed,
+ *  because execution splits the packet in place */
+void Capture_frame(Connection *conn, Frame *frame) {
+    char *record = pmalloc(sizeof(Capture_Record) + frame->len);
+    Capture_Record *header = (Capture_Record*) record;
+    header->time = frame->arrival > started ? frame->arrival - started : 0;
+    header->conn = conn->id;
+    header->len = frame->len;
+    header->msgId = frame->msgId;
+    header->flags = frame->flags;
+    header->type = frame->type;
+    header->mode = frame->mode;
+    memcpy(record + sizeof(Capture_Record), frame->data, frame->len);
+
+    if (MPMC_tryPut(records, record)) {
+        Stats_inc(STATS_CAPTURE_FRAMES);
+    } else {
+        Stats_inc(STATS_CAPTURE_DROPPED);
+        pfree(record);
+    }
+}
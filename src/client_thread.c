@@ -1,53 +1,365 @@
 /** Thread that's read data from the socket. Its task is to build packets from the incoming byte stream and place them
- *  in a queue of received packets. */
+ *  in a queue of received packets. Connections of the seqpacket listener receive whole packet by each message, so
+ *  they are read by recvmmsg without any reassembly. While the daemon is upgraded, reading is interrupted by signal,
+ *  and the connection that waits for the next packet is passed to the new daemon process */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
 #include "../inc/client_thread.h"
 #include "../libs/collections/include/rings.h"
-#include "../libs/collections/include/lbq.h"
+#include "../libs/collections/include/mlq.h"
 #include "../inc/logger.h"
 #include "../inc/cmd_processor.h"
 #include "../libs/oscl/include/time.h"
+#include "../inc/stats.h"
+#include "../inc/frame.h"
+#include "../inc/otpp.h"
+#include "../inc/io_engine.h"
+#include "../inc/upgrade.h"
+#include "../inc/thread_pool.h"
+#include "../inc/capture.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/data.h"
 
+/** Capacity of the connection command queue, shared by all lanes. When it is reached, socket reading is suspended */
+#define CLIENT_THREAD_QUEUE_CAPACITY 100
 
-void ClientThread_run(void *args) {
-    bool clientThread_alive = true;
-    int sockfd = *(int*) args;
-    Logger_info("ClientThread", "Client thread for sockdf '%d' was started", sockfd);
-    LinkedBlockingQueue *cmdQueue = new_LQB(50); //Free in cmd_processor
-    RingBufferDef *inBuf  = RINGS_createRingBuffer(500, RINGS_OVERFLOW_SHIFT, true);
-    CmdProcessor_Args *cpa = malloc(sizeof(CmdProcessor_Args));  //Free in cmd_processor
-    cpa->cmdQueue = cmdQueue;
-    cpa->sockfd = sockfd;
-    cpa->alive = true;
-    thread_t cmdp_t = NewThread(CmdProcessor_run, cpa, 0, NULL, 0);
+/** Places of the queue capacity left for the control commands, so they are read and queued while the normal and bulk
+ *  ones fill the rest */
+#define CLIENT_THREAD_CONTROL_RESERVE 10
+
+/** How many times lower priority lane may be passed over before it is served out of turn */
+#define CLIENT_THREAD_STARVATION_LIMIT 8
+
+
+/** Pass frame to the command processor. If the queue is full for the lane of the frame, reading is suspended until it
+ *  has free space. Inline-safe command is executed right here if the processor has nothing in work. Packet is captured
+ *  before, while it is not split by the execution */
+void ClientThread_enqueue(CmdProcessor_Args *cpa, Frame *frame, int sockfd) {
+    frame->depth = cpa->queued - __atomic_load_n(&cpa->finished, __ATOMIC_ACQUIRE);
+    if (Capture_enabled() && !frame->oversized)
+        Capture_frame(cpa->conn, frame);
+    if (CmdProcessor_tryInline(cpa, frame))
+        return;
+    MultiLaneQueue *cmdQueue = cpa->cmdQueue;
+    cpa->queued++;
+    Stats_inc(STATS_QUEUE_DEPTH_CONTROL + frame->priority);
+    if (!cmdQueue->tryPut(cmdQueue, frame->priority, frame)) {
+        //Socket is not read while the queue is full, so the client is pushed back by kernel socket buffers
+        Stats_inc(STATS_QUEUE_FULL);
+        while (!cmdQueue->put(cmdQueue, frame->priority, frame, CLIENT_THREAD_BACKPRESSURE_TIMEOUT)) {
+            Stats_inc(STATS_QUEUE_FULL_TIMEOUT);
+            Logger_info("ClientThread", "Command queue for sockfd '%d' stays full", sockfd);
+        }
+    }
+}
+
+/** Internal function. Pass connection to the new daemon process, if the daemon is upgraded and the connection has no
+ *  packets in work. State is the framing state of the connection, data received before is already parsed. Return true
+ *  if connection was passed, so the reader must stop without closing it */
+static bool ClientThread_handOff(Connection *conn, CmdProcessor_Args *cpa, uint8_t state) {
+    return Upgrade_handingOff() && CmdProcessor_idle(cpa) && Upgrade_sendConn(conn, state);
+}
+
+/** Internal function. Read exactly len bytes. Reading of the block that starts with the packet may be interrupted by
+ *  the upgrade, for other blocks state is IO_CONN_HELLO. Return false if socket was closed or connection was passed */
+static bool ClientThread_readFull(Connection *conn, CmdProcessor_Args *cpa, char *buf, size_t len, uint8_t state) {
+    bool started = false;
+    while (len > 0) {
+        ssize_t r = read(conn->sockfd, buf, len);
+        Stats_inc(STATS_IO_SYSCALLS);
+        if (r <= 0) {
+            if (r < 0 && errno == EINTR) {
+                if (!started && state != IO_CONN_HELLO && ClientThread_handOff(conn, cpa, state))
+                    return false;
+                continue;
+            }
+            return false;
+        }
+        started = true;
+        buf += r;
+        len -= r;
+    }
+
+    return true;
+}
+
+/** Create frame for the text packet. Data must be terminated by '\r' and zero char */
+Frame* ClientThread_textFrame(char *data, uint32_t len) {
+    Frame *frame = Frame_new(data, len); //Free in cmd_processor
+    CmdProcessor_classify(frame);
 
+    return frame;
+}
 
-    while(clientThread_alive) {
-        char ch;
-        ssize_t r = read(sockfd, &ch, 1);
-        if (r > 0) { // if some char was received
+/** Create frame that answers the text packet, which did not fit the assembly buffer, by error. Head is the start of the
+ *  packet. Return NULL if the head has no msgId, such packet is dropped as other broken ones */
+Frame* ClientThread_oversizedFrame(const char *head, size_t len) {
+    const char *tab = memchr(head, '\t', len);
+    uint32_t msgId = 0;
+    if (tab == NULL || atou32(tab + 1, head + len, &msgId) == NULL || msgId == 0)
+        return NULL;
+
+    Frame *frame = Frame_new(pmalloc(1), 0); //Free in cmd_processor
+    frame->msgId = msgId;
+    frame->priority = CMD_PRIORITY_NORMAL;
+    frame->oversized = true;
+
+    return frame;
+}
+
+/** Create frame for the binary packet. Payload must have one spare byte */
+Frame* ClientThread_binaryFrame(const Otpp_Header *header, char *payload) {
+    Frame *frame = Frame_new(payload, header->len); //Free in cmd_processor
+    frame->mode = OTPP_MODE_BINARY;
+    frame->type = header->type;
+    frame->msgId = header->msgId;
+    frame->flags = header->flags;
+    CmdProcessor_classify(frame);
+
+    return frame;
+}
+
+/** Answer the hello block. Return false if client asked for unsupported version */
+bool ClientThread_hello(Connection *conn, const char *block) {
+    uint8_t version;
+    if (!Otpp_checkHello(block, &version))
+        return false;
+
+    //Daemon answers with the accepted version. Client asked for unsupported version gets version 0 and is closed
+    char hello[OTPP_HELLO_SIZE];
+    bool supported = version == OTPP_VERSION;
+    Otpp_hello(hello, supported ? OTPP_VERSION : 0);
+    Connection_write(conn, hello, OTPP_HELLO_SIZE);
+    if (!supported)
+        return false;
+    conn->mode = OTPP_MODE_BINARY;
+    Logger_info("ClientThread", "Sockfd '%d' was switched to binary framing", conn->sockfd);
+
+    return true;
+}
+
+/** Internal function. Skip the rest of the packet that does not fit the assembly buffer. It's head is still in the
+ *  buffer, so the packet is answered by error if it has msgId. Return error frame or NULL */
+static Frame* ClientThread_overflow(RingBufferDef *inBuf, int sockfd) {
+    uint16_t len = RINGS_dataLenght(inBuf) < CLIENT_THREAD_HEAD_MAX ? RINGS_dataLenght(inBuf) : CLIENT_THREAD_HEAD_MAX;
+    char *head = RINGS_readStringInRange(inBuf->reader, len, inBuf);
+    RINGS_dataClear(inBuf);
+    Frame *frame = ClientThread_oversizedFrame(head, len);
+    pfree(head);
+    Logger_info("ClientThread", "Too big packet from sockfd '%d' was dropped", sockfd);
+
+    return frame;
+}
+
+/** Internal function. Build text packets from the byte stream until socket is closed. First char of the stream was
+ *  already read by the handshake. Packet that does not fit the buffer is skipped until it's end */
+static void ClientThread_readText(Connection *conn, CmdProcessor_Args *cpa, char first) {
+    int sockfd = conn->sockfd;
+    RingBufferDef *inBuf  = RINGS_createRingBuffer(CLIENT_THREAD_TEXT_BUFFER, RINGS_OVERFLOW_SHIFT, true);
+    Frame *oversized = NULL;
+    bool overflow = false;
+    char ch = first;
+    ssize_t r = 1;
+
+    do {
+        if (r < 0) {
+            //Interrupted read, connection is passed only between packets
+            if (RINGS_dataLenght(inBuf) == 0 && !overflow && ClientThread_handOff(conn, cpa, IO_CONN_TEXT))
+                break;
+        } else if (overflow) {
             if (ch == '\r') {
-                RINGS_write((uint8_t) ch, inBuf);
-                uint16_t len = RINGS_dataLenght(inBuf);
-                char *str = malloc(len + 1);
-                str[len] = 0;
-                RINGS_extractData(inBuf->writer - len, len, (uint8_t *) str, inBuf);
-                RINGS_dataClear(inBuf);
-                cmdQueue->enqueue(cmdQueue, str);
-            } else {
-                RINGS_write((uint8_t) ch, inBuf);
+                overflow = false;
+                if (oversized != NULL)
+                    ClientThread_enqueue(cpa, oversized, sockfd);
+                oversized = NULL;
             }
+        } else if (ch != '\r' && RINGS_dataLenght(inBuf) >= CLIENT_THREAD_TEXT_BUFFER - 2) {
+            //Ring keeps one byte less than it's size and the last one is left for the '\r'
+            overflow = true;
+            oversized = ClientThread_overflow(inBuf, sockfd);
+        } else if (ch == '\r') {
+            RINGS_write((uint8_t) ch, inBuf);
+            uint16_t len = RINGS_dataLenght(inBuf);
+            char *str = RINGS_readStringInRange(inBuf->reader, len, inBuf);
+            RINGS_dataClear(inBuf);
+            ClientThread_enqueue(cpa, ClientThread_textFrame(str, len), sockfd);
         } else {
-            Logger_info("ClientThread", "Socket is closed");
-            clientThread_alive = false;
+            RINGS_write((uint8_t) ch, inBuf);
         }
-    }
+        Stats_inc(STATS_IO_SYSCALLS);
+    } while ((r = read(sockfd, &ch, 1)) > 0 || (r < 0 && errno == EINTR));
 
-    cpa->alive = false;
+    if (oversized != NULL)
+        Frame_free(oversized);
     RINGS_Free(inBuf);
-    close(sockfd);
+}
+
+/** Internal function. Read binary packets until socket is closed. Header gives the payload size, so payload is read
+ *  directly to the frame buffer without scanning for the packet end */
+static void ClientThread_readBinary(Connection *conn, CmdProcessor_Args *cpa) {
+    int sockfd = conn->sockfd;
+    char buf[OTPP_HEADER_SIZE];
+
+    while (ClientThread_readFull(conn, cpa, buf, OTPP_HEADER_SIZE, IO_CONN_HEADER)) {
+        Otpp_Header header;
+        if (!Otpp_readHeader(buf, &header) || header.len > OTPP_MAX_PAYLOAD) {
+            //Stream position is lost, so the connection can't be recovered
+            Logger_info("ClientThread", "Broken binary packet from sockfd '%d'", sockfd);
+            break;
+        }
+
+        char *payload = pmalloc(header.len + 1); //Free in cmd_processor
+        if (!ClientThread_readFull(conn, cpa, payload, header.len, IO_CONN_HELLO)) {
+            pfree(payload);
+            break;
+        }
+        ClientThread_enqueue(cpa, ClientThread_binaryFrame(&header, payload), sockfd);
+    }
+}
+
+/** Internal function. Select framing by the first bytes of the connection. Binary framing is requested by the hello
+ *  block, any other data is the first text packet. Connection passed by the previous daemon process has the framing
+ *  already, only the first char of the text stream is read. Return false if socket was closed */
+static bool ClientThread_handshake(Connection *conn, CmdProcessor_Args *cpa, char *first) {
+    char hello[OTPP_HELLO_SIZE];
+    if (conn->framed)
+        return conn->mode == OTPP_MODE_BINARY || ClientThread_readFull(conn, cpa, first, 1, IO_CONN_TEXT);
+    if (!ClientThread_readFull(conn, cpa, hello, 1, IO_CONN_HANDSHAKE))
+        return false;
+    if (hello[0] != OTPP_HELLO[0]) {
+        *first = hello[0];
+        return true;
+    }
+
+    return ClientThread_readFull(conn, cpa, hello + 1, OTPP_HELLO_SIZE - 1, IO_CONN_HELLO)
+           && ClientThread_hello(conn, hello);
+}
+
+/** Create frame from the seqpacket message. Message holds exactly one packet, text packet may omit the terminating
+ *  '\r'. Return NULL if the message is broken */
+Frame* ClientThread_messageFrame(Connection *conn, const char *data, size_t len) {
+    if (conn->mode == OTPP_MODE_BINARY) {
+        Otpp_Header header;
+        if (len < OTPP_HEADER_SIZE || !Otpp_readHeader(data, &header) || header.len != len - OTPP_HEADER_SIZE)
+            return NULL;
+        char *payload = pmalloc(header.len + 1);
+        memcpy(payload, data + OTPP_HEADER_SIZE, header.len);
+        return ClientThread_binaryFrame(&header, payload);
+    }
+
+    bool terminated = data[len - 1] == '\r';
+    char *str = pmalloc(len + 2);
+    memcpy(str, data, len);
+    if (!terminated)
+        str[len++] = '\r';
+    str[len] = 0;
+
+    return ClientThread_textFrame(str, (uint32_t) len);
+}
+
+/** Internal function. Read packets from the seqpacket socket until it is closed. Each message is one packet, so all
+ *  messages that are already received are taken by one recvmmsg call. First message may be the hello block */
+static void ClientThread_readPackets(Connection *conn, CmdProcessor_Args *cpa) {
+    int sockfd = conn->sockfd;
+    char *buf = pmalloc(CLIENT_THREAD_SEQPACKET_SLOTS * CLIENT_THREAD_SEQPACKET_BUF);
+    struct mmsghdr msgs[CLIENT_THREAD_SEQPACKET_SLOTS];
+    struct iovec iov[CLIENT_THREAD_SEQPACKET_SLOTS];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < CLIENT_THREAD_SEQPACKET_SLOTS; i++) {
+        iov[i].iov_base = buf + i * CLIENT_THREAD_SEQPACKET_BUF;
+        iov[i].iov_len = CLIENT_THREAD_SEQPACKET_BUF;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    bool first = !conn->framed;
+    bool alive = true;
+    while (alive) {
+        int n = recvmmsg(sockfd, msgs, CLIENT_THREAD_SEQPACKET_SLOTS, MSG_WAITFORONE, NULL);
+        Stats_inc(STATS_IO_SYSCALLS);
+        if (n < 0 && errno == EINTR) {
+            uint8_t state = first ? IO_CONN_HANDSHAKE : conn->mode == OTPP_MODE_BINARY ? IO_CONN_HEADER : IO_CONN_TEXT;
+            if (ClientThread_handOff(conn, cpa, state))
+                break;
+            continue;
+        }
+        if (n <= 0)
+            break;
+
+        for (int i = 0; i < n && alive; i++) {
+            char *data = iov[i].iov_base;
+            size_t len = msgs[i].msg_len;
+            if (len == 0) {
+                //Zero length message is the end of stream
+                alive = false;
+            } else if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                Logger_info("ClientThread", "Too big packet from sockfd '%d' was dropped", sockfd);
+            } else if (first && data[0] == OTPP_HELLO[0]) {
+                alive = len == OTPP_HELLO_SIZE && ClientThread_hello(conn, data);
+            } else {
+                Frame *frame = ClientThread_messageFrame(conn, data, len);
+                if (frame != NULL)
+                    ClientThread_enqueue(cpa, frame, sockfd);
+                else
+                    Logger_info("ClientThread", "Broken packet from sockfd '%d' was dropped", sockfd);
+            }
+            first = false;
+        }
+    }
+
+    pfree(buf);
+}
+
+/** Create command queue of the connection and start it's command processor. Processor is stopped by CmdProcessor_stop
+ *  with the returned args */
+CmdProcessor_Args* ClientThread_startProcessor(Connection *conn) {
+    MultiLaneQueue *cmdQueue = new_MLQ(CMD_PRIORITY_COUNT, CLIENT_THREAD_QUEUE_CAPACITY,
+                                       CLIENT_THREAD_CONTROL_RESERVE, CLIENT_THREAD_STARVATION_LIMIT,
+                                       CmdProcessor_queueEngine()); //Free in cmd_processor
+    CmdProcessor_Args *cpa = malloc(sizeof(CmdProcessor_Args));  //Free in cmd_processor
+    cpa->cmdQueue = cmdQueue;
+    Connection_retain(conn); //Released by cmd_processor
+    cpa->conn = conn;
+    cpa->alive = true;
+    cpa->queued = 0;
+    cpa->finished = 0;
+    ThreadPool_runOwned(CmdProcessor_run, cpa);
+
+    return cpa;
+}
+
+void ClientThread_run(void *args) {
+    Connection *conn = (Connection*) args;
+    int sockfd = conn->sockfd;
+    Logger_info("ClientThread", "Client thread for sockdf '%d' (pid %d, uid %d) was started", sockfd, conn->pid,
+                conn->uid);
+    CmdProcessor_Args *cpa = ClientThread_startProcessor(conn);
+    Connection_setReader(conn, true);
+
+    char first;
+    if (conn->seqpacket) {
+        ClientThread_readPackets(conn, cpa);
+    } else if (ClientThread_handshake(conn, cpa, &first)) {
+        if (conn->mode == OTPP_MODE_BINARY)
+            ClientThread_readBinary(conn, cpa);
+        else
+            ClientThread_readText(conn, cpa, first);
+    }
+    Connection_setReader(conn, false);
+
+    CmdProcessor_stop(cpa);
+    if (conn->passed) {
+        //Socket is served by the new daemon process, so it must not be shut down
+        Logger_info("ClientThread", "Socket was passed to the new process");
+    } else {
+        Logger_info("ClientThread", "Socket is closed");
+        Connection_shutdown(conn);
+    }
+    Connection_release(conn);
     Logger_info("ClientThread", "Client thread for sockdf '%d' was stopped", sockfd);
-}
\ No newline at end of file
+}
@@ -0,0 +1,218 @@
+/** Per client accounting. Clients are identified by the peer credentials captured at accept, by pid (each agent
+ *  process is a client) or by uid (all processes of the user are one client), as configured by 'client.key'.
+ *
+ *  Each client has token bucket rate limit. Request that finds the bucket empty is not executed and is answered with
+ *  the throttle error. Limits are configured by 'client.rate' (requests per second, 0 is unlimited), 'client.burst'
+ *  and may be overridden for the uid by 'client.uid.<uid>.rate' and 'client.uid.<uid>.burst'.
+ *
+ *  Execution of commands is limited by 'sched.slots' concurrent commands for all connections. When all slots are busy,
+ *  commands wait for the slot, and waiting clients are served by deficit round robin, so client with many connections
+ *  gets no more turns than client with one connection. 'client.weight' (and 'client.uid.<uid>.weight') is count of
+ *  commands served in a row when client has the turn. Control commands don't take the slot, and responses of the
+ *  others are written after the slot is returned, so the client that does not read it's socket holds no slot. */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../inc/clients.h"
+#include "../inc/config.h"
+#include "../inc/logger.h"
+#include "../inc/stats.h"
+#include "../libs/collections/include/hashmap.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/threads.h"
+#include "../libs/oscl/include/time.h"
+
+/** Registry of attached clients by key */
+DEFINE_HASHMAP_NAMED(Clients_Registry, uint64_t, Client*, HASHMAP_HASH_INT, HASHMAP_EQ_INT)
+static Clients_Registry clients;
+static mutex_t *registryMutex = NULL;
+static bool keyByUid = false;
+
+/** Execution slots scheduler state */
+static mutex_t *schedMutex = NULL;
+static int64_t freeSlots = 0;
+static Client *activeHead = NULL;
+static Client *activeTail = NULL;
+
+/** Initialize clients registry and scheduler from the configuration */
+bool Clients_init() {
+    Clients_Registry_init(&clients);
+    registryMutex = NewMutex("clients.registry");
+    schedMutex = NewMutex("clients.sched");
+
+    keyByUid = strcmp(Config_getString("client.key", "pid"), "uid") == 0;
+    freeSlots = Config_getInt("sched.slots", sysconf(_SC_NPROCESSORS_ONLN));
+    if (freeSlots < 1)
+        freeSlots = 1;
+
+    Logger_info("Clients", "Clients are identified by %s, %d execution slots", keyByUid ? "uid" : "pid", freeSlots);
+
+    return true;
+}
+
+/** Internal function. Read client parameter, uid specific value overrides the common one */
+static int64_t Clients_param(uid_t uid, const char *name, int64_t def) {
+    char key[64];
+    sprintf(key, "client.%s", name);
+    int64_t value = Config_getInt(key, def);
+    sprintf(key, "client.uid.%u.%s", (unsigned) uid, name);
+
+    return Config_getInt(key, value);
+}
+
+/** Find client by credentials or create new one, and add connection reference to it */
+Client* Clients_attach(uid_t uid, pid_t pid) {
+    uint64_t key = keyByUid ? CLIENTS_UID_KEY | (uint32_t) uid : (uint32_t) pid;
+
+    MutexLock(registryMutex);
+
+    Client **found = Clients_Registry_get(&clients, key);
+    Client *client = found != NULL ? *found : NULL;
+    if (client == NULL) {
+        client = pmalloc(sizeof(Client));
+        memset(client, 0, sizeof(Client));
+        client->key = key;
+        client->uid = uid;
+        client->pid = pid;
+        client->rate = (uint32_t) Clients_param(uid, "rate", 0);
+        client->burst = (uint32_t) Clients_param(uid, "burst", client->rate);
+        if (client->burst < 1)
+            client->burst = 1;
+        client->bucketMutex = NewMutex("clients.bucket");
+        client->tokens = client->burst;
+        client->refilled = MonotonicMillis();
+        client->quantum = (uint32_t) Clients_param(uid, "weight", 1);
+        if (client->quantum < 1)
+            client->quantum = 1;
+        Clients_Registry_put(&clients, key, client);
+    }
+    client->refs++;
+
+    MutexUnlock(registryMutex);
+
+    return client;
+}
+
+/** Remove connection reference from the client. Client without connections is forgotten */
+void Clients_detach(Client *client) {
+    MutexLock(registryMutex);
+
+    if (--client->refs == 0) {
+        Clients_Registry_remove(&clients, client->key, NULL);
+        DelMutex(client->bucketMutex);
+        pfree(client);
+    }
+
+    MutexUnlock(registryMutex);
+}
+
+/** Take one token from the client bucket. Return false if client is over it's budget. Unlimited client takes no
+ *  lock, others lock only their own bucket */
+bool Clients_admit(Client *client) {
+    __atomic_add_fetch(&client->requests, 1, __ATOMIC_RELAXED);
+    if (client->rate == 0)
+        return true;
+
+    MutexLock(client->bucketMutex);
+
+    uint64_t now = MonotonicMillis();
+    client->tokens += (double) (now - client->refilled) * client->rate / 1000;
+    if (client->tokens > client->burst)
+        client->tokens = client->burst;
+    client->refilled = now;
+
+    bool admitted = client->tokens >= 1;
+    if (admitted)
+        client->tokens -= 1;
+    else
+        client->throttled++;
+
+    MutexUnlock(client->bucketMutex);
+
+    return admitted;
+}
+
+/** Internal function. Grant free slots to the waiting commands. Client at the head of the active list is served until
+ *  it's deficit is spent, then it moves to the tail. Must be called under the scheduler mutex */
+static void Clients_dispatch() {
+    while (freeSlots > 0 && activeHead != NULL) {
+        Client *client = activeHead;
+        if (client->deficit < 1)
+            client->deficit += client->quantum;
+
+        Clients_Waiter *waiter = client->waitHead;
+        client->waitHead = waiter->next;
+        if (client->waitHead == NULL)
+            client->waitTail = NULL;
+        client->deficit--;
+        freeSlots--;
+        waiter->granted = true;
+        CondSignal(waiter->cond);
+
+        if (client->waitHead == NULL || client->deficit < 1) {
+            activeHead = client->nextActive;
+            if (activeHead == NULL)
+                activeTail = NULL;
+            client->nextActive = NULL;
+            if (client->waitHead == NULL) {
+                client->deficit = 0;
+                client->active = false;
+            } else {
+                if (activeTail != NULL)
+                    activeTail->nextActive = client;
+                else
+                    activeHead = client;
+                activeTail = client;
+            }
+        }
+    }
+}
+
+/** Take execution slot for the client command. Wait for the client turn if all slots are busy */
+void Clients_enter(Client *client) {
+    MutexLock(schedMutex);
+
+    if (freeSlots > 0 && activeHead == NULL) {
+        freeSlots--;
+        MutexUnlock(schedMutex);
+        return;
+    }
+
+    Stats_inc(STATS_SCHED_WAITS);
+    Clients_Waiter waiter;
+    waiter.next = NULL;
+    waiter.granted = false;
+    waiter.cond = NewCond();
+
+    if (client->waitTail != NULL)
+        client->waitTail->next = &waiter;
+    else
+        client->waitHead = &waiter;
+    client->waitTail = &waiter;
+
+    if (!client->active) {
+        client->active = true;
+        client->nextActive = NULL;
+        if (activeTail != NULL)
+            activeTail->nextActive = client;
+        else
+            activeHead = client;
+        activeTail = client;
+    }
+
+    Clients_dispatch();
+    while (!waiter.granted)
+        CondWait(waiter.cond, schedMutex);
+
+    MutexUnlock(schedMutex);
+    DelCond(waiter.cond);
+}
+
+/** Return execution slot taken by the Clients_enter */
+void Clients_leave() {
+    MutexLock(schedMutex);
+    freeSlots++;
+    Clients_dispatch();
+    MutexUnlock(schedMutex);
+}
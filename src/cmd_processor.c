@@ -6,69 +6,420 @@
 #include <unistd.h>
 #include "../inc/cmd_processor.h"
 #include "../inc/logger.h"
-#include "../libs/collections/include/lbq.h"
-#include "../libs/collections/include/list.h"
+#include "../inc/config.h"
+#include "../libs/collections/include/mlq.h"
 #include "../libs/oscl/include/data.h"
 #include "../libs/oscl/include/time.h"
+#include "../inc/profiler.h"
+#include "../inc/stats.h"
+#include "../inc/frame.h"
+#include "../inc/clients.h"
+#include "../libs/oscl/include/twheel.h"
+#include "../inc/otpp.h"
+#include "../inc/shm_transport.h"
+#include "../inc/accounting.h"
+#include "../inc/slowlog.h"
+
+/** Engine of the connection command queue lanes, selected by 'queue.engine' */
+static uint8_t queueEngine = LBQ_ENGINE_MUTEX;
+
+/** Wheel for the delayed completion of commands */
+static twheel_t *timers = NULL;
+
+/** State of command which response is written by the timer */
+typedef struct CmdProcessor_Delayed {
+    wtimer_t timer;
+    Connection *conn;
+    uint32_t packetId;
+} CmdProcessor_Delayed;
+
+/** Collector of the batch sub-commands results. While it is set for the processor thread, responses of handlers are
+ *  appended to it instead of being written to the connection */
+typedef struct CmdProcessor_Batch {
+    char *data;
+    size_t len;
+    size_t capacity;
+    uint8_t mode;
+    uint32_t subId;
+    /** Type of the last appended result, zero if sub-command has not responded yet */
+    char lastType;
+} CmdProcessor_Batch;
+
+static __thread CmdProcessor_Batch *batch = NULL;
+
+/** Responses of the command executed in the execution slot. While it is set for the processor thread, responses are
+ *  collected to it and are written after the slot is returned, so the client that does not read it's socket can't
+ *  hold the slot */
+typedef struct CmdProcessor_Held {
+    char *data;
+    size_t len;
+    size_t capacity;
+    /** Whether data was allocated, initially it is the buffer of the caller */
+    bool allocated;
+    uint32_t ends[CMD_PROCESSOR_HELD_MESSAGES];
+    uint16_t count;
+} CmdProcessor_Held;
+
+static __thread CmdProcessor_Held *held = NULL;
+
+/** Slow log trace of the packet executed by the thread. It is set only while the slow log is enabled */
+static __thread SlowLog_Trace *trace = NULL;
+
+/** Preformatted constant responses */
+static CmdProcessor_Cached versionResponse;
+static CmdProcessor_Cached okResponse;
+static CmdProcessor_Cached notEnoughArgsResponse;
+static CmdProcessor_Cached unknownCommandResponse;
+static CmdProcessor_Cached deadlineResponse;
+static CmdProcessor_Cached throttleResponse;
+static CmdProcessor_Cached notBatchableResponse;
+static CmdProcessor_Cached brokenResponse;
+static CmdProcessor_Cached oversizedResponse;
+
+static void CmdProcessor_cache(CmdProcessor_Cached *cached, char type, const char *content);
+
+/** Initialize resources shared by all command processors. Must be called once before the first connection accepted */
+bool CmdProcessor_init() {
+    CmdProcessor_cache(&versionResponse, 'r', CMD_PROCESSOR_VERSION);
+    CmdProcessor_cache(&okResponse, 'r', "ok");
+    CmdProcessor_cache(&notEnoughArgsResponse, 'e', "Not enough arguments");
+    CmdProcessor_cache(&unknownCommandResponse, 'e', "Unknown command");
+    CmdProcessor_cache(&deadlineResponse, 'e', "Deadline exceeded");
+    CmdProcessor_cache(&throttleResponse, 'e', "Rate limit exceeded");
+    CmdProcessor_cache(&notBatchableResponse, 'e', "Not allowed in batch");
+    CmdProcessor_cache(&brokenResponse, 'e', "Broken command");
+    CmdProcessor_cache(&oversizedResponse, 'e', "Packet is too big");
+
+    timers = NewTimerWheel(1);
+    if (timers == NULL) {
+        Logger_fatal("CmdProcessor", "Unable to create timer wheel");
+        return false;
+    }
+    if (!Accounting_init(timers) || !SlowLog_init())
+        return false;
+
+    const char *engine = Config_getString("queue.engine", "mutex");
+    if (strcmp(engine, "mpmc") == 0)
+        queueEngine = LBQ_ENGINE_MPMC;
+    else if (strcmp(engine, "mutex") != 0)
+        Logger_info("CmdProcessor", "Unknown queue engine '%s', mutex engine is used", engine);
+
+    return true;
+}
+
+/** Return engine of the command queue lanes, LBQ_ENGINE_MUTEX or LBQ_ENGINE_MPMC */
+uint8_t CmdProcessor_queueEngine() {
+    return queueEngine;
+}
+
+/** Return the timer wheel of the delayed responses, other modules schedule their timers on it too */
+twheel_t* CmdProcessor_timers() {
+    return timers;
+}
+
+/** Build response packet 'type<TAB>msgId<TAB>content<CR>' in the caller buffer. Return length of the packet. If it
+ *  is bigger than the buffer size, nothing is written */
+size_t CmdProcessor_buildResponse(char *buf, size_t size, char type, uint32_t msgId, const char *content,
+                                  size_t len) {
+    char digits[U32_MAX_DIGITS];
+    uint8_t idLen = u32toa(msgId, digits);
+    size_t total = len + idLen + 4;
+    if (total > size)
+        return total;
+
+    char *p = buf;
+    *p++ = type;
+    *p++ = '\t';
+    memcpy(p, digits, idLen);
+    p += idLen;
+    *p++ = '\t';
+    memcpy(p, content, len);
+    p += len;
+    *p = '\r';
+
+    return total;
+}
+
+/** Internal function. Append response to the held responses. Return false if too many of them are held already */
+static bool CmdProcessor_hold(CmdProcessor_Held *collector, const struct iovec *iov, int count) {
+    if (collector->count == CMD_PROCESSOR_HELD_MESSAGES)
+        return false;
+    size_t len = 0;
+    for (int i = 0; i < count; i++)
+        len += iov[i].iov_len;
+    if (collector->len + len > collector->capacity) {
+        while (collector->len + len > collector->capacity)
+            collector->capacity *= 2;
+        if (collector->allocated) {
+            collector->data = prealloc(collector->data, collector->capacity);
+        } else {
+            char *data = pmalloc(collector->capacity);
+            memcpy(data, collector->data, collector->len);
+            collector->data = data;
+            collector->allocated = true;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        memcpy(collector->data + collector->len, iov[i].iov_base, iov[i].iov_len);
+        collector->len += iov[i].iov_len;
+    }
+    collector->ends[collector->count++] = (uint32_t) collector->len;
+
+    return true;
+}
+
+/** Internal function. Write held responses to the connection, each one by it's own write, so seqpacket connection
+ *  gets them as separate messages */
+static void CmdProcessor_flushHeld(Connection *conn, CmdProcessor_Held *collector) {
+    uint32_t start = 0;
+    for (uint16_t i = 0; i < collector->count; i++) {
+        Connection_write(conn, collector->data + start, collector->ends[i] - start);
+        start = collector->ends[i];
+    }
+    collector->len = 0;
+    collector->count = 0;
+}
+
+/** Internal function. Write response blocks to the connection, or hold them while the command runs in the execution
+ *  slot. Iov entries may be modified */
+static void CmdProcessor_write(Connection *conn, struct iovec *iov, int count) {
+    if (held != NULL) {
+        if (CmdProcessor_hold(held, iov, count))
+            return;
+        //Order of responses is kept, but the rest of them is written while the slot is taken
+        CmdProcessor_flushHeld(conn, held);
+    }
+    if (count == 1)
+        Connection_write(conn, iov[0].iov_base, iov[0].iov_len);
+    else
+        Connection_writev(conn, iov, count);
+}
+
+/** Internal function. Write binary response. Content is written by the same syscall as header, without copying */
+static void CmdProcessor_respondBinary(Connection *conn, char type, uint32_t msgId, const char *content, size_t len) {
+    char header[OTPP_HEADER_SIZE];
+    Otpp_writeHeader(header, type, msgId, (uint32_t) len);
+    struct iovec iov[2] = {{header, OTPP_HEADER_SIZE}, {(void*) content, len}};
+    CmdProcessor_write(conn, iov, 2);
+}
+
+/** Internal function. Append sub-command result to the batch. Text result is '<subId> <type> <content>', results
+ *  are separated by tabs */
+static void CmdProcessor_batchAppend(CmdProcessor_Batch *collector, char type, const char *content, size_t len) {
+    size_t need = len + U32_MAX_DIGITS + 9;
+    if (collector->len + need > collector->capacity) {
+        while (collector->len + need > collector->capacity)
+            collector->capacity *= 2;
+        collector->data = prealloc(collector->data, collector->capacity);
+    }
+
+    char *p = collector->data + collector->len;
+    if (collector->mode == OTPP_MODE_BINARY) {
+        uint32_t size = (uint32_t) len;
+        memcpy(p, &collector->subId, sizeof(uint32_t));
+        p[4] = type;
+        memcpy(p + 5, &size, sizeof(uint32_t));
+        p += 9;
+    } else {
+        if (collector->len > 0)
+            *p++ = '\t';
+        p += u32toa(collector->subId, p);
+        *p++ = ' ';
+        *p++ = type;
+        *p++ = ' ';
+    }
+    memcpy(p, content, len);
+    collector->len = p + len - collector->data;
+    collector->lastType = type;
+}
+
+/** Internal function. Start timing of the response write for the slow log trace. Return start time */
+static uint64_t CmdProcessor_writeBegin(uint32_t msgId) {
+    if (trace == NULL)
+        return 0;
+    trace->msgId = msgId;
+
+    return FastMonotonicNanos();
+}
+
+/** Internal function. Account time of the response write to the slow log trace */
+static void CmdProcessor_writeEnd(uint64_t start) {
+    if (trace != NULL)
+        trace->writeNanos += FastMonotonicNanos() - start;
+}
+
+/** Write response of specified length to the connection in it's framing, or to the batch if it is collected now.
+ *  Content may contain zero bytes */
+void CmdProcessor_respondData(Connection *conn, char type, uint32_t msgId, const char *content, size_t len) {
+    char buf[CMD_PROCESSOR_RESPONSE_BUF];
+    if (batch != NULL) {
+        CmdProcessor_batchAppend(batch, type, content, len);
+        return;
+    }
+    uint64_t start = CmdProcessor_writeBegin(msgId);
+    if (conn->mode == OTPP_MODE_BINARY) {
+        CmdProcessor_respondBinary(conn, type, msgId, content, len);
+    } else {
+        size_t total = CmdProcessor_buildResponse(buf, sizeof(buf), type, msgId, content, len);
+        if (total <= sizeof(buf)) {
+            struct iovec iov = {buf, total};
+            CmdProcessor_write(conn, &iov, 1);
+        } else {
+            char *big = pmalloc(total);
+            CmdProcessor_buildResponse(big, total, type, msgId, content, len);
+            struct iovec iov = {big, total};
+            CmdProcessor_write(conn, &iov, 1);
+            pfree(big);
+        }
+    }
+    CmdProcessor_writeEnd(start);
+}
 
-/** Internal function. Create packaged response from input data */
-char* CmdProcessor_createResponse(const char *type, uint32_t msgId, const char *content) {
-    char *msgIdStr = itoa2(msgId);
-    size_t size = strlen(type) + 2 + strlen(msgIdStr) + 2 + strlen(content);
-    char *buf = pmalloc(size);
-    sprintf(buf, "%s\t%s\t%s\r", type, msgIdStr, content);
+/** Write response to the connection in it's framing. Ordinary responses are built on the stack, so they cost no
+ *  allocations */
+void CmdProcessor_respond(Connection *conn, char type, uint32_t msgId, const char *content) {
+    CmdProcessor_respondData(conn, type, msgId, content, strlen(content));
+}
+
+/** Internal function. Preformat constant response. Place for the type and msgId is reserved before the content */
+static void CmdProcessor_cache(CmdProcessor_Cached *cached, char type, const char *content) {
+    size_t len = strlen(content);
+    cached->type = type;
+    cached->tail = U32_MAX_DIGITS + 2;
+    cached->data[cached->tail] = '\t';
+    memcpy(cached->data + cached->tail + 1, content, len);
+    cached->data[cached->tail + 1 + len] = '\r';
+    cached->len = (uint16_t) (cached->tail + len + 2);
+}
+
+/** Write preformatted response to the connection. Only msgId is formatted, right before the content */
+void CmdProcessor_respondCached(Connection *conn, const CmdProcessor_Cached *cached, uint32_t msgId) {
+    char buf[CMD_PROCESSOR_CACHED_MAX];
+    if (batch != NULL || conn->mode == OTPP_MODE_BINARY) {
+        //Cached content is placed between the tab and the '\r'
+        CmdProcessor_respondData(conn, cached->type, msgId, cached->data + cached->tail + 1,
+                                   cached->len - cached->tail - 2);
+        return;
+    }
+    memcpy(buf + cached->tail, cached->data + cached->tail, cached->len - cached->tail);
+    char *start = u32toaEnd(msgId, buf + cached->tail);
+    *--start = '\t';
+    *--start = cached->type;
+    uint64_t writeStart = CmdProcessor_writeBegin(msgId);
+    struct iovec iov = {start, buf + cached->len - start};
+    CmdProcessor_write(conn, &iov, 1);
+    CmdProcessor_writeEnd(writeStart);
+}
 
-    pfree(msgIdStr);
+/** Internal function. Return size of the options that precede arguments in the binary packet payload */
+static uint32_t CmdProcessor_binaryOptionsSize(uint16_t flags) {
+    uint32_t size = 0;
+    if (flags & OTPP_FLAG_TIMEOUT)
+        size += sizeof(uint32_t);
+    if (flags & OTPP_FLAG_DEADLINE)
+        size += sizeof(uint64_t);
+
+    return size;
+}
+
+/** Internal function. Check the packet options for deadline and return true if it has already passed. Options are
+ *  optional fields that follow the packet body, each in the form '@name=value':
+ *      @tmo=<millis>   timeout counted from the moment when the packet was received by the daemon
+ *      @dl=<millis>    absolute deadline as wall clock millis since epoch
+ *  Unknown options are ignored */
+static bool CmdProcessor_isExpired(Frame *frame, char **options, uint16_t count) {
+    for (uint16_t i = 0; i < count; i++) {
+        char *option = options[i];
+        char *end;
+        if (strncmp(option, "@tmo=", 5) == 0) {
+            uint64_t timeout = strtoull(option + 5, &end, 10);
+            if (end != option + 5 && FastMonotonicNanos() - frame->arrival >= timeout * NANOS_IN_MILLI)
+                return true;
+        } else if (strncmp(option, "@dl=", 4) == 0) {
+            uint64_t deadline = strtoull(option + 4, &end, 10);
+            if (end != option + 4 && RealTimeMillis() >= deadline)
+                return true;
+        }
+    }
 
-    return buf;
+    return false;
 }
 
-void CmdProcessor_notEnoughArgs(uint32_t packetId, int sockfd) {
-    char *resp = CmdProcessor_createResponse("e", packetId, "Not enough arguments");
-    write(sockfd, resp, strlen(resp));
-    pfree(resp);
+void CmdProcessor_notEnoughArgs(uint32_t packetId, Connection *conn) {
+    CmdProcessor_respondCached(conn, &notEnoughArgsResponse, packetId);
 }
 
 //============================================== COMMANDS =================================================
 
 /** Get daemon version */
-void CmdProcessor_cmd_version(uint32_t packetId, int sockfd) {
+void CmdProcessor_cmd_version(uint32_t packetId, Connection *conn, uint16_t argc, char **argv, uint32_t *argl) {
     Logger_info("CmdProcessor", "Received 'version' command");
-    char *resp = CmdProcessor_createResponse("r", packetId, "0.0.1");
-    write(sockfd, resp, strlen(resp));
-    pfree(resp);
+    CmdProcessor_respondCached(conn, &versionResponse, packetId);
+}
+
+/** Get daemon monitoring counters */
+void CmdProcessor_cmd_stats(uint32_t packetId, Connection *conn, uint16_t argc, char **argv, uint32_t *argl) {
+    char *stats = Stats_format();
+    CmdProcessor_respond(conn, 'r', packetId, stats);
+    pfree(stats);
+}
+
+/** Get CPU time and resources consumed by the command handlers, per command and per uid */
+void CmdProcessor_cmd_account(uint32_t packetId, Connection *conn, uint16_t argc, char **argv, uint32_t *argl) {
+    if (!Accounting_enabled()) {
+        CmdProcessor_respond(conn, 'e', packetId, "Accounting is disabled");
+        return;
+    }
+    char *usage = Accounting_format();
+    CmdProcessor_respond(conn, 'r', packetId, usage);
+    pfree(usage);
 }
 
 /** Test Function. Echoing first argument */
-void CmdProcessor_cmd_echo(uint32_t packetId, int sockfd, char *str) {
+void CmdProcessor_cmd_echo(uint32_t packetId, Connection *conn, uint16_t argc, char **argv, uint32_t *argl) {
+    char *str = argv[1];
     Logger_info("CmdProcessor", "Received 'echo' command with arg '%s'", str);
-    char *resp = CmdProcessor_createResponse("r", packetId, str);
-    write(sockfd, resp, strlen(resp));
-    pfree(resp);
+    CmdProcessor_respondData(conn, 'r', packetId, str, argl[1]);
 }
 
-/** Test Function. Stop thread for ms specified in first arg */
-void CmdProcessor_cmd_tmt(uint32_t packetId, int sockfd, long delay) {
+/** Internal function. Complete the 't_tmt' command from the wheel thread */
+static void CmdProcessor_tmtComplete(void *arg) {
+    CmdProcessor_Delayed *delayed = (CmdProcessor_Delayed*) arg;
+    CmdProcessor_respondCached(delayed->conn, &okResponse, delayed->packetId);
+    Connection_release(delayed->conn);
+    pfree(delayed);
+}
+
+/** Test Function. Respond after ms specified in first arg. Response is written by the timer wheel, so processor
+ *  thread is not blocked while command waits */
+void CmdProcessor_cmd_tmt(uint32_t packetId, Connection *conn, uint16_t argc, char **argv, uint32_t *argl) {
+    long delay = strtol(argv[1], NULL, 10);
     Logger_info("CmdProcessor", "Received 'tmt' command with arg '%d'", delay);
-    DelayMillis((uint64_t) delay);
-    char *resp = CmdProcessor_createResponse("r", packetId, "ok");
-    write(sockfd, resp, strlen(resp));
-    pfree(resp);
+    if (delay <= 0) {
+        CmdProcessor_respond(conn, 'e', packetId, "First arg must be a number");
+        return;
+    }
+    CmdProcessor_Delayed *delayed = pmalloc(sizeof(CmdProcessor_Delayed));
+    Connection_retain(conn);
+    delayed->conn = conn;
+    delayed->packetId = packetId;
+    WheelTimerInit(&delayed->timer, CmdProcessor_tmtComplete, delayed);
+    TimerSchedule(timers, &delayed->timer, (uint64_t) delay);
 }
 
 /** Test Function. Return first arg as content of error response packet */
-void CmdProcessor_cmd_err(uint32_t packetId, int sockfd, char *str) {
+void CmdProcessor_cmd_err(uint32_t packetId, Connection *conn, uint16_t argc, char **argv, uint32_t *argl) {
+    char *str = argv[1];
     Logger_info("CmdProcessor", "Received 'err' command");
-    char *resp = CmdProcessor_createResponse("e", packetId, str);
-    write(sockfd, resp, strlen(resp));
-    pfree(resp);
+    CmdProcessor_respondData(conn, 'e', packetId, str, argl[1]);
 }
 
 /** Test Function. Return broken packet by type from first arg */
-void CmdProcessor_cmd_re(uint32_t packetId, int sockfd, char *type) {
+void CmdProcessor_cmd_re(uint32_t packetId, Connection *conn, uint16_t argc, char **argv, uint32_t *argl) {
+    char *type = argv[1];
     Logger_info("CmdProcessor", "Received 're' with type '%s'", type);
     char *resp;
-    bool mf = false;
     if (strcmp("0", type) == 0) {
         resp = "_\t1\terror\r"; //Incorrect qualifier
     } else if (strcmp("1", type) == 0) {
@@ -78,217 +429,591 @@ void CmdProcessor_cmd_re(uint32_t packetId, int sockfd, char *type) {
     } else if (strcmp("3", type) == 0) {
         resp = "r\t1234\terror\r";  //Arbitrary msgid
     } else {
-        mf = true;
-        resp = CmdProcessor_createResponse("e", packetId, "Unknown type");
+        CmdProcessor_respond(conn, 'e', packetId, "Unknown type");
+        return;
+    }
+    struct iovec iov = {resp, strlen(resp)};
+    CmdProcessor_write(conn, &iov, 1);
+}
+
+/** Control built-in sampling profiler. Action 'start' may be followed by the sampling frequency in Hz. Action 'dump'
+ *  may be followed by name of the dump, that is placed to the PROFILER_DUMP_DIR as nsd.<name>.folded */
+void CmdProcessor_cmd_profile(uint32_t packetId, Connection *conn, uint16_t argc, char **argv, uint32_t *argl) {
+    char *action = argv[1];
+    char *arg = argc > 2 ? argv[2] : NULL;
+    Logger_info("CmdProcessor", "Received 'profile' command with action '%s'", action);
+    if (strcmp("start", action) == 0) {
+        uint32_t hz = arg != NULL ? (uint32_t) strtol(arg, NULL, 10) : PROFILER_DEFAULT_HZ;
+        if (Profiler_start(hz))
+            CmdProcessor_respondCached(conn, &okResponse, packetId);
+        else
+            CmdProcessor_respond(conn, 'e', packetId, "Profiler already started");
+    } else if (strcmp("stop", action) == 0) {
+        Profiler_stop();
+        char samples[U32_MAX_DIGITS + 1];
+        samples[u32toa(Profiler_samples(), samples)] = 0;
+        CmdProcessor_respond(conn, 'r', packetId, samples);
+    } else if (strcmp("dump", action) == 0) {
+        char *name = arg != NULL ? arg : "profile";
+        //Name is a part of the path of file written by root, so only safe chars are allowed
+        for (char *c = name; *c != 0; c++) {
+            if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '_'
+                  || *c == '-')) {
+                name = NULL;
+                break;
+            }
+        }
+        if (name == NULL || strlen(name) > 64) {
+            CmdProcessor_respond(conn, 'e', packetId, "Incorrect dump name");
+        } else {
+            char path[128];
+            sprintf(path, "%s/nsd.%s.folded", PROFILER_DUMP_DIR, name);
+            if (Profiler_dump(path) >= 0)
+                CmdProcessor_respond(conn, 'r', packetId, path);
+            else
+                CmdProcessor_respond(conn, 'e', packetId, "Unable to write dump");
+        }
+    } else {
+        CmdProcessor_respond(conn, 'e', packetId, "Unknown action");
+    }
+}
+
+/** Open shared memory transport. Response content is the ring size, descriptor of the shared region is passed with
+ *  the response. Requests written to the region are executed with the same commands, but separately from this
+ *  connection, that must stay open while the transport is used */
+void CmdProcessor_cmd_shm(uint32_t packetId, Connection *conn, uint16_t argc, char **argv, uint32_t *argl) {
+    Logger_info("CmdProcessor", "Received 'shm' command");
+    if (conn->sockfd < 0) {
+        CmdProcessor_respond(conn, 'e', packetId, "Already shm transport");
+        return;
+    }
+    uint32_t ringSize;
+    int fd = ShmTransport_open(conn, &ringSize);
+    if (fd == SHM_TRANSPORT_OPENED) {
+        CmdProcessor_respond(conn, 'e', packetId, "Shm transport is already open");
+        return;
+    }
+    if (fd < 0) {
+        CmdProcessor_respond(conn, 'e', packetId, "Shm transport is not available");
+        return;
+    }
+
+    char size[U32_MAX_DIGITS];
+    uint8_t sizeLen = u32toa(ringSize, size);
+    char buf[CMD_PROCESSOR_CACHED_MAX];
+    size_t len;
+    if (conn->mode == OTPP_MODE_BINARY) {
+        Otpp_writeHeader(buf, 'r', packetId, sizeLen);
+        memcpy(buf + OTPP_HEADER_SIZE, size, sizeLen);
+        len = OTPP_HEADER_SIZE + sizeLen;
+    } else {
+        len = CmdProcessor_buildResponse(buf, sizeof(buf), 'r', packetId, size, sizeLen);
+    }
+    Connection_sendFd(conn, buf, len, fd);
+    close(fd);
+}
+
+
+//=========================================== COMMANDS TABLE ==============================================
+
+/** Registered commands. Priority defines the lane of the connection queue in which the command waits for execution,
+ *  so cheap control commands are not stuck behind slow queued work. Count of required args does not include the
+ *  command name. Batch packets are always classified as normal. Inline-safe commands skip the queue when the
+ *  connection has nothing in work */
+static const CmdProcessor_Command commands[] = {
+        {"version", CMD_PRIORITY_CONTROL, 0, CMD_FLAG_INLINE,   CmdProcessor_cmd_version},
+        {"stats",   CMD_PRIORITY_CONTROL, 0, 0,                 CmdProcessor_cmd_stats},
+        {"account", CMD_PRIORITY_CONTROL, 0, 0,                 CmdProcessor_cmd_account},
+        {"profile", CMD_PRIORITY_CONTROL, 1, 0,                 CmdProcessor_cmd_profile},
+        {"shm",     CMD_PRIORITY_CONTROL, 0, CMD_FLAG_NO_BATCH, CmdProcessor_cmd_shm},
+        {"t_echo",  CMD_PRIORITY_NORMAL,  1, CMD_FLAG_INLINE,   CmdProcessor_cmd_echo},
+        {"t_tmt",   CMD_PRIORITY_BULK,    1, CMD_FLAG_NO_BATCH, CmdProcessor_cmd_tmt},
+        {"t_err",   CMD_PRIORITY_NORMAL,  1, CMD_FLAG_INLINE,   CmdProcessor_cmd_err},
+        {"t_re",    CMD_PRIORITY_NORMAL,  1, CMD_FLAG_NO_BATCH, CmdProcessor_cmd_re},
+};
+
+/** Find registered command by name. Name is not required to be zero terminated and may contain zero bytes. Return NULL
+ *  if command is unknown */
+const CmdProcessor_Command* CmdProcessor_findCommand(const char *name, size_t len) {
+    for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+        if (strlen(commands[i].name) == len && memcmp(commands[i].name, name, len) == 0)
+            return &commands[i];
     }
-    write(sockfd, resp, strlen(resp));
-    if (mf)
-        pfree(resp);
+
+    return NULL;
+}
+
+/** Internal function. Find command of the raw text packet. It only looks for the command name without any copying.
+ *  Return NULL for batches, broken packets and unknown commands */
+static const CmdProcessor_Command* CmdProcessor_lookupText(const char *packet, size_t len) {
+    if (len > 1 && packet[0] == 'b' && packet[1] == '\t')
+        return NULL;
+    const char *end = packet + len;
+    const char *name = packet;
+    for (int tabs = 0; tabs < 2; tabs++) {
+        name = memchr(name, '\t', end - name);
+        if (name == NULL)
+            return NULL;
+        name++;
+    }
+
+    const char *nameEnd = name;
+    while (nameEnd < end && *nameEnd != ' ' && *nameEnd != '\t' && *nameEnd != '\r')
+        nameEnd++;
+
+    return CmdProcessor_findCommand(name, nameEnd - name);
+}
+
+/** Internal function. Find command of the binary packet payload. Command name is the first argument after the
+ *  options. Return NULL for batches, broken packets and unknown commands */
+static const CmdProcessor_Command* CmdProcessor_lookupBinary(uint8_t type, const char *payload, size_t len,
+                                                             uint16_t flags) {
+    if (type == 'b')
+        return NULL;
+    size_t pos = CmdProcessor_binaryOptionsSize(flags);
+    uint32_t nameLen;
+    if (len < pos + sizeof(nameLen))
+        return NULL;
+    memcpy(&nameLen, payload + pos, sizeof(nameLen));
+    pos += sizeof(nameLen);
+    if (nameLen > len - pos)
+        return NULL;
+
+    return CmdProcessor_findCommand(payload + pos, nameLen);
+}
+
+/** Set priority of the frame and whether it may be executed inline by the command of it's packet. It is called by the
+ *  reader for each received packet. Broken packets and unknown commands have normal priority */
+void CmdProcessor_classify(Frame *frame) {
+    const CmdProcessor_Command *command = frame->mode == OTPP_MODE_BINARY
+            ? CmdProcessor_lookupBinary(frame->type, frame->data, frame->len, frame->flags)
+            : CmdProcessor_lookupText(frame->data, frame->len);
+
+    frame->priority = command != NULL ? command->priority : (uint8_t) CMD_PRIORITY_NORMAL;
+    frame->inlineSafe = command != NULL && (command->flags & CMD_FLAG_INLINE);
 }
 
 
 //=========================================== THREAD FUNCTION =============================================
 
-/** Main thread function. It parses incoming packets and execute some commands based on it`s content */
-void CmdProcessor_run(void *args) {
-    Logger_info("CmdProcessor", "Command processor thread was started");
+/** Internal function. Run handler of the command, accounting resources consumed by it when accounting is enabled.
+ *  Handler time of the slow log trace does not include the response writes */
+static void CmdProcessor_invoke(const CmdProcessor_Command *command, uint32_t packetId, Connection *conn,
+                                uint16_t argc, char **argv, uint32_t *argl) {
+    Accounting_Mark mark;
+    bool accounted = Accounting_enabled();
+    if (accounted)
+        Accounting_begin(&mark);
+    uint64_t writes = trace != NULL ? trace->writeNanos : 0;
+    uint64_t start = trace != NULL ? FastMonotonicNanos() : 0;
+
+    command->run(packetId, conn, argc, argv, argl);
+
+    if (trace != NULL)
+        trace->handlerNanos += FastMonotonicNanos() - start - (trace->writeNanos - writes);
+    if (accounted)
+        Accounting_end(&mark, command->name, conn->uid);
+}
 
-    CmdProcessor_Args *params = (CmdProcessor_Args*) args;
+/** Internal function. Record command name and argument sizes of the packet to the slow log trace */
+static void CmdProcessor_traceCommand(uint16_t argc, char **argv, uint32_t *argl) {
+    strncpy(trace->command, argv[0], SLOWLOG_NAME_MAX - 1);
+    trace->command[SLOWLOG_NAME_MAX - 1] = 0;
+    trace->argc = (uint16_t) (argc - 1);
+    for (uint16_t i = 1; i < argc && i <= SLOWLOG_MAX_ARGS; i++)
+        trace->argSizes[i - 1] = argl[i];
+}
 
-    LinkedBlockingQueue *cmdQueue = params->cmdQueue;
-    while(params->alive) {
-        if (cmdQueue->size(cmdQueue) > 0) {
-            char *cmd = cmdQueue->dequeue(cmdQueue);
-            char *spl = strtok(cmd, "\t");
-            List *fields = new_List();
+/** Internal function. Run handler of the command in the execution slot of the client. Responses are held while the
+ *  slot is taken and are written after it is returned */
+static void CmdProcessor_invokeInSlot(const CmdProcessor_Command *command, uint32_t packetId, Connection *conn,
+                                      uint16_t argc, char **argv, uint32_t *argl) {
+    char buf[CMD_PROCESSOR_RESPONSE_BUF];
+    CmdProcessor_Held collector = {buf, 0, sizeof(buf), false, {0}, 0};
+
+    Clients_enter(conn->client);
+    held = &collector;
+    CmdProcessor_invoke(command, packetId, conn, argc, argv, argl);
+    held = NULL;
+    Clients_leave();
+
+    uint64_t start = CmdProcessor_writeBegin(packetId);
+    CmdProcessor_flushHeld(conn, &collector);
+    CmdProcessor_writeEnd(start);
+    if (collector.allocated)
+        pfree(collector.data);
+}
 
-            while (spl != NULL)  {
-                fields->prepend(fields, strcpy2(spl));
-                spl = strtok (NULL, "\t");
-            }
+/** Internal function. Execute command of the parsed packet. Inside the batch execution slot is already taken for the
+ *  whole batch. Control commands and inline-safe ones don't take the slot */
+static void CmdProcessor_execute(CmdProcessor_Args *params, uint32_t packetId, uint16_t argc, char **argv,
+                                 uint32_t *argl) {
+    if (trace != NULL && batch == NULL)
+        CmdProcessor_traceCommand(argc, argv, argl);
+    Client *client = params->conn->client;
+    if (client != NULL && !Clients_admit(client)) {
+        Stats_inc(STATS_REQUESTS_THROTTLED);
+        CmdProcessor_respondCached(params->conn, &throttleResponse, packetId);
+        return;
+    }
 
-            //----------------------------------------------------------------------------
-
-            if (fields->size < 3) {
-                pfree(cmd);
-                pfree(spl);
-                ListIterator *iterator = fields->iterator(fields);
-                while(iterator->hasNext(iterator)) {
-                    void *v = iterator->next(iterator);
-                    iterator->remove(iterator);
-                    pfree(v);
-                }
-                pfree(iterator);
-                pfree(fields);
-                continue;
-            }
+    const CmdProcessor_Command *command = CmdProcessor_findCommand(argv[0], argl[0]);
+    if (command == NULL) {
+        Logger_info("CmdProcessor", "Received unknown command '%s'", argv[0]);
+        CmdProcessor_respondCached(params->conn, &unknownCommandResponse, packetId);
+    } else if (argc - 1 < command->minArgs) {
+        CmdProcessor_notEnoughArgs(packetId, params->conn);
+    } else if (batch != NULL && (command->flags & CMD_FLAG_NO_BATCH)) {
+        CmdProcessor_respondCached(params->conn, &notBatchableResponse, packetId);
+    } else if (client != NULL && batch == NULL && command->priority != CMD_PRIORITY_CONTROL
+               && !(command->flags & CMD_FLAG_INLINE)) {
+        CmdProcessor_invokeInSlot(command, packetId, params->conn, argc, argv, argl);
+    } else {
+        CmdProcessor_invoke(command, packetId, params->conn, argc, argv, argl);
+    }
+}
 
-            char *packetType = fields->get(fields, 2); // Тип пакета
-            uint32_t packetId = (uint32_t) strtol(fields->get(fields, 1), NULL, 10); // Идентификатор пакета
-            List *packetElements = new_List(); // Элементы
-
-            if (packetId == 0) {
-                pfree(cmd);
-                pfree(spl);
-                ListIterator *iterator = fields->iterator(fields);
-                while(iterator->hasNext(iterator)) {
-                    void *v = iterator->next(iterator);
-                    iterator->remove(iterator);
-                    pfree(v);
-                }
-                pfree(iterator);
-                pfree(fields);
-
-                ListIterator *iterator2 = packetElements->iterator(packetElements);
-                while(iterator2->hasNext(iterator2)) {
-                    void *v = iterator2->next(iterator2);
-                    iterator2->remove(iterator2);
-                    pfree(v);
-                }
-                pfree(iterator2);
-                pfree(packetElements);
-                continue;
-            }
+/** Internal function. Start collecting of the batch results. All sub-commands are executed in one execution slot */
+static void CmdProcessor_batchBegin(CmdProcessor_Args *params, CmdProcessor_Batch *collector) {
+    collector->capacity = CMD_PROCESSOR_BATCH_BUF;
+    collector->data = pmalloc(collector->capacity);
+    collector->len = 0;
+    collector->mode = params->conn->mode;
+    collector->subId = 0;
+    collector->lastType = 0;
+    Stats_inc(STATS_BATCH_PACKETS);
+    if (trace != NULL)
+        strcpy(trace->command, "batch");
+    if (params->conn->client != NULL)
+        Clients_enter(params->conn->client);
+    batch = collector;
+}
 
-            char *inCmdSpl = strtok(fields->get(fields, 0), " ");
-            while (inCmdSpl != NULL)  {
-                if (strchr(inCmdSpl, '\r') != NULL) {
-                    size_t strLen = strlen(inCmdSpl);
-                    char *nInCmdSpl = pmalloc(strLen);
-                    nInCmdSpl[strLen - 1] = 0;
-
-                    strncpy(nInCmdSpl, inCmdSpl, strLen - 1);
-                    if (strlen(inCmdSpl) != 0)
-                        packetElements->prepend(packetElements, strcpy2(nInCmdSpl));
-                    pfree(nInCmdSpl);
-
-                } else {
-                    packetElements->prepend(packetElements, strcpy2(inCmdSpl));
-                }
-                inCmdSpl = strtok (NULL, " ");
-            }
+/** Internal function. Execute one sub-command of the batch. Return false if it was failed */
+static bool CmdProcessor_batchExecute(CmdProcessor_Args *params, uint32_t subId, uint16_t argc, char **argv,
+                                      uint32_t *argl) {
+    batch->subId = subId;
+    batch->lastType = 0;
+    Stats_inc(STATS_BATCH_COMMANDS);
+    if (argc == 0)
+        CmdProcessor_respondCached(params->conn, &brokenResponse, subId);
+    else
+        CmdProcessor_execute(params, subId, argc, argv, argl);
+
+    return batch->lastType != 'e';
+}
 
-            if (packetElements->size == 0) {
-                pfree(cmd);
-                pfree(spl);
-                ListIterator *iterator = fields->iterator(fields);
-                while(iterator->hasNext(iterator)) {
-                    void *v = iterator->next(iterator);
-                    iterator->remove(iterator);
-                    pfree(v);
-                }
-                pfree(iterator);
-                pfree(fields);
-
-                ListIterator *iterator2 = packetElements->iterator(packetElements);
-                while(iterator2->hasNext(iterator2)) {
-                    void *v = iterator2->next(iterator2);
-                    iterator2->remove(iterator2);
-                    pfree(v);
-                }
-                pfree(iterator2);
-                pfree(packetElements);
-                continue;
-            }
+/** Internal function. Write all collected results by one response */
+static void CmdProcessor_batchEnd(CmdProcessor_Args *params, uint32_t packetId) {
+    CmdProcessor_Batch *collector = batch;
+    batch = NULL;
+    if (params->conn->client != NULL)
+        Clients_leave();
+    CmdProcessor_respondData(params->conn, 'r', packetId, collector->data, collector->len);
+    pfree(collector->data);
+}
 
-            //----------------------------------------------
-
-            uint16_t cmdSize = packetElements->size;
-
-            char *cmdName = packetElements->get(packetElements, (uint16_t) (cmdSize - 1));
-
-            /*if (strcmp(cmdName, "readAdc") == 0) {
-                char *inNum = packetElements->get(packetElements, (uint16_t) (cmdSize - 2));
-                if (inNum != NULL) {
-                    long inNumInt = strtol(inNum, NULL, 10);
-                    if (inNumInt != 0) {
-                        CmdProcessor_cmd_adcRead(packetId, (uint8_t) inNumInt);
-                    } else {
-                        char *resp = CmdProcessor_createResponse("e", packetId, "First arg must be a number");
-                        Hardware_writeToUart(resp);
-                        pfree(resp);
-                    }
-                } else {
-                    char *resp = CmdProcessor_createResponse("e", packetId, "Not enough arguments");
-                    Hardware_writeToUart(resp);
-                    pfree(resp);
-                }
-            }*/
-
-            if (strcmp(cmdName, "version") == 0) {
-                CmdProcessor_cmd_version(packetId, params->sockfd);
-            } else if (strcmp(cmdName, "t_echo") == 0) {
-                char *str = packetElements->get(packetElements, (uint16_t) (cmdSize - 2));
-                if (str != NULL)
-                    CmdProcessor_cmd_echo(packetId, params->sockfd, str);
-                else
-                    CmdProcessor_notEnoughArgs(packetId, params->sockfd);
-            } else if (strcmp(cmdName, "t_tmt") == 0) {
-                char *delay = packetElements->get(packetElements, (uint16_t) (cmdSize - 2));
-                if (delay != NULL) {
-                    long delayInt = strtol(delay, NULL, 10);
-                    if (delayInt != 0) {
-                        CmdProcessor_cmd_tmt(packetId, params->sockfd, delayInt);
-                    } else {
-                        char *resp = CmdProcessor_createResponse("e", packetId, "First arg must be a number");
-                        write(params->sockfd, resp, strlen(resp));
-                        pfree(resp);
-                    }
-                } else {
-                    CmdProcessor_notEnoughArgs(packetId, params->sockfd);
-                }
-            } else if (strcmp(cmdName, "t_err") == 0) {
-                char *str = packetElements->get(packetElements, (uint16_t) (cmdSize - 2));
-                if (str != NULL)
-                    CmdProcessor_cmd_err(packetId, params->sockfd, str);
-                else
-                    CmdProcessor_notEnoughArgs(packetId, params->sockfd);
-            } else if (strcmp(cmdName, "t_re") == 0) {
-                char *type = packetElements->get(packetElements, (uint16_t) (cmdSize - 2));
-                if (type != NULL)
-                    CmdProcessor_cmd_re(packetId, params->sockfd, type);
-                else
-                    CmdProcessor_notEnoughArgs(packetId, params->sockfd);
-            } else {
-                Logger_info("CmdProcessor", "Received unknown command '%s'", cmdName);
-                char *resp = CmdProcessor_createResponse("e", packetId, "Unknown command");
-                write(params->sockfd, resp, strlen(resp));
-                pfree(resp);
-            }
+/** Internal function. Reject the packet which deadline has passed */
+static void CmdProcessor_shed(CmdProcessor_Args *params, uint32_t packetId) {
+    //Client has already given up waiting for this request, so it's execution would only extend the backlog
+    Stats_inc(STATS_REQUESTS_SHED);
+    CmdProcessor_respondCached(params->conn, &deadlineResponse, packetId);
+}
 
-            pfree(cmd);
-            if (cmd != NULL)
-                pfree(spl);
-            if (inCmdSpl != NULL)
-                pfree(inCmdSpl);
-            ListIterator *iterator = fields->iterator(fields);
-            while(iterator->hasNext(iterator)) {
-                void *v = iterator->next(iterator);
-                iterator->remove(iterator);
-                pfree(v);
-            }
-            pfree(iterator);
-            pfree(fields);
-
-            ListIterator *iterator2 = packetElements->iterator(packetElements);
-            while(iterator2->hasNext(iterator2)) {
-                void *v = iterator2->next(iterator2);
-                iterator2->remove(iterator2);
-                pfree(v);
-            }
-            pfree(iterator2);
-            pfree(packetElements);
-        } else {
-            DelayMillis(100);
+/** Internal function. Split command to the space separated args in place. Return count of args */
+static uint16_t CmdProcessor_splitArgs(char *command, char **argv, uint32_t *argl) {
+    uint16_t argc = 0;
+    char *save;
+    char *arg = strtok_r(command, " ", &save);
+    while (arg != NULL && argc < CMD_PROCESSOR_MAX_ARGS) {
+        argl[argc] = (uint32_t) strlen(arg);
+        argv[argc++] = arg;
+        arg = strtok_r(NULL, " ", &save);
+    }
+
+    return argc;
+}
+
+/** Internal function. Execute sub-commands of the text batch packet. Packet has form
+ *  'b<TAB>msgId<TAB>subId command args...<TAB>subId command args...[<TAB>@option...]<CR>'. Besides the deadline
+ *  options, option '@mode=stop' stops the batch on the first failed sub-command, by default all sub-commands are
+ *  executed. Response content is the tab separated list of '<subId> <r|e> <content>' of the executed sub-commands */
+static void CmdProcessor_processTextBatch(CmdProcessor_Args *params, Frame *frame, uint32_t packetId, char **fields,
+                                          uint16_t count) {
+    if (CmdProcessor_isExpired(frame, fields, count)) {
+        CmdProcessor_shed(params, packetId);
+        return;
+    }
+
+    bool stopOnError = false;
+    uint16_t subCount = 0;
+    for (uint16_t i = 0; i < count; i++) {
+        if (strcmp(fields[i], "@mode=stop") == 0)
+            stopOnError = true;
+        else if (fields[i][0] != '@')
+            subCount++;
+    }
+    if (subCount > CMD_PROCESSOR_MAX_BATCH) {
+        CmdProcessor_respond(params->conn, 'e', packetId, "Too many commands in batch");
+        return;
+    }
+
+    CmdProcessor_Batch collector;
+    CmdProcessor_batchBegin(params, &collector);
+    for (uint16_t i = 0; i < count; i++) {
+        if (fields[i][0] == '@')
+            continue;
+        char *argv[CMD_PROCESSOR_MAX_ARGS];
+        uint32_t argl[CMD_PROCESSOR_MAX_ARGS];
+        uint16_t argc = CmdProcessor_splitArgs(fields[i], argv, argl);
+        uint32_t subId = 0;
+        if (argc > 0 && atou32(argv[0], NULL, &subId) == NULL)
+            argc = 0;
+        bool ok = CmdProcessor_batchExecute(params, subId, argc > 0 ? (uint16_t) (argc - 1) : 0, argv + 1, argl + 1);
+        if (!ok && stopOnError)
+            break;
+    }
+    CmdProcessor_batchEnd(params, packetId);
+}
+
+/** Internal function. Parse text packet in place and execute command from it. Packet has form
+ *  'type<TAB>msgId<TAB>command args...[<TAB>@option...]<CR>', broken packets are silently dropped */
+static void CmdProcessor_processText(CmdProcessor_Args *params, Frame *frame) {
+    char *packet = frame->data;
+    if (frame->len > 0 && packet[frame->len - 1] == '\r')
+        packet[frame->len - 1] = 0;
+
+    char *fields[CMD_PROCESSOR_MAX_FIELDS];
+    uint16_t fieldsCount = 0;
+    char *save;
+    char *field = strtok_r(packet, "\t", &save);
+    while (field != NULL && fieldsCount < CMD_PROCESSOR_MAX_FIELDS) {
+        fields[fieldsCount++] = field;
+        field = strtok_r(NULL, "\t", &save);
+    }
+
+    if (fieldsCount < 3)
+        return;
+
+    uint32_t packetId = 0;
+    atou32(fields[1], NULL, &packetId);
+    if (packetId == 0)
+        return;
+
+    if (fields[0][0] == 'b' && fields[0][1] == 0) {
+        if (field != NULL)
+            CmdProcessor_respond(params->conn, 'e', packetId, "Too many commands in batch");
+        else
+            CmdProcessor_processTextBatch(params, frame, packetId, fields + 2, (uint16_t) (fieldsCount - 2));
+        return;
+    }
+
+    if (CmdProcessor_isExpired(frame, fields + 3, (uint16_t) (fieldsCount - 3))) {
+        CmdProcessor_shed(params, packetId);
+        return;
+    }
+
+    char *argv[CMD_PROCESSOR_MAX_ARGS];
+    uint32_t argl[CMD_PROCESSOR_MAX_ARGS];
+    uint16_t argc = CmdProcessor_splitArgs(fields[2], argv, argl);
+    if (argc == 0)
+        return;
+
+    CmdProcessor_execute(params, packetId, argc, argv, argl);
+}
+
+/** Internal function. Execute sub-commands of the binary batch packet. Sub-commands bounds are collected before the
+ *  execution, because splitting of the sub-command args overwrites the first byte of the next sub-command */
+static void CmdProcessor_processBinaryBatch(CmdProcessor_Args *params, Frame *frame, uint32_t packetId, uint32_t pos) {
+    uint32_t ids[CMD_PROCESSOR_MAX_BATCH];
+    uint32_t offsets[CMD_PROCESSOR_MAX_BATCH];
+    uint32_t sizes[CMD_PROCESSOR_MAX_BATCH];
+    uint16_t count = 0;
+    while (pos < frame->len) {
+        if (frame->len - pos < 2 * sizeof(uint32_t))
+            return;
+        if (count == CMD_PROCESSOR_MAX_BATCH) {
+            CmdProcessor_respond(params->conn, 'e', packetId, "Too many commands in batch");
+            return;
+        }
+        memcpy(&ids[count], frame->data + pos, sizeof(uint32_t));
+        memcpy(&sizes[count], frame->data + pos + sizeof(uint32_t), sizeof(uint32_t));
+        pos += 2 * sizeof(uint32_t);
+        if (sizes[count] > frame->len - pos)
+            return;
+        offsets[count++] = pos;
+        pos += sizes[count - 1];
+    }
+
+    CmdProcessor_Batch collector;
+    CmdProcessor_batchBegin(params, &collector);
+    for (uint16_t i = 0; i < count; i++) {
+        char *argv[CMD_PROCESSOR_MAX_ARGS];
+        uint32_t argl[CMD_PROCESSOR_MAX_ARGS];
+        uint16_t argc = Otpp_splitArgs(frame->data + offsets[i], sizes[i], argv, argl, CMD_PROCESSOR_MAX_ARGS);
+        bool ok = CmdProcessor_batchExecute(params, ids[i], argc, argv, argl);
+        if (!ok && (frame->flags & OTPP_FLAG_STOP_ON_ERROR))
+            break;
+    }
+    CmdProcessor_batchEnd(params, packetId);
+}
+
+/** Internal function. Execute command from the binary packet. Arguments are terminated in place, so they are passed
+ *  to the handler without copying. Broken packets are silently dropped */
+static void CmdProcessor_processBinary(CmdProcessor_Args *params, Frame *frame) {
+    uint32_t packetId = frame->msgId;
+    uint32_t pos = CmdProcessor_binaryOptionsSize(frame->flags);
+    if (packetId == 0 || frame->len < pos)
+        return;
+
+    if (frame->flags & OTPP_FLAG_TIMEOUT) {
+        uint32_t timeout;
+        memcpy(&timeout, frame->data, sizeof(timeout));
+        if (FastMonotonicNanos() - frame->arrival >= timeout * NANOS_IN_MILLI) {
+            CmdProcessor_shed(params, packetId);
+            return;
+        }
+    }
+    if (frame->flags & OTPP_FLAG_DEADLINE) {
+        uint64_t deadline;
+        memcpy(&deadline, frame->data + pos - sizeof(deadline), sizeof(deadline));
+        if (RealTimeMillis() >= deadline) {
+            CmdProcessor_shed(params, packetId);
+            return;
+        }
+    }
+
+    if (frame->type == 'b') {
+        CmdProcessor_processBinaryBatch(params, frame, packetId, pos);
+        return;
+    }
+
+    char *argv[CMD_PROCESSOR_MAX_ARGS];
+    uint32_t argl[CMD_PROCESSOR_MAX_ARGS];
+    uint16_t argc = Otpp_splitArgs(frame->data + pos, frame->len - pos, argv, argl, CMD_PROCESSOR_MAX_ARGS);
+    if (argc == 0)
+        return;
+
+    CmdProcessor_execute(params, packetId, argc, argv, argl);
+}
+
+/** Internal function. Execute packet in it's framing. Packet that was too big to be received is answered by error */
+static void CmdProcessor_process(CmdProcessor_Args *params, Frame *frame) {
+    if (frame->oversized)
+        CmdProcessor_respondCached(params->conn, &oversizedResponse, frame->msgId);
+    else if (frame->mode == OTPP_MODE_BINARY)
+        CmdProcessor_processBinary(params, frame);
+    else
+        CmdProcessor_processText(params, frame);
+}
+
+/** Internal function. Start slow log trace of the packet taken for execution */
+static void CmdProcessor_traceBegin(SlowLog_Trace *packet, Frame *frame) {
+    memset(packet, 0, sizeof(SlowLog_Trace));
+    packet->msgId = frame->msgId;
+    packet->arrival = frame->arrival;
+    packet->depth = frame->depth;
+    packet->dequeued = FastMonotonicNanos();
+    trace = packet;
+}
+
+/** Internal function. Pass traces of the packets, which responses were just written, to the slow log */
+static void CmdProcessor_traceEnd(Connection *conn, SlowLog_Trace *packets, uint16_t count) {
+    uint64_t end = FastMonotonicNanos();
+    for (uint16_t i = 0; i < count; i++)
+        SlowLog_check(&packets[i], conn, end);
+}
+
+/** Execute packet of the inline-safe command by the reader itself, if all earlier packets of the connection were
+ *  answered, so responses keep the order of requests. Return false if the packet must be queued. Must be called by the
+ *  reader of the connection */
+bool CmdProcessor_tryInline(CmdProcessor_Args *cpa, Frame *frame) {
+    if (!frame->inlineSafe || __atomic_load_n(&cpa->finished, __ATOMIC_ACQUIRE) != cpa->queued)
+        return false;
+
+    Stats_inc(STATS_REQUESTS_INLINE);
+    SlowLog_Trace packet;
+    bool traced = SlowLog_enabled();
+    if (traced)
+        CmdProcessor_traceBegin(&packet, frame);
+    CmdProcessor_process(cpa, frame);
+    if (traced) {
+        trace = NULL;
+        CmdProcessor_traceEnd(cpa->conn, &packet, 1);
+    }
+    Frame_free(frame);
+
+    return true;
+}
+
+/** Return true if all packets queued to the processor were executed and nothing else refers the connection (timer
+ *  callbacks, sends in flight, shm transport), so it owes no responses. Must be called by the reader of the connection,
+ *  that is the only one who queues packets */
+bool CmdProcessor_idle(CmdProcessor_Args *cpa) {
+    //Reader and processor own one reference each
+    return __atomic_load_n(&cpa->finished, __ATOMIC_ACQUIRE) == cpa->queued
+           && __atomic_load_n(&cpa->conn->refs, __ATOMIC_ACQUIRE) == 2;
+}
+
+/** Main thread function. It takes packets from the connection queue, highest priority lane first, and executes
+ *  commands from them */
+void CmdProcessor_run(void *args) {
+    Logger_info("CmdProcessor", "Command processor thread was started");
+
+    CmdProcessor_Args *params = (CmdProcessor_Args*) args;
+
+    MultiLaneQueue *cmdQueue = params->cmdQueue;
+    while(__atomic_load_n(&params->alive, __ATOMIC_ACQUIRE)) {
+        Frame *frame = cmdQueue->take(cmdQueue, CMD_PROCESSOR_IDLE_TIMEOUT);
+        if (frame == NULL)
+            continue;
+
+        //When more packets are already queued, connection is corked, so their responses are written together
+        bool corked = cmdQueue->size(cmdQueue) > 0;
+        if (corked)
+            Connection_cork(params->conn);
+        SlowLog_Trace packets[CMD_PROCESSOR_CORK_FRAMES];
+        bool traced = SlowLog_enabled();
+        uint16_t count = 0;
+        do {
+            Stats_add(STATS_QUEUE_DEPTH_CONTROL + frame->priority, -1);
+            if (traced)
+                CmdProcessor_traceBegin(&packets[count], frame);
+            CmdProcessor_process(params, frame);
+            trace = NULL;
+            Frame_free(frame);
+            count++;
+        } while (corked && count < CMD_PROCESSOR_CORK_FRAMES && (frame = cmdQueue->dequeue(cmdQueue)) != NULL);
+        if (corked) {
+            uint64_t start = traced ? FastMonotonicNanos() : 0;
+            Connection_uncork(params->conn);
+            //Corked responses are written together, so each of them waits for the whole flush
+            uint64_t flush = traced ? FastMonotonicNanos() - start : 0;
+            for (uint16_t i = 0; traced && i < count; i++)
+                packets[i].writeNanos += flush;
         }
+        if (traced)
+            CmdProcessor_traceEnd(params->conn, packets, count);
+        //Packets are counted only when their responses have left the cork buffer
+        __atomic_add_fetch(&params->finished, count, __ATOMIC_RELEASE);
     }
 
+    Connection_release(params->conn);
     free(args);
     while(cmdQueue->size(cmdQueue) > 0) {
-        char *v = cmdQueue->dequeue(cmdQueue);
-        free(v);
+        Frame *v = cmdQueue->dequeue(cmdQueue);
+        Stats_add(STATS_QUEUE_DEPTH_CONTROL + v->priority, -1);
+        Frame_free(v);
     }
-    del_LQB(cmdQueue);
+    del_MLQ(cmdQueue);
 
     Logger_info("CmdProcessor", "Command processor thread was stopped");
-}
\ No newline at end of file
+}
+
+/** Stop the command processor of the closed connection. Queue is closed first, so the processor returns it's worker
+ *  to the pool right away instead of after the idle timeout. Processor frees the queue and the arguments once it sees
+ *  the cleared alive flag, so they are not touched after it */
+void CmdProcessor_stop(CmdProcessor_Args *cpa) {
+    cpa->cmdQueue->close(cpa->cmdQueue);
+    __atomic_store_n(&cpa->alive, false, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,89 @@
+/** Daemon configuration. Configuration file consists of lines in form 'key = value', lines started with '#' are
+ *  comments. Absence of the file is not an error, in this case all parameters have default values. The file is read
+ *  once at start, so values may be read from any thread without locks */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../inc/config.h"
+#include "../inc/logger.h"
+#include "../libs/collections/include/map2.h"
+#include "../libs/oscl/include/data.h"
+
+static Map *values = NULL;
+
+/** Internal function. Cut whitespaces from the both sides of the string in place */
+static char* Config_trim(char *str) {
+    while (isspace((unsigned char) *str))
+        str++;
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char) end[-1]))
+        end--;
+    *end = 0;
+
+    return str;
+}
+
+/** Load configuration from the file. Return false if file exists but can't be read */
+bool Config_load(const char *path) {
+    if (values == NULL)
+        values = MAP_new();
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        Logger_info("Config", "Configuration file '%s' not found, defaults are used", path);
+        return true;
+    }
+
+    char line[512];
+    uint32_t lineNum = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineNum++;
+        char *str = Config_trim(line);
+        if (*str == 0 || *str == '#')
+            continue;
+
+        char *eq = strchr(str, '=');
+        if (eq == NULL) {
+            Logger_fatal("Config", "Incorrect line %d in '%s'", lineNum, path);
+            continue;
+        }
+        *eq = 0;
+        char *key = Config_trim(str);
+        char *value = Config_trim(eq + 1);
+        if (MAP_contain(key, values))
+            pfree(MAP_remove(key, values));
+        MAP_add(key, strcpy2(value), values);
+    }
+
+    fclose(f);
+    Logger_info("Config", "Configuration was loaded from '%s'", path);
+
+    return true;
+}
+
+/** Return string parameter or default value if parameter is not defined */
+const char* Config_getString(const char *key, const char *def) {
+    if (values == NULL)
+        return def;
+    char *value = MAP_get((char*) key, values);
+
+    return value != NULL ? value : def;
+}
+
+/** Return integer parameter or default value if parameter is not defined or is not a number */
+int64_t Config_getInt(const char *key, int64_t def) {
+    const char *value = Config_getString(key, NULL);
+    if (value == NULL)
+        return def;
+
+    char *end;
+    int64_t num = strtoll(value, &end, 10);
+    if (end == value || *end != 0) {
+        Logger_fatal("Config", "Parameter '%s' must be a number", key);
+        return def;
+    }
+
+    return num;
+}
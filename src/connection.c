@@ -0,0 +1,460 @@
+/** Reference counted client connection. Responses may be written to it from several threads (command processor and
+ *  timer callbacks), so each response is written whole under the write mutex. Command processor corks connection
+ *  while it executes packets that was already queued, so their responses are written by one syscall: single write
+ *  for the stream socket and sendmmsg for the seqpacket socket, where each response must stay a separate message.
+ *  Connection served by the io_uring engine collects responses while the previous send is in flight, they are
+ *  submitted to the ring by the completion of that send. Accepted connections are listed, so the upgrade can find
+ *  connections that are still served by this process */
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include "../inc/connection.h"
+#include "../inc/otpp.h"
+#include "../inc/shm_transport.h"
+#include "../inc/uring_engine.h"
+#include "../inc/stats.h"
+#include "../libs/oscl/include/malloc.h"
+
+/** List of the accepted connections */
+static Connection *openConns = NULL;
+static mutex_t openMutex = MUTEX_INITIALIZER("connection.open");
+/** Last assigned connection id */
+static uint32_t lastId = 0;
+
+/** Create connection for accepted socket. Created connection has one reference owned by caller */
+Connection* Connection_new(int sockfd) {
+    Connection *conn = pmalloc(sizeof(Connection));
+    conn->id = __atomic_add_fetch(&lastId, 1, __ATOMIC_RELAXED);
+    conn->sockfd = sockfd;
+    conn->refs = 1;
+    conn->open = true;
+    conn->writeMutex = NewMutex("connection.write");
+    conn->uid = (uid_t) -1;
+    conn->pid = 0;
+    conn->client = NULL;
+    conn->mode = OTPP_MODE_TEXT;
+    conn->framed = false;
+    conn->passed = false;
+    conn->seqpacket = false;
+    conn->corked = false;
+    conn->corkBuf = NULL;
+    conn->corkLen = 0;
+    conn->corkCount = 0;
+    conn->shm = NULL;
+    conn->shmOpened = false;
+    conn->uring = NULL;
+    conn->sendBuf = NULL;
+    conn->sendLen = 0;
+    conn->sendOff = 0;
+    conn->sending = 0;
+    conn->sent = NULL;
+    conn->inlining = false;
+    conn->hasReader = false;
+    conn->prevOpen = NULL;
+    conn->nextOpen = NULL;
+
+    return conn;
+}
+
+/** Create connection for the socket accepted by the listener and capture peer credentials */
+Connection* Connection_accepted(int sockfd, bool seqpacket) {
+    Connection *conn = Connection_new(sockfd);
+    conn->seqpacket = seqpacket;
+    struct ucred cred;
+    socklen_t credLen = sizeof(cred);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) == 0) {
+        conn->uid = cred.uid;
+        conn->pid = cred.pid;
+        conn->client = Clients_attach(cred.uid, cred.pid);
+    }
+
+    MutexLock(&openMutex);
+    conn->nextOpen = openConns;
+    if (openConns != NULL)
+        openConns->prevOpen = conn;
+    openConns = conn;
+    MutexUnlock(&openMutex);
+
+    return conn;
+}
+
+void Connection_retain(Connection *conn) {
+    __atomic_fetch_add(&conn->refs, 1, __ATOMIC_RELAXED);
+}
+
+/** Release reference to the connection. Last release closes socket and frees connection */
+void Connection_release(Connection *conn) {
+    if (__atomic_sub_fetch(&conn->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        if (conn->sockfd >= 0) {
+            //Only accepted connections have socket
+            MutexLock(&openMutex);
+            if (conn->prevOpen != NULL)
+                conn->prevOpen->nextOpen = conn->nextOpen;
+            else
+                openConns = conn->nextOpen;
+            if (conn->nextOpen != NULL)
+                conn->nextOpen->prevOpen = conn->prevOpen;
+            MutexUnlock(&openMutex);
+            close(conn->sockfd);
+        }
+        if (conn->shm != NULL)
+            ShmTransport_free(conn->shm);
+        if (conn->client != NULL)
+            Clients_detach(conn->client);
+        DelMutex(conn->writeMutex);
+        if (conn->corkBuf != NULL)
+            pfree(conn->corkBuf);
+        if (conn->sendBuf != NULL)
+            pfree(conn->sendBuf);
+        if (conn->sent != NULL)
+            DelCond(conn->sent);
+        pfree(conn);
+    }
+}
+
+/** Mark connection as closed by peer. All following writes will be dropped */
+void Connection_shutdown(Connection *conn) {
+    conn->open = false;
+    if (conn->sockfd >= 0)
+        shutdown(conn->sockfd, SHUT_RDWR);
+}
+
+/** Internal function. Write whole data block by the write calls. Must be called under the write mutex */
+static ssize_t Connection_writeLocked(Connection *conn, const char *data, size_t len) {
+    size_t written = 0;
+    while (written < len) {
+        ssize_t r = write(conn->sockfd, data + written, len - written);
+        Stats_inc(STATS_IO_SYSCALLS);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        written += r;
+    }
+
+    return written;
+}
+
+/** Internal function. Write collected responses. Seqpacket messages are sent by sendmmsg, stream data by one write.
+ *  Connection of the io_uring engine submits them to the ring, unless previous send is still in flight. Must be
+ *  called under the write mutex */
+static void Connection_flushLocked(Connection *conn) {
+    if (conn->corkCount == 0)
+        return;
+
+    if (conn->uring != NULL) {
+        if (conn->sending > 0)
+            return;
+        //Submitted buffer must stay untouched until the send is completed, so buffers are swapped
+        char *buf = conn->sendBuf != NULL ? conn->sendBuf : pmalloc(CONNECTION_CORK_BUF);
+        conn->sendBuf = conn->corkBuf;
+        conn->corkBuf = buf;
+        conn->sendLen = (uint32_t) conn->corkLen;
+        conn->sendOff = 0;
+        Connection_retain(conn); //Released by the last completion of the send
+        conn->sending = UringEngine_send(conn->uring, conn, conn->sendBuf, conn->corkEnds, conn->corkCount);
+        if (conn->sending == 0)
+            Connection_release(conn);
+    } else if (conn->seqpacket) {
+        struct mmsghdr msgs[CONNECTION_CORK_MESSAGES];
+        struct iovec iov[CONNECTION_CORK_MESSAGES];
+        memset(msgs, 0, conn->corkCount * sizeof(struct mmsghdr));
+        uint32_t start = 0;
+        for (uint16_t i = 0; i < conn->corkCount; i++) {
+            iov[i].iov_base = conn->corkBuf + start;
+            iov[i].iov_len = conn->corkEnds[i] - start;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            start = conn->corkEnds[i];
+        }
+        uint16_t sent = 0;
+        while (sent < conn->corkCount) {
+            int r = sendmmsg(conn->sockfd, msgs + sent, conn->corkCount - sent, 0);
+            Stats_inc(STATS_IO_SYSCALLS);
+            if (r < 0) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            sent += r;
+        }
+    } else {
+        Connection_writeLocked(conn, conn->corkBuf, conn->corkLen);
+    }
+
+    conn->corkLen = 0;
+    conn->corkCount = 0;
+}
+
+/** Internal function. Wait until the send submitted to the io_uring is completed. Must be called under the write
+ *  mutex */
+static void Connection_waitSentLocked(Connection *conn) {
+    while (conn->sending > 0)
+        CondWait(conn->sent, conn->writeMutex);
+}
+
+/** Internal function. Wait until the io_uring loop collects the response of the packet that it executes inline, so
+ *  the loop never waits for the space in the cork buffer. Must be called under the write mutex */
+static void Connection_waitInlineLocked(Connection *conn) {
+    while (conn->inlining && !pthread_equal(pthread_self(), conn->uring->loop))
+        CondWait(conn->sent, conn->writeMutex);
+}
+
+/** Internal function. Append response to the cork buffer. Return false if it does not fit even to the empty buffer,
+ *  in this case collected responses are flushed, so response may be written directly without reordering. Must be
+ *  called under the write mutex */
+static bool Connection_appendLocked(Connection *conn, const struct iovec *iov, int count) {
+    size_t len = 0;
+    for (int i = 0; i < count; i++)
+        len += iov[i].iov_len;
+    if (len > CONNECTION_CORK_BUF) {
+        Connection_waitSentLocked(conn);
+        Connection_flushLocked(conn);
+        Connection_waitSentLocked(conn);
+        return false;
+    }
+    if (conn->corkLen + len > CONNECTION_CORK_BUF || conn->corkCount == CONNECTION_CORK_MESSAGES) {
+        Connection_waitSentLocked(conn);
+        Connection_flushLocked(conn);
+    }
+    if (conn->corkBuf == NULL)
+        conn->corkBuf = pmalloc(CONNECTION_CORK_BUF);
+
+    for (int i = 0; i < count; i++) {
+        memcpy(conn->corkBuf + conn->corkLen, iov[i].iov_base, iov[i].iov_len);
+        conn->corkLen += iov[i].iov_len;
+    }
+    conn->corkEnds[conn->corkCount++] = (uint32_t) conn->corkLen;
+
+    return true;
+}
+
+/** Write whole data block to the connection. Return count of written bytes or -1 if connection is closed or write was
+ *  failed. On the corked connection block is only collected, connection of the io_uring engine submits it and does
+ *  not wait for the send completion */
+ssize_t Connection_write(Connection *conn, const char *data, size_t len) {
+    if (!conn->open)
+        return -1;
+
+    MutexLock(conn->writeMutex);
+    Connection_waitInlineLocked(conn);
+    struct iovec iov = {(void*) data, len};
+    if (conn->shm != NULL) {
+        ssize_t written = ShmTransport_write(conn->shm, &iov, 1);
+        MutexUnlock(conn->writeMutex);
+        return written;
+    }
+    bool collected = (conn->corked || conn->uring != NULL) && Connection_appendLocked(conn, &iov, 1);
+    ssize_t written = collected ? (ssize_t) len : Connection_writeLocked(conn, data, len);
+    if (collected && !conn->corked)
+        Connection_flushLocked(conn);
+    MutexUnlock(conn->writeMutex);
+
+    return written;
+}
+
+/** Write whole blocks list to the connection with one syscall if the socket accepts it at once. Iov entries are
+ *  modified. Return count of written bytes or -1 if connection is closed or write was failed. On the corked connection
+ *  blocks are only collected */
+ssize_t Connection_writev(Connection *conn, struct iovec *iov, int count) {
+    if (!conn->open)
+        return -1;
+
+    MutexLock(conn->writeMutex);
+    Connection_waitInlineLocked(conn);
+    if (conn->shm != NULL) {
+        ssize_t written = ShmTransport_write(conn->shm, iov, count);
+        MutexUnlock(conn->writeMutex);
+        return written;
+    }
+    size_t written = 0;
+    if ((conn->corked || conn->uring != NULL) && Connection_appendLocked(conn, iov, count)) {
+        for (int i = 0; i < count; i++)
+            written += iov[i].iov_len;
+        if (!conn->corked)
+            Connection_flushLocked(conn);
+        MutexUnlock(conn->writeMutex);
+        return written;
+    }
+    while (count > 0) {
+        ssize_t r = writev(conn->sockfd, iov, count);
+        Stats_inc(STATS_IO_SYSCALLS);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            MutexUnlock(conn->writeMutex);
+            return -1;
+        }
+        written += r;
+        while (count > 0 && (size_t) r >= iov->iov_len) {
+            r -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*) iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+    MutexUnlock(conn->writeMutex);
+
+    return written;
+}
+
+/** Write whole data block and pass descriptor with it. Collected responses are written before it. Return count of
+ *  written bytes or -1 if connection is closed or write was failed */
+ssize_t Connection_sendFd(Connection *conn, const char *data, size_t len, int fd) {
+    if (!conn->open || conn->sockfd < 0)
+        return -1;
+
+    MutexLock(conn->writeMutex);
+    Connection_waitInlineLocked(conn);
+    Connection_waitSentLocked(conn);
+    Connection_flushLocked(conn);
+    Connection_waitSentLocked(conn);
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {(void*) data, len};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t r;
+    do {
+        r = sendmsg(conn->sockfd, &msg, 0);
+        Stats_inc(STATS_IO_SYSCALLS);
+    } while (r < 0 && errno == EINTR);
+    //Descriptor goes with the first byte, the rest of the stream socket data is written as usual
+    if (r >= 0 && (size_t) r < len && Connection_writeLocked(conn, data + r, len - r) < 0)
+        r = -1;
+    MutexUnlock(conn->writeMutex);
+
+    return r < 0 ? -1 : (ssize_t) len;
+}
+
+/** Start collecting of responses. They are written by the Connection_uncork */
+void Connection_cork(Connection *conn) {
+    if (conn->shm != NULL)
+        return;
+    MutexLock(conn->writeMutex);
+    if (conn->corkBuf == NULL)
+        conn->corkBuf = pmalloc(CONNECTION_CORK_BUF);
+    conn->corked = true;
+    MutexUnlock(conn->writeMutex);
+}
+
+/** Write collected responses and return connection to the direct writing. Responses of the io_uring connection
+ *  collected while the send is in flight stay in the buffer until it's completion */
+void Connection_uncork(Connection *conn) {
+    MutexLock(conn->writeMutex);
+    conn->corked = false;
+    if (conn->open) {
+        Connection_flushLocked(conn);
+    } else {
+        conn->corkLen = 0;
+        conn->corkCount = 0;
+    }
+    MutexUnlock(conn->writeMutex);
+}
+
+/** Cork the io_uring connection for the packet executed inline by the loop, if the connection has no send in flight
+ *  and no collected responses. Until Connection_releaseInline other writers wait, so no send starts and the response
+ *  that fits the cork buffer is collected without waiting. Return false if the connection is not idle */
+bool Connection_claimInline(Connection *conn) {
+    MutexLock(conn->writeMutex);
+    bool idle = conn->sending == 0 && conn->corkCount == 0 && !conn->corked;
+    if (idle) {
+        conn->inlining = true;
+        conn->corked = true;
+    }
+    MutexUnlock(conn->writeMutex);
+
+    return idle;
+}
+
+/** Submit the response collected by the inline execution and let other writers continue */
+void Connection_releaseInline(Connection *conn) {
+    MutexLock(conn->writeMutex);
+    conn->inlining = false;
+    conn->corked = false;
+    if (conn->open) {
+        Connection_flushLocked(conn);
+    } else {
+        conn->corkLen = 0;
+        conn->corkCount = 0;
+    }
+    CondBroadcast(conn->sent);
+    MutexUnlock(conn->writeMutex);
+}
+
+/** Complete one submission of the io_uring send with it's result. Rest of the short stream send is submitted again.
+ *  Last completion submits responses that were collected while the send was in flight */
+void Connection_sent(Connection *conn, int32_t res) {
+    MutexLock(conn->writeMutex);
+    if (res < 0 || (res == 0 && !conn->seqpacket))
+        conn->open = false;
+    else if (!conn->seqpacket)
+        conn->sendOff += (uint32_t) res;
+    if (conn->sending == 1 && conn->open && !conn->seqpacket && conn->sendOff < conn->sendLen) {
+        //Send was cut by signal, completion of the rest finishes it
+        uint32_t end = conn->sendLen - conn->sendOff;
+        UringEngine_send(conn->uring, conn, conn->sendBuf + conn->sendOff, &end, 1);
+        MutexUnlock(conn->writeMutex);
+        return;
+    }
+    bool done = --conn->sending == 0;
+    if (done) {
+        if (!conn->corked && conn->open)
+            Connection_flushLocked(conn);
+        CondBroadcast(conn->sent);
+    }
+    MutexUnlock(conn->writeMutex);
+
+    if (done)
+        Connection_release(conn);
+}
+
+/** Register the calling thread as the reader of the connection, or forget it before the thread is stopped */
+void Connection_setReader(Connection *conn, bool reading) {
+    MutexLock(&openMutex);
+    conn->reader = pthread_self();
+    conn->hasReader = reading;
+    MutexUnlock(&openMutex);
+}
+
+/** Return count of the accepted connections that are still open and are served by this process */
+uint32_t Connection_count() {
+    uint32_t count = 0;
+    MutexLock(&openMutex);
+    for (Connection *conn = openConns; conn != NULL; conn = conn->nextOpen) {
+        if (conn->open && !conn->passed)
+            count++;
+    }
+    MutexUnlock(&openMutex);
+
+    return count;
+}
+
+/** Send signal to the reader threads of the connections, so their blocking reads are interrupted */
+void Connection_interruptReaders(int sig) {
+    MutexLock(&openMutex);
+    for (Connection *conn = openConns; conn != NULL; conn = conn->nextOpen) {
+        if (conn->hasReader)
+            pthread_kill(conn->reader, sig);
+    }
+    MutexUnlock(&openMutex);
+}
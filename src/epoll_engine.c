@@ -0,0 +1,184 @@
+/** Epoll event loop engine. Listeners and client sockets are watched by one epoll instance in the level triggered
+ *  mode, each readiness event is served by one read call, so sockets stay blocking and responses are written by the
+ *  command processors directly, as with the threads engine. Seqpacket sockets are read by recvmmsg, that takes all
+ *  messages already received. Collected log entries are written after each loop pass. While the daemon is upgraded,
+ *  listeners are removed from the loop and idle connections are passed to the new daemon process */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "../inc/epoll_engine.h"
+#include "../inc/client_thread.h"
+#include "../inc/connection.h"
+#include "../inc/logger.h"
+#include "../inc/stats.h"
+#include "../inc/upgrade.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/time.h"
+#include "../libs/oscl/include/wait.h"
+
+/** Internal function. Start or stop watching of the socket. Return false if epoll_ctl was failed */
+static bool EpollEngine_watch(int epfd, int op, int sockfd, uint64_t data) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = data;
+    Stats_inc(STATS_IO_SYSCALLS);
+
+    return epoll_ctl(epfd, op, sockfd, &event) == 0;
+}
+
+/** Internal function. Accept one connection of the listener and start watching it */
+static void EpollEngine_accept(int epfd, IoEngine_Listener *listener) {
+    int sockfd = accept(listener->sockfd, NULL, NULL);
+    Stats_inc(STATS_IO_SYSCALLS);
+    if (sockfd == -1) {
+        if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && errno != EWOULDBLOCK)
+            Logger_fatal("EpollEngine", "Unable to accept connection of '%s' (%s)", listener->path, strerror(errno));
+        return;
+    }
+
+    IoConn *io = IoEngine_open(Connection_accepted(sockfd, listener->seqpacket));
+    EpollEngine_watch(epfd, EPOLL_CTL_ADD, sockfd, IO_ENGINE_DATA(io, IO_ENGINE_TAG_RECV));
+}
+
+/** Internal function. Read seqpacket messages that are already received. Return false if connection must be closed */
+static bool EpollEngine_readPackets(IoConn *io, char *buf) {
+    struct mmsghdr msgs[CLIENT_THREAD_SEQPACKET_SLOTS];
+    struct iovec iov[CLIENT_THREAD_SEQPACKET_SLOTS];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < CLIENT_THREAD_SEQPACKET_SLOTS; i++) {
+        iov[i].iov_base = buf + i * CLIENT_THREAD_SEQPACKET_BUF;
+        iov[i].iov_len = CLIENT_THREAD_SEQPACKET_BUF;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int n = recvmmsg(io->conn->sockfd, msgs, CLIENT_THREAD_SEQPACKET_SLOTS, MSG_DONTWAIT, NULL);
+    Stats_inc(STATS_IO_SYSCALLS);
+    if (n < 0)
+        return errno == EINTR || errno == EAGAIN;
+    for (int i = 0; i < n; i++) {
+        //Zero length message is the end of stream
+        if (msgs[i].msg_len == 0 || !IoEngine_message(io, iov[i].iov_base, msgs[i].msg_len,
+                                                      msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+            return false;
+    }
+
+    return n > 0;
+}
+
+/** Internal function. Read ready socket of the connection. Return false if connection must be closed */
+static bool EpollEngine_read(IoConn *io, char *buf) {
+    if (io->conn->seqpacket)
+        return EpollEngine_readPackets(io, buf);
+
+    ssize_t r = read(io->conn->sockfd, buf, EPOLL_ENGINE_READ_BUF);
+    Stats_inc(STATS_IO_SYSCALLS);
+    if (r < 0)
+        return errno == EINTR || errno == EAGAIN;
+
+    return r > 0 && IoEngine_feed(io, buf, (size_t) r);
+}
+
+/** Internal function. Pass idle connections to the new daemon process */
+static void EpollEngine_handOff(int epfd) {
+    for (IoConn *io = IoEngine_conns(); io != NULL;) {
+        IoConn *next = io->nextOpen;
+        int state = IoEngine_idleState(io);
+        if (state >= 0 && Upgrade_sendConn(io->conn, (uint8_t) state)) {
+            //Socket stays open in the new process, so it is not removed from the epoll by close
+            EpollEngine_watch(epfd, EPOLL_CTL_DEL, io->conn->sockfd, 0);
+            IoEngine_passed(io);
+        }
+        io = next;
+    }
+}
+
+/** Serve listeners until the daemon is stopped */
+void EpollEngine_run(IoEngine_Listener *listeners, int count) {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        Logger_fatal("EpollEngine", "Unable to create epoll instance (%s)", strerror(errno));
+        exit(-1);
+    }
+    for (int i = 0; i < count; i++) {
+        //While the daemon is upgraded both processes accept, and the other one may take connection after the wakeup
+        fcntl(listeners[i].sockfd, F_SETFL, fcntl(listeners[i].sockfd, F_GETFL) | O_NONBLOCK);
+        EpollEngine_watch(epfd, EPOLL_CTL_ADD, listeners[i].sockfd, IO_ENGINE_DATA(&listeners[i], IO_ENGINE_TAG_ACCEPT));
+        Logger_info("Server", "Server listen '%s'", listeners[i].path);
+    }
+    Logger_info("EpollEngine", "Epoll engine was started");
+    Upgrade_acceptStarted();
+
+    char *buf = pmalloc(CLIENT_THREAD_SEQPACKET_SLOTS * CLIENT_THREAD_SEQPACKET_BUF);
+    struct epoll_event events[EPOLL_ENGINE_EVENTS];
+    IoConn *paused = NULL;
+    bool accepting = true;
+    uint64_t handedAt = 0;
+    while (1) {
+        //Events are polled by the process wait strategy before the loop blocks
+        int n = 0;
+        uint32_t round = 0;
+        while (WaitStep(WaitDefault(), &round) && (n = epoll_wait(epfd, events, EPOLL_ENGINE_EVENTS, 0)) == 0)
+            Stats_inc(STATS_IO_SYSCALLS);
+        if (n == 0)
+            n = epoll_wait(epfd, events, EPOLL_ENGINE_EVENTS,
+                           paused != NULL ? IO_ENGINE_DRAIN_INTERVAL : IO_ENGINE_FLUSH_INTERVAL);
+        Stats_inc(STATS_IO_SYSCALLS);
+
+        for (IoConn *io = IoEngine_takeAdopted(); io != NULL; io = io->next)
+            EpollEngine_watch(epfd, EPOLL_CTL_ADD, io->conn->sockfd, IO_ENGINE_DATA(io, IO_ENGINE_TAG_RECV));
+
+        for (int i = 0; i < n; i++) {
+            void *ptr = IO_ENGINE_PTR(events[i].data.u64);
+            if (IO_ENGINE_TAG(events[i].data.u64) == IO_ENGINE_TAG_ACCEPT) {
+                EpollEngine_accept(epfd, ptr);
+                continue;
+            }
+
+            IoConn *io = ptr;
+            if (!EpollEngine_read(io, buf)) {
+                EpollEngine_watch(epfd, EPOLL_CTL_DEL, io->conn->sockfd, 0);
+                IoEngine_close(io);
+            } else if (io->paused) {
+                //Socket is not watched until pending frames are queued, so the client is pushed back by kernel
+                EpollEngine_watch(epfd, EPOLL_CTL_DEL, io->conn->sockfd, 0);
+                io->next = paused;
+                paused = io;
+            }
+        }
+
+        for (IoConn **p = &paused; *p != NULL;) {
+            IoConn *io = *p;
+            if (IoEngine_drain(io)) {
+                *p = io->next;
+                EpollEngine_watch(epfd, EPOLL_CTL_ADD, io->conn->sockfd, IO_ENGINE_DATA(io, IO_ENGINE_TAG_RECV));
+            } else {
+                p = &io->next;
+            }
+        }
+
+        if (Upgrade_handingOff()) {
+            if (accepting) {
+                //Listeners stay open in the new process, so they are removed from the epoll explicitly
+                for (int i = 0; i < count; i++)
+                    EpollEngine_watch(epfd, EPOLL_CTL_DEL, listeners[i].sockfd, 0);
+                accepting = false;
+                Upgrade_acceptStopped();
+            }
+            uint64_t now = CoarseMonotonicMillis();
+            if (Upgrade_passing() && now - handedAt >= IO_ENGINE_DRAIN_INTERVAL) {
+                EpollEngine_handOff(epfd);
+                handedAt = now;
+            }
+        }
+
+        Logger_flush();
+    }
+}
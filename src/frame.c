@@ -0,0 +1,29 @@
+/** Packet received from the client with it's reception metadata */
+
+#include "../inc/frame.h"
+#include "../inc/otpp.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/time.h"
+
+/** Create frame for packet data that was just completely received. Frame takes ownership of the data */
+Frame* Frame_new(char *data, uint32_t len) {
+    Frame *frame = pmalloc(sizeof(Frame));
+    frame->data = data;
+    frame->len = len;
+    frame->arrival = FastMonotonicNanos();
+    frame->priority = 0;
+    frame->inlineSafe = false;
+    frame->mode = OTPP_MODE_TEXT;
+    frame->type = 0;
+    frame->msgId = 0;
+    frame->flags = 0;
+    frame->depth = 0;
+    frame->oversized = false;
+
+    return frame;
+}
+
+void Frame_free(Frame *frame) {
+    pfree(frame->data);
+    pfree(frame);
+}
@@ -0,0 +1,388 @@
+/** Event loop engines of the client sockets. By default each connection is read by it's own blocking client thread.
+ *  With 'io.engine' set to 'epoll' or 'uring' all connections are read by the one loop thread. Loop feeds received
+ *  data to the incremental parser of the connection, that builds the same frames as the client thread and passes
+ *  them to the connection command processor. Command queue is never waited by the loop, frames that do not fit to
+ *  the full queue are kept by the connection and it's socket is not read until they are queued. While loop engine
+ *  runs, log entries are collected to the batch, that the loop writes by one call. Connections passed by the previous
+ *  daemon process are created by the adoption thread and are taken by the loop on it's next pass */
+
+#include <string.h>
+#include "../inc/io_engine.h"
+#include "../inc/epoll_engine.h"
+#include "../inc/uring_engine.h"
+#include "../inc/client_thread.h"
+#include "../inc/config.h"
+#include "../inc/logger.h"
+#include "../inc/stats.h"
+#include "../inc/thread_pool.h"
+#include "../inc/capture.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/threads.h"
+#include "../libs/oscl/include/time.h"
+
+/** Initial capacity of the connection pending frames list */
+#define IO_ENGINE_PENDING_CAP 16
+
+/** Connections served by the loop. List is used by the loop thread only */
+static IoConn *openConns = NULL;
+
+/** Connections passed by the previous daemon process, that the loop has not taken yet */
+static IoConn *adopted = NULL;
+static mutex_t adoptedMutex = MUTEX_INITIALIZER("io.adopted");
+
+/** Return engine selected by the config */
+uint8_t IoEngine_select() {
+    const char *engine = Config_getString("io.engine", "threads");
+    if (strcmp(engine, "uring") == 0)
+        return IO_ENGINE_URING;
+    if (strcmp(engine, "epoll") == 0)
+        return IO_ENGINE_EPOLL;
+    if (strcmp(engine, "threads") != 0)
+        Logger_info("IoEngine", "Unknown io engine '%s', threads engine is used", engine);
+
+    return IO_ENGINE_THREADS;
+}
+
+/** Serve listeners by the loop engine. Io_uring engine falls back to epoll if kernel does not support it. Never
+ *  returns */
+void IoEngine_run(uint8_t engine, IoEngine_Listener *listeners, int count) {
+    Logger_batch();
+    if (engine == IO_ENGINE_URING) {
+        UringEngine_run(listeners, count);
+        Logger_info("IoEngine", "Io_uring is not available, epoll engine is used");
+    }
+    EpollEngine_run(listeners, count);
+}
+
+/** Internal function. Create loop connection and start it's command processor. Connection passed by the previous
+ *  daemon process starts with it's framing */
+static IoConn* IoEngine_create(Connection *conn) {
+    IoConn *io = pmalloc(sizeof(IoConn));
+    memset(io, 0, sizeof(IoConn));
+    io->conn = conn;
+    io->state = !conn->framed ? IO_CONN_HANDSHAKE : conn->mode == OTPP_MODE_BINARY ? IO_CONN_HEADER : IO_CONN_TEXT;
+    io->first = !conn->framed;
+    io->cpa = ClientThread_startProcessor(conn);
+    Logger_info("IoEngine", "Connection for sockdf '%d' (pid %d, uid %d) was opened", conn->sockfd, conn->pid,
+                conn->uid);
+
+    return io;
+}
+
+/** Internal function. Add connection to the list of the connections served by the loop */
+static void IoEngine_link(IoConn *io) {
+    io->prevOpen = NULL;
+    io->nextOpen = openConns;
+    if (openConns != NULL)
+        openConns->prevOpen = io;
+    openConns = io;
+}
+
+/** Internal function. Remove connection from the list of the connections served by the loop and free it */
+static void IoEngine_free(IoConn *io) {
+    if (io->prevOpen != NULL)
+        io->prevOpen->nextOpen = io->nextOpen;
+    else
+        openConns = io->nextOpen;
+    if (io->nextOpen != NULL)
+        io->nextOpen->prevOpen = io->prevOpen;
+    pfree(io);
+}
+
+/** Create loop connection for the accepted socket and start it's command processor */
+IoConn* IoEngine_open(Connection *conn) {
+    IoConn *io = IoEngine_create(conn);
+    IoEngine_link(io);
+
+    return io;
+}
+
+/** Internal function. Execute inline-safe command by the loop, if the connection has nothing in work, no send in flight
+ *  and it's response fits the cork buffer. Response is collected to the claimed connection and is submitted to the
+ *  io_uring, so the loop never blocks on the socket and never waits for the send completion, that only the loop itself
+ *  can process. Return false if the frame must be queued */
+static bool IoEngine_tryInline(IoConn *io, Frame *frame) {
+    if (!frame->inlineSafe || frame->len + IO_ENGINE_INLINE_SLACK > CONNECTION_CORK_BUF ||
+        !Connection_claimInline(io->conn))
+        return false;
+    bool executed = CmdProcessor_tryInline(io->cpa, frame);
+    Connection_releaseInline(io->conn);
+
+    return executed;
+}
+
+/** Internal function. Pass frame to the command processor. If the queue is full or earlier frames are waiting, frame
+ *  waits in the pending list and connection is paused. Inline-safe command may be executed by the loop itself */
+static void IoEngine_enqueue(IoConn *io, Frame *frame) {
+    frame->depth = io->cpa->queued - __atomic_load_n(&io->cpa->finished, __ATOMIC_ACQUIRE);
+    if (Capture_enabled() && !frame->oversized)
+        Capture_frame(io->conn, frame);
+    if (io->conn->uring != NULL && io->pendingCount == 0 && IoEngine_tryInline(io, frame))
+        return;
+    MultiLaneQueue *cmdQueue = io->cpa->cmdQueue;
+    Stats_inc(STATS_QUEUE_DEPTH_CONTROL + frame->priority);
+    io->cpa->queued++;
+    if (io->pendingCount == 0 && cmdQueue->tryPut(cmdQueue, frame->priority, frame))
+        return;
+
+    if (!io->paused) {
+        Stats_inc(STATS_QUEUE_FULL);
+        io->paused = true;
+        io->pausedAt = CoarseMonotonicMillis();
+    }
+    if (io->pendingHead + io->pendingCount == io->pendingCap) {
+        //Queued part is moved to the list start before it grows
+        memmove(io->pending, io->pending + io->pendingHead, io->pendingCount * sizeof(Frame*));
+        io->pendingHead = 0;
+        if (io->pendingCount == io->pendingCap) {
+            io->pendingCap = io->pendingCap == 0 ? IO_ENGINE_PENDING_CAP : io->pendingCap * 2;
+            io->pending = prealloc(io->pending, io->pendingCap * sizeof(Frame*));
+        }
+    }
+    io->pending[io->pendingHead + io->pendingCount++] = frame;
+}
+
+/** Internal function. Process received text. Packets that lie in the chunk whole are copied to the frames directly,
+ *  only the split packet is assembled in the connection buffer */
+static void IoEngine_text(IoConn *io, const char *data, size_t len) {
+    while (len > 0) {
+        const char *end = memchr(data, '\r', len);
+        size_t part = end != NULL ? (size_t) (end - data) + 1 : len;
+
+        if (!io->overflow && io->packetLen + part > CLIENT_THREAD_TEXT_BUFFER) {
+            //Packet is answered by error once it's end is received, the head is needed for it's msgId
+            const char *head = io->packetLen > 0 ? io->packet : data;
+            size_t headLen = io->packetLen > 0 ? io->packetLen : part;
+            io->oversized = ClientThread_oversizedFrame(head, headLen < CLIENT_THREAD_HEAD_MAX ? headLen
+                                                                                            : CLIENT_THREAD_HEAD_MAX);
+            io->overflow = true;
+            io->packetLen = 0;
+        }
+        if (io->overflow) {
+            if (end != NULL) {
+                Logger_info("IoEngine", "Too big packet from sockfd '%d' was dropped", io->conn->sockfd);
+                io->overflow = false;
+                if (io->oversized != NULL)
+                    IoEngine_enqueue(io, io->oversized);
+                io->oversized = NULL;
+            }
+        } else if (end != NULL) {
+            char *str = pmalloc(io->packetLen + part + 1); //Free in cmd_processor
+            if (io->packetLen > 0)
+                memcpy(str, io->packet, io->packetLen);
+            memcpy(str + io->packetLen, data, part);
+            uint32_t packetLen = io->packetLen + (uint32_t) part;
+            str[packetLen] = 0;
+            io->packetLen = 0;
+            IoEngine_enqueue(io, ClientThread_textFrame(str, packetLen));
+        } else {
+            if (io->packet == NULL)
+                io->packet = pmalloc(CLIENT_THREAD_TEXT_BUFFER);
+            memcpy(io->packet + io->packetLen, data, part);
+            io->packetLen += (uint32_t) part;
+        }
+
+        data += part;
+        len -= part;
+    }
+}
+
+/** Internal function. Process received binary packets. Return false if the stream is broken */
+static bool IoEngine_binary(IoConn *io, const char *data, size_t len) {
+    while (len > 0) {
+        if (io->state == IO_CONN_HEADER) {
+            size_t part = OTPP_HEADER_SIZE - io->headLen < len ? OTPP_HEADER_SIZE - io->headLen : len;
+            memcpy(io->head + io->headLen, data, part);
+            io->headLen += (uint32_t) part;
+            data += part;
+            len -= part;
+            if (io->headLen < OTPP_HEADER_SIZE)
+                break;
+
+            io->headLen = 0;
+            if (!Otpp_readHeader(io->head, &io->header) || io->header.len > OTPP_MAX_PAYLOAD) {
+                //Stream position is lost, so the connection can't be recovered
+                Logger_info("IoEngine", "Broken binary packet from sockfd '%d'", io->conn->sockfd);
+                return false;
+            }
+            io->packet = pmalloc(io->header.len + 1); //Free in cmd_processor
+            io->packetLen = 0;
+            io->state = IO_CONN_PAYLOAD;
+        } else {
+            size_t part = io->header.len - io->packetLen < len ? io->header.len - io->packetLen : len;
+            memcpy(io->packet + io->packetLen, data, part);
+            io->packetLen += (uint32_t) part;
+            data += part;
+            len -= part;
+        }
+
+        if (io->state == IO_CONN_PAYLOAD && io->packetLen == io->header.len) {
+            IoEngine_enqueue(io, ClientThread_binaryFrame(&io->header, io->packet));
+            io->packet = NULL;
+            io->packetLen = 0;
+            io->state = IO_CONN_HEADER;
+        }
+    }
+
+    return true;
+}
+
+/** Process data received from the stream socket. First bytes select the framing, like in the client thread. Return
+ *  false if connection must be closed */
+bool IoEngine_feed(IoConn *io, const char *data, size_t len) {
+    if (len > 0 && io->state == IO_CONN_HANDSHAKE)
+        io->state = data[0] == OTPP_HELLO[0] ? IO_CONN_HELLO : IO_CONN_TEXT;
+
+    if (len > 0 && io->state == IO_CONN_HELLO) {
+        size_t part = OTPP_HELLO_SIZE - io->headLen < len ? OTPP_HELLO_SIZE - io->headLen : len;
+        memcpy(io->head + io->headLen, data, part);
+        io->headLen += (uint32_t) part;
+        data += part;
+        len -= part;
+        if (io->headLen < OTPP_HELLO_SIZE)
+            return true;
+        io->headLen = 0;
+        if (!ClientThread_hello(io->conn, io->head))
+            return false;
+        io->state = IO_CONN_HEADER;
+    }
+
+    if (io->state == IO_CONN_TEXT) {
+        IoEngine_text(io, data, len);
+        return true;
+    }
+
+    return IoEngine_binary(io, data, len);
+}
+
+/** Process message received from the seqpacket socket. Return false if connection must be closed */
+bool IoEngine_message(IoConn *io, const char *data, size_t len, bool truncated) {
+    bool first = io->first;
+    io->first = false;
+    if (truncated) {
+        Logger_info("IoEngine", "Too big packet from sockfd '%d' was dropped", io->conn->sockfd);
+        return true;
+    }
+    if (first && data[0] == OTPP_HELLO[0])
+        return len == OTPP_HELLO_SIZE && ClientThread_hello(io->conn, data);
+
+    Frame *frame = ClientThread_messageFrame(io->conn, data, len);
+    if (frame != NULL)
+        IoEngine_enqueue(io, frame);
+    else
+        Logger_info("IoEngine", "Broken packet from sockfd '%d' was dropped", io->conn->sockfd);
+
+    return true;
+}
+
+/** Pass pending frames to the command queue. Return true if all of them were queued, so the connection may be read
+ *  again */
+bool IoEngine_drain(IoConn *io) {
+    MultiLaneQueue *cmdQueue = io->cpa->cmdQueue;
+    while (io->pendingCount > 0) {
+        Frame *frame = io->pending[io->pendingHead];
+        if (!cmdQueue->tryPut(cmdQueue, frame->priority, frame)) {
+            uint64_t now = CoarseMonotonicMillis();
+            if (now - io->pausedAt >= CLIENT_THREAD_BACKPRESSURE_TIMEOUT) {
+                Stats_inc(STATS_QUEUE_FULL_TIMEOUT);
+                Logger_info("IoEngine", "Command queue for sockfd '%d' stays full", io->conn->sockfd);
+                io->pausedAt = now;
+            }
+            return false;
+        }
+        io->pendingHead++;
+        io->pendingCount--;
+    }
+    io->pendingHead = 0;
+    io->paused = false;
+
+    return true;
+}
+
+/** Stop command processor of the connection and free it. Receive of the connection must be already completed */
+void IoEngine_close(IoConn *io) {
+    Connection *conn = io->conn;
+    int sockfd = conn->sockfd;
+    for (uint32_t i = 0; i < io->pendingCount; i++) {
+        Frame *frame = io->pending[io->pendingHead + i];
+        Stats_add(STATS_QUEUE_DEPTH_CONTROL + frame->priority, -1);
+        Frame_free(frame);
+    }
+    if (io->pending != NULL)
+        pfree(io->pending);
+    if (io->packet != NULL)
+        pfree(io->packet);
+    if (io->oversized != NULL)
+        Frame_free(io->oversized);
+
+    CmdProcessor_stop(io->cpa);
+    Connection_shutdown(conn);
+    Connection_release(conn);
+    IoEngine_free(io);
+    Logger_info("IoEngine", "Connection for sockdf '%d' was closed", sockfd);
+}
+
+/** Return first of the connections served by the loop */
+IoConn* IoEngine_conns() {
+    return openConns;
+}
+
+/** Return framing state with which connection may be passed to the new daemon process, or -1 if it has packets in
+ *  work or unparsed data */
+int IoEngine_idleState(IoConn *io) {
+    if (io->paused || io->packetLen > 0 || io->overflow || io->headLen > 0 || io->state == IO_CONN_HELLO
+        || io->state == IO_CONN_PAYLOAD || !CmdProcessor_idle(io->cpa))
+        return -1;
+    if (io->conn->seqpacket)
+        return io->first ? IO_CONN_HANDSHAKE : io->conn->mode == OTPP_MODE_BINARY ? IO_CONN_HEADER : IO_CONN_TEXT;
+
+    return io->state;
+}
+
+/** Stop command processor of the connection that was passed to the new daemon process and free it. Unlike close,
+ *  socket is not shut down, because it is served by the new process. It must be already removed from the loop */
+void IoEngine_passed(IoConn *io) {
+    int sockfd = io->conn->sockfd;
+    CmdProcessor_stop(io->cpa);
+    Connection_release(io->conn);
+    //Passed connection is idle, so the pending list is empty, but it's array stays allocated
+    if (io->pending != NULL)
+        pfree(io->pending);
+    if (io->packet != NULL)
+        pfree(io->packet);
+    IoEngine_free(io);
+    Logger_info("IoEngine", "Connection for sockdf '%d' was passed to the new process", sockfd);
+}
+
+/** Serve socket passed by the previous daemon process. It continues with the framing state it had there. Loop engines
+ *  take such connections by IoEngine_takeAdopted, threads engine starts client thread for it */
+void IoEngine_adopt(uint8_t engine, int sockfd, bool seqpacket, uint8_t state) {
+    Connection *conn = Connection_accepted(sockfd, seqpacket);
+    conn->framed = state != IO_CONN_HANDSHAKE;
+    conn->mode = state == IO_CONN_HEADER ? OTPP_MODE_BINARY : OTPP_MODE_TEXT;
+    if (engine == IO_ENGINE_THREADS) {
+        ThreadPool_run(ClientThread_run, conn);
+        return;
+    }
+
+    IoConn *io = IoEngine_create(conn);
+    MutexLock(&adoptedMutex);
+    io->next = adopted;
+    adopted = io;
+    MutexUnlock(&adoptedMutex);
+}
+
+/** Take connections passed by the previous daemon process. They are linked by the next field */
+IoConn* IoEngine_takeAdopted() {
+    if (__atomic_load_n(&adopted, __ATOMIC_ACQUIRE) == NULL)
+        return NULL;
+
+    MutexLock(&adoptedMutex);
+    IoConn *list = adopted;
+    adopted = NULL;
+    MutexUnlock(&adoptedMutex);
+    for (IoConn *io = list; io != NULL; io = io->next)
+        IoEngine_link(io);
+
+    return list;
+}
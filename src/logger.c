@@ -1,7 +1,11 @@
 /**
- * Internal daemon logger. Function from this file used for write formatted log to the file and stdout
+ * Internal daemon logger. Function from this file used for write formatted log to the file and stdout. When event
+ * loop engine serves the sockets, log entries are collected to the batch, that the loop writes by one call for each
+ * target. Only one batch is written at a time, entries logged while it is written are queued behind it, so they are
+ * never written before the earlier ones
  */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -9,10 +13,12 @@
 #include <string.h>
 #include <stdint.h>
 #include <malloc.h>
-#include <time.h>
 #include <stdbool.h>
 #include <stdarg.h>
 #include "../inc/logger.h"
+#include "../inc/stats.h"
+#include "../libs/oscl/include/threads.h"
+#include "../libs/oscl/include/time.h"
 
 /** Log file descriptor */
 int fd = -1;
@@ -23,6 +29,16 @@ bool STDOUT = true;
 /** Log entry format. For example [TIME][LEVEL][SOURCE] -> MESSAGE */
 const char *logf = "[%d][%s][%s] -> %s\n";
 
+/** Entries collected while batching is enabled */
+static char *batch = NULL;
+static size_t batchLen = 0;
+static size_t batchCap = 0;
+static bool batched = false;
+static mutex_t *batchMutex = NULL;
+/** Taken batch is being written, next one is not taken until Logger_written */
+static bool writing = false;
+static cond_t *writtenCond = NULL;
+
 /** see func def */
 void Logger_log(char *msg);
 
@@ -31,59 +47,194 @@ void Logger_log(char *msg);
  * @param fp path to the log file
  **/
 int Logger_init(const char* fp) {
-    fd = open(fp, O_RDWR | O_CREAT, 0644);
+    //Each write goes to the file end, so file position is not moved before writes
+    fd = open(fp, O_RDWR | O_CREAT | O_APPEND, 0644);
     return fd;
 }
 
-/** Write info log */
-void Logger_info(char *source, char *str, ...) {
-    size_t len = strlen(str);
-    size_t lineSize = len + 200;
+/** Internal function. Format the message to the buffer of it's exact size, that must be freed by caller */
+static char* Logger_format(const char *str, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(NULL, 0, str, copy);
+    va_end(copy);
 
-    char *msg = (char*) malloc(lineSize);
+    char *msg = (char*) malloc(len > 0 ? (size_t) len + 1 : 1);
+    vsnprintf(msg, len > 0 ? (size_t) len + 1 : 1, str, args);
+
+    return msg;
+}
 
+/** Write info log */
+void Logger_info(char *source, char *str, ...) {
     va_list args;
     va_start(args, str);
-    vsprintf(msg, str, args);
+    char *msg = Logger_format(str, args);
     va_end(args);
 
     char *m = (char*) malloc(100 + strlen(msg));
 
-    sprintf(m, logf, time(0), "INFO",source, msg);
+    sprintf(m, logf, (int) CoarseRealTimeSeconds(), "INFO",source, msg);
     Logger_log(m);
+    free(m);
+    free(msg);
 }
 
 /** Write fatal log */
 void Logger_fatal(char *source, char *str, ...) {
-    size_t len = strlen(str);
-    size_t lineSize = len + 200;
-
-    char *msg = (char*) malloc(lineSize);
-
     va_list args;
     va_start(args, str);
-    vsprintf(msg, str, args);
+    char *msg = Logger_format(str, args);
     va_end(args);
 
-    char *m = (char*) malloc(100 + strlen(msg)); //FIXME не вижу освобождения памяти
+    char *m = (char*) malloc(100 + strlen(msg));
 
-    sprintf(m, logf, time(0), "FATAL",source, msg);
+    sprintf(m, logf, (int) CoarseRealTimeSeconds(), "FATAL",source, msg);
     Logger_log(m);
+    free(m);
+    free(msg);
+}
+
+/** Collect entries to the batch instead of writing each one. Batch is taken by Logger_takeBatch */
+void Logger_batch() {
+    batchMutex = NewMutex("logger.batch");
+    writtenCond = NewCond();
+    batch = malloc(LOGGER_BATCH_LIMIT);
+    batchCap = LOGGER_BATCH_LIMIT;
+    batched = true;
+}
+
+/** Internal function. Take collected entries. Must be called under the batch mutex */
+static char* Logger_takeLocked(size_t *len) {
+    char *data = NULL;
+    if (batchLen > 0 && !writing) {
+        data = batch;
+        *len = batchLen;
+        batch = malloc(LOGGER_BATCH_LIMIT);
+        batchCap = LOGGER_BATCH_LIMIT;
+        batchLen = 0;
+        writing = true;
+    }
+
+    return data;
+}
+
+/** Take collected entries. Return NULL if there are no entries or the previous batch is not written yet, otherwise
+ *  the batch that must be written to each descriptor returned by Logger_targets and freed by caller, who calls
+ *  Logger_written after that */
+char* Logger_takeBatch(size_t *len) {
+    if (!batched)
+        return NULL;
+
+    MutexLock(batchMutex);
+    char *data = Logger_takeLocked(len);
+    MutexUnlock(batchMutex);
+
+    return data;
+}
+
+/** Report that the taken batch is written, so the next one may be taken */
+void Logger_written() {
+    MutexLock(batchMutex);
+    writing = false;
+    CondBroadcast(writtenCond);
+    MutexUnlock(batchMutex);
+}
+
+/** Fill descriptors where batch must be written. Return their count */
+int Logger_targets(int *fds) {
+    int count = 0;
+    if (fd >= 0)
+        fds[count++] = fd;
+    if (STDOUT)
+        fds[count++] = STDOUT_FILENO;
+
+    return count;
+}
+
+/** Internal function. Write whole data to the descriptor, short writes are continued */
+static void Logger_write(int target, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t r = write(target, data, len);
+        Stats_inc(STATS_IO_SYSCALLS);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += r;
+        len -= r;
+    }
+}
+
+/** Internal function. Write taken batch to all targets and report that it is written */
+static void Logger_writeBatch(char *data, size_t len) {
+    int fds[LOGGER_MAX_TARGETS];
+    int count = Logger_targets(fds);
+    for (int i = 0; i < count; i++)
+        Logger_write(fds[i], data, len);
+    free(data);
+    Logger_written();
+}
+
+/** Write collected entries to all targets right now. Batch that is being written by the loop is waited for, so must
+ *  not be called by the thread that writes it */
+void Logger_flush() {
+    if (!batched)
+        return;
+
+    MutexLock(batchMutex);
+    while (writing)
+        CondWait(writtenCond, batchMutex);
+    size_t len;
+    char *data = Logger_takeLocked(&len);
+    MutexUnlock(batchMutex);
+
+    if (data != NULL)
+        Logger_writeBatch(data, len);
+}
+
+/** Internal function. Append entry to the batch. If batch has reached it's limit and no batch is being written, it is
+ *  taken together with the entry and must be written by caller, otherwise entry is queued behind the batch in flight.
+ *  Return NULL if entry was queued */
+static char* Logger_append(const char *msg, size_t *taken) {
+    size_t len = strlen(msg);
+    MutexLock(batchMutex);
+    bool full = batchLen + len > LOGGER_BATCH_LIMIT;
+    if (batchLen + len > batchCap) {
+        batchCap = batchLen + len > 2 * batchCap ? batchLen + len : 2 * batchCap;
+        batch = realloc(batch, batchCap);
+    }
+    memcpy(batch + batchLen, msg, len);
+    batchLen += len;
+    char *data = full ? Logger_takeLocked(taken) : NULL;
+    MutexUnlock(batchMutex);
+
+    return data;
 }
 
 /** Internal function that`s do all work */
 void Logger_log(char *msg) {
+    if (batched) {
+        size_t len;
+        char *data = Logger_append(msg, &len);
+        //The loop does not take the batch in time, so it is written right now
+        if (data != NULL)
+            Logger_writeBatch(data, len);
+        return;
+    }
+
     if (fd == NULL) {
         printf("Unable to write log to the file -> %s", msg);
         fflush(stdout);
     } else {
-        lseek(fd, 0L, SEEK_END);
         size_t len = strlen(msg);
         uint8_t *bf = malloc(len);
         memcpy(bf, msg, len);
-        write(fd, bf, len);
+        Logger_write(fd, (char*) bf, len);
         if (STDOUT) {
-            printf(msg);
+            Stats_inc(STATS_IO_SYSCALLS);
+            fputs(msg, stdout);
             fflush(stdout);
         }
         free(bf);
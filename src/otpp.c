@@ -0,0 +1,67 @@
+/** Binary framing of the OTPP. Header is read and written by memcpy, because it may be placed at any offset of the
+ *  buffer */
+
+#include <string.h>
+#include "../inc/otpp.h"
+
+/** Fill hello block with specified version */
+void Otpp_hello(char *block, uint8_t version) {
+    memcpy(block, OTPP_HELLO, OTPP_HELLO_LEN);
+    block[OTPP_HELLO_LEN] = (char) version;
+    block[OTPP_HELLO_LEN + 1] = 0;
+}
+
+/** Check that block is hello block. Return version requested by it through the pointer */
+bool Otpp_checkHello(const char *block, uint8_t *version) {
+    if (memcmp(block, OTPP_HELLO, OTPP_HELLO_LEN) != 0)
+        return false;
+    *version = (uint8_t) block[OTPP_HELLO_LEN];
+
+    return true;
+}
+
+/** Write packet header of the current version to the buffer */
+void Otpp_writeHeader(char *buf, char type, uint32_t msgId, uint32_t len) {
+    Otpp_Header header;
+    header.magic = OTPP_MAGIC;
+    header.version = OTPP_VERSION;
+    header.type = (uint8_t) type;
+    header.flags = 0;
+    header.reserved = 0;
+    header.msgId = msgId;
+    header.len = len;
+    memcpy(buf, &header, OTPP_HEADER_SIZE);
+}
+
+/** Read packet header from the buffer. Return false if it has wrong magic or version */
+bool Otpp_readHeader(const char *buf, Otpp_Header *header) {
+    memcpy(header, buf, OTPP_HEADER_SIZE);
+
+    return header->magic == OTPP_MAGIC && header->version == OTPP_VERSION;
+}
+
+/** Split payload to the arguments in place. Buffer must have one spare byte after the payload. Each argument is
+ *  terminated by zero, that overwrites the first byte of the next argument length after it was read, so arguments
+ *  are not copied. Arguments may contain zero bytes themselves, so their lengths are returned by argl. Return count
+ *  of arguments or 0 if payload is broken */
+uint16_t Otpp_splitArgs(char *payload, uint32_t len, char **argv, uint32_t *argl, uint16_t max) {
+    uint16_t argc = 0;
+    uint32_t pos = 0;
+    while (pos < len) {
+        uint32_t argLen;
+        if (len - pos < sizeof(argLen) || argc == max)
+            return 0;
+        memcpy(&argLen, payload + pos, sizeof(argLen));
+        if (argc > 0)
+            payload[pos] = 0;
+        pos += sizeof(argLen);
+        if (argLen > len - pos)
+            return 0;
+        argl[argc] = argLen;
+        argv[argc++] = payload + pos;
+        pos += argLen;
+    }
+    payload[len] = 0;
+
+    return argc;
+}
@@ -0,0 +1,253 @@
+/** Built-in sampling profiler. When started, it arms the ITIMER_PROF interval timer, so the kernel delivers SIGPROF to
+ *  the thread that is consuming cpu at the moment of the tick. The signal handler unwinds the stack of the interrupted
+ *  thread and stores it to the preallocated samples buffer. Slots in the buffer are reserved by atomic increment, so
+ *  any count of threads may be sampled without locks. When the profiler is stopped, timer is disarmed and signal is
+ *  ignored, so it costs nothing in this state. Collected samples may be dumped in the folded stacks format that is
+ *  accepted by flamegraph.pl */
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <sys/time.h>
+#include "../inc/profiler.h"
+#include "../inc/logger.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/threads.h"
+
+/** Count of frames that belongs to the signal handler itself (handler and kernel signal trampoline) */
+#define PROFILER_SKIP_FRAMES 2
+
+/** One collected stack. Frames are stored from leaf to root, as backtrace returns it */
+typedef struct Profiler_Sample {
+    volatile uint8_t ready;
+    uint8_t depth;
+    void *pc[PROFILER_MAX_DEPTH];
+} Profiler_Sample;
+
+/** Samples buffer. It is allocated at first start and is never freed, because late signal may still refer it */
+static Profiler_Sample *samples = NULL;
+static uint32_t capacity = 0;
+/** Index of the next free slot in the buffer. May grow beyond the capacity, all this samples will be dropped */
+static uint32_t next = 0;
+static uint32_t dropped = 0;
+static volatile bool running = false;
+
+/** Serializes start, stop and dump calls from different client threads */
+static mutex_t *controlMutex = NULL;
+static pthread_once_t controlOnce = PTHREAD_ONCE_INIT;
+
+static void Profiler_initControl() {
+    controlMutex = NewMutex("profiler");
+}
+
+/** SIGPROF handler. It must be async signal safe, so it only reserves slot and unwinds stack into it */
+static void Profiler_handler(int sig) {
+    int savedErrno = errno;
+
+    uint32_t slot = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED);
+    if (slot >= capacity) {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+        errno = savedErrno;
+        return;
+    }
+
+    void *frames[PROFILER_MAX_DEPTH + PROFILER_SKIP_FRAMES];
+    int depth = backtrace(frames, PROFILER_MAX_DEPTH + PROFILER_SKIP_FRAMES) - PROFILER_SKIP_FRAMES;
+    if (depth < 0)
+        depth = 0;
+
+    Profiler_Sample *sample = &samples[slot];
+    memcpy(sample->pc, frames + PROFILER_SKIP_FRAMES, depth * sizeof(void*));
+    sample->depth = (uint8_t) depth;
+    __atomic_store_n(&sample->ready, 1, __ATOMIC_RELEASE);
+
+    errno = savedErrno;
+}
+
+/** Start sampling with specified frequency. Previously collected samples will be discarded. Return false if
+ *  profiler already run or timer can't be armed */
+bool Profiler_start(uint32_t hz) {
+    pthread_once(&controlOnce, Profiler_initControl);
+    MutexLock(controlMutex);
+
+    if (running) {
+        MutexUnlock(controlMutex);
+        return false;
+    }
+
+    if (samples == NULL) {
+        capacity = PROFILER_DEFAULT_CAPACITY;
+        samples = pmalloc(capacity * sizeof(Profiler_Sample));
+    }
+    memset(samples, 0, capacity * sizeof(Profiler_Sample));
+    __atomic_store_n(&next, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&dropped, 0, __ATOMIC_RELAXED);
+
+    //First call of the backtrace loads libgcc_s, that is not signal safe. Do it here, outside of the handler.
+    void *prime[1];
+    backtrace(prime, 1);
+
+    if (hz == 0)
+        hz = PROFILER_DEFAULT_HZ;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = Profiler_handler;
+    sa.sa_flags = SA_RESTART; //Sampling must not break blocking io of the client threads
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz >= 1000000 ? 1 : 1000000 / hz;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        Logger_fatal("Profiler", "Unable to arm profiling timer (%s)", strerror(errno));
+        signal(SIGPROF, SIG_IGN);
+        MutexUnlock(controlMutex);
+        return false;
+    }
+
+    running = true;
+    MutexUnlock(controlMutex);
+
+    Logger_info("Profiler", "Profiler was started with frequency %d Hz", hz);
+
+    return true;
+}
+
+/** Stop sampling. Collected samples stay available for dump */
+void Profiler_stop() {
+    pthread_once(&controlOnce, Profiler_initControl);
+    MutexLock(controlMutex);
+
+    if (running) {
+        struct itimerval timer;
+        memset(&timer, 0, sizeof(timer));
+        setitimer(ITIMER_PROF, &timer, NULL);
+        //Default action of the SIGPROF is termination, so a tick that is already pending must be ignored
+        signal(SIGPROF, SIG_IGN);
+        running = false;
+        Logger_info("Profiler", "Profiler was stopped with %d samples (%d dropped)", Profiler_samples(),
+                    Profiler_dropped());
+    }
+
+    MutexUnlock(controlMutex);
+}
+
+bool Profiler_isRunning() {
+    return running;
+}
+
+/** Return count of samples that was stored to the buffer */
+uint32_t Profiler_samples() {
+    uint32_t n = __atomic_load_n(&next, __ATOMIC_RELAXED);
+    return n > capacity ? capacity : n;
+}
+
+/** Return count of samples that was dropped due to buffer overflow */
+uint32_t Profiler_dropped() {
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+/** Internal function. Copy sample to the result, replacing each frame address by the start address of it's function,
+ *  so samples that differs only by the position inside functions will be folded together. All frames except leaf are
+ *  return addresses, that may point to the next function if call was the last instruction, so lookup is made by the
+ *  previous byte. Collected samples are left as is, so they may be dumped again */
+static void Profiler_normalize(const Profiler_Sample *sample, Profiler_Sample *result) {
+    result->depth = sample->depth;
+    for (uint8_t i = 0; i < sample->depth; i++) {
+        char *pc = (char*) sample->pc[i];
+        Dl_info info;
+        if (dladdr(i == 0 ? pc : pc - 1, &info) != 0 && info.dli_saddr != NULL)
+            result->pc[i] = info.dli_saddr;
+        else
+            result->pc[i] = pc;
+    }
+}
+
+/** Internal function. Order samples by frames, so equal stacks will be placed side by side */
+static int Profiler_compare(const void *a, const void *b) {
+    const Profiler_Sample *sa = *(const Profiler_Sample**) a;
+    const Profiler_Sample *sb = *(const Profiler_Sample**) b;
+    if (sa->depth != sb->depth)
+        return sa->depth < sb->depth ? -1 : 1;
+    return memcmp(sa->pc, sb->pc, sa->depth * sizeof(void*));
+}
+
+/** Internal function. Write one folded line in form 'root;...;leaf count' */
+static void Profiler_writeStack(FILE *f, Profiler_Sample *sample, uint32_t count) {
+    for (int i = sample->depth - 1; i >= 0; i--) {
+        Dl_info info;
+        int found = dladdr(sample->pc[i], &info);
+        if (found != 0 && info.dli_sname != NULL) {
+            fputs(info.dli_sname, f);
+        } else if (found != 0 && info.dli_fname != NULL) {
+            const char *base = strrchr(info.dli_fname, '/');
+            fprintf(f, "[%s]", base != NULL ? base + 1 : info.dli_fname);
+        } else {
+            fprintf(f, "%p", sample->pc[i]);
+        }
+        if (i > 0)
+            fputc(';', f);
+    }
+    fprintf(f, " %u\n", count);
+}
+
+/** Write collected samples to the file in the folded stacks format. Return count of written stacks or -1 if file
+ *  can't be created */
+int32_t Profiler_dump(const char *path) {
+    pthread_once(&controlOnce, Profiler_initControl);
+    MutexLock(controlMutex);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0644);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "w");
+    if (f == NULL) {
+        Logger_fatal("Profiler", "Unable to open dump file '%s' (%s)", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        MutexUnlock(controlMutex);
+        return -1;
+    }
+
+    //Sampling may continue while dump is made, so samples are normalized to the separate array
+    uint32_t total = Profiler_samples();
+    Profiler_Sample *normalized = pmalloc((total > 0 ? total : 1) * sizeof(Profiler_Sample));
+    Profiler_Sample **sorted = pmalloc((total > 0 ? total : 1) * sizeof(Profiler_Sample*));
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < total; i++) {
+        if (__atomic_load_n(&samples[i].ready, __ATOMIC_ACQUIRE) && samples[i].depth > 0) {
+            Profiler_normalize(&samples[i], &normalized[count]);
+            sorted[count] = &normalized[count];
+            count++;
+        }
+    }
+    qsort(sorted, count, sizeof(Profiler_Sample*), Profiler_compare);
+
+    int32_t stacks = 0;
+    uint32_t i = 0;
+    while (i < count) {
+        uint32_t j = i + 1;
+        while (j < count && Profiler_compare(&sorted[i], &sorted[j]) == 0)
+            j++;
+        Profiler_writeStack(f, sorted[i], j - i);
+        stacks++;
+        i = j;
+    }
+
+    pfree(sorted);
+    pfree(normalized);
+    fclose(f);
+    MutexUnlock(controlMutex);
+
+    Logger_info("Profiler", "Profile with %d stacks was dumped to '%s'", stacks, path);
+
+    return stacks;
+}
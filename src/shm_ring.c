@@ -0,0 +1,147 @@
+/** Single producer single consumer rings of the shm transport. Sides sleep on the futex of the counter that the other
+ *  side advances. Before sleeping the side sets it's waiting flag and checks the counter again, and the other side
+ *  checks the flag after it has published the counter, both with sequential consistency, so wakeup can't be lost and
+ *  the syscall is made only when somebody sleeps. Data of the ring is written by the other process, so consumer
+ *  checks every length it reads */
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "../inc/shm_ring.h"
+
+#define SHM_ALIGN(len) (((len) + 3) & ~3u)
+
+/** Internal function. Sleep while the word has specified value, but not longer than timeout millis. Futex is not
+ *  private, because the word is shared with another process */
+static void ShmRing_futexWait(volatile uint32_t *word, uint32_t value, uint32_t timeout) {
+    struct timespec ts = {timeout / 1000, (long) (timeout % 1000) * 1000000};
+    syscall(SYS_futex, word, FUTEX_WAIT, value, &ts, NULL, 0);
+}
+
+static void ShmRing_futexWake(volatile uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/** Prepare region header for the rings of specified size, that must be a power of two */
+void ShmRegion_init(ShmRegion *region, uint32_t ringSize) {
+    memset(region, 0, sizeof(ShmRegion));
+    region->magic = SHM_MAGIC;
+    region->version = SHM_VERSION;
+    region->ringSize = ringSize;
+}
+
+/** Return data of the ring of the region */
+char* ShmRegion_data(ShmRegion *region, ShmRing *ring) {
+    char *data = (char*) region + sizeof(ShmRegion);
+    return ring == &region->response ? data + region->ringSize : data;
+}
+
+/** Write record gathered from the blocks. Return false if ring has not enough free space */
+bool ShmRing_push(ShmRing *ring, char *data, uint32_t size, const struct iovec *iov, int count) {
+    uint32_t len = 0;
+    for (int i = 0; i < count; i++)
+        len += (uint32_t) iov[i].iov_len;
+
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t offset = head & (size - 1);
+    uint32_t need = SHM_ALIGN(len) + sizeof(uint32_t);
+    uint32_t rest = size - offset;
+    //Record is never split, so if it does not fit to the end of the ring, the end is skipped
+    uint32_t skip = rest < need ? rest : 0;
+    if (need > size || head - tail > size || need + skip > size - (head - tail))
+        return false;
+
+    if (skip > 0) {
+        uint32_t wrap = SHM_RING_WRAP;
+        memcpy(data + offset, &wrap, sizeof(wrap));
+        offset = 0;
+    }
+    memcpy(data + offset, &len, sizeof(len));
+    char *p = data + offset + sizeof(len);
+    for (int i = 0; i < count; i++) {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        p += iov[i].iov_len;
+    }
+
+    __atomic_store_n(&ring->head, head + skip + need, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->headWaiting, __ATOMIC_SEQ_CST))
+        ShmRing_futexWake(&ring->head);
+
+    return true;
+}
+
+/** Find the next record. Return it's length, pointer to it's data and the tail position after it, 0 if ring is
+ *  empty or -1 if ring state is broken by the other side */
+int64_t ShmRing_peek(ShmRing *ring, char *data, uint32_t size, const char **record, uint32_t *next) {
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return 0;
+    if (head - tail > size || head - tail < sizeof(uint32_t))
+        return -1;
+
+    uint32_t offset = tail & (size - 1);
+    uint32_t len;
+    memcpy(&len, data + offset, sizeof(len));
+    if (len == SHM_RING_WRAP) {
+        //Skipped end of the ring is consumed together with the record at the ring start
+        uint32_t skip = size - offset;
+        if (head - tail < skip + sizeof(uint32_t))
+            return -1;
+        tail += skip;
+        offset = 0;
+        memcpy(&len, data, sizeof(len));
+    }
+    if (len > head - tail - sizeof(uint32_t) || len > size - offset - sizeof(uint32_t))
+        return -1;
+
+    *record = data + offset + sizeof(uint32_t);
+    *next = tail + SHM_ALIGN(len) + sizeof(uint32_t);
+
+    return len;
+}
+
+/** Release records up to the position returned by the peek */
+void ShmRing_pop(ShmRing *ring, uint32_t next) {
+    __atomic_store_n(&ring->tail, next, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->tailWaiting, __ATOMIC_SEQ_CST))
+        ShmRing_futexWake(&ring->tail);
+}
+
+/** Wait until ring has a record, but not longer than timeout millis. Return false if it is still empty */
+bool ShmRing_waitData(ShmRing *ring, uint32_t timeout) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    if (head != ring->tail)
+        return true;
+
+    __atomic_store_n(&ring->headWaiting, 1, __ATOMIC_SEQ_CST);
+    head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+    if (head == ring->tail)
+        ShmRing_futexWait(&ring->head, head, timeout);
+    __atomic_store_n(&ring->headWaiting, 0, __ATOMIC_RELAXED);
+
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail;
+}
+
+/** Wait until ring has space for the record of specified length, but not longer than timeout millis. Return false if
+ *  it is still full. Must be called by the producer */
+bool ShmRing_waitSpace(ShmRing *ring, uint32_t size, uint32_t len, uint32_t timeout) {
+    uint32_t need = SHM_ALIGN(len) + sizeof(uint32_t);
+    uint32_t rest = size - (ring->head & (size - 1));
+    if (rest < need)
+        need += rest;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+    if (size - (ring->head - tail) >= need)
+        return true;
+
+    __atomic_store_n(&ring->tailWaiting, 1, __ATOMIC_SEQ_CST);
+    tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+    if (size - (ring->head - tail) < need)
+        ShmRing_futexWait(&ring->tail, tail, timeout);
+    __atomic_store_n(&ring->tailWaiting, 0, __ATOMIC_RELAXED);
+
+    return size - (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) >= need;
+}
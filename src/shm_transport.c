@@ -0,0 +1,169 @@
+/** Shared memory transport for the co-located clients. On the 'shm' command the daemon creates sealed memfd with the
+ *  request and response rings and passes it to the client over the socket. Each request record is a binary OTPP
+ *  packet, it is copied out of the ring before parsing, because the client may change ring memory at any moment, and
+ *  is executed by the ordinary command processor of the separate connection, whose responses are written to the
+ *  response ring as binary OTPP packets. Transport is closed together with the socket connection that requested it */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../inc/shm_transport.h"
+#include "../inc/client_thread.h"
+#include "../inc/config.h"
+#include "../inc/logger.h"
+#include "../inc/otpp.h"
+#include "../inc/thread_pool.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/time.h"
+
+/** Internal function. Return ring size from the config rounded up to the power of two, or zero if transport is
+ *  disabled */
+static uint32_t ShmTransport_ringSize() {
+    int64_t size = Config_getInt("shm.ring", SHM_TRANSPORT_DEFAULT_RING);
+    if (size <= 0)
+        return 0;
+    if (size > (1 << 24))
+        size = 1 << 24;
+
+    uint32_t ring = 4096;
+    while (ring < size)
+        ring <<= 1;
+
+    return ring;
+}
+
+/** Transport thread. Reads requests from the ring while the origin connection is open */
+static void ShmTransport_run(void *args) {
+    ShmTransport *shm = (ShmTransport*) args;
+    Connection *conn = shm->conn;
+    ShmRing *ring = &shm->region->request;
+    char *data = ShmRegion_data(shm->region, ring);
+    CmdProcessor_Args *cpa = ClientThread_startProcessor(conn);
+    Logger_info("ShmTransport", "Shm transport for pid %d was started", conn->pid);
+
+    while (shm->origin->open && conn->open) {
+        const char *record;
+        uint32_t next;
+        int64_t len = ShmRing_peek(ring, data, shm->ringSize, &record, &next);
+        if (len < 0) {
+            Logger_info("ShmTransport", "Request ring of pid %d is broken", conn->pid);
+            break;
+        }
+        if (len == 0) {
+            ShmRing_waitData(ring, SHM_TRANSPORT_IDLE_TIMEOUT);
+            continue;
+        }
+
+        Otpp_Header header;
+        char *payload = NULL;
+        if (len >= OTPP_HEADER_SIZE && Otpp_readHeader(record, &header)
+            && header.len == len - OTPP_HEADER_SIZE && header.len <= OTPP_MAX_PAYLOAD) {
+            payload = pmalloc(header.len + 1); //Free in cmd_processor
+            memcpy(payload, record + OTPP_HEADER_SIZE, header.len);
+        }
+        ShmRing_pop(ring, next);
+
+        if (payload != NULL)
+            ClientThread_enqueue(cpa, ClientThread_binaryFrame(&header, payload), -1);
+        else
+            Logger_info("ShmTransport", "Broken packet from pid %d was dropped", conn->pid);
+    }
+
+    CmdProcessor_stop(cpa);
+    Connection_shutdown(conn);
+    Connection_release(conn);
+    Logger_info("ShmTransport", "Shm transport was stopped");
+}
+
+/** Create transport for the client of the socket connection. Connection may have only one transport. Return memfd of
+ *  the shared region, that must be passed to the client and closed, SHM_TRANSPORT_OPENED if connection already has
+ *  the transport or -1 if transport can't be created */
+int ShmTransport_open(Connection *origin, uint32_t *ringSize) {
+    uint32_t ring = ShmTransport_ringSize();
+    if (ring == 0)
+        return -1;
+    if (__atomic_exchange_n(&origin->shmOpened, true, __ATOMIC_ACQ_REL))
+        return SHM_TRANSPORT_OPENED;
+
+    size_t size = SHM_REGION_SIZE(ring);
+    int fd = memfd_create("nsd-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        Logger_fatal("ShmTransport", "Unable to create memfd (%s)", strerror(errno));
+        __atomic_store_n(&origin->shmOpened, false, __ATOMIC_RELEASE);
+        return -1;
+    }
+    //Client must not be able to resize the region under the daemon mapping
+    if (ftruncate(fd, (off_t) size) != 0
+        || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        Logger_fatal("ShmTransport", "Unable to prepare memfd (%s)", strerror(errno));
+        close(fd);
+        __atomic_store_n(&origin->shmOpened, false, __ATOMIC_RELEASE);
+        return -1;
+    }
+    ShmRegion *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED) {
+        Logger_fatal("ShmTransport", "Unable to map memfd (%s)", strerror(errno));
+        close(fd);
+        __atomic_store_n(&origin->shmOpened, false, __ATOMIC_RELEASE);
+        return -1;
+    }
+    ShmRegion_init(region, ring);
+
+    ShmTransport *shm = pmalloc(sizeof(ShmTransport));
+    shm->region = region;
+    shm->mapSize = size;
+    shm->ringSize = ring;
+    Connection_retain(origin);
+    shm->origin = origin;
+
+    Connection *conn = Connection_new(-1);
+    conn->mode = OTPP_MODE_BINARY;
+    conn->uid = origin->uid;
+    conn->pid = origin->pid;
+    if (origin->client != NULL)
+        conn->client = Clients_attach(origin->uid, origin->pid);
+    conn->shm = shm;
+    shm->conn = conn;
+
+    ThreadPool_runOwned(ShmTransport_run, shm);
+    *ringSize = ring;
+
+    return fd;
+}
+
+/** Write response record to the response ring. If the ring is full, wait while client is connected, but not longer
+ *  than SHM_TRANSPORT_WRITE_TIMEOUT. Client that does not drain the ring for so long has it's transport closed, so
+ *  writers are not stalled by it. Must be called under the connection write mutex, so the ring has one producer */
+ssize_t ShmTransport_write(ShmTransport *shm, const struct iovec *iov, int count) {
+    ShmRing *ring = &shm->region->response;
+    char *data = ShmRegion_data(shm->region, ring);
+    size_t len = 0;
+    for (int i = 0; i < count; i++)
+        len += iov[i].iov_len;
+    if (len + sizeof(uint32_t) > shm->ringSize || !shm->conn->open)
+        return -1;
+
+    uint64_t deadline = CoarseMonotonicMillis() + SHM_TRANSPORT_WRITE_TIMEOUT;
+    while (!ShmRing_push(ring, data, shm->ringSize, iov, count)) {
+        if (!shm->origin->open)
+            return -1;
+        if (CoarseMonotonicMillis() >= deadline) {
+            Logger_info("ShmTransport", "Response ring of pid %d stays full, transport is closed", shm->conn->pid);
+            Connection_shutdown(shm->conn);
+            return -1;
+        }
+        ShmRing_waitSpace(ring, shm->ringSize, (uint32_t) len, SHM_TRANSPORT_IDLE_TIMEOUT);
+    }
+
+    return len;
+}
+
+/** Unmap region and release origin connection. Called by the last release of the transport connection */
+void ShmTransport_free(ShmTransport *shm) {
+    munmap(shm->region, shm->mapSize);
+    Connection_release(shm->origin);
+    pfree(shm);
+}
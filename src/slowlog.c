@@ -0,0 +1,116 @@
+/** Slow requests log. Request which end to end time, from the moment it's packet was completely received to the moment
+ *  it's response was written, exceeds 'slowlog.threshold' micros is recorded by one line to the separate log file
+ *  'slowlog.path':
+ *
+ *      ts=<epoch millis> msgId=<id> cmd=<name> args=<size,size,...> pid=<pid> uid=<uid> total_us=<t> queue_us=<t>
+ *      handler_us=<t> write_us=<t> depth=<packets> suppressed=<lines>
+ *
+ *  Queue time is spent in the connection queue, handler time in the command handlers and write time in writing of the
+ *  responses, depth is count of the connection packets that were in work when this one was received. Not more than
+ *  'slowlog.rate' lines are written per second, so the stall of the daemon does not produce a log storm, lines dropped
+ *  above it are counted by the next written line */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../inc/slowlog.h"
+#include "../inc/config.h"
+#include "../inc/logger.h"
+#include "../inc/stats.h"
+#include "../libs/oscl/include/threads.h"
+#include "../libs/oscl/include/time.h"
+
+static int fd = -1;
+static uint64_t thresholdNanos = 0;
+static uint32_t rate = SLOWLOG_DEFAULT_RATE;
+
+/** Rate limiter state, protected by the mutex. Only slow requests reach it */
+static mutex_t *limitMutex = NULL;
+static uint64_t windowStart = 0;
+static uint32_t windowLines = 0;
+static uint64_t suppressed = 0;
+
+/** Read configuration and open the log file. Slow log is disabled unless 'slowlog.threshold' is set. Return false if
+ *  the file can't be opened */
+bool SlowLog_init() {
+    int64_t threshold = Config_getInt("slowlog.threshold", 0);
+    if (threshold <= 0)
+        return true;
+
+    const char *path = Config_getString("slowlog.path", SLOWLOG_DEFAULT_PATH);
+    fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        Logger_fatal("SlowLog", "Unable to open slow log '%s'", path);
+        return false;
+    }
+    int64_t lines = Config_getInt("slowlog.rate", SLOWLOG_DEFAULT_RATE);
+    rate = lines > 0 ? (uint32_t) lines : 1;
+    limitMutex = NewMutex("slowlog");
+    thresholdNanos = (uint64_t) threshold * 1000;
+    Logger_info("SlowLog", "Requests slower than %lld us are logged to '%s'", (long long) threshold, path);
+
+    return true;
+}
+
+bool SlowLog_enabled() {
+    return thresholdNanos > 0;
+}
+
+/** Internal function. Take the line from the rate limit. Return false if the line must be suppressed, otherwise
+ *  suppressed count is the count of lines dropped since the previous taken line */
+static bool SlowLog_take(uint64_t now, uint64_t *dropped) {
+    MutexLock(limitMutex);
+    if (now - windowStart >= NANOS_IN_SECOND) {
+        windowStart = now;
+        windowLines = 0;
+    }
+    bool taken = windowLines < rate;
+    if (taken) {
+        windowLines++;
+        *dropped = suppressed;
+        suppressed = 0;
+    } else {
+        suppressed++;
+    }
+    MutexUnlock(limitMutex);
+
+    return taken;
+}
+
+/** Write the line of the request if it's end to end time exceeds the threshold. End is the monotonic time when the
+ *  response was written */
+void SlowLog_check(const SlowLog_Trace *trace, Connection *conn, uint64_t end) {
+    uint64_t total = end - trace->arrival;
+    uint64_t dropped;
+    if (total < thresholdNanos || !SlowLog_take(end, &dropped))
+        return;
+
+    char args[SLOWLOG_MAX_ARGS * 11 + 4];
+    int argsLen = 0;
+    uint16_t listed = trace->argc < SLOWLOG_MAX_ARGS ? trace->argc : (uint16_t) SLOWLOG_MAX_ARGS;
+    for (uint16_t i = 0; i < listed; i++)
+        argsLen += sprintf(args + argsLen, i == 0 ? "%u" : ",%u", trace->argSizes[i]);
+    if (trace->argc > listed)
+        argsLen += sprintf(args + argsLen, ",...");
+    if (argsLen == 0)
+        sprintf(args, "-");
+
+    char line[512];
+    int len = snprintf(line, sizeof(line), "ts=%llu msgId=%u cmd=%s args=%s pid=%d uid=%d total_us=%llu queue_us=%llu"
+                                           " handler_us=%llu write_us=%llu depth=%u suppressed=%llu\n",
+                       (unsigned long long) RealTimeMillis(), trace->msgId,
+                       trace->command[0] != 0 ? trace->command : "-", args, (int) conn->pid, (int) conn->uid,
+                       (unsigned long long) (total / 1000),
+                       (unsigned long long) ((trace->dequeued - trace->arrival) / 1000),
+                       (unsigned long long) (trace->handlerNanos / 1000),
+                       (unsigned long long) (trace->writeNanos / 1000), trace->depth,
+                       (unsigned long long) dropped);
+    if (len >= (int) sizeof(line)) {
+        len = sizeof(line) - 1;
+        line[len - 1] = '\n';
+    }
+    //Appended line is written by one syscall, so lines of different threads are not mixed
+    if (write(fd, line, (size_t) len) < 0)
+        Logger_info("SlowLog", "Unable to write slow log line");
+    Stats_inc(STATS_IO_SYSCALLS);
+}
@@ -0,0 +1,87 @@
+/** Daemon wide monitoring counters. Counters are updated by atomic operations, so they may be touched from any
+ *  thread without locks. Snapshot of all counters is available through the 'stats' OTPP command, while the mutex
+ *  profiling is enabled it is followed by the contention of the named mutexes. Allocator state is appended to the
+ *  counters, so the memory growth may be watched without attaching to the process */
+
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+#include "../inc/stats.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/threads.h"
+
+/** Names of the counters, indexed by Stats_Counter */
+static const char *names[STATS_COUNTERS_COUNT] = {
+        "queue.full",               //Frames that found connection queue full, so socket reading was suspended
+        "queue.full_timeout",       //Backpressure waits that expired while connection queue stays full
+        "requests.shed",            //Requests dropped at dequeue because their deadline has passed
+        "queue.depth.control",      //Packets waiting in the control lanes of all connection queues
+        "queue.depth.normal",       //Packets waiting in the normal lanes of all connection queues
+        "queue.depth.bulk",         //Packets waiting in the bulk lanes of all connection queues
+        "requests.throttled",       //Requests rejected because client was over it's rate limit
+        "sched.waits",              //Commands that waited for the execution slot
+        "batch.packets",            //Received batch packets
+        "batch.commands",           //Sub-commands executed from the batch packets
+        "io.syscalls",              //Syscalls made for the socket and log I/O
+        "threads.pool",             //Workers of the connection threads pool
+        "threads.busy",             //Workers that execute tasks
+        "threads.queued",           //Tasks that waited for a free worker because the pool was full
+        "threads.stack_kb",         //Stack memory reserved by the workers
+        "requests.inline",          //Requests executed by the reader without queueing
+        "capture.frames",           //Received packets passed to the capture file writer
+        "capture.dropped",          //Received packets not captured because the capture buffer was full
+};
+
+static uint64_t counters[STATS_COUNTERS_COUNT];
+
+void Stats_inc(Stats_Counter counter) {
+    __atomic_fetch_add(&counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+/** Add value to the counter. Value may be negative, so counter may be used as gauge */
+void Stats_add(Stats_Counter counter, int64_t value) {
+    __atomic_fetch_add(&counters[counter], (uint64_t) value, __ATOMIC_RELAXED);
+}
+
+uint64_t Stats_get(Stats_Counter counter) {
+    return __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+}
+
+/** Return all counters as string in form 'name=value name=value ...'. Each measured mutex name adds counters
+ *  'mutex.<name>.{acquired,contended,wait_us,wait_max_us,hold_us,hold_max_us}'. Result must be freed by caller */
+char* Stats_format() {
+    MutexStats mutexes[MUTEX_STATS_MAX];
+    uint32_t mutexCount = MutexStatsSnapshot(mutexes, MUTEX_STATS_MAX);
+
+    size_t size = 1;
+    for (int i = 0; i < STATS_COUNTERS_COUNT; i++)
+        size += strlen(names[i]) + 22;
+    for (uint32_t i = 0; i < mutexCount; i++)
+        size += 6 * (strlen(mutexes[i].name) + 40);
+    size += 3 * 40;
+
+    char *buf = pmalloc(size);
+    size_t pos = 0;
+    buf[0] = 0;
+    for (int i = 0; i < STATS_COUNTERS_COUNT; i++) {
+        pos += sprintf(buf + pos, i == 0 ? "%s=%llu" : " %s=%llu", names[i], (unsigned long long) Stats_get(i));
+    }
+    //Heap is the memory taken by the allocator from the system, used is it's part given to the daemon
+    struct mallinfo2 heap = mallinfo2();
+    pos += sprintf(buf + pos, " malloc.heap_kb=%llu malloc.used_kb=%llu malloc.mmap_kb=%llu",
+                   (unsigned long long) ((heap.arena + heap.hblkhd) / 1024),
+                   (unsigned long long) ((heap.uordblks + heap.hblkhd) / 1024),
+                   (unsigned long long) (heap.hblkhd / 1024));
+    for (uint32_t i = 0; i < mutexCount; i++) {
+        MutexStats *m = &mutexes[i];
+        pos += sprintf(buf + pos, " mutex.%s.acquired=%llu mutex.%s.contended=%llu mutex.%s.wait_us=%llu"
+                                  " mutex.%s.wait_max_us=%llu mutex.%s.hold_us=%llu mutex.%s.hold_max_us=%llu",
+                       m->name, (unsigned long long) m->acquired, m->name, (unsigned long long) m->contended,
+                       m->name, (unsigned long long) (m->waitNanos / 1000), m->name,
+                       (unsigned long long) (m->maxWaitNanos / 1000), m->name,
+                       (unsigned long long) (m->holdNanos / 1000), m->name,
+                       (unsigned long long) (m->maxHoldNanos / 1000));
+    }
+
+    return buf;
+}
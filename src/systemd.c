@@ -0,0 +1,122 @@
+/** Systemd integration without the libsystemd. Socket activation passes listening sockets bound by the .socket unit
+ *  to the daemon as descriptors started from the 3, their count is in the LISTEN_FDS environment variable and the
+ *  LISTEN_PID must be the pid of the process that takes them. Clients may connect to these sockets before the daemon
+ *  is started, their connects are queued by the kernel. Readiness is reported by the datagram sent to the
+ *  NOTIFY_SOCKET, as sd_notify does it */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../inc/systemd.h"
+#include "../inc/logger.h"
+
+/** Listening socket received from the systemd */
+typedef struct Systemd_Listener {
+    int sockfd;
+    bool seqpacket;
+    bool taken;
+    char path[sizeof(((struct sockaddr_un*) 0)->sun_path)];
+} Systemd_Listener;
+
+static Systemd_Listener activated[SYSTEMD_MAX_LISTENERS];
+static int activatedCount = 0;
+
+/** Take sockets passed by the socket activation. Must be called before the fork, since LISTEN_PID is the pid of the
+ *  launched process. Variables are removed, so the processes started by the daemon don't take them */
+void Systemd_init() {
+    const char *pidStr = getenv("LISTEN_PID");
+    const char *fdsStr = getenv("LISTEN_FDS");
+    if (pidStr == NULL || fdsStr == NULL || atoi(pidStr) != getpid())
+        return;
+    int count = atoi(fdsStr);
+    unsetenv("LISTEN_PID");
+    unsetenv("LISTEN_FDS");
+    unsetenv("LISTEN_FDNAMES");
+
+    for (int fd = SYSTEMD_LISTEN_FDS_START; fd < SYSTEMD_LISTEN_FDS_START + count; fd++) {
+        //Systemd passes descriptors without the close on exec, they must not leak to the programs started by the daemon
+        fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+        struct sockaddr_un address;
+        socklen_t len = sizeof(address);
+        memset(&address, 0, sizeof(address));
+        int type = 0;
+        int listening = 0;
+        socklen_t optLen = sizeof(int);
+        if (getsockname(fd, (struct sockaddr*) &address, &len) != 0 || address.sun_family != AF_UNIX
+            || getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &optLen) != 0
+            || getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &optLen) != 0 || !listening
+            || (type != SOCK_STREAM && type != SOCK_SEQPACKET) || activatedCount == SYSTEMD_MAX_LISTENERS) {
+            Logger_info("Systemd", "Activated descriptor %d is not an unix domain listener, it is ignored", fd);
+            continue;
+        }
+
+        Systemd_Listener *listener = &activated[activatedCount++];
+        listener->sockfd = fd;
+        listener->seqpacket = type == SOCK_SEQPACKET;
+        listener->taken = false;
+        strncpy(listener->path, address.sun_path, sizeof(listener->path) - 1);
+    }
+}
+
+/** Return descriptor of the activated listener bound to the path, or -1 if the socket was not activated */
+int Systemd_listener(const char *path, bool seqpacket) {
+    for (int i = 0; i < activatedCount; i++) {
+        Systemd_Listener *listener = &activated[i];
+        if (!listener->taken && listener->seqpacket == seqpacket && strcmp(listener->path, path) == 0) {
+            listener->taken = true;
+            Logger_info("Systemd", "Socket '%s' was activated by systemd", path);
+            return listener->sockfd;
+        }
+    }
+
+    return -1;
+}
+
+/** Close activated sockets that were not taken by any listener, like the seqpacket one while 'listen.seqpacket' is not
+ *  set. Clients would connect to them and wait forever, since nobody accepts. Must be called after all listeners are
+ *  opened */
+void Systemd_closeUntaken() {
+    for (int i = 0; i < activatedCount; i++) {
+        Systemd_Listener *listener = &activated[i];
+        if (!listener->taken && listener->sockfd >= 0) {
+            Logger_info("Systemd", "Activated socket '%s' is not listened by the daemon, it is closed", listener->path);
+            close(listener->sockfd);
+            listener->sockfd = -1;
+        }
+    }
+}
+
+/** Send state to the service manager. Return false if the NOTIFY_SOCKET is not set or state was not sent */
+bool Systemd_notify(const char *state) {
+    const char *path = getenv("NOTIFY_SOCKET");
+    if (path == NULL || (path[0] != '/' && path[0] != '@'))
+        return false;
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    size_t pathLen = strlen(path);
+    if (pathLen >= sizeof(address.sun_path))
+        return false;
+    memcpy(address.sun_path, path, pathLen);
+    //Socket in the abstract namespace
+    if (address.sun_path[0] == '@')
+        address.sun_path[0] = 0;
+
+    int sockfd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sockfd < 0)
+        return false;
+    size_t stateLen = strlen(state);
+    bool sent = sendto(sockfd, state, stateLen, MSG_NOSIGNAL, (struct sockaddr*) &address,
+                       (socklen_t) (offsetof(struct sockaddr_un, sun_path) + pathLen)) == (ssize_t) stateLen;
+    close(sockfd);
+    if (!sent)
+        Logger_fatal("Systemd", "Unable to notify '%s'", path);
+
+    return sent;
+}
@@ -0,0 +1,258 @@
+/** Pool of the reusable threads for the connections. Client threads, command processors and shared memory transports
+ *  run as tasks of the pool instead of creating own threads. 'pool.threads' workers are started with the daemon and
+ *  more are created while all of them are busy, up to 'pool.max'. Command processors and shm transports are owned by
+ *  the connections that are already served, readers wait for them, so they get workers above the limit and are taken
+ *  before the waiting readers, otherwise readers that hold all workers would wait forever. Worker above the prestarted
+ *  count exits when it has no task for THREAD_POOL_IDLE_TIMEOUT, and is joined by the next retired one outside of the
+ *  pool mutex, so resources of finished threads are always freed. When workers stop retiring, the wheel timer returns
+ *  memory freed by them from the allocator arenas to the system once. Idle workers are woken in the reverse order of
+ *  parking, otherwise steady load would wake each of them in turn and the pool would never shrink from it's peak size.
+ *  Workers have 'pool.stack' KB stacks instead of the default 8 MB ones, are named 'nsd-worker-<n>', are bound to the
+ *  'pool.cpus' CPUs (list like '0-3,6') if it is set and get SCHED_RR 'pool.priority' if it is not 0 */
+
+#include <stdio.h>
+#include <malloc.h>
+#include "../inc/thread_pool.h"
+#include "../inc/config.h"
+#include "../inc/logger.h"
+#include "../inc/stats.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/threads.h"
+#include "../libs/oscl/include/wait.h"
+
+static mutex_t *poolMutex = NULL;
+
+/** Queue of the tasks not taken by workers yet, and the free list of it's nodes */
+static ThreadPool_Task *head = NULL;
+static ThreadPool_Task *tail = NULL;
+static ThreadPool_Task *freeTasks = NULL;
+static uint32_t pending = 0;
+
+/** Workers state. Idle workers poll the queue by the wait strategy, then park on the sleepers stack */
+static uint32_t workers = 0;
+static uint32_t idle = 0;
+static ThreadPool_Sleeper *sleepers = NULL;
+static uint32_t started = 0;
+static bool hasRetired = false;
+static thread_t retired;
+/** Timer that trims the allocator after the last retired worker */
+static twheel_t *trimWheel = NULL;
+static wtimer_t trimTimer;
+
+/** Configuration */
+static uint32_t prestarted = THREAD_POOL_DEFAULT_THREADS;
+static uint32_t maxWorkers = THREAD_POOL_DEFAULT_MAX;
+static uint16_t stackSize = THREAD_POOL_DEFAULT_STACK;
+/** Actual stack size of the worker, it is reported by the stats */
+static int64_t stackKb = THREAD_POOL_DEFAULT_STACK;
+static uint64_t priority = 0;
+static const char *cpus = NULL;
+
+/** Internal function. Load has dropped, so pages freed by the connections are returned to the system instead of
+ *  staying in the allocator arenas. Called by the wheel thread */
+static void ThreadPool_trim(void *arg) {
+    malloc_trim(0);
+}
+
+/** Internal function. Worker exits, it is joined by the next retired one. Return true if there is the previously
+ *  retired worker, that caller must join after the pool mutex is released. Each retire postpones the trim, so workers
+ *  that time out together trim the allocator once. Must be called under the pool mutex */
+static bool ThreadPool_retire(thread_t *previous) {
+    workers--;
+    Stats_add(STATS_THREADS_POOL, -1);
+    Stats_add(STATS_THREADS_STACK, -stackKb);
+    bool join = hasRetired;
+    *previous = retired;
+    retired = pthread_self();
+    hasRetired = true;
+    if (trimWheel != NULL)
+        TimerSchedule(trimWheel, &trimTimer, THREAD_POOL_TRIM_DELAY);
+
+    return join;
+}
+
+/** Internal function. Park the worker on the top of the sleepers stack until the task wakes it, or for the idle timeout
+ *  if timed. Return false if it was not woken. Must be called under the pool mutex */
+static bool ThreadPool_park(ThreadPool_Sleeper *sleeper, bool timed) {
+    sleeper->woken = false;
+    sleeper->next = sleepers;
+    sleepers = sleeper;
+    while (!sleeper->woken) {
+        if (!timed) {
+            CondWait(sleeper->cond, poolMutex);
+        } else if (!CondTimedWait(sleeper->cond, poolMutex, THREAD_POOL_IDLE_TIMEOUT)) {
+            break;
+        }
+    }
+    if (!sleeper->woken) {
+        ThreadPool_Sleeper **link = &sleepers;
+        while (*link != sleeper)
+            link = &(*link)->next;
+        *link = sleeper->next;
+    }
+
+    return sleeper->woken;
+}
+
+/** Internal function. Worker thread function. It executes queued tasks and waits for new ones */
+static void ThreadPool_work(void *args) {
+    ThreadPool_Sleeper sleeper = {NewCond(), false, NULL};
+    MutexLock(poolMutex);
+    while (1) {
+        idle++;
+        const wait_t *wait = WaitDefault();
+        bool polled = wait->spins + wait->yields == 0;
+        while (head == NULL) {
+            if (!polled) {
+                //Task queue is polled by the process wait strategy before the worker parks
+                polled = true;
+                MutexUnlock(poolMutex);
+                uint32_t round = 0;
+                while (__atomic_load_n(&head, __ATOMIC_RELAXED) == NULL && WaitStep(wait, &round));
+                MutexLock(poolMutex);
+            } else if (!ThreadPool_park(&sleeper, workers > prestarted) && head == NULL && workers > prestarted) {
+                //Workers time out together, so the count is checked again by each one
+                idle--;
+                thread_t previous;
+                bool join = ThreadPool_retire(&previous);
+                MutexUnlock(poolMutex);
+                DelCond(sleeper.cond);
+                if (join)
+                    ThreadJoin(previous);
+                return;
+            }
+        }
+        idle--;
+
+        ThreadPool_Task *task = head;
+        head = task->next;
+        if (head == NULL)
+            tail = NULL;
+        pending--;
+        void (*run)(void*) = task->run;
+        void *taskArgs = task->args;
+        task->next = freeTasks;
+        freeTasks = task;
+        MutexUnlock(poolMutex);
+
+        Stats_add(STATS_THREADS_BUSY, 1);
+        run(taskArgs);
+        Stats_add(STATS_THREADS_BUSY, -1);
+
+        MutexLock(poolMutex);
+    }
+}
+
+/** Internal function. Start new worker. Must be called under the pool mutex. Return false if thread can't be created */
+static bool ThreadPool_spawn() {
+    char *name = pmalloc(16);
+    snprintf(name, 16, "nsd-worker-%u", started % 10000);
+    thread_t thread = NewThread(ThreadPool_work, NULL, stackSize, name, priority);
+    if (thread == 0) {
+        Logger_fatal("ThreadPool", "Unable to start worker, %u workers are running", workers);
+        return false;
+    }
+    if (cpus != NULL && !ThreadPin(thread, cpus))
+        Logger_fatal("ThreadPool", "Unable to bind worker to CPUs '%s'", cpus);
+
+    started++;
+    workers++;
+    Stats_add(STATS_THREADS_POOL, 1);
+    Stats_add(STATS_THREADS_STACK, stackKb);
+
+    return true;
+}
+
+/** Read configuration of the pool and start prestarted workers. Allocator is trimmed by the timer on the wheel after
+ *  the workers retire. Must be called once before the first task is run */
+bool ThreadPool_init(twheel_t *wheel) {
+    poolMutex = NewMutex("pool");
+    trimWheel = wheel;
+    WheelTimerInit(&trimTimer, ThreadPool_trim, NULL);
+
+    prestarted = (uint32_t) Config_getInt("pool.threads", THREAD_POOL_DEFAULT_THREADS);
+    maxWorkers = (uint32_t) Config_getInt("pool.max", THREAD_POOL_DEFAULT_MAX);
+    if (maxWorkers < 1)
+        maxWorkers = 1;
+    if (prestarted > maxWorkers)
+        prestarted = maxWorkers;
+    int64_t stack = Config_getInt("pool.stack", THREAD_POOL_DEFAULT_STACK);
+    stackSize = (uint16_t) (stack < 0 ? 0 : stack > UINT16_MAX ? UINT16_MAX : stack);
+    stackKb = stackSize;
+    if (stackSize == 0) {
+        size_t size;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_getstacksize(&attr, &size);
+        pthread_attr_destroy(&attr);
+        stackKb = (int64_t) (size / 1024);
+    }
+    int64_t prio = Config_getInt("pool.priority", 0);
+    priority = prio < 0 ? 0 : (uint64_t) prio;
+    cpus = Config_getString("pool.cpus", NULL);
+    if (cpus != NULL && cpus[0] == 0)
+        cpus = NULL;
+
+    MutexLock(poolMutex);
+    for (uint32_t i = 0; i < prestarted; i++) {
+        if (!ThreadPool_spawn())
+            break;
+    }
+    MutexUnlock(poolMutex);
+
+    Logger_info("ThreadPool", "%u workers were started, up to %u with %lld KB stacks", workers, maxWorkers,
+                (long long) stackKb);
+
+    return workers > 0 || prestarted == 0;
+}
+
+/** Internal function. Queue task and wake or start the worker for it. Owned task goes before the waiting ones and
+ *  starts new worker even if the pool is full */
+static void ThreadPool_submit(void (*run)(void*), void *args, bool owned) {
+    MutexLock(poolMutex);
+    ThreadPool_Task *task = freeTasks;
+    if (task != NULL)
+        freeTasks = task->next;
+    else
+        task = pmalloc(sizeof(ThreadPool_Task));
+    task->run = run;
+    task->args = args;
+    if (owned) {
+        task->next = head;
+        head = task;
+        if (tail == NULL)
+            tail = task;
+    } else {
+        task->next = NULL;
+        if (tail != NULL)
+            tail->next = task;
+        else
+            head = task;
+        tail = task;
+    }
+    pending++;
+
+    if (idle >= pending) {
+        //Workers that still poll the queue are not parked, they take the task themselves
+        ThreadPool_Sleeper *sleeper = sleepers;
+        if (sleeper != NULL) {
+            sleepers = sleeper->next;
+            sleeper->woken = true;
+            CondSignal(sleeper->cond);
+        }
+    } else if ((workers >= maxWorkers && !owned) || !ThreadPool_spawn())
+        Stats_inc(STATS_THREADS_QUEUED);
+    MutexUnlock(poolMutex);
+}
+
+/** Run task by the free worker. New worker is started if all are busy, and if the pool is full, task waits until
+ *  some worker becomes free */
+void ThreadPool_run(void (*run)(void*), void *args) {
+    ThreadPool_submit(run, args, false);
+}
+
+/** Run task owned by the connection that is already served, like it's command processor or shm transport. It never
+ *  waits for the free worker, count of such tasks is bounded by the count of the connections */
+void ThreadPool_runOwned(void (*run)(void*), void *args) {
+    ThreadPool_submit(run, args, true);
+}
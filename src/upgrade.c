@@ -0,0 +1,385 @@
+/** Zero downtime upgrade. Running daemon listens the upgrade socket ('upgrade.socket', accessible for root only). New
+ *  daemon started by the 'upgrade' action connects to it, and the running one passes the listening sockets to it by
+ *  SCM_RIGHTS, so listeners are never closed and connects are never refused. The new process sends READY record when
+ *  it's listeners accept, only then the old process stops accepting, passes connections that have no packets in work to
+ *  the new one together with their framing state, and exits when the rest of it's connections are closed, but not later
+ *  than 'upgrade.drain' millis. If the new process closes the socket without READY or does not send it in
+ *  'upgrade.ready' millis, the old one keeps serving. Blocking calls of the accepting and reading threads are broken by
+ *  the SIGUSR2, that has no other effect */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "../inc/upgrade.h"
+#include "../inc/capture.h"
+#include "../inc/config.h"
+#include "../inc/logger.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/threads.h"
+#include "../libs/oscl/include/time.h"
+
+/** Old process side. Listeners of the process, socket where the new process is accepted, and the connection to it */
+static int upgradeFd = -1;
+static IoEngine_Listener *ownListeners = NULL;
+static int ownCount = 0;
+static bool canPass = false;
+static int peerFd = -1;
+static mutex_t peerMutex = MUTEX_INITIALIZER("upgrade.peer");
+static volatile bool handingOff = false;
+static volatile bool passing = false;
+
+/** Threads that accept connections of the listeners */
+static thread_t acceptThreads[UPGRADE_MAX_LISTENERS];
+static bool accepting[UPGRADE_MAX_LISTENERS];
+static mutex_t acceptMutex = MUTEX_INITIALIZER("upgrade.accept");
+
+/** New process side. Connection to the old process, that is notified when listeners accept and passes connections
+ *  if adopting is set. It is closed under the accept mutex */
+static int adoptFd = -1;
+static bool adopting = false;
+static bool announced = false;
+
+/** Internal function. Handler of the interrupting signal. It does nothing, signal only breaks the blocking call */
+static void Upgrade_interrupted(int sig) {
+}
+
+/** Internal function. Send record to the socket, with descriptor if fd is not -1. Old process sends to the peer under
+ *  the peer mutex */
+static bool Upgrade_sendRecord(int sockfd, const Upgrade_Record *record, int fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {(void*) record, sizeof(Upgrade_Record)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd >= 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t r;
+    do {
+        r = sendmsg(sockfd, &msg, 0);
+    } while (r < 0 && errno == EINTR);
+
+    return r == sizeof(Upgrade_Record);
+}
+
+/** Internal function. Receive record and it's descriptor, fd is -1 if record has no one. Return false if connection
+ *  was closed */
+static bool Upgrade_recvRecord(int sockfd, Upgrade_Record *record, int *fd) {
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {record, sizeof(Upgrade_Record)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t r;
+    do {
+        r = recvmsg(sockfd, &msg, 0);
+    } while (r < 0 && errno == EINTR);
+
+    *fd = -1;
+    struct cmsghdr *cmsg = r > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    if (r != sizeof(Upgrade_Record) && *fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+
+    return r == sizeof(Upgrade_Record);
+}
+
+/** Internal function. Check the new process, pass listeners to it and wait until it accepts. Return false if it was
+ *  rejected or has not become ready, then this process keeps serving */
+static bool Upgrade_handshake(int sockfd) {
+    struct ucred cred;
+    socklen_t credLen = sizeof(cred);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_PEERCRED, &cred, &credLen) != 0 || cred.uid != geteuid()) {
+        Logger_info("Upgrade", "Upgrade by the foreign user was rejected");
+        return false;
+    }
+    //New process that hangs without exiting must not hold the upgrade thread, timeout is handled as a close
+    int64_t ready = Config_getInt("upgrade.ready", UPGRADE_DEFAULT_READY);
+    struct timeval timeout = {(time_t) (ready / 1000), (suseconds_t) (ready % 1000 * 1000)};
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    Upgrade_Hello hello;
+    if (recv(sockfd, &hello, sizeof(hello), 0) != sizeof(hello) || hello.magic != UPGRADE_MAGIC
+        || hello.version != UPGRADE_VERSION) {
+        Logger_info("Upgrade", "Upgrade by pid %d was rejected, it's hello is broken or late", cred.pid);
+        return false;
+    }
+
+    Upgrade_Record record;
+    memset(&record, 0, sizeof(record));
+    record.type = UPGRADE_LISTENER;
+    bool sent = true;
+    for (int i = 0; i < ownCount && sent; i++) {
+        record.seqpacket = ownListeners[i].seqpacket;
+        strncpy(record.path, ownListeners[i].path, sizeof(record.path) - 1);
+        sent = Upgrade_sendRecord(sockfd, &record, ownListeners[i].sockfd);
+    }
+    memset(&record, 0, sizeof(record));
+    record.type = UPGRADE_LISTENED;
+    sent = sent && Upgrade_sendRecord(sockfd, &record, -1);
+    if (!sent) {
+        Logger_fatal("Upgrade", "Unable to pass listeners to pid %d (%s)", cred.pid, strerror(errno));
+        return false;
+    }
+    Logger_info("Upgrade", "Listeners were passed to pid %d, it is waited to accept", cred.pid);
+
+    //Socket is closed without READY if the new process has failed to start
+    int fd;
+    if (!Upgrade_recvRecord(sockfd, &record, &fd) || record.type != UPGRADE_READY) {
+        if (fd >= 0)
+            close(fd);
+        Logger_info("Upgrade", "Pid %d has not become ready, daemon keeps serving", cred.pid);
+        return false;
+    }
+
+    MutexLock(&peerMutex);
+    peerFd = sockfd;
+    passing = canPass && (hello.flags & UPGRADE_FLAG_ADOPT);
+    __atomic_store_n(&handingOff, true, __ATOMIC_SEQ_CST);
+    MutexUnlock(&peerMutex);
+    Logger_info("Upgrade", "Pid %d accepts, connections are drained", cred.pid);
+
+    return true;
+}
+
+/** Internal function. Wait until accepting is stopped and connections are closed or passed, but not longer than the
+ *  drain timeout, then exit */
+static void Upgrade_drain() {
+    uint64_t next = MonotonicNanos();
+    uint64_t end = next + (uint64_t) Config_getInt("upgrade.drain", UPGRADE_DEFAULT_DRAIN) * NANOS_IN_MILLI;
+    while (next < end) {
+        int count = 0;
+        MutexLock(&acceptMutex);
+        for (int i = 0; i < UPGRADE_MAX_LISTENERS; i++) {
+            if (accepting[i]) {
+                pthread_kill(acceptThreads[i], SIGUSR2);
+                count++;
+            }
+        }
+        MutexUnlock(&acceptMutex);
+        //Connection accepted at the last moment is counted, because accepting is stopped after it
+        if (count == 0 && Connection_count() == 0)
+            break;
+        if (passing)
+            Connection_interruptReaders(SIGUSR2);
+        next += UPGRADE_INTERRUPT_INTERVAL * NANOS_IN_MILLI;
+        SleepUntilNanos(next);
+    }
+
+    uint32_t left = Connection_count();
+    if (left > 0)
+        Logger_info("Upgrade", "%u connections were not drained in time and are closed", left);
+    MutexLock(&peerMutex);
+    Upgrade_Record record;
+    memset(&record, 0, sizeof(record));
+    record.type = UPGRADE_END;
+    Upgrade_sendRecord(peerFd, &record, -1);
+    MutexUnlock(&peerMutex);
+    Logger_info("Upgrade", "Daemon was drained and exits");
+    Capture_stop();
+    Logger_flush();
+    exit(0);
+}
+
+/** Internal function. Upgrade thread. Waits for the new process, passes listeners to it and drains the daemon */
+static void Upgrade_run(void *args) {
+    while (1) {
+        int sockfd = accept(upgradeFd, NULL, NULL);
+        if (sockfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            Logger_fatal("Upgrade", "Unable to accept upgrade connection (%s)", strerror(errno));
+            return;
+        }
+        if (Upgrade_handshake(sockfd))
+            break;
+        close(sockfd);
+    }
+
+    close(upgradeFd);
+    Upgrade_drain();
+}
+
+/** Start waiting for the new process on the upgrade socket. Listeners array must stay valid while the daemon runs.
+ *  If passConnections is false, engine can't pass connections and they are only drained */
+void Upgrade_listen(int sockfd, IoEngine_Listener *listeners, int count, bool passConnections) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    //Without SA_RESTART the blocking call returns EINTR
+    action.sa_handler = Upgrade_interrupted;
+    sigaction(SIGUSR2, &action, NULL);
+
+    upgradeFd = sockfd;
+    ownListeners = listeners;
+    ownCount = count;
+    canPass = passConnections;
+    ThreadDetach(NewThread(Upgrade_run, NULL, 0, NULL, 0));
+}
+
+/** Return true if listeners were passed to the new process, so this one must stop accepting and drain connections */
+bool Upgrade_handingOff() {
+    return __atomic_load_n(&handingOff, __ATOMIC_SEQ_CST);
+}
+
+/** Return true if idle connections must be passed to the new process */
+bool Upgrade_passing() {
+    return Upgrade_handingOff() && passing;
+}
+
+/** Pass connection to the new process. It must have no packets in work and no unparsed data. Return false if it
+ *  can't be passed, then it is still served by this process */
+bool Upgrade_sendConn(Connection *conn, uint8_t state) {
+    if (!Upgrade_passing())
+        return false;
+
+    Upgrade_Record record;
+    memset(&record, 0, sizeof(record));
+    record.type = UPGRADE_CONN;
+    record.seqpacket = conn->seqpacket;
+    record.state = state;
+    MutexLock(&peerMutex);
+    bool sent = Upgrade_sendRecord(peerFd, &record, conn->sockfd);
+    if (!sent && passing) {
+        passing = false;
+        Logger_fatal("Upgrade", "Unable to pass connection (%s), connections are only drained", strerror(errno));
+    }
+    MutexUnlock(&peerMutex);
+    if (sent) {
+        conn->passed = true;
+        conn->open = false;
+    }
+
+    return sent;
+}
+
+/** Register calling thread as accepting connections of the listeners. It is interrupted until it calls
+ *  Upgrade_acceptStopped. The first one of the upgraded process sends READY, so the old process stops accepting */
+void Upgrade_acceptStarted() {
+    MutexLock(&acceptMutex);
+    for (int i = 0; i < UPGRADE_MAX_LISTENERS; i++) {
+        if (!accepting[i]) {
+            acceptThreads[i] = pthread_self();
+            accepting[i] = true;
+            break;
+        }
+    }
+    if (adoptFd >= 0 && !announced) {
+        announced = true;
+        Upgrade_Record record;
+        memset(&record, 0, sizeof(record));
+        record.type = UPGRADE_READY;
+        //Old process that has not waited for READY keeps serving, so this one must not serve the listeners too
+        if (!Upgrade_sendRecord(adoptFd, &record, -1)) {
+            Logger_fatal("Upgrade", "Unable to report readiness to the old process (%s), daemon exits",
+                         strerror(errno));
+            Logger_flush();
+            exit(-1);
+        }
+        if (!adopting) {
+            close(adoptFd);
+            adoptFd = -1;
+        }
+    }
+    MutexUnlock(&acceptMutex);
+}
+
+/** Report that the calling thread will not accept connections anymore */
+void Upgrade_acceptStopped() {
+    MutexLock(&acceptMutex);
+    for (int i = 0; i < UPGRADE_MAX_LISTENERS; i++) {
+        if (accepting[i] && pthread_equal(acceptThreads[i], pthread_self()))
+            accepting[i] = false;
+    }
+    MutexUnlock(&acceptMutex);
+}
+
+/** Connect to the running daemon and take it's listeners. Return count of the listeners or -1 if daemon can't be
+ *  upgraded. Connection is kept to report readiness when listeners accept, and if adopt is true, to receive passed
+ *  connections by Upgrade_adopt */
+int Upgrade_connect(IoEngine_Listener *listeners, bool adopt) {
+    const char *path = Config_getString("upgrade.socket", UPGRADE_DEFAULT_SOCKET);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    int sockfd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sockfd < 0 || connect(sockfd, (struct sockaddr*) &address, sizeof(address)) != 0) {
+        Logger_fatal("Upgrade", "Unable to connect '%s' (%s)", path, strerror(errno));
+        if (sockfd >= 0)
+            close(sockfd);
+        return -1;
+    }
+
+    Upgrade_Hello hello = {UPGRADE_MAGIC, UPGRADE_VERSION, adopt ? UPGRADE_FLAG_ADOPT : 0};
+    int count = 0;
+    Upgrade_Record record;
+    memset(&record, 0, sizeof(record));
+    int fd;
+    if (send(sockfd, &hello, sizeof(hello), 0) == sizeof(hello)) {
+        while (Upgrade_recvRecord(sockfd, &record, &fd) && record.type == UPGRADE_LISTENER && fd >= 0
+               && count < UPGRADE_MAX_LISTENERS) {
+            char *listenerPath = pmalloc(strlen(record.path) + 1);
+            strcpy(listenerPath, record.path);
+            listeners[count++] = (IoEngine_Listener) {fd, listenerPath, record.seqpacket};
+        }
+    }
+    if (record.type != UPGRADE_LISTENED || count == 0) {
+        Logger_fatal("Upgrade", "Running daemon has not passed it's listeners");
+        for (int i = 0; i < count; i++)
+            close(listeners[i].sockfd);
+        close(sockfd);
+        return -1;
+    }
+
+    adoptFd = sockfd;
+    adopting = adopt;
+
+    return count;
+}
+
+/** Internal function. Adoption thread. Receives connections passed by the old process until it exits */
+static void Upgrade_adoptRun(void *args) {
+    uint8_t engine = (uint8_t) (uintptr_t) args;
+    uint32_t count = 0;
+    Upgrade_Record record;
+    int fd;
+    while (Upgrade_recvRecord(adoptFd, &record, &fd) && record.type == UPGRADE_CONN) {
+        if (fd < 0)
+            continue;
+        IoEngine_adopt(engine, fd, record.seqpacket, record.state);
+        count++;
+    }
+
+    MutexLock(&acceptMutex);
+    close(adoptFd);
+    adoptFd = -1;
+    MutexUnlock(&acceptMutex);
+    Logger_info("Upgrade", "Upgrade was completed, %u connections were taken", count);
+}
+
+/** Start taking connections passed by the old process, if this process was started by the upgrade */
+void Upgrade_adopt(uint8_t engine) {
+    if (adoptFd >= 0 && adopting)
+        ThreadDetach(NewThread(Upgrade_adoptRun, (void*) (uintptr_t) engine, 0, NULL, 0));
+}
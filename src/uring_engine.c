@@ -0,0 +1,546 @@
+/** Io_uring event loop engine. Listeners are served by the multishot accept, client sockets by the multishot receive
+ *  into the ring of provided buffers, so one submission of each socket delivers all it's data and the loop takes
+ *  completions of all sockets by one syscall. Responses collected by the connection are submitted by the command
+ *  processor as one send, seqpacket responses as the chain of linked sends, so messages keep their order. Log
+ *  batch is written by the linked submissions too. Ring is set up by the raw syscalls, if the kernel does not provide
+ *  any of the used features, engine returns and the caller falls back to epoll. While the daemon is upgraded, accepts
+ *  are cancelled and connections are drained, they are not passed to the new process, because each of them has
+ *  receive in flight */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "../inc/uring_engine.h"
+#include "../inc/client_thread.h"
+#include "../inc/connection.h"
+#include "../inc/logger.h"
+#include "../inc/stats.h"
+#include "../inc/upgrade.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/wait.h"
+
+struct UringEngine_Log;
+
+/** Write of the log batch to one target, it's completion refers it */
+typedef struct UringEngine_Target {
+    struct UringEngine_Log *log;
+    int fd;
+    /** Count of the bytes that were already written */
+    size_t written;
+} UringEngine_Target;
+
+/** Log batch written to several targets, it is freed by the last completion */
+typedef struct UringEngine_Log {
+    char *data;
+    size_t len;
+    int refs;
+    UringEngine_Target targets[LOGGER_MAX_TARGETS];
+} UringEngine_Log;
+
+/** Internal function. Submit published entries and wait for completions if requested. Entries of all threads are
+ *  submitted by any enter, so whole published part of the queue is requested. Kernel does not wait if it has
+ *  submitted less than requested, because other thread took some entries, it is only a spurious wakeup of the loop */
+static int UringEngine_enter(UringEngine *engine, uint32_t minComplete, uint32_t flags, void *arg, size_t argSize) {
+    uint32_t pending = __atomic_load_n(engine->sqTail, __ATOMIC_ACQUIRE)
+                       - __atomic_load_n(engine->sqHead, __ATOMIC_ACQUIRE);
+    Stats_inc(STATS_IO_SYSCALLS);
+
+    return (int) syscall(__NR_io_uring_enter, engine->fd, pending, minComplete, flags, arg, argSize);
+}
+
+/** Internal function. Move completions to the backlog, so the kernel may flush overflowed ones into the queue. Called
+ *  by the loop only */
+static void UringEngine_backlog(UringEngine *engine) {
+    uint32_t head = *engine->cqHead;
+    uint32_t tail = __atomic_load_n(engine->cqTail, __ATOMIC_ACQUIRE);
+    if (engine->backlogCount + (tail - head) > engine->backlogCap) {
+        engine->backlogCap = engine->backlogCount + (tail - head) + engine->cqMask + 1;
+        engine->backlog = prealloc(engine->backlog, engine->backlogCap * sizeof(struct io_uring_cqe));
+    }
+    while (head != tail)
+        engine->backlog[engine->backlogCount++] = engine->cqes[head++ & engine->cqMask];
+    __atomic_store_n(engine->cqHead, head, __ATOMIC_RELEASE);
+}
+
+/** Internal function. Take next completion, the backlog goes before the queue. Return false if there are no more
+ *  completions. Called by the loop only */
+static bool UringEngine_reap(UringEngine *engine, struct io_uring_cqe *cqe) {
+    if (engine->backlogHead < engine->backlogCount) {
+        *cqe = engine->backlog[engine->backlogHead++];
+        if (engine->backlogHead == engine->backlogCount)
+            engine->backlogHead = engine->backlogCount = 0;
+        return true;
+    }
+    uint32_t head = *engine->cqHead;
+    if (head == __atomic_load_n(engine->cqTail, __ATOMIC_ACQUIRE))
+        return false;
+    *cqe = engine->cqes[head & engine->cqMask];
+    __atomic_store_n(engine->cqHead, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/** Internal function. Return true if the submission queue has space for count entries */
+static bool UringEngine_hasSpace(UringEngine *engine, uint32_t count) {
+    return engine->sqLocal - __atomic_load_n(engine->sqHead, __ATOMIC_ACQUIRE) + count <= engine->sqEntries;
+}
+
+/** Internal function. Make space for count entries in the submission queue. Kernel takes no submissions while the
+ *  completion queue is overflowed, only the loop frees it, so the loop moves completions to the backlog until the
+ *  space appears, other threads return false at once and must not wait under the mutex. Must be called under the sq
+ *  mutex */
+static bool UringEngine_reserve(UringEngine *engine, uint32_t count) {
+    bool loop = pthread_equal(pthread_self(), engine->loop);
+    while (!UringEngine_hasSpace(engine, count)) {
+        UringEngine_enter(engine, 0, loop ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (UringEngine_hasSpace(engine, count))
+            break;
+        if (!loop)
+            return false;
+        UringEngine_backlog(engine);
+    }
+
+    return true;
+}
+
+/** Internal function. Take next free entry. Must be called under the sq mutex after the space reservation */
+static struct io_uring_sqe* UringEngine_sqe(UringEngine *engine) {
+    struct io_uring_sqe *sqe = &engine->sqes[engine->sqLocal++ & engine->sqMask];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    return sqe;
+}
+
+/** Internal function. Make filled entries visible to the kernel. Must be called under the sq mutex */
+static void UringEngine_publish(UringEngine *engine) {
+    __atomic_store_n(engine->sqTail, engine->sqLocal, __ATOMIC_RELEASE);
+}
+
+/** Internal function. Return buffer to the provided buffers ring */
+static void UringEngine_recycle(UringEngine *engine, uint16_t bid) {
+    struct io_uring_buf *buf = &engine->bufRing->bufs[engine->bufTail & (URING_ENGINE_BUFFERS - 1)];
+    buf->addr = (uint64_t) (uintptr_t) (engine->buffers + (size_t) bid * URING_ENGINE_BUFFER_SIZE);
+    buf->len = URING_ENGINE_BUFFER_SIZE;
+    buf->bid = bid;
+    engine->bufTail++;
+    __atomic_store_n(&engine->bufRing->tail, engine->bufTail, __ATOMIC_RELEASE);
+}
+
+/** Internal function. Create ring, map it's queues and register provided buffers. Return false if kernel does not
+ *  support the used features */
+static bool UringEngine_init(UringEngine *engine) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_ENGINE_ENTRIES * URING_ENGINE_CQ_FACTOR;
+    engine->fd = (int) syscall(__NR_io_uring_setup, URING_ENGINE_ENTRIES, &params);
+    if (engine->fd < 0) {
+        Logger_info("UringEngine", "Unable to create io_uring (%s)", strerror(errno));
+        return false;
+    }
+    uint32_t required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) {
+        Logger_info("UringEngine", "Io_uring features %x are not supported", required & ~params.features);
+        close(engine->fd);
+        return false;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    char *ring = mmap(NULL, sqSize > cqSize ? sqSize : cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      engine->fd, IORING_OFF_SQ_RING);
+    engine->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, engine->fd, IORING_OFF_SQES);
+    engine->bufRing = mmap(NULL, URING_ENGINE_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED || engine->sqes == MAP_FAILED || engine->bufRing == MAP_FAILED) {
+        Logger_info("UringEngine", "Unable to map io_uring (%s)", strerror(errno));
+        close(engine->fd);
+        return false;
+    }
+
+    engine->sqHead = (uint32_t*) (ring + params.sq_off.head);
+    engine->sqTail = (uint32_t*) (ring + params.sq_off.tail);
+    engine->sqMask = *(uint32_t*) (ring + params.sq_off.ring_mask);
+    engine->sqEntries = params.sq_entries;
+    engine->sqArray = (uint32_t*) (ring + params.sq_off.array);
+    engine->sqLocal = *engine->sqTail;
+    engine->cqHead = (uint32_t*) (ring + params.cq_off.head);
+    engine->cqTail = (uint32_t*) (ring + params.cq_off.tail);
+    engine->cqMask = *(uint32_t*) (ring + params.cq_off.ring_mask);
+    engine->cqes = (struct io_uring_cqe*) (ring + params.cq_off.cqes);
+    //Entries are never reordered, so the index array is the identity
+    for (uint32_t i = 0; i < engine->sqEntries; i++)
+        engine->sqArray[i] = i;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) engine->bufRing;
+    reg.ring_entries = URING_ENGINE_BUFFERS;
+    reg.bgid = URING_ENGINE_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, engine->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        Logger_info("UringEngine", "Unable to register provided buffers (%s)", strerror(errno));
+        close(engine->fd);
+        return false;
+    }
+    engine->buffers = pmalloc((size_t) URING_ENGINE_BUFFERS * URING_ENGINE_BUFFER_SIZE);
+    for (uint16_t i = 0; i < URING_ENGINE_BUFFERS; i++)
+        UringEngine_recycle(engine, i);
+
+    engine->sqMutex = NewMutex("uring.sq");
+    engine->multishot = true;
+
+    return true;
+}
+
+/** Internal function. Submit accept of the listener */
+static void UringEngine_accept(UringEngine *engine, IoEngine_Listener *listener) {
+    MutexLock(engine->sqMutex);
+    UringEngine_reserve(engine, 1);
+    struct io_uring_sqe *sqe = UringEngine_sqe(engine);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener->sockfd;
+    sqe->ioprio = engine->multishot ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->user_data = IO_ENGINE_DATA(listener, IO_ENGINE_TAG_ACCEPT);
+    UringEngine_publish(engine);
+    MutexUnlock(engine->sqMutex);
+}
+
+/** Internal function. Submit receive of the connection to the provided buffers */
+static void UringEngine_recv(UringEngine *engine, IoConn *io) {
+    MutexLock(engine->sqMutex);
+    UringEngine_reserve(engine, 1);
+    struct io_uring_sqe *sqe = UringEngine_sqe(engine);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = io->conn->sockfd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_ENGINE_BUFFER_GROUP;
+    sqe->ioprio = engine->multishot ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = IO_ENGINE_DATA(io, IO_ENGINE_TAG_RECV);
+    UringEngine_publish(engine);
+    MutexUnlock(engine->sqMutex);
+    io->armed = true;
+}
+
+/** Internal function. Cancel submission with specified data: receive of the paused connection, so it's data stays in
+ *  the socket, or accept of the listener */
+static void UringEngine_cancel(UringEngine *engine, uint64_t data) {
+    MutexLock(engine->sqMutex);
+    UringEngine_reserve(engine, 1);
+    struct io_uring_sqe *sqe = UringEngine_sqe(engine);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = data;
+    sqe->user_data = IO_ENGINE_TAG_NONE;
+    UringEngine_publish(engine);
+    MutexUnlock(engine->sqMutex);
+}
+
+/** Send that did not fit the full submission queue. Ends are copied, because the connection collects next responses
+ *  to the cork buffer */
+typedef struct UringEngine_Send {
+    Connection *conn;
+    char *data;
+    uint32_t ends[CONNECTION_CORK_MESSAGES];
+    uint16_t count;
+    struct UringEngine_Send *next;
+} UringEngine_Send;
+
+/** Internal function. Fill entries of the send. Must be called under the sq mutex after the space reservation */
+static void UringEngine_fillSend(UringEngine *engine, Connection *conn, char *data, const uint32_t *ends,
+                                 uint16_t count) {
+    uint16_t sends = conn->seqpacket ? count : 1;
+    uint32_t start = 0;
+    for (uint16_t i = 0; i < sends; i++) {
+        uint32_t end = conn->seqpacket ? ends[i] : ends[count - 1];
+        struct io_uring_sqe *sqe = UringEngine_sqe(engine);
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = conn->sockfd;
+        sqe->addr = (uint64_t) (uintptr_t) (data + start);
+        sqe->len = end - start;
+        //Kernel retries the short stream send, the rest of the send cut by signal is submitted by the connection
+        sqe->msg_flags = MSG_NOSIGNAL | (conn->seqpacket ? 0 : MSG_WAITALL);
+        sqe->flags = i + 1 < sends ? IOSQE_IO_LINK : 0;
+        sqe->user_data = IO_ENGINE_DATA(conn, IO_ENGINE_TAG_SEND);
+        start = end;
+    }
+}
+
+/** Submit responses collected by the connection. Stream data is sent by one submission, seqpacket messages by the
+ *  chain of linked submissions, one for each message. If the submission queue is full, send is deferred to the loop.
+ *  Return count of the submissions, each of them is completed by Connection_sent. Called by the connection under it's
+ *  write mutex */
+uint16_t UringEngine_send(UringEngine *engine, Connection *conn, char *data, const uint32_t *ends, uint16_t count) {
+    uint16_t sends = conn->seqpacket ? count : 1;
+    MutexLock(engine->sqMutex);
+    if (!UringEngine_reserve(engine, sends)) {
+        UringEngine_Send *send = pmalloc(sizeof(UringEngine_Send));
+        send->conn = conn;
+        send->data = data;
+        memcpy(send->ends, ends, count * sizeof(uint32_t));
+        send->count = count;
+        send->next = NULL;
+        if (engine->deferredTail != NULL)
+            engine->deferredTail->next = send;
+        else
+            engine->deferred = send;
+        engine->deferredTail = send;
+        MutexUnlock(engine->sqMutex);
+        return sends;
+    }
+    UringEngine_fillSend(engine, conn, data, ends, count);
+    UringEngine_publish(engine);
+    MutexUnlock(engine->sqMutex);
+    UringEngine_enter(engine, 0, 0, NULL, 0);
+
+    return sends;
+}
+
+/** Internal function. Submit sends deferred by the command processors */
+static void UringEngine_submitDeferred(UringEngine *engine) {
+    MutexLock(engine->sqMutex);
+    UringEngine_Send *send = engine->deferred;
+    engine->deferred = NULL;
+    engine->deferredTail = NULL;
+    while (send != NULL) {
+        UringEngine_reserve(engine, send->conn->seqpacket ? send->count : 1);
+        UringEngine_fillSend(engine, send->conn, send->data, send->ends, send->count);
+        //Only published entries are submitted, so each chain is published before the space for the next one is made
+        UringEngine_publish(engine);
+        UringEngine_Send *next = send->next;
+        pfree(send);
+        send = next;
+    }
+    MutexUnlock(engine->sqMutex);
+}
+
+/** Internal function. Fill entry of the write of the rest of the log batch to the target. Must be called under the sq
+ *  mutex after the space reservation */
+static void UringEngine_writeLog(UringEngine *engine, UringEngine_Target *target) {
+    struct io_uring_sqe *sqe = UringEngine_sqe(engine);
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = target->fd;
+    sqe->addr = (uint64_t) (uintptr_t) (target->log->data + target->written);
+    sqe->len = (uint32_t) (target->log->len - target->written);
+    //Current file position, log file is opened for appending
+    sqe->off = (uint64_t) -1;
+    sqe->user_data = IO_ENGINE_DATA(target, IO_ENGINE_TAG_LOG);
+}
+
+/** Internal function. Submit writes of the collected log entries, if the previous batch is already written */
+static void UringEngine_flushLog(UringEngine *engine) {
+    if (engine->logging)
+        return;
+    size_t len;
+    char *data = Logger_takeBatch(&len);
+    if (data == NULL)
+        return;
+
+    int fds[LOGGER_MAX_TARGETS];
+    int count = Logger_targets(fds);
+    if (count == 0) {
+        free(data);
+        Logger_written();
+        return;
+    }
+    UringEngine_Log *log = pmalloc(sizeof(UringEngine_Log));
+    log->data = data;
+    log->len = len;
+    log->refs = count;
+    MutexLock(engine->sqMutex);
+    UringEngine_reserve(engine, (uint32_t) count);
+    for (int i = 0; i < count; i++) {
+        log->targets[i].log = log;
+        log->targets[i].fd = fds[i];
+        log->targets[i].written = 0;
+        UringEngine_writeLog(engine, &log->targets[i]);
+    }
+    UringEngine_publish(engine);
+    MutexUnlock(engine->sqMutex);
+    engine->logging = true;
+}
+
+/** Internal function. Handle completion of the accept */
+static void UringEngine_accepted(UringEngine *engine, IoEngine_Listener *listener, int32_t res, uint32_t flags) {
+    if (res >= 0) {
+        Connection *conn = Connection_accepted(res, listener->seqpacket);
+        conn->sent = NewCond();
+        conn->uring = engine;
+        UringEngine_recv(engine, IoEngine_open(conn));
+    } else if (res == -EINVAL && engine->multishot) {
+        Logger_info("UringEngine", "Multishot submissions are not supported, single ones are used");
+        engine->multishot = false;
+    } else if (res != -EINTR && res != -ECONNABORTED && res != -ECANCELED) {
+        Logger_fatal("UringEngine", "Unable to accept connection of '%s' (%s)", listener->path, strerror(-res));
+    }
+
+    if (flags & IORING_CQE_F_MORE)
+        return;
+    if (!engine->stopping)
+        UringEngine_accept(engine, listener);
+    else if (--engine->accepting == 0)
+        Upgrade_acceptStopped();
+}
+
+/** Internal function. Serve connection passed by the previous daemon process */
+static void UringEngine_adopted(UringEngine *engine, IoConn *io) {
+    io->conn->sent = NewCond();
+    io->conn->uring = engine;
+    UringEngine_recv(engine, io);
+}
+
+/** Internal function. Handle completion of the receive. Connection is freed only when it's receive is not in flight,
+ *  because the kernel still refers it */
+static void UringEngine_received(UringEngine *engine, IoConn *io, int32_t res, uint32_t flags) {
+    if (!(flags & IORING_CQE_F_MORE))
+        io->armed = false;
+
+    bool alive = true;
+    bool paused = io->paused;
+    if (flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = (uint16_t) (flags >> IORING_CQE_BUFFER_SHIFT);
+        char *data = engine->buffers + (size_t) bid * URING_ENGINE_BUFFER_SIZE;
+        if (res > 0 && !io->closing) {
+            alive = io->conn->seqpacket
+                    ? IoEngine_message(io, data, (size_t) res, res > CLIENT_THREAD_SEQPACKET_BUF)
+                    : IoEngine_feed(io, data, (size_t) res);
+        }
+        UringEngine_recycle(engine, bid);
+    }
+    if (res == 0) {
+        //End of stream, seqpacket zero length message too
+        alive = false;
+    } else if (res == -EINVAL && engine->multishot) {
+        Logger_info("UringEngine", "Multishot submissions are not supported, single ones are used");
+        engine->multishot = false;
+    } else if (res < 0 && res != -ENOBUFS && res != -ECANCELED && res != -EINTR) {
+        alive = false;
+    }
+
+    if (!alive && !io->closing) {
+        //Shutdown completes the receive in flight
+        io->closing = true;
+        Connection_shutdown(io->conn);
+    }
+    if (!paused && io->paused) {
+        //Socket is not read until pending frames are queued, so the client is pushed back by kernel
+        io->next = engine->paused;
+        engine->paused = io;
+        if (io->armed)
+            UringEngine_cancel(engine, IO_ENGINE_DATA(io, IO_ENGINE_TAG_RECV));
+    }
+
+    //Paused connection is resumed or closed by the loop
+    if (io->armed || io->paused)
+        return;
+    if (io->closing)
+        IoEngine_close(io);
+    else
+        UringEngine_recv(engine, io);
+}
+
+/** Internal function. Handle completion of the log write. Rest of the short write is submitted again */
+static void UringEngine_logged(UringEngine *engine, UringEngine_Target *target, int32_t res) {
+    UringEngine_Log *log = target->log;
+    if (res > 0)
+        target->written += (size_t) res;
+    if ((res > 0 || res == -EINTR) && target->written < log->len) {
+        MutexLock(engine->sqMutex);
+        UringEngine_reserve(engine, 1);
+        UringEngine_writeLog(engine, target);
+        UringEngine_publish(engine);
+        MutexUnlock(engine->sqMutex);
+        return;
+    }
+    if (--log->refs == 0) {
+        free(log->data);
+        pfree(log);
+        engine->logging = false;
+        Logger_written();
+    }
+}
+
+/** Internal function. Resume paused connections whose pending frames were queued, close the closed ones */
+static void UringEngine_drain(UringEngine *engine) {
+    for (IoConn **p = &engine->paused; *p != NULL;) {
+        IoConn *io = *p;
+        if (io->closing) {
+            if (io->armed) {
+                p = &io->next;
+            } else {
+                *p = io->next;
+                IoEngine_close(io);
+            }
+        } else if (IoEngine_drain(io)) {
+            *p = io->next;
+            if (!io->armed)
+                UringEngine_recv(engine, io);
+        } else {
+            p = &io->next;
+        }
+    }
+}
+
+/** Serve listeners until the daemon is stopped. Return only if io_uring can't be used */
+void UringEngine_run(IoEngine_Listener *listeners, int count) {
+    UringEngine *engine = pmalloc(sizeof(UringEngine));
+    memset(engine, 0, sizeof(UringEngine));
+    if (!UringEngine_init(engine)) {
+        pfree(engine);
+        return;
+    }
+    engine->loop = pthread_self();
+    for (int i = 0; i < count; i++) {
+        UringEngine_accept(engine, &listeners[i]);
+        Logger_info("Server", "Server listen '%s'", listeners[i].path);
+    }
+    engine->accepting = (uint8_t) count;
+    Logger_info("UringEngine", "Io_uring engine was started");
+    Upgrade_acceptStarted();
+
+    while (1) {
+        UringEngine_submitDeferred(engine);
+        UringEngine_flushLog(engine);
+        struct __kernel_timespec ts = {0, (engine->paused != NULL ? IO_ENGINE_DRAIN_INTERVAL
+                                                                  : IO_ENGINE_FLUSH_INTERVAL) * 1000000LL};
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.ts = (uint64_t) (uintptr_t) &ts;
+        //Completion queue is polled by the process wait strategy before the loop blocks, entries submitted by the loop
+        //itself go to the kernel first
+        const wait_t *wait = WaitDefault();
+        if (wait->spins + wait->yields > 0) {
+            UringEngine_enter(engine, 0, 0, NULL, 0);
+            uint32_t round = 0;
+            while (*engine->cqHead == __atomic_load_n(engine->cqTail, __ATOMIC_ACQUIRE) && WaitStep(wait, &round));
+        }
+        if (*engine->cqHead == __atomic_load_n(engine->cqTail, __ATOMIC_ACQUIRE))
+            UringEngine_enter(engine, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+
+        struct io_uring_cqe cqe;
+        while (UringEngine_reap(engine, &cqe)) {
+            void *ptr = IO_ENGINE_PTR(cqe.user_data);
+            switch (IO_ENGINE_TAG(cqe.user_data)) {
+                case IO_ENGINE_TAG_ACCEPT: UringEngine_accepted(engine, ptr, cqe.res, cqe.flags); break;
+                case IO_ENGINE_TAG_RECV: UringEngine_received(engine, ptr, cqe.res, cqe.flags); break;
+                case IO_ENGINE_TAG_SEND: Connection_sent(ptr, cqe.res); break;
+                case IO_ENGINE_TAG_LOG: UringEngine_logged(engine, ptr, cqe.res); break;
+                default: break;
+            }
+        }
+
+        UringEngine_drain(engine);
+        for (IoConn *io = IoEngine_takeAdopted(); io != NULL; io = io->next)
+            UringEngine_adopted(engine, io);
+        if (Upgrade_handingOff() && !engine->stopping) {
+            //Last completion of each accept reports that it is stopped
+            engine->stopping = true;
+            for (int i = 0; i < count; i++)
+                UringEngine_cancel(engine, IO_ENGINE_DATA(&listeners[i], IO_ENGINE_TAG_ACCEPT));
+        }
+    }
+}
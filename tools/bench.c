@@ -0,0 +1,651 @@
+/** Load generator for the daemon. It runs one of the benchmark scenarios against the running daemon and prints
+ *  latency distribution of the measured requests.
+ *
+ *  Usage: nsd-bench <scenario> [-s socket] [-d seconds] [-r rate] [-c connections] [-n batch] [-b] [-p]
+ *
+ *  With -b measured client uses the binary OTPP framing, with -p it connects to the SOCK_SEQPACKET socket
+ *
+ *  Scenarios:
+ *      latency     one client sends 't_echo' requests with fixed rate
+ *      noisy       same as latency, while another process floods the daemon through several connections. With
+ *                  'client.rate' configured, noisy client is throttled and well-behaved client latency stays low
+ *      pipeline    one client keeps -n 't_echo' requests in flight and reports throughput and latency
+ *      shm         compares the binary socket path and the shared memory transport, with one request in flight and
+ *                  with -n requests in flight
+ *      batch       groups of -n 't_echo' commands are sent as separate round trips, then as one batch packet. Each
+ *                  mode runs for the whole duration and reports latency of the whole group
+ *      engine      runs pipeline with one request and with -n requests in flight and reports I/O syscalls made by the
+ *                  daemon for each request, taken from the 'io.syscalls' counter. It is run once for each value of
+ *                  the daemon 'io.engine' option
+ *      conns       opens -c connections, each one makes one 't_echo' round trip, and reports growth of the daemon
+ *                  virtual and resident memory for each open connection
+ *  */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "../inc/otpp.h"
+#include "../client/nsd_shm.h"
+
+#define BENCH_DEFAULT_SOCKET "/tmp/nsd.socket"
+
+/** Count of requests kept in flight by each flooding connection */
+#define BENCH_FLOOD_WINDOW 32
+
+typedef struct Bench_Options {
+    const char *socket;
+    uint32_t duration;
+    uint32_t rate;
+    uint32_t connections;
+    uint32_t batch;
+    bool binary;
+    bool seqpacket;
+} Bench_Options;
+
+/** Client connection with input buffer for the responses reading */
+typedef struct Bench_Conn {
+    int fd;
+    char buf[65536];
+    size_t len;
+    bool binary;
+} Bench_Conn;
+
+/** Collected latencies in nanoseconds */
+typedef struct Bench_Latency {
+    uint64_t *samples;
+    size_t count;
+    size_t capacity;
+    uint64_t errors;
+} Bench_Latency;
+
+typedef struct Bench_Scenario {
+    const char *name;
+    int (*run)(Bench_Options *options);
+} Bench_Scenario;
+
+static uint64_t Bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static Bench_Conn* Bench_connect(Bench_Options *options) {
+    const char *path = options->socket;
+    int fd = socket(AF_UNIX, options->seqpacket ? SOCK_SEQPACKET : SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Unable to connect to '%s' (%s)\n", path, strerror(errno));
+        exit(1);
+    }
+
+    Bench_Conn *conn = calloc(1, sizeof(Bench_Conn));
+    conn->fd = fd;
+
+    return conn;
+}
+
+static bool Bench_send(Bench_Conn *conn, const char *data, size_t len);
+static bool Bench_fill(Bench_Conn *conn, size_t need);
+
+/** Switch connection to the binary framing */
+static void Bench_hello(Bench_Conn *conn) {
+    char hello[OTPP_HELLO_SIZE] = {0};
+    memcpy(hello, OTPP_HELLO, OTPP_HELLO_LEN);
+    hello[OTPP_HELLO_LEN] = OTPP_VERSION;
+    if (!Bench_send(conn, hello, OTPP_HELLO_SIZE) || !Bench_fill(conn, OTPP_HELLO_SIZE)
+        || conn->buf[OTPP_HELLO_LEN] != OTPP_VERSION) {
+        fprintf(stderr, "Binary framing was rejected\n");
+        exit(1);
+    }
+    conn->len = 0;
+    conn->binary = true;
+}
+
+static void Bench_close(Bench_Conn *conn) {
+    close(conn->fd);
+    free(conn);
+}
+
+static bool Bench_send(Bench_Conn *conn, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t r = write(conn->fd, data, len);
+        if (r <= 0)
+            return false;
+        data += r;
+        len -= r;
+    }
+
+    return true;
+}
+
+/** Read until buffer has at least specified count of bytes. Return false if connection was closed */
+static bool Bench_fill(Bench_Conn *conn, size_t need) {
+    while (conn->len < need) {
+        ssize_t r = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+        if (r <= 0)
+            return false;
+        conn->len += r;
+    }
+
+    return true;
+}
+
+/** Build binary request with one argument */
+static size_t Bench_binaryPacket(char *buf, uint32_t id, const char *cmd, const char *arg) {
+    uint32_t cmdLen = (uint32_t) strlen(cmd);
+    uint32_t argLen = (uint32_t) strlen(arg);
+    Otpp_Header header = {OTPP_MAGIC, OTPP_VERSION, 'q', 0, 0, id, 8 + cmdLen + argLen};
+    char *p = buf;
+    memcpy(p, &header, OTPP_HEADER_SIZE);
+    p += OTPP_HEADER_SIZE;
+    memcpy(p, &cmdLen, 4);
+    memcpy(p + 4, cmd, cmdLen);
+    p += 4 + cmdLen;
+    memcpy(p, &argLen, 4);
+    memcpy(p + 4, arg, argLen);
+
+    return OTPP_HEADER_SIZE + header.len;
+}
+
+/** Read one response. Return it's type char or 0 if connection was closed */
+static char Bench_receive(Bench_Conn *conn) {
+    if (conn->binary) {
+        Otpp_Header header;
+        if (!Bench_fill(conn, OTPP_HEADER_SIZE))
+            return 0;
+        memcpy(&header, conn->buf, OTPP_HEADER_SIZE);
+        size_t used = OTPP_HEADER_SIZE + header.len;
+        if (used > sizeof(conn->buf) || !Bench_fill(conn, used))
+            return 0;
+        memmove(conn->buf, conn->buf + used, conn->len - used);
+        conn->len -= used;
+        return (char) header.type;
+    }
+
+    while (1) {
+        char *end = memchr(conn->buf, '\r', conn->len);
+        if (end != NULL) {
+            char type = conn->buf[0];
+            size_t used = end - conn->buf + 1;
+            memmove(conn->buf, end + 1, conn->len - used);
+            conn->len -= used;
+            return type;
+        }
+        if (conn->len == sizeof(conn->buf))
+            conn->len = 0;
+        ssize_t r = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+        if (r <= 0)
+            return 0;
+        conn->len += r;
+    }
+}
+
+static void Bench_record(Bench_Latency *latency, uint64_t value) {
+    if (latency->count == latency->capacity) {
+        latency->capacity = latency->capacity == 0 ? 4096 : latency->capacity * 2;
+        latency->samples = realloc(latency->samples, latency->capacity * sizeof(uint64_t));
+    }
+    latency->samples[latency->count++] = value;
+}
+
+static int Bench_compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+static void Bench_report(const char *name, Bench_Latency *latency) {
+    if (latency->count == 0) {
+        printf("%-12s no responses, errors %llu\n", name, (unsigned long long) latency->errors);
+        return;
+    }
+
+    qsort(latency->samples, latency->count, sizeof(uint64_t), Bench_compare);
+    uint64_t *s = latency->samples;
+    size_t n = latency->count;
+    printf("%-12s requests %zu errors %llu  p50 %.1f us  p90 %.1f us  p99 %.1f us  max %.1f us\n", name, n,
+           (unsigned long long) latency->errors, s[n / 2] / 1000.0, s[n * 90 / 100] / 1000.0,
+           s[n * 99 / 100] / 1000.0, s[n - 1] / 1000.0);
+}
+
+/** Send requests one by one with the fixed rate and measure each round trip */
+static void Bench_paced(Bench_Options *options, Bench_Latency *latency) {
+    Bench_Conn *conn = Bench_connect(options);
+    if (options->binary)
+        Bench_hello(conn);
+    uint64_t interval = 1000000000ULL / (options->rate > 0 ? options->rate : 1);
+    uint64_t end = Bench_now() + (uint64_t) options->duration * 1000000000;
+    uint32_t id = 1;
+    char packet[64];
+
+    for (uint64_t next = Bench_now(); next < end; next += interval) {
+        //Absolute sleep, so the send schedule does not drift by the time of the round trips
+        struct timespec ts = {(time_t) (next / 1000000000), (long) (next % 1000000000)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+        size_t len = options->binary ? Bench_binaryPacket(packet, id++, "t_echo", "ping")
+                                     : (size_t) sprintf(packet, "q\t%u\tt_echo ping\r", id++);
+        uint64_t start = Bench_now();
+        if (!Bench_send(conn, packet, len))
+            break;
+        char type = Bench_receive(conn);
+        if (type == 'r')
+            Bench_record(latency, Bench_now() - start);
+        else
+            latency->errors++;
+    }
+
+    Bench_close(conn);
+}
+
+typedef struct Bench_Flood {
+    Bench_Options *options;
+    uint64_t ok;
+    uint64_t errors;
+} Bench_Flood;
+
+/** Flooding connection thread. It keeps BENCH_FLOOD_WINDOW requests in flight until the scenario end */
+static void* Bench_floodThread(void *args) {
+    Bench_Flood *flood = (Bench_Flood*) args;
+    Bench_Conn *conn = Bench_connect(flood->options);
+    uint64_t end = Bench_now() + (uint64_t) flood->options->duration * 1000000000;
+    uint32_t id = 1;
+    uint32_t inFlight = 0;
+    char packet[64];
+
+    while (Bench_now() < end) {
+        while (inFlight < BENCH_FLOOD_WINDOW) {
+            int len = sprintf(packet, "q\t%u\tt_echo flood\r", id++);
+            if (!Bench_send(conn, packet, len))
+                goto done;
+            inFlight++;
+        }
+        char type = Bench_receive(conn);
+        if (type == 0)
+            break;
+        if (type == 'r')
+            flood->ok++;
+        else
+            flood->errors++;
+        inFlight--;
+    }
+
+    done:
+    Bench_close(conn);
+
+    return NULL;
+}
+
+/** Build batch packet of count 't_echo' sub-commands */
+static size_t Bench_batchPacket(char *buf, bool binary, uint32_t id, uint32_t count) {
+    char *p = buf;
+    if (binary) {
+        p += OTPP_HEADER_SIZE;
+        for (uint32_t i = 0; i < count; i++) {
+            char args[64];
+            uint32_t len = (uint32_t) Bench_binaryPacket(args, 0, "t_echo", "ping") - OTPP_HEADER_SIZE;
+            uint32_t subId = i + 1;
+            memcpy(p, &subId, 4);
+            memcpy(p + 4, &len, 4);
+            memcpy(p + 8, args + OTPP_HEADER_SIZE, len);
+            p += 8 + len;
+        }
+        Otpp_Header header = {OTPP_MAGIC, OTPP_VERSION, 'b', 0, 0, id, (uint32_t) (p - buf - OTPP_HEADER_SIZE)};
+        memcpy(buf, &header, OTPP_HEADER_SIZE);
+    } else {
+        p += sprintf(p, "b\t%u", id);
+        for (uint32_t i = 0; i < count; i++)
+            p += sprintf(p, "\t%u t_echo ping", i + 1);
+        *p++ = '\r';
+    }
+
+    return p - buf;
+}
+
+static int Bench_batch(Bench_Options *options) {
+    uint32_t count = options->batch > 0 ? options->batch : 1;
+    Bench_Conn *conn = Bench_connect(options);
+    if (options->binary)
+        Bench_hello(conn);
+    char *packet = malloc(count * 64 + 64);
+    uint32_t id = 1;
+
+    for (int batched = 0; batched < 2; batched++) {
+        Bench_Latency latency = {0};
+        uint64_t started = Bench_now();
+        uint64_t end = started + (uint64_t) options->duration * 1000000000;
+        while (Bench_now() < end) {
+            uint64_t start = Bench_now();
+            bool ok = true;
+            if (batched) {
+                size_t len = Bench_batchPacket(packet, options->binary, id++, count);
+                ok = Bench_send(conn, packet, len) && Bench_receive(conn) == 'r';
+            } else {
+                for (uint32_t i = 0; i < count && ok; i++) {
+                    size_t len = options->binary ? Bench_binaryPacket(packet, id++, "t_echo", "ping")
+                                                 : (size_t) sprintf(packet, "q\t%u\tt_echo ping\r", id++);
+                    ok = Bench_send(conn, packet, len) && Bench_receive(conn) == 'r';
+                }
+            }
+            if (ok)
+                Bench_record(&latency, Bench_now() - start);
+            else
+                latency.errors++;
+        }
+        double seconds = (Bench_now() - started) / 1e9;
+        Bench_report(batched ? "batch" : "separate", &latency);
+        printf("%-12s %.0f commands/s\n", "", latency.count * count / seconds);
+        free(latency.samples);
+    }
+
+    free(packet);
+    Bench_close(conn);
+
+    return 0;
+}
+
+/** Keep window requests in flight until the scenario end. Return count of the completed requests */
+static uint64_t Bench_window(Bench_Options *options, uint32_t window) {
+    Bench_Conn *conn = Bench_connect(options);
+    if (options->binary)
+        Bench_hello(conn);
+    uint64_t *sent = calloc(window, sizeof(uint64_t));
+    Bench_Latency latency = {0};
+    uint64_t started = Bench_now();
+    uint64_t end = started + (uint64_t) options->duration * 1000000000;
+    uint32_t next = 0;
+    uint32_t done = 0;
+    char packet[64];
+
+    //Responses come in order, so the send time of each one is found by it's sequence number
+    while (done < next || Bench_now() < end) {
+        while (next - done < window && Bench_now() < end) {
+            size_t len = options->binary ? Bench_binaryPacket(packet, next + 1, "t_echo", "ping")
+                                         : (size_t) sprintf(packet, "q\t%u\tt_echo ping\r", next + 1);
+            sent[next % window] = Bench_now();
+            if (!Bench_send(conn, packet, len))
+                goto done;
+            next++;
+        }
+        char type = Bench_receive(conn);
+        if (type == 0)
+            break;
+        if (type == 'r')
+            Bench_record(&latency, Bench_now() - sent[done % window]);
+        else
+            latency.errors++;
+        done++;
+    }
+
+    done:
+    Bench_report("client", &latency);
+    printf("%-12s %.0f requests/s\n", "", latency.count / ((Bench_now() - started) / 1e9));
+    free(latency.samples);
+    free(sent);
+    Bench_close(conn);
+
+    return done;
+}
+
+static int Bench_pipeline(Bench_Options *options) {
+    Bench_window(options, options->batch > 0 ? options->batch : 1);
+
+    return 0;
+}
+
+/** Read daemon counter by the 'stats' command through the separate text connection */
+static uint64_t Bench_counter(Bench_Options *options, const char *name) {
+    Bench_Conn *conn = Bench_connect(options);
+    char *end = NULL;
+    if (Bench_send(conn, "q\t1\tstats\r", 11)) {
+        while ((end = memchr(conn->buf, '\r', conn->len)) == NULL && Bench_fill(conn, conn->len + 1));
+    }
+    uint64_t value = 0;
+    if (end != NULL) {
+        *end = 0;
+        char *counter = strstr(conn->buf, name);
+        if (counter != NULL && counter[strlen(name)] == '=')
+            value = strtoull(counter + strlen(name) + 1, NULL, 10);
+    }
+    Bench_close(conn);
+
+    return value;
+}
+
+static int Bench_engine(Bench_Options *options) {
+    uint32_t windows[2] = {1, options->batch > 1 ? options->batch : 32};
+    for (int i = 0; i < 2; i++) {
+        printf("in flight %u\n", windows[i]);
+        uint64_t before = Bench_counter(options, "io.syscalls");
+        uint64_t requests = Bench_window(options, windows[i]);
+        uint64_t syscalls = Bench_counter(options, "io.syscalls") - before;
+        printf("%-12s %.2f syscalls/request\n", "", requests > 0 ? (double) syscalls / requests : 0.0);
+    }
+
+    return 0;
+}
+
+/** Internal function. Read field of the daemon /proc status in kilobytes */
+static uint64_t Bench_procStatus(pid_t pid, const char *field) {
+    char path[64];
+    char line[256];
+    sprintf(path, "/proc/%d/status", (int) pid);
+    FILE *f = fopen(path, "r");
+    uint64_t value = 0;
+    if (f == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, field, strlen(field)) == 0 && line[strlen(field)] == ':') {
+            value = strtoull(line + strlen(field) + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+
+    return value;
+}
+
+static int Bench_conns(Bench_Options *options) {
+    Bench_Conn *probe = Bench_connect(options);
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(probe->fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0) {
+        fprintf(stderr, "Unable to get daemon pid (%s)\n", strerror(errno));
+        return 1;
+    }
+    Bench_close(probe);
+    usleep(100000);
+
+    uint64_t vmBefore = Bench_procStatus(cred.pid, "VmSize");
+    uint64_t rssBefore = Bench_procStatus(cred.pid, "VmRSS");
+    uint64_t threadsBefore = Bench_procStatus(cred.pid, "Threads");
+    Bench_Conn **conns = calloc(options->connections, sizeof(Bench_Conn*));
+    uint32_t open = 0;
+    for (; open < options->connections; open++) {
+        conns[open] = Bench_connect(options);
+        if (!Bench_send(conns[open], "q\t1\tt_echo x\r", 14) || Bench_receive(conns[open]) != 'r') {
+            fprintf(stderr, "Connection %u was not served\n", open);
+            Bench_close(conns[open]);
+            break;
+        }
+    }
+    uint64_t vm = Bench_procStatus(cred.pid, "VmSize") - vmBefore;
+    uint64_t rss = Bench_procStatus(cred.pid, "VmRSS") - rssBefore;
+    uint64_t threads = Bench_procStatus(cred.pid, "Threads") - threadsBefore;
+    printf("%-12s %u connections, %llu threads, stacks %llu KB\n", "conns", open, (unsigned long long) threads,
+           (unsigned long long) Bench_counter(options, "threads.stack_kb"));
+    printf("%-12s virtual %.1f KB/conn, resident %.1f KB/conn\n", "", open > 0 ? (double) vm / open : 0.0,
+           open > 0 ? (double) rss / open : 0.0);
+    for (uint32_t i = 0; i < open; i++)
+        Bench_close(conns[i]);
+    free(conns);
+
+    return 0;
+}
+
+/** Keep window requests in flight over the shared memory transport */
+static void Bench_shmPipeline(Bench_Options *options, uint32_t window) {
+    NsdShm *shm = NsdShm_open(options->socket);
+    if (shm == NULL) {
+        fprintf(stderr, "Unable to open shm transport through '%s'\n", options->socket);
+        exit(1);
+    }
+    uint64_t *sent = calloc(window, sizeof(uint64_t));
+    Bench_Latency latency = {0};
+    uint64_t started = Bench_now();
+    uint64_t end = started + (uint64_t) options->duration * 1000000000;
+    uint32_t next = 0;
+    uint32_t done = 0;
+    const char *argv[] = {"t_echo", "ping"};
+    char buf[64];
+
+    while (done < next || Bench_now() < end) {
+        while (next - done < window && Bench_now() < end) {
+            sent[next % window] = Bench_now();
+            if (!NsdShm_send(shm, next + 1, 2, argv))
+                goto done;
+            next++;
+        }
+        char type;
+        uint32_t msgId;
+        if (NsdShm_receive(shm, &type, &msgId, buf, sizeof(buf), 1000) < 0)
+            break;
+        if (type == 'r')
+            Bench_record(&latency, Bench_now() - sent[done % window]);
+        else
+            latency.errors++;
+        done++;
+    }
+
+    done:
+    Bench_report("shm", &latency);
+    printf("%-12s %.0f requests/s\n", "", latency.count / ((Bench_now() - started) / 1e9));
+    free(latency.samples);
+    free(sent);
+    NsdShm_close(shm);
+}
+
+static int Bench_pipeline(Bench_Options *options);
+
+static int Bench_shm(Bench_Options *options) {
+    uint32_t windows[2] = {1, options->batch > 1 ? options->batch : 32};
+    for (int i = 0; i < 2; i++) {
+        Bench_Options socketOptions = *options;
+        socketOptions.binary = true;
+        socketOptions.batch = windows[i];
+        printf("in flight %u\n", windows[i]);
+        Bench_pipeline(&socketOptions);
+        Bench_shmPipeline(options, windows[i]);
+    }
+
+    return 0;
+}
+
+static int Bench_latency(Bench_Options *options) {
+    Bench_Latency latency = {0};
+    Bench_paced(options, &latency);
+    Bench_report("client", &latency);
+
+    return 0;
+}
+
+static int Bench_noisy(Bench_Options *options) {
+    int report[2];
+    if (pipe(report) != 0)
+        return 1;
+
+    //Noisy neighbor is a separate process, so the daemon sees it as a separate client
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(report[0]);
+        uint32_t count = options->connections > 0 ? options->connections : 4;
+        Bench_Flood *floods = calloc(count, sizeof(Bench_Flood));
+        pthread_t *threads = calloc(count, sizeof(pthread_t));
+        for (uint32_t i = 0; i < count; i++) {
+            floods[i].options = options;
+            pthread_create(&threads[i], NULL, Bench_floodThread, &floods[i]);
+        }
+        uint64_t totals[2] = {0, 0};
+        for (uint32_t i = 0; i < count; i++) {
+            pthread_join(threads[i], NULL);
+            totals[0] += floods[i].ok;
+            totals[1] += floods[i].errors;
+        }
+        write(report[1], totals, sizeof(totals));
+        _exit(0);
+    }
+    close(report[1]);
+
+    //Let the flood saturate the daemon before measuring
+    usleep(200000);
+    Bench_Latency latency = {0};
+    Bench_paced(options, &latency);
+
+    uint64_t totals[2] = {0, 0};
+    read(report[0], totals, sizeof(totals));
+    waitpid(pid, NULL, 0);
+
+    Bench_report("client", &latency);
+    printf("%-12s ok %llu (%.0f/s) rejected %llu\n", "noisy", (unsigned long long) totals[0],
+           (double) totals[0] / options->duration, (unsigned long long) totals[1]);
+
+    return 0;
+}
+
+static const Bench_Scenario scenarios[] = {
+        {"latency", Bench_latency},
+        {"noisy", Bench_noisy},
+        {"batch", Bench_batch},
+        {"pipeline", Bench_pipeline},
+        {"shm", Bench_shm},
+        {"engine", Bench_engine},
+        {"conns", Bench_conns},
+};
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <scenario> [-s socket] [-d seconds] [-r rate] [-c connections] [-n batch] [-b] [-p]\n",
+                argv[0]);
+        return 1;
+    }
+
+    Bench_Options options = {BENCH_DEFAULT_SOCKET, 5, 200, 4, 32, false, false};
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "s:d:r:c:n:bp")) != -1) {
+        switch (opt) {
+            case 's': options.socket = optarg; break;
+            case 'd': options.duration = (uint32_t) atoi(optarg); break;
+            case 'r': options.rate = (uint32_t) atoi(optarg); break;
+            case 'c': options.connections = (uint32_t) atoi(optarg); break;
+            case 'n': options.batch = (uint32_t) atoi(optarg); break;
+            case 'b': options.binary = true; break;
+            case 'p': options.seqpacket = true; break;
+            default: return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if (strcmp(scenarios[i].name, argv[1]) == 0)
+            return scenarios[i].run(&options);
+    }
+
+    fprintf(stderr, "Unknown scenario '%s'\n", argv[1]);
+
+    return 1;
+}
@@ -0,0 +1,237 @@
+/** Microbenchmark of the type specialized containers against the void* collections. Each pair does the same work
+ *  with uint32_t items, the void* collections store them boxed, as the daemon would store fds or msgIds. Time of one
+ *  operation is printed for both and the speedup of the specialized one.
+ *
+ *  Usage: nsd-collections-bench [-n items] [-r rounds] [-t threads]
+ *
+ *  Pairs:
+ *      vector      push of n items and pass over them, Vector against List prepend and iterator
+ *      ring        push and pop of n items through the ring of 1024, Ring against LinkedBlockingQueue
+ *      hashmap     put, get and remove of n keys, HashMap against Map with the decimal string keys
+ *      queue       n items of each of 1, 2, 4 .. t producers are taken by the same count of consumers through the
+ *                  LinkedBlockingQueue of 1024, MPMC engine against the mutex one
+ *  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sched.h>
+#include "../libs/collections/include/vector.h"
+#include "../libs/collections/include/ring.h"
+#include "../libs/collections/include/hashmap.h"
+#include "../libs/collections/include/list.h"
+#include "../libs/collections/include/lbq.h"
+#include "../libs/collections/include/map2.h"
+#include "../libs/oscl/include/data.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/time.h"
+#include "../libs/oscl/include/threads.h"
+
+#define COLL_BENCH_RING 1024
+
+DEFINE_VECTOR(uint32_t)
+DEFINE_RING(uint32_t, 1024)
+DEFINE_HASHMAP(uint32_t, uint32_t)
+
+/** Sum of the read items, it is printed so the compiler can't drop the reads */
+static uint64_t checksum = 0;
+
+/** Internal function. Box the item as the void* collections need */
+static void* CollBench_box(uint32_t value) {
+    uint32_t *box = pmalloc(sizeof(uint32_t));
+    *box = value;
+    return box;
+}
+
+static void CollBench_vector(uint32_t n) {
+    Vector_uint32_t v;
+    Vector_uint32_t_init(&v);
+    for (uint32_t i = 0; i < n; i++)
+        Vector_uint32_t_push(&v, i);
+    for (uint32_t i = 0; i < v.size; i++)
+        checksum += Vector_uint32_t_get(&v, i);
+    Vector_uint32_t_free(&v);
+}
+
+static void CollBench_list(uint32_t n) {
+    List *list = new_List();
+    for (uint32_t i = 0; i < n; i++)
+        list->prepend(list, CollBench_box(i));
+    ListIterator *iterator = list->iterator(list);
+    while (iterator->hasNext(iterator))
+        checksum += *(uint32_t*) iterator->next(iterator);
+    pfree(iterator);
+    while (list->size > 0)
+        pfree(list->remove(list, 0));
+    del_List(list);
+}
+
+static void CollBench_ring(uint32_t n) {
+    static Ring_uint32_t_1024 ring;
+    Ring_uint32_t_1024_init(&ring);
+    uint32_t value;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!Ring_uint32_t_1024_push(&ring, i) && Ring_uint32_t_1024_pop(&ring, &value)) {
+            checksum += value;
+            Ring_uint32_t_1024_push(&ring, i);
+        }
+    }
+    while (Ring_uint32_t_1024_pop(&ring, &value))
+        checksum += value;
+}
+
+static void CollBench_lbq(uint32_t n) {
+    LinkedBlockingQueue *queue = new_LQB(COLL_BENCH_RING);
+    for (uint32_t i = 0; i < n; i++) {
+        void *box = CollBench_box(i);
+        if (!queue->tryPut(queue, box)) {
+            uint32_t *item = queue->dequeue(queue);
+            checksum += *item;
+            pfree(item);
+            queue->tryPut(queue, box);
+        }
+    }
+    uint32_t *item;
+    while ((item = queue->dequeue(queue)) != NULL) {
+        checksum += *item;
+        pfree(item);
+    }
+    del_LQB(queue);
+}
+
+static void CollBench_hashmap(uint32_t n) {
+    HashMap_uint32_t_uint32_t map;
+    HashMap_uint32_t_uint32_t_init(&map);
+    for (uint32_t i = 0; i < n; i++)
+        HashMap_uint32_t_uint32_t_put(&map, i * 7, i);
+    for (uint32_t i = 0; i < n; i++)
+        checksum += *HashMap_uint32_t_uint32_t_get(&map, i * 7);
+    for (uint32_t i = 0; i < n; i++)
+        HashMap_uint32_t_uint32_t_remove(&map, i * 7, NULL);
+    HashMap_uint32_t_uint32_t_free(&map);
+}
+
+static void CollBench_map(uint32_t n) {
+    Map *map = MAP_new();
+    char key[U32_MAX_DIGITS + 1];
+    for (uint32_t i = 0; i < n; i++) {
+        key[u32toa(i * 7, key)] = 0;
+        MAP_add(key, CollBench_box(i), map);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        key[u32toa(i * 7, key)] = 0;
+        checksum += *(uint32_t*) MAP_get(key, map);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        key[u32toa(i * 7, key)] = 0;
+        pfree(MAP_remove(key, map));
+    }
+    MAP_del(map);
+}
+
+/** Shared state of the queue scaling run */
+typedef struct CollBench_Queue {
+    LinkedBlockingQueue *queue;
+    uint32_t items;
+    uint64_t total;
+    uint64_t taken;
+} CollBench_Queue;
+
+static void CollBench_producer(void *args) {
+    CollBench_Queue *q = (CollBench_Queue*) args;
+    //Items are not dereferenced, so they are not allocated, only the queue cost is measured
+    for (uint32_t i = 1; i <= q->items; i++)
+        q->queue->enqueue(q->queue, (void*) (uintptr_t) i);
+}
+
+static void CollBench_consumer(void *args) {
+    CollBench_Queue *q = (CollBench_Queue*) args;
+    uint64_t sum = 0;
+    while (__atomic_load_n(&q->taken, __ATOMIC_RELAXED) < q->total) {
+        void *item = q->queue->dequeue(q->queue);
+        if (item == NULL) {
+            sched_yield();
+            continue;
+        }
+        sum += (uintptr_t) item;
+        __atomic_add_fetch(&q->taken, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&checksum, sum, __ATOMIC_RELAXED);
+}
+
+/** Internal function. Return nanos of one item passed through the queue of the engine by the threads producers and
+ *  the threads consumers */
+static double CollBench_queue(uint8_t engine, uint32_t threads, uint32_t n) {
+    CollBench_Queue q;
+    q.queue = new_LQB_engine(COLL_BENCH_RING, engine);
+    q.items = n;
+    q.total = (uint64_t) n * threads;
+    q.taken = 0;
+    thread_t workers[2 * threads];
+
+    stopwatch_t sw;
+    StopwatchStart(&sw);
+    for (uint32_t i = 0; i < threads; i++) {
+        workers[2 * i] = NewThread(CollBench_consumer, &q, 0, NULL, 0);
+        workers[2 * i + 1] = NewThread(CollBench_producer, &q, 0, NULL, 0);
+    }
+    for (uint32_t i = 0; i < 2 * threads; i++)
+        ThreadJoin(workers[i]);
+    uint64_t elapsed = StopwatchElapsedNanos(&sw);
+    del_LQB(q.queue);
+
+    return (double) elapsed / (double) q.total;
+}
+
+/** Internal function. Return nanos of one operation of the run, that makes ops operations for n items */
+static double CollBench_measure(void (*run)(uint32_t), uint32_t n, uint32_t rounds, uint32_t ops) {
+    stopwatch_t sw;
+    StopwatchStart(&sw);
+    for (uint32_t i = 0; i < rounds; i++)
+        run(n);
+
+    return (double) StopwatchElapsedNanos(&sw) / ((double) rounds * ops);
+}
+
+static void CollBench_compare(const char *name, void (*specialized)(uint32_t), void (*boxed)(uint32_t), uint32_t n,
+                              uint32_t rounds, uint32_t ops) {
+    double fast = CollBench_measure(specialized, n, rounds, ops);
+    double slow = CollBench_measure(boxed, n, rounds, ops);
+    printf("%-10s n=%-7u specialized %8.2f ns/op   void* %8.2f ns/op   x%.1f\n", name, n, fast, slow, slow / fast);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t n = 10000;
+    uint32_t rounds = 20;
+    uint32_t maxThreads = 16;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:t:")) != -1) {
+        switch (opt) {
+            case 'n': n = (uint32_t) atoi(optarg); break;
+            case 'r': rounds = (uint32_t) atoi(optarg); break;
+            case 't': maxThreads = (uint32_t) atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n items] [-r rounds] [-t threads]\n", argv[0]);
+                return 1;
+        }
+    }
+    //List and map index items by uint16_t
+    if (n > UINT16_MAX)
+        n = UINT16_MAX;
+
+    CollBench_compare("vector", CollBench_vector, CollBench_list, n, rounds, 2 * n);
+    CollBench_compare("ring", CollBench_ring, CollBench_lbq, n, rounds, 2 * n);
+    //Map is a list, so it's operations are linear, it is compared on the smaller set
+    uint32_t mapItems = n < 2000 ? n : 2000;
+    CollBench_compare("hashmap", CollBench_hashmap, CollBench_map, mapItems, rounds, 3 * mapItems);
+    for (uint32_t threads = 1; threads <= maxThreads; threads *= 2) {
+        double fast = CollBench_queue(LBQ_ENGINE_MPMC, threads, n * rounds / threads);
+        double slow = CollBench_queue(LBQ_ENGINE_MUTEX, threads, n * rounds / threads);
+        printf("%-10s t=%-7u mpmc        %8.2f ns/op   mutex %8.2f ns/op   x%.1f\n", "queue", threads, fast, slow,
+               slow / fast);
+    }
+    printf("checksum %llu\n", (unsigned long long) checksum);
+
+    return 0;
+}
@@ -0,0 +1,493 @@
+/** Replay of the traffic captured by the daemon with 'capture.path'. Each captured connection is opened again, at the
+ *  same offset from the replay start as it was from the capture start, and it's packets are sent in the captured
+ *  order, so the concurrency of the connections and the order of packets in each of them are preserved. Message ids
+ *  are rewritten to the index of the packet in it's connection, so the responses are matched to the requests even if
+ *  the captured ids were repeated. Packets are not waited for their responses before the next one is sent.
+ *
+ *  Usage: nsd-replay <capture> [-s socket] [-x speed] [-f]
+ *
+ *  With -x times between packets are divided by the speed, with -f packets are sent without pauses and all
+ *  connections are opened at once. Replay prints latency distribution of all requests and of each command. Packets
+ *  which are not answered by the daemon at all, like the packets with broken id, are counted as missing once their
+ *  connection is idle for REPLAY_IDLE_TIMEOUT */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../inc/otpp.h"
+#include "../inc/capture.h"
+
+#define REPLAY_DEFAULT_SOCKET "/tmp/nsd.socket"
+
+/** How long connection waits for the missing responses after all it's packets were answered or sent, millis */
+#define REPLAY_IDLE_TIMEOUT 2000
+
+/** Max count of distinct commands reported separately, the rest are reported as 'other' */
+#define REPLAY_MAX_COMMANDS 64
+
+typedef struct Replay_Options {
+    const char *socket;
+    double speed;
+    bool flat;
+} Replay_Options;
+
+/** Captured packet and the result of it's replay */
+typedef struct Replay_Packet {
+    const Capture_Record *record;
+    const char *data;
+    /** Index of the command in the report */
+    uint16_t command;
+    /** Monotonic time when packet was sent, zero until then */
+    uint64_t sent;
+    uint64_t latency;
+    /** Type of the response, zero if packet was not answered */
+    char answer;
+} Replay_Packet;
+
+typedef struct Replay_Conn {
+    uint32_t id;
+    uint8_t mode;
+    Replay_Packet *packets;
+    uint32_t count;
+    uint32_t capacity;
+    int fd;
+    pthread_t thread;
+    /** Count of packets sent by the sender, set when it is done */
+    uint32_t sent;
+    bool sendDone;
+} Replay_Conn;
+
+typedef struct Replay_Command {
+    char name[32];
+    uint64_t *samples;
+    size_t count;
+    uint64_t errors;
+    uint64_t missing;
+} Replay_Command;
+
+static Replay_Options options = {REPLAY_DEFAULT_SOCKET, 1.0, false};
+static Replay_Command commands[REPLAY_MAX_COMMANDS + 1];
+static uint16_t commandsCount = 0;
+/** Monotonic time of the replay start */
+static uint64_t started = 0;
+
+static uint64_t Replay_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** Sleep until the capture time of the record, scaled by the speed */
+static void Replay_sleepUntil(uint64_t captured) {
+    if (options.flat)
+        return;
+    uint64_t at = started + (uint64_t) ((double) captured / options.speed);
+    struct timespec ts = {(time_t) (at / 1000000000), (long) (at % 1000000000)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/** Find command in the report by name or add it */
+static uint16_t Replay_command(const char *name, size_t len) {
+    if (len >= sizeof(commands[0].name))
+        len = sizeof(commands[0].name) - 1;
+    for (uint16_t i = 0; i < commandsCount; i++) {
+        if (strlen(commands[i].name) == len && memcmp(commands[i].name, name, len) == 0)
+            return i;
+    }
+    if (commandsCount == REPLAY_MAX_COMMANDS) {
+        strcpy(commands[REPLAY_MAX_COMMANDS].name, "other");
+        return REPLAY_MAX_COMMANDS;
+    }
+    memcpy(commands[commandsCount].name, name, len);
+
+    return commandsCount++;
+}
+
+/** Name the command of the packet. Text command is the first word of the third field, binary command is the first
+ *  argument after the options */
+static uint16_t Replay_classify(const Capture_Record *record, const char *data) {
+    if (record->mode == OTPP_MODE_BINARY) {
+        if (record->type == 'b')
+            return Replay_command("batch", 5);
+        uint32_t pos = (record->flags & OTPP_FLAG_TIMEOUT ? 4 : 0) + (record->flags & OTPP_FLAG_DEADLINE ? 8 : 0);
+        uint32_t len;
+        if (pos + 4 > record->len)
+            return Replay_command("-", 1);
+        memcpy(&len, data + pos, 4);
+        if (len > record->len - pos - 4)
+            return Replay_command("-", 1);
+        return Replay_command(data + pos + 4, len);
+    }
+
+    const char *end = data + record->len;
+    if (record->len > 1 && data[0] == 'b' && data[1] == '\t')
+        return Replay_command("batch", 5);
+    const char *field = data;
+    for (int i = 0; i < 2 && field != NULL; i++) {
+        field = memchr(field, '\t', end - field);
+        if (field != NULL)
+            field++;
+    }
+    if (field == NULL)
+        return Replay_command("-", 1);
+    size_t len = 0;
+    while (field + len < end && field[len] != ' ' && field[len] != '\t' && field[len] != '\r')
+        len++;
+
+    return Replay_command(field, len);
+}
+
+/** Read the capture file and group it's packets by connections. Return count of connections */
+static uint32_t Replay_load(const char *path, Replay_Conn **result) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open '%s' (%s)\n", path, strerror(errno));
+        exit(1);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *content = malloc(size > 0 ? (size_t) size : 1);
+    if (size < (long) sizeof(Capture_FileHeader) || fread(content, 1, (size_t) size, file) != (size_t) size
+        || memcmp(content, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0
+        || ((Capture_FileHeader*) content)->version != CAPTURE_VERSION) {
+        fprintf(stderr, "'%s' is not a capture file\n", path);
+        exit(1);
+    }
+    fclose(file);
+
+    Replay_Conn *conns = NULL;
+    uint32_t count = 0;
+    uint32_t capacity = 0;
+    size_t pos = sizeof(Capture_FileHeader);
+    while (pos + sizeof(Capture_Record) <= (size_t) size) {
+        const Capture_Record *record = (const Capture_Record*) (content + pos);
+        if (pos + sizeof(Capture_Record) + record->len > (size_t) size) {
+            fprintf(stderr, "Capture file is truncated, last packet is skipped\n");
+            break;
+        }
+        const char *data = content + pos + sizeof(Capture_Record);
+        pos += sizeof(Capture_Record) + record->len;
+
+        //Connections were opened in the order of their ids, so the search from the end is short
+        Replay_Conn *conn = NULL;
+        for (uint32_t i = count; i > 0 && conn == NULL; i--) {
+            if (conns[i - 1].id == record->conn)
+                conn = &conns[i - 1];
+        }
+        if (conn == NULL) {
+            if (count == capacity) {
+                capacity = capacity == 0 ? 64 : capacity * 2;
+                conns = realloc(conns, capacity * sizeof(Replay_Conn));
+            }
+            conn = &conns[count++];
+            memset(conn, 0, sizeof(Replay_Conn));
+            conn->id = record->conn;
+            conn->mode = record->mode;
+        }
+        if (conn->count == conn->capacity) {
+            conn->capacity = conn->capacity == 0 ? 16 : conn->capacity * 2;
+            conn->packets = realloc(conn->packets, conn->capacity * sizeof(Replay_Packet));
+        }
+        Replay_Packet *packet = &conn->packets[conn->count++];
+        memset(packet, 0, sizeof(Replay_Packet));
+        packet->record = record;
+        packet->data = data;
+        packet->command = Replay_classify(record, data);
+    }
+
+    *result = conns;
+
+    return count;
+}
+
+static bool Replay_send(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t r = write(fd, data, len);
+        if (r <= 0)
+            return false;
+        data += r;
+        len -= r;
+    }
+
+    return true;
+}
+
+/** Build the packet with the new message id. Text packet which id can't be replaced is sent as captured, daemon does
+ *  not answer it anyway. Return size of the packet */
+static size_t Replay_build(char *buf, const Replay_Packet *packet, uint32_t id) {
+    const Capture_Record *record = packet->record;
+    if (record->mode == OTPP_MODE_BINARY) {
+        Otpp_Header header = {OTPP_MAGIC, OTPP_VERSION, record->type, record->flags, 0, id, record->len};
+        memcpy(buf, &header, OTPP_HEADER_SIZE);
+        memcpy(buf + OTPP_HEADER_SIZE, packet->data, record->len);
+        return OTPP_HEADER_SIZE + record->len;
+    }
+
+    const char *end = packet->data + record->len;
+    const char *idStart = memchr(packet->data, '\t', record->len);
+    const char *idEnd = idStart != NULL ? memchr(idStart + 1, '\t', end - idStart - 1) : NULL;
+    size_t len;
+    if (idEnd == NULL || strtoul(idStart + 1, NULL, 10) == 0) {
+        memcpy(buf, packet->data, record->len);
+        len = record->len;
+    } else {
+        size_t head = idStart - packet->data + 1;
+        memcpy(buf, packet->data, head);
+        len = head + sprintf(buf + head, "%u", id);
+        memcpy(buf + len, idEnd, end - idEnd);
+        len += end - idEnd;
+    }
+    //Packets of the seqpacket connections may omit the terminator, replay is made through the stream socket
+    if (len == 0 || buf[len - 1] != '\r')
+        buf[len++] = '\r';
+
+    return len;
+}
+
+/** Sender thread of the connection. Each packet is sent at it's captured time, it's id is it's index plus one */
+static void* Replay_sender(void *args) {
+    Replay_Conn *conn = (Replay_Conn*) args;
+    char *buf = NULL;
+    size_t capacity = 0;
+
+    for (uint32_t i = 0; i < conn->count; i++) {
+        Replay_Packet *packet = &conn->packets[i];
+        size_t need = OTPP_HEADER_SIZE + packet->record->len + 16;
+        if (need > capacity) {
+            capacity = need;
+            buf = realloc(buf, capacity);
+        }
+        size_t len = Replay_build(buf, packet, i + 1);
+        Replay_sleepUntil(packet->record->time);
+        __atomic_store_n(&packet->sent, Replay_now(), __ATOMIC_RELEASE);
+        if (!Replay_send(conn->fd, buf, len))
+            break;
+        __atomic_store_n(&conn->sent, i + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&conn->sendDone, true, __ATOMIC_RELEASE);
+    free(buf);
+
+    return NULL;
+}
+
+/** Internal function. Take response with the id from the input buffer */
+static void Replay_answer(Replay_Conn *conn, uint32_t id, char type, uint64_t now, uint32_t *answered) {
+    if (id == 0 || id > conn->count)
+        return;
+    Replay_Packet *packet = &conn->packets[id - 1];
+    uint64_t sent = __atomic_load_n(&packet->sent, __ATOMIC_ACQUIRE);
+    if (packet->answer != 0 || sent == 0)
+        return;
+    packet->answer = type;
+    packet->latency = now - sent;
+    (*answered)++;
+}
+
+/** Internal function. Parse complete responses of the buffer. Return count of the consumed bytes */
+static size_t Replay_parse(Replay_Conn *conn, const char *buf, size_t len, uint32_t *answered) {
+    uint64_t now = Replay_now();
+    size_t pos = 0;
+    while (pos < len) {
+        if (conn->mode == OTPP_MODE_BINARY) {
+            Otpp_Header header;
+            if (len - pos < OTPP_HEADER_SIZE)
+                break;
+            memcpy(&header, buf + pos, OTPP_HEADER_SIZE);
+            if (len - pos < OTPP_HEADER_SIZE + header.len)
+                break;
+            Replay_answer(conn, header.msgId, (char) header.type, now, answered);
+            pos += OTPP_HEADER_SIZE + header.len;
+        } else {
+            const char *end = memchr(buf + pos, '\r', len - pos);
+            if (end == NULL)
+                break;
+            const char *tab = memchr(buf + pos, '\t', end - buf - pos);
+            if (tab != NULL)
+                Replay_answer(conn, (uint32_t) strtoul(tab + 1, NULL, 10), buf[pos], now, answered);
+            pos = end - buf + 1;
+        }
+    }
+
+    return pos;
+}
+
+/** Switch connection to the binary framing. Return false if it was rejected */
+static bool Replay_hello(int fd) {
+    char hello[OTPP_HELLO_SIZE] = {0};
+    memcpy(hello, OTPP_HELLO, OTPP_HELLO_LEN);
+    hello[OTPP_HELLO_LEN] = OTPP_VERSION;
+    if (!Replay_send(fd, hello, OTPP_HELLO_SIZE))
+        return false;
+    size_t got = 0;
+    while (got < OTPP_HELLO_SIZE) {
+        ssize_t r = read(fd, hello + got, OTPP_HELLO_SIZE - got);
+        if (r <= 0)
+            return false;
+        got += r;
+    }
+
+    return hello[OTPP_HELLO_LEN] == OTPP_VERSION;
+}
+
+/** Connection thread. It connects, starts the sender and reads responses until all sent packets are answered or the
+ *  connection is idle for REPLAY_IDLE_TIMEOUT after the last packet was sent */
+static void* Replay_connThread(void *args) {
+    Replay_Conn *conn = (Replay_Conn*) args;
+    conn->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, options.socket, sizeof(addr.sun_path) - 1);
+    if (conn->fd < 0 || connect(conn->fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Unable to connect to '%s' (%s)\n", options.socket, strerror(errno));
+        return NULL;
+    }
+    if (conn->mode == OTPP_MODE_BINARY && !Replay_hello(conn->fd)) {
+        fprintf(stderr, "Binary framing was rejected\n");
+        close(conn->fd);
+        return NULL;
+    }
+
+    pthread_t sender;
+    pthread_create(&sender, NULL, Replay_sender, conn);
+    size_t capacity = 65536;
+    char *buf = malloc(capacity);
+    size_t len = 0;
+    uint32_t answered = 0;
+    uint64_t lastActivity = Replay_now();
+    while (1) {
+        bool done = __atomic_load_n(&conn->sendDone, __ATOMIC_ACQUIRE);
+        uint32_t sent = __atomic_load_n(&conn->sent, __ATOMIC_ACQUIRE);
+        if (done && (answered >= sent || Replay_now() - lastActivity > REPLAY_IDLE_TIMEOUT * 1000000ULL))
+            break;
+
+        struct pollfd pfd = {conn->fd, POLLIN, 0};
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+        if (len == capacity) {
+            capacity *= 2;
+            buf = realloc(buf, capacity);
+        }
+        ssize_t r = read(conn->fd, buf + len, capacity - len);
+        if (r <= 0)
+            break;
+        len += r;
+        lastActivity = Replay_now();
+        size_t used = Replay_parse(conn, buf, len, &answered);
+        memmove(buf, buf + used, len - used);
+        len -= used;
+    }
+    //Close wakes the sender if it is blocked by the full socket
+    shutdown(conn->fd, SHUT_RDWR);
+    pthread_join(sender, NULL);
+    close(conn->fd);
+    free(buf);
+
+    return NULL;
+}
+
+static int Replay_compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+static void Replay_report(const char *name, uint64_t *samples, size_t n, uint64_t errors, uint64_t missing) {
+    if (n == 0) {
+        printf("%-16s no responses, missing %llu\n", name, (unsigned long long) missing);
+        return;
+    }
+
+    qsort(samples, n, sizeof(uint64_t), Replay_compare);
+    printf("%-16s requests %zu errors %llu missing %llu  p50 %.1f us  p90 %.1f us  p99 %.1f us  p99.9 %.1f us"
+           "  max %.1f us\n", name, n + (size_t) missing, (unsigned long long) errors, (unsigned long long) missing,
+           samples[n / 2] / 1000.0, samples[n * 90 / 100] / 1000.0, samples[n * 99 / 100] / 1000.0,
+           samples[n * 999 / 1000] / 1000.0, samples[n - 1] / 1000.0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <capture> [-s socket] [-x speed] [-f]\n", argv[0]);
+        return 1;
+    }
+
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "s:x:f")) != -1) {
+        switch (opt) {
+            case 's': options.socket = optarg; break;
+            case 'x': options.speed = atof(optarg); break;
+            case 'f': options.flat = true; break;
+            default: return 1;
+        }
+    }
+    if (options.speed <= 0)
+        options.speed = 1.0;
+
+    Replay_Conn *conns;
+    uint32_t count = Replay_load(argv[1], &conns);
+    uint64_t packets = 0;
+    for (uint32_t i = 0; i < count; i++)
+        packets += conns[i].count;
+    printf("Replaying %llu packets of %u connections\n", (unsigned long long) packets, count);
+
+    signal(SIGPIPE, SIG_IGN);
+    started = Replay_now();
+    for (uint32_t i = 0; i < count; i++) {
+        Replay_sleepUntil(conns[i].packets[0].record->time);
+        pthread_create(&conns[i].thread, NULL, Replay_connThread, &conns[i]);
+    }
+    for (uint32_t i = 0; i < count; i++)
+        pthread_join(conns[i].thread, NULL);
+    double seconds = (Replay_now() - started) / 1e9;
+
+    for (uint32_t i = 0; i < count; i++) {
+        for (uint32_t j = 0; j < conns[i].count; j++)
+            commands[conns[i].packets[j].command].count++;
+    }
+    for (uint16_t i = 0; i <= REPLAY_MAX_COMMANDS; i++) {
+        commands[i].samples = malloc((commands[i].count > 0 ? commands[i].count : 1) * sizeof(uint64_t));
+        commands[i].count = 0;
+    }
+    uint64_t *all = malloc((packets > 0 ? packets : 1) * sizeof(uint64_t));
+    size_t answered = 0;
+    uint64_t errors = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        for (uint32_t j = 0; j < conns[i].count; j++) {
+            Replay_Packet *packet = &conns[i].packets[j];
+            Replay_Command *command = &commands[packet->command];
+            if (packet->answer == 0) {
+                command->missing++;
+                continue;
+            }
+            if (packet->answer == 'e') {
+                command->errors++;
+                errors++;
+            }
+            command->samples[command->count++] = packet->latency;
+            all[answered++] = packet->latency;
+        }
+    }
+
+    printf("Replayed in %.2f s, %.0f requests/s\n", seconds, seconds > 0 ? answered / seconds : 0);
+    Replay_report("all", all, answered, errors, packets - answered);
+    for (uint16_t i = 0; i <= REPLAY_MAX_COMMANDS; i++) {
+        if (commands[i].count > 0 || commands[i].missing > 0)
+            Replay_report(commands[i].name, commands[i].samples, commands[i].count, commands[i].errors,
+                          commands[i].missing);
+    }
+
+    return 0;
+}
@@ -0,0 +1,612 @@
+/** Soak test of the running daemon. Client threads open and close connections for the whole duration, each connection
+ *  runs one of the traffic scenarios below, well-formed and malformed ones in turn. Meanwhile resources of the daemon
+ *  process are sampled: resident memory, thread count and open descriptors from /proc, allocator used memory from the
+ *  'malloc.used_kb' counter of the 'stats' command. When the load is over, growth slope of the resident memory is
+ *  fitted by least squares over the samples taken after the warmup. Allocator used memory, threads and descriptors
+ *  follow the count of connections in work, so they are taken again when the daemon settles after the load, for
+ *  longer than the pool idle timeout, and their growth from the values before the load is divided by the run minutes.
+ *  Test fails if any slope exceeds it's limit. Kernel 'iou-wrk' workers of the io_uring are not counted as daemon
+ *  threads.
+ *
+ *  Usage: nsd-soak [-s socket] [-q seqpacket socket] [-p pid] [-d seconds] [-c clients] [-i interval] [-w warmup]
+ *                  [-l settle] [-r rss kb/min] [-m malloc kb/min] [-t threads/min] [-f fds/min]
+ *
+ *  Scenarios:
+ *      text        text requests, including the unknown command and the failing one, all responses are read
+ *      binary      binary requests with timeout and deadline options and the batch packet
+ *      broken      text packets without id, with zero id, with too few fields and the line longer than the reader
+ *                  buffer, followed by the request which response is waited
+ *      garbage     binary header with the wrong magic or too big payload, daemon closes such connection
+ *      hello       binary hello with the unsupported version
+ *      abandon     pipeline of requests and the timer command, connection is closed without reading responses
+ *      partial     half of the packet, then connection is closed
+ *      seqpacket   text and binary messages through the seqpacket socket given by -q
+ *
+ *  Exit status is 0 when all slopes are in their limits, 1 otherwise */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../inc/otpp.h"
+
+#define SOAK_DEFAULT_SOCKET "/tmp/nsd.socket"
+#define SOAK_DEFAULT_PID_FILE "/var/run/nsd.pid"
+
+/** How long client waits for the responses before the connection is counted as stalled, millis */
+#define SOAK_RESPONSE_TIMEOUT 5000
+
+/** Default seconds to wait after the load, the pool retires idle workers after 10 s */
+#define SOAK_DEFAULT_SETTLE 15
+
+/** Requests sent by the abandoned connection */
+#define SOAK_ABANDON_REQUESTS 64
+
+#define SOAK_MAX_SAMPLES 65536
+
+typedef struct Soak_Options {
+    const char *socket;
+    const char *seqpacket;
+    int pid;
+    uint32_t duration;
+    uint32_t clients;
+    uint32_t interval;
+    uint32_t warmup;
+    uint32_t settle;
+    /** Limits of the growth slopes, per minute */
+    double rss;
+    double heap;
+    double threads;
+    double fds;
+} Soak_Options;
+
+typedef struct Soak_Sample {
+    double time;
+    double rss;
+    double heap;
+    double threads;
+    double fds;
+} Soak_Sample;
+
+/** Client connection with input buffer for the responses reading */
+typedef struct Soak_Conn {
+    int fd;
+    char buf[65536];
+    size_t len;
+    bool binary;
+} Soak_Conn;
+
+typedef struct Soak_Scenario {
+    const char *name;
+    /** Return false if connection stalled, closing of the connection by the daemon is expected by some scenarios */
+    bool (*run)(Soak_Conn *conn);
+    bool seqpacket;
+} Soak_Scenario;
+
+static Soak_Options options = {SOAK_DEFAULT_SOCKET, NULL, 0, 120, 8, 5, 30, SOAK_DEFAULT_SETTLE, 1024, 256,
+                                 1, 10};
+static volatile bool running = true;
+static uint64_t connections = 0;
+static uint64_t stalls = 0;
+static uint64_t failures = 0;
+
+static double Soak_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static Soak_Conn* Soak_connect(const char *path, int type) {
+    int fd = socket(AF_UNIX, type, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    Soak_Conn *conn = calloc(1, sizeof(Soak_Conn));
+    conn->fd = fd;
+
+    return conn;
+}
+
+static void Soak_close(Soak_Conn *conn) {
+    close(conn->fd);
+    free(conn);
+}
+
+static bool Soak_send(Soak_Conn *conn, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t r = write(conn->fd, p, len);
+        if (r <= 0)
+            return false;
+        p += r;
+        len -= r;
+    }
+
+    return true;
+}
+
+/** Read more data to the buffer. Return 1 if data was read, 0 if connection was closed and -1 on timeout */
+static int Soak_fill(Soak_Conn *conn) {
+    struct pollfd pfd = {conn->fd, POLLIN, 0};
+    if (poll(&pfd, 1, SOAK_RESPONSE_TIMEOUT) <= 0)
+        return -1;
+    if (conn->len == sizeof(conn->buf))
+        conn->len = 0;
+    ssize_t r = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+    if (r <= 0)
+        return 0;
+    conn->len += r;
+
+    return 1;
+}
+
+/** Read count responses. Return 1 if all were read, 0 if connection was closed and -1 if they were not received in
+ *  time */
+static int Soak_receive(Soak_Conn *conn, uint32_t count) {
+    while (count > 0) {
+        size_t used = 0;
+        if (conn->binary) {
+            Otpp_Header header;
+            if (conn->len >= OTPP_HEADER_SIZE) {
+                memcpy(&header, conn->buf, OTPP_HEADER_SIZE);
+                if (conn->len >= OTPP_HEADER_SIZE + header.len)
+                    used = OTPP_HEADER_SIZE + header.len;
+            }
+        } else {
+            char *end = memchr(conn->buf, '\r', conn->len);
+            if (end != NULL)
+                used = end - conn->buf + 1;
+        }
+        if (used == 0) {
+            int r = Soak_fill(conn);
+            if (r <= 0)
+                return r;
+            continue;
+        }
+        memmove(conn->buf, conn->buf + used, conn->len - used);
+        conn->len -= used;
+        count--;
+    }
+
+    return 1;
+}
+
+/** Switch connection to the binary framing with the given version. Return false if it was rejected */
+static bool Soak_hello(Soak_Conn *conn, uint8_t version) {
+    char hello[OTPP_HELLO_SIZE] = {0};
+    memcpy(hello, OTPP_HELLO, OTPP_HELLO_LEN);
+    hello[OTPP_HELLO_LEN] = (char) version;
+    if (!Soak_send(conn, hello, OTPP_HELLO_SIZE))
+        return false;
+    while (conn->len < OTPP_HELLO_SIZE) {
+        if (Soak_fill(conn) <= 0)
+            return false;
+    }
+    bool accepted = conn->buf[OTPP_HELLO_LEN] == version;
+    memmove(conn->buf, conn->buf + OTPP_HELLO_SIZE, conn->len - OTPP_HELLO_SIZE);
+    conn->len -= OTPP_HELLO_SIZE;
+    conn->binary = accepted;
+
+    return accepted;
+}
+
+/** Build binary packet from the options block and arguments list terminated by NULL */
+static size_t Soak_binaryPacket(char *buf, char type, uint16_t flags, uint32_t id, const void *opts, uint32_t optsLen,
+                                const char **args) {
+    char *p = buf + OTPP_HEADER_SIZE;
+    if (optsLen > 0)
+        memcpy(p, opts, optsLen);
+    p += optsLen;
+    for (; *args != NULL; args++) {
+        uint32_t len = (uint32_t) strlen(*args);
+        memcpy(p, &len, 4);
+        memcpy(p + 4, *args, len);
+        p += 4 + len;
+    }
+    Otpp_Header header = {OTPP_MAGIC, OTPP_VERSION, (uint8_t) type, flags, 0, id,
+                          (uint32_t) (p - buf - OTPP_HEADER_SIZE)};
+    memcpy(buf, &header, OTPP_HEADER_SIZE);
+
+    return p - buf;
+}
+
+/** Convert result of Soak_receive to the scenario result. Closing by the daemon is a failure for valid traffic */
+static bool Soak_expect(int received) {
+    if (received == 0)
+        __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+
+    return received >= 0;
+}
+
+static bool Soak_text(Soak_Conn *conn) {
+    const char *packets = "q\t1\tt_echo soak\rq\t2\tversion\rq\t3\tnosuch arg\rq\t4\tt_err soak\r"
+                          "q\t5\tt_echo a b c d e f g h\rb\t6\t1 t_echo x\t2 version\r";
+    if (!Soak_send(conn, packets, strlen(packets)))
+        return true;
+
+    return Soak_expect(Soak_receive(conn, 6));
+}
+
+static bool Soak_binary(Soak_Conn *conn) {
+    if (!Soak_hello(conn, OTPP_VERSION))
+        return Soak_expect(0);
+
+    char packet[512];
+    const char *echo[] = {"t_echo", "soak", NULL};
+    const char *version[] = {"version", NULL};
+    const char *unknown[] = {"nosuch", NULL};
+    uint32_t timeout = 1000;
+    uint64_t deadline = (uint64_t) time(NULL) * 1000 + 60000;
+    size_t len = Soak_binaryPacket(packet, 'q', 0, 1, NULL, 0, echo);
+    len += Soak_binaryPacket(packet + len, 'q', 0, 2, NULL, 0, version);
+    len += Soak_binaryPacket(packet + len, 'q', 0, 3, NULL, 0, unknown);
+    len += Soak_binaryPacket(packet + len, 'q', OTPP_FLAG_TIMEOUT, 4, &timeout, 4, echo);
+    len += Soak_binaryPacket(packet + len, 'q', OTPP_FLAG_DEADLINE, 5, &deadline, 8, echo);
+
+    //Batch of two sub-commands, each is sub-id, size and arguments
+    char batch[128];
+    char *p = batch + OTPP_HEADER_SIZE;
+    for (uint32_t sub = 1; sub <= 2; sub++) {
+        char args[64];
+        uint32_t size = (uint32_t) Soak_binaryPacket(args, 'q', 0, 0, NULL, 0, sub == 1 ? echo : version)
+                        - OTPP_HEADER_SIZE;
+        memcpy(p, &sub, 4);
+        memcpy(p + 4, &size, 4);
+        memcpy(p + 8, args + OTPP_HEADER_SIZE, size);
+        p += 8 + size;
+    }
+    Otpp_Header header = {OTPP_MAGIC, OTPP_VERSION, 'b', 0, 0, 6, (uint32_t) (p - batch - OTPP_HEADER_SIZE)};
+    memcpy(batch, &header, OTPP_HEADER_SIZE);
+    memcpy(packet + len, batch, p - batch);
+    len += p - batch;
+
+    if (!Soak_send(conn, packet, len))
+        return true;
+
+    return Soak_expect(Soak_receive(conn, 6));
+}
+
+static bool Soak_broken(Soak_Conn *conn) {
+    const char *packets = "q\t\tt_echo x\rq\tabc\tt_echo x\rq\t0\tt_echo x\rq\t7\r\r\t\t\r";
+    if (!Soak_send(conn, packets, strlen(packets)))
+        return true;
+    char *line = malloc(70000);
+    memset(line, 'a', 70000);
+    bool sent = Soak_send(conn, line, 70000) && Soak_send(conn, "\r", 1);
+    free(line);
+    //Broken packets are not answered, so the response of the last one shows that all of them were processed. Daemon
+    //may close the connection after the too long line, that is not a failure
+    const char *sync = "q\t8\tt_echo sync\r";
+    if (!sent || !Soak_send(conn, sync, strlen(sync)))
+        return true;
+
+    return Soak_receive(conn, 1) >= 0;
+}
+
+static bool Soak_garbage(Soak_Conn *conn) {
+    if (!Soak_hello(conn, OTPP_VERSION))
+        return Soak_expect(0);
+
+    static uint32_t round = 0;
+    Otpp_Header header = {OTPP_MAGIC, OTPP_VERSION, 'q', 0, 0, 1, OTPP_MAX_PAYLOAD + 1};
+    if (__atomic_add_fetch(&round, 1, __ATOMIC_RELAXED) % 2 == 0)
+        header.magic = 0x1234;
+    if (!Soak_send(conn, &header, OTPP_HEADER_SIZE))
+        return true;
+
+    //Connection must be closed by the daemon
+    return Soak_receive(conn, 1) >= 0;
+}
+
+static bool Soak_unsupportedHello(Soak_Conn *conn) {
+    Soak_hello(conn, 99);
+
+    return true;
+}
+
+static bool Soak_abandon(Soak_Conn *conn) {
+    char packet[64];
+    for (uint32_t i = 1; i <= SOAK_ABANDON_REQUESTS; i++) {
+        int len = sprintf(packet, "q\t%u\tt_echo abandoned\r", i);
+        if (!Soak_send(conn, packet, (size_t) len))
+            return true;
+    }
+    const char *timer = "q\t100\tt_tmt 20\r";
+    Soak_send(conn, timer, strlen(timer));
+
+    return true;
+}
+
+static bool Soak_partial(Soak_Conn *conn) {
+    const char *half = "q\t1\tt_echo unfinish";
+    Soak_send(conn, half, strlen(half));
+
+    return true;
+}
+
+static bool Soak_seqpacket(Soak_Conn *conn) {
+    const char *messages[] = {"q\t1\tt_echo seq\r", "q\t2\tversion", "q\tx\tbroken\r", "q\t3\tnosuch\r"};
+    for (size_t i = 0; i < sizeof(messages) / sizeof(messages[0]); i++) {
+        if (!Soak_send(conn, messages[i], strlen(messages[i])))
+            return true;
+    }
+
+    return Soak_expect(Soak_receive(conn, 3));
+}
+
+static Soak_Scenario scenarios[] = {
+        {"text",      Soak_text,             false},
+        {"binary",    Soak_binary,           false},
+        {"broken",    Soak_broken,           false},
+        {"garbage",   Soak_garbage,          false},
+        {"hello",     Soak_unsupportedHello, false},
+        {"abandon",   Soak_abandon,          false},
+        {"partial",   Soak_partial,          false},
+        {"seqpacket", Soak_seqpacket,        true}
+};
+
+/** Client thread. It opens connections one by one and runs the next scenario in each of them */
+static void* Soak_client(void *args) {
+    uint32_t next = (uint32_t) (uintptr_t) args;
+    uint32_t count = sizeof(scenarios) / sizeof(scenarios[0]);
+
+    while (running) {
+        Soak_Scenario *scenario = &scenarios[next++ % count];
+        if (scenario->seqpacket && options.seqpacket == NULL)
+            continue;
+        Soak_Conn *conn = scenario->seqpacket ? Soak_connect(options.seqpacket, SOCK_SEQPACKET)
+                                              : Soak_connect(options.socket, SOCK_STREAM);
+        if (conn == NULL) {
+            __atomic_add_fetch(&failures, 1, __ATOMIC_RELAXED);
+            usleep(10000);
+            continue;
+        }
+        if (!scenario->run(conn)) {
+            fprintf(stderr, "Scenario '%s' stalled\n", scenario->name);
+            __atomic_add_fetch(&stalls, 1, __ATOMIC_RELAXED);
+        }
+        Soak_close(conn);
+        __atomic_add_fetch(&connections, 1, __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+/** Read value of the field from /proc/<pid>/status. Return -1 if it is not found */
+static double Soak_status(const char *field) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", options.pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return -1;
+    char line[256];
+    double value = -1;
+    size_t len = strlen(field);
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            value = atof(line + len + 1);
+            break;
+        }
+    }
+    fclose(file);
+
+    return value;
+}
+
+/** Count entries of the /proc/<pid>/<name> directory. Tasks named with the skipped prefix are not counted. Return -1
+ *  if the directory can't be read */
+static double Soak_count(const char *name, const char *skip) {
+    char path[300];
+    snprintf(path, sizeof(path), "/proc/%d/%s", options.pid, name);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+        return -1;
+    double count = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.')
+            continue;
+        if (skip != NULL) {
+            char comm[32] = {0};
+            snprintf(path, sizeof(path), "/proc/%d/task/%s/comm", options.pid, entry->d_name);
+            FILE *file = fopen(path, "r");
+            bool skipped = file != NULL && fgets(comm, sizeof(comm), file) != NULL
+                           && strncmp(comm, skip, strlen(skip)) == 0;
+            if (file != NULL)
+                fclose(file);
+            if (skipped)
+                continue;
+        }
+        count++;
+    }
+    closedir(dir);
+
+    return count;
+}
+
+/** Take allocator used memory from the daemon counters. Return -1 if it can't be taken */
+static double Soak_heap() {
+    Soak_Conn *conn = Soak_connect(options.socket, SOCK_STREAM);
+    if (conn == NULL)
+        return -1;
+    const char *request = "q\t1\tstats\r";
+    double value = -1;
+    if (Soak_send(conn, request, strlen(request))) {
+        while (memchr(conn->buf, '\r', conn->len) == NULL && conn->len < sizeof(conn->buf) - 1) {
+            if (Soak_fill(conn) <= 0)
+                break;
+        }
+        conn->buf[conn->len < sizeof(conn->buf) ? conn->len : sizeof(conn->buf) - 1] = 0;
+        char *field = strstr(conn->buf, "malloc.used_kb=");
+        if (field != NULL)
+            value = atof(field + strlen("malloc.used_kb="));
+    }
+    Soak_close(conn);
+
+    return value;
+}
+
+static bool Soak_sample(Soak_Sample *sample, double started) {
+    sample->time = Soak_now() - started;
+    sample->rss = Soak_status("VmRSS");
+    sample->threads = Soak_count("task", "iou-wrk");
+    sample->fds = Soak_count("fd", NULL);
+    sample->heap = Soak_heap();
+
+    return sample->rss >= 0 && sample->threads >= 0 && sample->fds >= 0;
+}
+
+/** Least squares slope of the value over time, per minute. Value is given by it's offset inside Soak_Sample */
+static double Soak_slope(Soak_Sample *samples, uint32_t count, size_t offset) {
+    double sumT = 0, sumV = 0, sumTT = 0, sumTV = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        double t = samples[i].time / 60;
+        double v = *(double*) ((char*) &samples[i] + offset);
+        sumT += t;
+        sumV += v;
+        sumTT += t * t;
+        sumTV += t * v;
+    }
+    double d = count * sumTT - sumT * sumT;
+
+    return count < 2 || d == 0 ? 0 : (count * sumTV - sumT * sumV) / d;
+}
+
+/** Read pid of the daemon from it's pid file */
+static int Soak_pid() {
+    FILE *file = fopen(SOAK_DEFAULT_PID_FILE, "r");
+    int pid = 0;
+    if (file != NULL) {
+        if (fscanf(file, "%d", &pid) != 1)
+            pid = 0;
+        fclose(file);
+    }
+
+    return pid;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "s:q:p:d:c:i:w:l:r:m:t:f:")) != -1) {
+        switch (opt) {
+            case 's': options.socket = optarg; break;
+            case 'q': options.seqpacket = optarg; break;
+            case 'p': options.pid = atoi(optarg); break;
+            case 'd': options.duration = (uint32_t) atoi(optarg); break;
+            case 'c': options.clients = (uint32_t) atoi(optarg); break;
+            case 'i': options.interval = (uint32_t) atoi(optarg); break;
+            case 'w': options.warmup = (uint32_t) atoi(optarg); break;
+            case 'l': options.settle = (uint32_t) atoi(optarg); break;
+            case 'r': options.rss = atof(optarg); break;
+            case 'm': options.heap = atof(optarg); break;
+            case 't': options.threads = atof(optarg); break;
+            case 'f': options.fds = atof(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-s socket] [-q seqpacket socket] [-p pid] [-d seconds] [-c clients]"
+                                " [-i interval] [-w warmup] [-l settle] [-r rss kb/min] [-m malloc kb/min]"
+                                " [-t threads/min] [-f fds/min]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (options.pid == 0)
+        options.pid = Soak_pid();
+    if (options.interval == 0)
+        options.interval = 1;
+
+    signal(SIGPIPE, SIG_IGN);
+    Soak_Sample *samples = malloc(SOAK_MAX_SAMPLES * sizeof(Soak_Sample));
+    uint32_t count = 0;
+    double started = Soak_now();
+    if (options.pid <= 0 || !Soak_sample(&samples[count++], started)) {
+        fprintf(stderr, "Unable to read the daemon process, give it's pid by -p\n");
+        return 1;
+    }
+
+    pthread_t *clients = malloc(options.clients * sizeof(pthread_t));
+    for (uint32_t i = 0; i < options.clients; i++)
+        pthread_create(&clients[i], NULL, Soak_client, (void*) (uintptr_t) i);
+
+    printf("%8s %12s %10s %12s %8s %6s\n", "time", "connections", "rss_kb", "malloc_kb", "threads", "fds");
+    double end = started + options.duration;
+    while (Soak_now() < end && count < SOAK_MAX_SAMPLES) {
+        sleep(options.interval);
+        Soak_Sample *sample = &samples[count];
+        if (!Soak_sample(sample, started)) {
+            fprintf(stderr, "Daemon process is gone\n");
+            running = false;
+            return 1;
+        }
+        count++;
+        printf("%8.1f %12llu %10.0f %12.0f %8.0f %6.0f\n", sample->time,
+               (unsigned long long) __atomic_load_n(&connections, __ATOMIC_RELAXED), sample->rss, sample->heap,
+               sample->threads, sample->fds);
+        fflush(stdout);
+    }
+    running = false;
+    for (uint32_t i = 0; i < options.clients; i++)
+        pthread_join(clients[i], NULL);
+    double minutes = (Soak_now() - started) / 60;
+
+    Soak_Sample settled;
+    sleep(options.settle);
+    if (!Soak_sample(&settled, started)) {
+        fprintf(stderr, "Daemon process is gone\n");
+        return 1;
+    }
+    printf("%8.1f %12s %10.0f %12.0f %8.0f %6.0f  settled\n", settled.time, "-", settled.rss, settled.heap,
+           settled.threads, settled.fds);
+
+    //Samples of the warmup, while the pools and the allocator arenas grow to the load, are not fitted
+    uint32_t first = 0;
+    while (first < count && samples[first].time < options.warmup)
+        first++;
+    if (count - first < 3) {
+        fprintf(stderr, "Too few samples after the warmup, make the duration longer\n");
+        return 1;
+    }
+
+    struct {
+        const char *name;
+        double slope;
+        double limit;
+    } metrics[] = {
+            {"rss_kb",    Soak_slope(samples + first, count - first, offsetof(Soak_Sample, rss)), options.rss},
+            {"malloc_kb", (settled.heap - samples[0].heap) / minutes, options.heap},
+            {"threads",   (settled.threads - samples[0].threads) / minutes, options.threads},
+            {"fds",       (settled.fds - samples[0].fds) / minutes, options.fds}
+    };
+    bool passed = true;
+    printf("\nconnections %llu stalled %llu failed %llu\n", (unsigned long long) connections,
+           (unsigned long long) stalls, (unsigned long long) failures);
+    for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++) {
+        bool ok = metrics[i].slope <= metrics[i].limit;
+        passed = passed && ok;
+        printf("%-10s slope %10.2f per min, limit %10.2f  %s\n", metrics[i].name, metrics[i].slope, metrics[i].limit,
+               ok ? "ok" : "FAILED");
+    }
+    if (stalls > 0) {
+        printf("Some connections were not answered in time\n");
+        passed = false;
+    }
+
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+/** Benchmark of the wait strategies. Producer inserts item to the queue each interval, consumer waits for it with the
+ *  strategy and measures time from the insertion to it's wakeup. Consumer CPU time spent over the run shows the price
+ *  of the strategy while the queue is idle.
+ *
+ *  Usage: nsd-wait-bench [-n items] [-i interval micros] [-s spins] [-y yields]
+ *
+ *  Strategies park, hybrid and spin are measured for the lock free queue, where consumer parks on the futex, and for
+ *  the multi lane queue, where consumer parks on the condition variable. Spins and yields, if given, replace the
+ *  counts of the spin strategy */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include "../libs/collections/include/mpmc.h"
+#include "../libs/collections/include/mlq.h"
+#include "../libs/oscl/include/malloc.h"
+#include "../libs/oscl/include/time.h"
+#include "../libs/oscl/include/threads.h"
+#include "../libs/oscl/include/wait.h"
+
+/** How long consumer waits for the item before it checks the run end */
+#define WAIT_BENCH_TAKE_TIMEOUT 100
+
+typedef struct WaitBench_Run {
+    MpmcQueue *mpmc;
+    MultiLaneQueue *mlq;
+    uint32_t items;
+    uint64_t interval;
+    /** Insertion time of each item, item is the index + 1 */
+    uint64_t *stamps;
+    uint64_t *latencies;
+    uint64_t cpuNanos;
+} WaitBench_Run;
+
+/** Internal function. Return CPU time of the calling thread */
+static uint64_t WaitBench_cpuNanos() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * NANOS_IN_SECOND + ts.tv_nsec;
+}
+
+static void WaitBench_consumer(void *args) {
+    WaitBench_Run *run = (WaitBench_Run*) args;
+    uint64_t cpu = WaitBench_cpuNanos();
+    uint32_t taken = 0;
+    while (taken < run->items) {
+        void *item = run->mpmc != NULL ? MPMC_take(run->mpmc, WAIT_BENCH_TAKE_TIMEOUT)
+                                       : run->mlq->take(run->mlq, WAIT_BENCH_TAKE_TIMEOUT);
+        uint64_t now = FastMonotonicNanos();
+        if (item == NULL)
+            continue;
+        uint32_t index = (uint32_t) (uintptr_t) item - 1;
+        run->latencies[index] = now - run->stamps[index];
+        taken++;
+    }
+    run->cpuNanos = WaitBench_cpuNanos() - cpu;
+}
+
+static int WaitBench_compare(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*) a;
+    uint64_t y = *(const uint64_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+/** Internal function. Measure the queue with the strategy and print the result */
+static void WaitBench_measure(const char *name, const wait_t *wait, bool lockFree, uint32_t items, uint64_t interval) {
+    WaitSetDefault(wait);
+    WaitBench_Run run;
+    run.mpmc = lockFree ? MPMC_new(items) : NULL;
+    run.mlq = lockFree ? NULL : new_MLQ(1, (uint16_t) (items > UINT16_MAX ? UINT16_MAX : items), 0, 1,
+                                        LBQ_ENGINE_MUTEX);
+    run.items = items;
+    run.interval = interval;
+    run.stamps = pmalloc(items * sizeof(uint64_t));
+    run.latencies = pmalloc(items * sizeof(uint64_t));
+    run.cpuNanos = 0;
+
+    thread_t consumer = NewThread(WaitBench_consumer, &run, 0, NULL, 0);
+    //Consumer starts to wait before the first item
+    DelayMillis(10);
+    uint64_t start = MonotonicNanos();
+    uint64_t next = start;
+    for (uint32_t i = 0; i < items; i++) {
+        next += interval * 1000;
+        SleepUntilNanos(next);
+        run.stamps[i] = FastMonotonicNanos();
+        void *item = (void*) (uintptr_t) (i + 1);
+        if (lockFree)
+            MPMC_put(run.mpmc, item, MPMC_WAIT_FOREVER);
+        else
+            run.mlq->put(run.mlq, 0, item, WAIT_BENCH_TAKE_TIMEOUT);
+    }
+    ThreadJoin(consumer);
+    uint64_t wall = MonotonicNanos() - start;
+
+    qsort(run.latencies, items, sizeof(uint64_t), WaitBench_compare);
+    printf("%-8s %-5s wakeup p50 %8.1f us  p99 %8.1f us  max %8.1f us   consumer cpu %5.1f%%\n", name,
+           lockFree ? "mpmc" : "mlq", run.latencies[items / 2] / 1000.0, run.latencies[items * 99 / 100] / 1000.0,
+           run.latencies[items - 1] / 1000.0, 100.0 * run.cpuNanos / wall);
+
+    pfree(run.stamps);
+    pfree(run.latencies);
+    if (lockFree)
+        MPMC_del(run.mpmc);
+    else
+        del_MLQ(run.mlq);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t items = 2000;
+    uint64_t interval = 1000;
+    wait_t spin;
+    WaitParse("spin", &spin);
+    int opt;
+    while ((opt = getopt(argc, argv, "n:i:s:y:")) != -1) {
+        switch (opt) {
+            case 'n': items = (uint32_t) atoi(optarg); break;
+            case 'i': interval = (uint64_t) atoll(optarg); break;
+            case 's': spin.spins = (uint32_t) atoi(optarg); break;
+            case 'y': spin.yields = (uint32_t) atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n items] [-i interval micros] [-s spins] [-y yields]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (items == 0)
+        items = 1;
+
+    wait_t park;
+    wait_t hybrid;
+    WaitParse("park", &park);
+    WaitParse("hybrid", &hybrid);
+    for (int lockFree = 1; lockFree >= 0; lockFree--) {
+        WaitBench_measure("park", &park, lockFree, items, interval);
+        WaitBench_measure("hybrid", &hybrid, lockFree, items, interval);
+        WaitBench_measure("spin", &spin, lockFree, items, interval);
+    }
+
+    return 0;
+}